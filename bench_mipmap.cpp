@@ -0,0 +1,328 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#if !defined(WIN32_LEAN_AND_MEAN)
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <EGL/egl.h>
+#endif
+
+#include <GL/gl.h>
+#include <GL/glu.h>
+
+#include "job_system.h"
+#include "mipmap.h"
+
+#if !defined(GL_BGRA_EXT)
+#define GL_BGRA_EXT 0x80E1
+#endif
+
+#if !defined(GL_TEXTURE_MAX_LEVEL)
+#define GL_TEXTURE_MAX_LEVEL 0x813D
+#endif
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    struct ImageSpec
+    {
+        int width;
+        int height;
+    };
+
+    const ImageSpec g_imageSpecs[] =
+    {
+        {512,  512},
+        {1000, 750},
+        {2048, 2048},
+        {3000, 2000},
+        {4096, 4096},
+    };
+
+    class HeadlessContext
+    {
+    public:
+        HeadlessContext();
+        ~HeadlessContext();
+
+        bool isValid() const
+        { return m_valid; }
+
+    private:
+        bool m_valid;
+#if defined(_WIN32)
+        HWND m_hWnd;
+        HDC m_hDC;
+        HGLRC m_hRC;
+#else
+        EGLDisplay m_display;
+        EGLSurface m_surface;
+        EGLContext m_context;
+#endif
+    };
+
+#if defined(_WIN32)
+    HeadlessContext::HeadlessContext() : m_valid(false), m_hWnd(0), m_hDC(0), m_hRC(0)
+    {
+        m_hWnd = CreateWindowEx(0, "STATIC", "bench_mipmap", WS_POPUP, 0, 0, 1, 1,
+            0, 0, GetModuleHandle(0), 0);
+
+        if (!m_hWnd || !(m_hDC = GetDC(m_hWnd)))
+            return;
+
+        PIXELFORMATDESCRIPTOR pfd = {0};
+
+        pfd.nSize = sizeof(pfd);
+        pfd.nVersion = 1;
+        pfd.dwFlags = PFD_DRAW_TO_WINDOW | PFD_SUPPORT_OPENGL;
+        pfd.iPixelType = PFD_TYPE_RGBA;
+        pfd.cColorBits = 24;
+
+        int pf = ChoosePixelFormat(m_hDC, &pfd);
+
+        if (!pf || !SetPixelFormat(m_hDC, pf, &pfd) || !(m_hRC = wglCreateContext(m_hDC)))
+            return;
+
+        m_valid = wglMakeCurrent(m_hDC, m_hRC) != FALSE;
+    }
+
+    HeadlessContext::~HeadlessContext()
+    {
+        if (m_hRC)
+        {
+            wglMakeCurrent(0, 0);
+            wglDeleteContext(m_hRC);
+        }
+
+        if (m_hDC)
+            ReleaseDC(m_hWnd, m_hDC);
+
+        if (m_hWnd)
+            DestroyWindow(m_hWnd);
+    }
+#else
+    HeadlessContext::HeadlessContext()
+        : m_valid(false), m_display(EGL_NO_DISPLAY), m_surface(EGL_NO_SURFACE),
+          m_context(EGL_NO_CONTEXT)
+    {
+        const EGLint configAttribs[] =
+        {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+            EGL_NONE
+        };
+
+        const EGLint surfaceAttribs[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+
+        EGLConfig config = 0;
+        EGLint numConfigs = 0;
+
+        m_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+        if (m_display == EGL_NO_DISPLAY || !eglInitialize(m_display, 0, 0))
+            return;
+
+        if (!eglChooseConfig(m_display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0)
+            return;
+
+        if (!eglBindAPI(EGL_OPENGL_API))
+            return;
+
+        m_surface = eglCreatePbufferSurface(m_display, config, surfaceAttribs);
+        m_context = eglCreateContext(m_display, config, EGL_NO_CONTEXT, 0);
+
+        if (m_surface == EGL_NO_SURFACE || m_context == EGL_NO_CONTEXT)
+            return;
+
+        m_valid = eglMakeCurrent(m_display, m_surface, m_surface, m_context) == EGL_TRUE;
+    }
+
+    HeadlessContext::~HeadlessContext()
+    {
+        if (m_display == EGL_NO_DISPLAY)
+            return;
+
+        eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+
+        if (m_context != EGL_NO_CONTEXT)
+            eglDestroyContext(m_display, m_context);
+
+        if (m_surface != EGL_NO_SURFACE)
+            eglDestroySurface(m_display, m_surface);
+
+        eglTerminate(m_display);
+    }
+#endif
+
+    void FillImage(std::vector<unsigned char> &pixels, int width, int height)
+    {
+        pixels.resize(width * height * 4);
+
+        for (int y = 0; y < height; ++y)
+        {
+            unsigned char *pRow = &pixels[y * width * 4];
+
+            for (int x = 0; x < width; ++x)
+            {
+                pRow[x * 4 + 0] = static_cast<unsigned char>((x * 7) ^ (y * 3));
+                pRow[x * 4 + 1] = static_cast<unsigned char>(((x / 8) + (y / 8)) & 1 ? 200 : 40);
+                pRow[x * 4 + 2] = static_cast<unsigned char>(x + y);
+                pRow[x * 4 + 3] = 255;
+            }
+        }
+    }
+
+    double Median(std::vector<double> &samples)
+    {
+        std::sort(samples.begin(), samples.end());
+        return samples[samples.size() / 2];
+    }
+
+    double TimeGlu(const std::vector<unsigned char> &pixels, int width, int height)
+    {
+        GLuint texture = 0;
+
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+
+        Clock::time_point start = Clock::now();
+        gluBuild2DMipmaps(GL_TEXTURE_2D, 4, width, height, GL_BGRA_EXT,
+            GL_UNSIGNED_BYTE, &pixels[0]);
+        glFinish();
+        Clock::time_point end = Clock::now();
+
+        glDeleteTextures(1, &texture);
+        return std::chrono::duration<double, std::milli>(end - start).count();
+    }
+
+    double TimeMipChain(const std::vector<unsigned char> &pixels, int width, int height,
+                        MipChain::Filter filter, bool upload)
+    {
+        MipChain chain;
+        GLuint texture = 0;
+
+        if (upload)
+        {
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+        }
+
+        Clock::time_point start = Clock::now();
+        chain.generate(&pixels[0], width, height, width * 4, filter, true);
+
+        if (upload)
+        {
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, chain.getNumberOfLevels() - 1);
+
+            for (int i = 0; i < chain.getNumberOfLevels(); ++i)
+            {
+                const MipChain::Level &level = chain.getLevel(i);
+
+                glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA8, level.width, level.height, 0,
+                    GL_BGRA_EXT, GL_UNSIGNED_BYTE, &level.pixels[0]);
+            }
+
+            glFinish();
+        }
+
+        Clock::time_point end = Clock::now();
+
+        if (upload)
+            glDeleteTextures(1, &texture);
+
+        return std::chrono::duration<double, std::milli>(end - start).count();
+    }
+
+    double TimeBatch(const std::vector<unsigned char> &pixels, int width, int height, int count)
+    {
+        std::vector<MipChain> chains(count);
+        std::vector<JobSystem::Job> jobs;
+
+        for (int i = 0; i < count; ++i)
+        {
+            MipChain *pChain = &chains[i];
+            jobs.push_back([pChain, &pixels, width, height]()
+                { pChain->generate(&pixels[0], width, height, width * 4); });
+        }
+
+        Clock::time_point start = Clock::now();
+        JobSystem::instance().run(jobs);
+        Clock::time_point end = Clock::now();
+
+        return std::chrono::duration<double, std::milli>(end - start).count();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int repetitions = (argc > 1) ? std::max(1, atoi(argv[1])) : 5;
+    HeadlessContext context;
+    std::vector<unsigned char> pixels;
+    std::vector<double> glu;
+    std::vector<double> box;
+    std::vector<double> boxUpload;
+    std::vector<double> kaiser;
+
+    printf("threads: %d, GL context: %s\n", JobSystem::instance().getNumberOfThreads(),
+        context.isValid() ? reinterpret_cast<const char *>(glGetString(GL_RENDERER)) : "none");
+    printf("%-11s %12s %12s %12s %12s\n", "size", "glu ms", "box ms", "box+up ms", "kaiser ms");
+
+    for (size_t s = 0; s < sizeof(g_imageSpecs) / sizeof(g_imageSpecs[0]); ++s)
+    {
+        const ImageSpec &spec = g_imageSpecs[s];
+
+        FillImage(pixels, spec.width, spec.height);
+        glu.clear();
+        box.clear();
+        boxUpload.clear();
+        kaiser.clear();
+
+        for (int i = 0; i < repetitions; ++i)
+        {
+            if (context.isValid())
+            {
+                glu.push_back(TimeGlu(pixels, spec.width, spec.height));
+                boxUpload.push_back(TimeMipChain(pixels, spec.width, spec.height,
+                    MipChain::FILTER_BOX, true));
+            }
+
+            box.push_back(TimeMipChain(pixels, spec.width, spec.height,
+                MipChain::FILTER_BOX, false));
+            kaiser.push_back(TimeMipChain(pixels, spec.width, spec.height,
+                MipChain::FILTER_KAISER, false));
+        }
+
+        char size[32];
+        sprintf(size, "%dx%d", spec.width, spec.height);
+
+        printf("%-11s %12.2f %12.2f %12.2f %12.2f\n", size,
+            glu.empty() ? 0.0 : Median(glu), Median(box),
+            boxUpload.empty() ? 0.0 : Median(boxUpload), Median(kaiser));
+    }
+
+    FillImage(pixels, 2048, 2048);
+    JobSystem::instance().resetStatistics();
+    printf("\n8 x 2048x2048 textures in parallel: %.2f ms\n", TimeBatch(pixels, 2048, 2048, 8));
+
+    for (int i = 0; i < JobSystem::instance().getNumberOfWorkers(); ++i)
+    {
+        JobSystem::WorkerStatistics statistics = JobSystem::instance().getWorkerStatistics(i);
+        double total = statistics.busySeconds + statistics.idleSeconds;
+
+        printf("worker %d: %llu jobs (%llu stolen), %.0f%% busy\n", i, statistics.jobsExecuted,
+            statistics.jobsStolen, (total > 0.0) ? 100.0 * statistics.busySeconds / total : 0.0);
+    }
+
+    return 0;
+}
@@ -0,0 +1,529 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#if !defined(WIN32_LEAN_AND_MEAN)
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "model_obj.h"
+
+namespace
+{
+    struct Options
+    {
+        int warmup;
+        int repetitions;
+        int cpu;
+        float threshold;
+        double noiseFloorMs;
+        std::string outputFilename;
+        std::string baselineFilename;
+        std::string workDirectory;
+        std::string meshFilter;
+    };
+
+    struct MeshSpec
+    {
+        const char *pszName;
+        int rings;
+        int sides;
+        int materials;
+    };
+
+    struct Result
+    {
+        std::string mesh;
+        std::string stage;
+        int triangles;
+        int vertices;
+        int samples;
+        double minMs;
+        double medianMs;
+        double p95Ms;
+        double maxMs;
+    };
+
+    struct Baseline
+    {
+        double medianMs;
+        double p95Ms;
+    };
+
+    const MeshSpec g_meshSpecs[] =
+    {
+        {"torus_8k",    64,   64,  1},
+        {"torus_130k",  256,  256, 4},
+        {"torus_520k",  1024, 256, 8},
+    };
+
+    const char *g_stageNames[] =
+    {
+        "import",
+        "normalize",
+        "reverseWinding",
+        "generateNormals",
+        "generateTangents",
+        "buildMeshes",
+        "bounds"
+    };
+
+    void PrintUsage(const char *pszProgram)
+    {
+        printf("usage: %s [options]\n"
+            "  --warmup N        untimed runs per stage (default 2)\n"
+            "  --reps N          timed runs per stage (default 10)\n"
+            "  --cpu N           pin the benchmark thread to logical CPU N (default 0, -1 = off)\n"
+            "  --mesh NAME       only run meshes whose name contains NAME\n"
+            "  --dir PATH        directory for the generated .obj/.mtl files (default .)\n"
+            "  --out FILE        write results as JSON to FILE\n"
+            "  --compare FILE    compare against a previous JSON result file\n"
+            "  --threshold PCT   regression threshold for --compare in percent (default 5)\n"
+            "  --noise-floor MS  slowdowns below this many ms never count as regressions (default 0.005)\n",
+            pszProgram);
+    }
+
+    bool PinCurrentThread(int cpu)
+    {
+        if (cpu < 0)
+            return true;
+
+#if defined(_WIN32)
+        DWORD_PTR mask = static_cast<DWORD_PTR>(1) << cpu;
+        return SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#endif
+    }
+
+    bool WriteTorus(const MeshSpec &spec, const std::string &directory,
+                    std::string &objFilename)
+    {
+        const float PI = 3.14159265f;
+        const float majorRadius = 1.0f;
+        const float minorRadius = 0.35f;
+
+        std::string mtlName = std::string(spec.pszName) + ".mtl";
+        std::string mtlFilename = directory + mtlName;
+
+        objFilename = directory + spec.pszName + ".obj";
+
+        FILE *pFile = fopen(mtlFilename.c_str(), "w");
+
+        if (!pFile)
+            return false;
+
+        for (int i = 0; i < spec.materials; ++i)
+        {
+            fprintf(pFile, "newmtl material%d\n", i);
+            fprintf(pFile, "Ka 0.2 0.2 0.2\nKd 0.8 0.8 0.8\nKs 0.5 0.5 0.5\nNs 50\n");
+            fprintf(pFile, "d %.2f\n", (i % 2) ? 0.5f : 1.0f);
+            fprintf(pFile, "map_Kd bench_color.jpg\nmap_bump bench_normal.jpg\n\n");
+        }
+
+        fclose(pFile);
+
+        if (!(pFile = fopen(objFilename.c_str(), "w")))
+            return false;
+
+        fprintf(pFile, "mtllib %s\n", mtlName.c_str());
+
+        for (int i = 0; i <= spec.rings; ++i)
+        {
+            float u = 2.0f * PI * i / spec.rings;
+
+            for (int j = 0; j <= spec.sides; ++j)
+            {
+                float v = 2.0f * PI * j / spec.sides;
+                float r = majorRadius + minorRadius * cosf(v);
+
+                fprintf(pFile, "v %f %f %f\n",
+                    r * cosf(u), minorRadius * sinf(v), r * sinf(u));
+                fprintf(pFile, "vt %f %f\n",
+                    static_cast<float>(i) / spec.rings, static_cast<float>(j) / spec.sides);
+                fprintf(pFile, "vn %f %f %f\n",
+                    cosf(v) * cosf(u), sinf(v), cosf(v) * sinf(u));
+            }
+        }
+
+        int ringsPerMaterial = (spec.rings + spec.materials - 1) / spec.materials;
+        int stride = spec.sides + 1;
+
+        for (int i = 0; i < spec.rings; ++i)
+        {
+            if (i % ringsPerMaterial == 0)
+                fprintf(pFile, "usemtl material%d\n", i / ringsPerMaterial);
+
+            for (int j = 0; j < spec.sides; ++j)
+            {
+                int a = i * stride + j + 1;
+                int b = (i + 1) * stride + j + 1;
+
+                fprintf(pFile, "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n",
+                    a, a, a, a + 1, a + 1, a + 1, b + 1, b + 1, b + 1, b, b, b);
+            }
+        }
+
+        fclose(pFile);
+        return true;
+    }
+
+    double Percentile(const std::vector<double> &sorted, double p)
+    {
+        if (sorted.empty())
+            return 0.0;
+
+        double rank = p * (sorted.size() - 1);
+        size_t lo = static_cast<size_t>(rank);
+        size_t hi = std::min(lo + 1, sorted.size() - 1);
+        double frac = rank - lo;
+
+        return sorted[lo] + (sorted[hi] - sorted[lo]) * frac;
+    }
+
+    bool ReadNumber(const char *pszLine, const char *pszKey, double &value)
+    {
+        const char *p = strstr(pszLine, pszKey);
+
+        if (!p)
+            return false;
+
+        p = strchr(p + strlen(pszKey), ':');
+        return p && sscanf(p + 1, "%lf", &value) == 1;
+    }
+
+    bool ReadString(const char *pszLine, const char *pszKey, std::string &value)
+    {
+        const char *p = strstr(pszLine, pszKey);
+
+        if (!p || !(p = strchr(p + strlen(pszKey), ':')) || !(p = strchr(p, '"')))
+            return false;
+
+        const char *pEnd = strchr(++p, '"');
+
+        if (!pEnd)
+            return false;
+
+        value.assign(p, pEnd);
+        return true;
+    }
+}
+
+class ModelBenchmark
+{
+public:
+    explicit ModelBenchmark(const Options &options) : m_options(options) {}
+
+    void run(const MeshSpec &spec, const std::string &objFilename);
+    bool writeJson(const char *pszFilename) const;
+    int compare(const char *pszFilename) const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    double timeStage(int stage, const Model &base, const std::string &objFilename);
+    void record(const MeshSpec &spec, const Model &base, int stage,
+        std::vector<double> &samples);
+
+    Options m_options;
+    std::vector<Result> m_results;
+};
+
+double ModelBenchmark::timeStage(int stage, const Model &base, const std::string &objFilename)
+{
+    Model model;
+    float center[3] = {0.0f};
+    float width = 0.0f;
+    float height = 0.0f;
+    float length = 0.0f;
+    float radius = 0.0f;
+
+    if (stage != 0)
+        model = base;
+
+    Clock::time_point start = Clock::now();
+
+    switch (stage)
+    {
+    case 0:
+        model.import(objFilename.c_str());
+        break;
+
+    case 1:
+        model.normalize();
+        break;
+
+    case 2:
+        model.reverseWinding();
+        break;
+
+    case 3:
+        model.generateNormals();
+        break;
+
+    case 4:
+        model.generateTangents();
+        break;
+
+    case 5:
+        model.buildMeshes();
+        break;
+
+    case 6:
+        model.bounds(center, width, height, length, radius);
+        break;
+
+    default:
+        break;
+    }
+
+    Clock::time_point end = Clock::now();
+
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void ModelBenchmark::record(const MeshSpec &spec, const Model &base, int stage,
+                            std::vector<double> &samples)
+{
+    Result result;
+
+    std::sort(samples.begin(), samples.end());
+
+    result.mesh = spec.pszName;
+    result.stage = g_stageNames[stage];
+    result.triangles = base.getNumberOfTriangles();
+    result.vertices = base.getNumberOfVertices();
+    result.samples = static_cast<int>(samples.size());
+    result.minMs = samples.front();
+    result.medianMs = Percentile(samples, 0.5);
+    result.p95Ms = Percentile(samples, 0.95);
+    result.maxMs = samples.back();
+
+    printf("%-12s %-18s %10d tris  median %10.3f ms  p95 %10.3f ms  min %10.3f ms\n",
+        result.mesh.c_str(), result.stage.c_str(), result.triangles,
+        result.medianMs, result.p95Ms, result.minMs);
+
+    m_results.push_back(result);
+}
+
+void ModelBenchmark::run(const MeshSpec &spec, const std::string &objFilename)
+{
+    Model base;
+
+    if (!base.import(objFilename.c_str()))
+    {
+        fprintf(stderr, "failed to import %s\n", objFilename.c_str());
+        return;
+    }
+
+    int numStages = static_cast<int>(sizeof(g_stageNames) / sizeof(g_stageNames[0]));
+    std::vector<double> samples;
+
+    for (int stage = 0; stage < numStages; ++stage)
+    {
+        samples.clear();
+
+        for (int i = 0; i < m_options.warmup; ++i)
+            timeStage(stage, base, objFilename);
+
+        for (int i = 0; i < m_options.repetitions; ++i)
+            samples.push_back(timeStage(stage, base, objFilename));
+
+        record(spec, base, stage, samples);
+    }
+}
+
+bool ModelBenchmark::writeJson(const char *pszFilename) const
+{
+    FILE *pFile = fopen(pszFilename, "w");
+
+    if (!pFile)
+        return false;
+
+    fprintf(pFile, "{\n  \"warmup\": %d,\n  \"repetitions\": %d,\n  \"cpu\": %d,\n",
+        m_options.warmup, m_options.repetitions, m_options.cpu);
+    fprintf(pFile, "  \"results\": [\n");
+
+    for (size_t i = 0; i < m_results.size(); ++i)
+    {
+        const Result &r = m_results[i];
+
+        fprintf(pFile, "    {\"mesh\": \"%s\", \"stage\": \"%s\", \"triangles\": %d, "
+            "\"vertices\": %d, \"samples\": %d, \"min_ms\": %.6f, \"median_ms\": %.6f, "
+            "\"p95_ms\": %.6f, \"max_ms\": %.6f}%s\n",
+            r.mesh.c_str(), r.stage.c_str(), r.triangles, r.vertices, r.samples,
+            r.minMs, r.medianMs, r.p95Ms, r.maxMs,
+            (i + 1 < m_results.size()) ? "," : "");
+    }
+
+    fprintf(pFile, "  ]\n}\n");
+    fclose(pFile);
+    return true;
+}
+
+int ModelBenchmark::compare(const char *pszFilename) const
+{
+    FILE *pFile = fopen(pszFilename, "r");
+
+    if (!pFile)
+    {
+        fprintf(stderr, "failed to open baseline %s\n", pszFilename);
+        return 2;
+    }
+
+    std::map<std::string, Baseline> baseline;
+    std::string mesh;
+    std::string stage;
+    Baseline timing = {0.0, 0.0};
+    char buffer[1024] = {0};
+
+    while (fgets(buffer, sizeof(buffer), pFile))
+    {
+        if (ReadString(buffer, "\"mesh\"", mesh) &&
+            ReadString(buffer, "\"stage\"", stage) &&
+            ReadNumber(buffer, "\"median_ms\"", timing.medianMs))
+        {
+            if (!ReadNumber(buffer, "\"p95_ms\"", timing.p95Ms))
+                timing.p95Ms = timing.medianMs;
+
+            baseline[mesh + "/" + stage] = timing;
+        }
+    }
+
+    fclose(pFile);
+
+    int regressions = 0;
+    std::map<std::string, Baseline>::const_iterator iter;
+
+    printf("\n%-32s %12s %12s %9s\n", "mesh/stage", "baseline ms", "current ms", "change");
+
+    for (size_t i = 0; i < m_results.size(); ++i)
+    {
+        const Result &r = m_results[i];
+        std::string key = r.mesh + "/" + r.stage;
+
+        if ((iter = baseline.find(key)) == baseline.end() || iter->second.medianMs <= 0.0)
+            continue;
+
+        // Stages that take a few microseconds change by more than the
+        // threshold between identical runs, so a slowdown also has to be
+        // larger than the noise floor and the baseline's own p95 spread.
+        double noise = std::max(m_options.noiseFloorMs, iter->second.p95Ms - iter->second.medianMs);
+        double change = (r.medianMs - iter->second.medianMs) / iter->second.medianMs * 100.0;
+        bool regressed = r.medianMs - iter->second.medianMs > noise && change > m_options.threshold;
+
+        printf("%-32s %12.3f %12.3f %+8.1f%%%s\n", key.c_str(), iter->second.medianMs,
+            r.medianMs, change, regressed ? "  REGRESSION" : "");
+
+        if (regressed)
+            ++regressions;
+    }
+
+    if (regressions > 0)
+    {
+        printf("\n%d stage(s) regressed by more than %.1f%%\n", regressions, m_options.threshold);
+        return 1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+
+    options.warmup = 2;
+    options.repetitions = 10;
+    options.cpu = 0;
+    options.threshold = 5.0f;
+    options.noiseFloorMs = 0.005;
+    options.workDirectory = "./";
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--warmup" && hasValue)
+            options.warmup = atoi(argv[++i]);
+        else if (arg == "--reps" && hasValue)
+            options.repetitions = std::max(1, atoi(argv[++i]));
+        else if (arg == "--cpu" && hasValue)
+            options.cpu = atoi(argv[++i]);
+        else if (arg == "--threshold" && hasValue)
+            options.threshold = static_cast<float>(atof(argv[++i]));
+        else if (arg == "--noise-floor" && hasValue)
+            options.noiseFloorMs = std::max(0.0, atof(argv[++i]));
+        else if (arg == "--out" && hasValue)
+            options.outputFilename = argv[++i];
+        else if (arg == "--compare" && hasValue)
+            options.baselineFilename = argv[++i];
+        else if (arg == "--mesh" && hasValue)
+            options.meshFilter = argv[++i];
+        else if (arg == "--dir" && hasValue)
+        {
+            options.workDirectory = argv[++i];
+
+            char last = options.workDirectory[options.workDirectory.length() - 1];
+
+            if (last != '/' && last != '\\')
+                options.workDirectory += '/';
+        }
+        else
+        {
+            PrintUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (!PinCurrentThread(options.cpu))
+        fprintf(stderr, "warning: failed to pin benchmark thread to cpu %d\n", options.cpu);
+
+    ModelBenchmark benchmark(options);
+    std::string objFilename;
+    int numSpecs = static_cast<int>(sizeof(g_meshSpecs) / sizeof(g_meshSpecs[0]));
+
+    for (int i = 0; i < numSpecs; ++i)
+    {
+        const MeshSpec &spec = g_meshSpecs[i];
+
+        if (!options.meshFilter.empty() && !strstr(spec.pszName, options.meshFilter.c_str()))
+            continue;
+
+        if (!WriteTorus(spec, options.workDirectory, objFilename))
+        {
+            fprintf(stderr, "failed to write %s\n", objFilename.c_str());
+            return 2;
+        }
+
+        benchmark.run(spec, objFilename);
+    }
+
+    if (!options.outputFilename.empty() && !benchmark.writeJson(options.outputFilename.c_str()))
+    {
+        fprintf(stderr, "failed to write %s\n", options.outputFilename.c_str());
+        return 2;
+    }
+
+    if (!options.baselineFilename.empty())
+        return benchmark.compare(options.baselineFilename.c_str());
+
+    return 0;
+}
@@ -0,0 +1,490 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#if !defined(WIN32_LEAN_AND_MEAN)
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#define GL_GLEXT_PROTOTYPES
+#include <EGL/egl.h>
+#endif
+
+#include <GL/gl.h>
+#include <GL/glu.h>
+
+#if defined(_WIN32)
+#include "gl2.h"
+#else
+#include <GL/glext.h>
+#endif
+
+#include "camera_path.h"
+#include "frame_profiler.h"
+#include "model_obj.h"
+
+// Replays a camera path over one or more models without a window and reports
+// frame time percentiles. Paths recorded in the viewer (K) can be passed with
+// --path; otherwise the camera orbits each model once. Drawing follows the
+// viewer's fixed function path without textures, and every frame ends with
+// glFinish() so the timings include the GPU work. With --buffers the geometry
+// is uploaded once into buffer objects instead of being drawn from client
+// memory. The reported KB per frame is the index data plus the referenced
+// vertex range of each client-side array that the driver copies on every draw.
+
+namespace
+{
+    const float CAMERA_FOVY = 60.0f;
+    const float CAMERA_ZFAR = 10.0f;
+    const float CAMERA_ZNEAR = 0.1f;
+
+    struct Result
+    {
+        std::string filename;
+        int triangles;
+        size_t bytesPerFrame;
+        FrameProfiler::Statistics statistics;
+    };
+
+    struct ModelBuffers
+    {
+        GLuint vertexBuffer;
+        GLuint indexBuffer;
+    };
+
+    class HeadlessContext
+    {
+    public:
+        HeadlessContext(int width, int height);
+        ~HeadlessContext();
+
+        bool isValid() const
+        { return m_valid; }
+
+    private:
+        bool m_valid;
+#if defined(_WIN32)
+        HWND m_hWnd;
+        HDC m_hDC;
+        HGLRC m_hRC;
+#else
+        EGLDisplay m_display;
+        EGLSurface m_surface;
+        EGLContext m_context;
+#endif
+    };
+
+#if defined(_WIN32)
+    HeadlessContext::HeadlessContext(int width, int height) : m_valid(false), m_hWnd(0), m_hDC(0), m_hRC(0)
+    {
+        m_hWnd = CreateWindowEx(0, "STATIC", "bench_replay", WS_POPUP, 0, 0, width, height,
+            0, 0, GetModuleHandle(0), 0);
+
+        if (!m_hWnd || !(m_hDC = GetDC(m_hWnd)))
+            return;
+
+        PIXELFORMATDESCRIPTOR pfd = {0};
+
+        pfd.nSize = sizeof(pfd);
+        pfd.nVersion = 1;
+        pfd.dwFlags = PFD_DRAW_TO_WINDOW | PFD_SUPPORT_OPENGL;
+        pfd.iPixelType = PFD_TYPE_RGBA;
+        pfd.cColorBits = 24;
+        pfd.cDepthBits = 16;
+
+        int pf = ChoosePixelFormat(m_hDC, &pfd);
+
+        if (!pf || !SetPixelFormat(m_hDC, pf, &pfd) || !(m_hRC = wglCreateContext(m_hDC)))
+            return;
+
+        m_valid = wglMakeCurrent(m_hDC, m_hRC) != FALSE;
+    }
+
+    HeadlessContext::~HeadlessContext()
+    {
+        if (m_hRC)
+        {
+            wglMakeCurrent(0, 0);
+            wglDeleteContext(m_hRC);
+        }
+
+        if (m_hDC)
+            ReleaseDC(m_hWnd, m_hDC);
+
+        if (m_hWnd)
+            DestroyWindow(m_hWnd);
+    }
+#else
+    HeadlessContext::HeadlessContext(int width, int height)
+        : m_valid(false), m_display(EGL_NO_DISPLAY), m_surface(EGL_NO_SURFACE),
+          m_context(EGL_NO_CONTEXT)
+    {
+        const EGLint configAttribs[] =
+        {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+            EGL_DEPTH_SIZE, 16,
+            EGL_NONE
+        };
+
+        const EGLint surfaceAttribs[] = {EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE};
+
+        EGLConfig config = 0;
+        EGLint numConfigs = 0;
+
+        m_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+        if (m_display == EGL_NO_DISPLAY || !eglInitialize(m_display, 0, 0))
+            return;
+
+        if (!eglChooseConfig(m_display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0)
+            return;
+
+        if (!eglBindAPI(EGL_OPENGL_API))
+            return;
+
+        m_surface = eglCreatePbufferSurface(m_display, config, surfaceAttribs);
+        m_context = eglCreateContext(m_display, config, EGL_NO_CONTEXT, 0);
+
+        if (m_surface == EGL_NO_SURFACE || m_context == EGL_NO_CONTEXT)
+            return;
+
+        m_valid = eglMakeCurrent(m_display, m_surface, m_surface, m_context) == EGL_TRUE;
+    }
+
+    HeadlessContext::~HeadlessContext()
+    {
+        if (m_display == EGL_NO_DISPLAY)
+            return;
+
+        eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+
+        if (m_context != EGL_NO_CONTEXT)
+            eglDestroyContext(m_display, m_context);
+
+        if (m_surface != EGL_NO_SURFACE)
+            eglDestroySurface(m_display, m_surface);
+
+        eglTerminate(m_display);
+    }
+#endif
+
+    const GLubyte *BufferOffset(size_t bytes)
+    {
+        return static_cast<const GLubyte *>(0) + bytes;
+    }
+
+    size_t CountClientBytesPerFrame(const Model &model)
+    {
+        size_t elementSize = model.hasNormals() ? 6 * sizeof(float) : 3 * sizeof(float);
+        size_t bytes = 0;
+
+        for (int i = 0; i < model.getNumberOfMeshes(); ++i)
+        {
+            const Model::Mesh &mesh = model.getMesh(i);
+            const int *pIndices = model.getIndexBuffer() + mesh.startIndex;
+            int count = mesh.triangleCount * 3;
+
+            if (count == 0)
+                continue;
+
+            int first = *std::min_element(pIndices, pIndices + count);
+            int last = *std::max_element(pIndices, pIndices + count);
+            int numberOfInstances = (mesh.prototype >= 0) ? model.getNumberOfInstances(mesh.prototype) : 1;
+
+            bytes += (count * sizeof(int) + (last - first + 1) * elementSize) * numberOfInstances;
+        }
+
+        return bytes;
+    }
+
+    void CreateModelBuffers(const Model &model, ModelBuffers &buffers)
+    {
+        glGenBuffers(1, &buffers.vertexBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, buffers.vertexBuffer);
+        glBufferData(GL_ARRAY_BUFFER, model.getNumberOfVertices() * model.getVertexSize(),
+            model.getVertexBuffer(), GL_STATIC_DRAW);
+
+        glGenBuffers(1, &buffers.indexBuffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.indexBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, model.getNumberOfIndices() * model.getIndexSize(),
+            model.getIndexBuffer(), GL_STATIC_DRAW);
+    }
+
+    void DeleteModelBuffers(ModelBuffers &buffers)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        glDeleteBuffers(1, &buffers.vertexBuffer);
+        glDeleteBuffers(1, &buffers.indexBuffer);
+        buffers.vertexBuffer = 0;
+        buffers.indexBuffer = 0;
+    }
+
+    CameraPath::Key GetStartKey(const Model &model)
+    {
+        CameraPath::Key key;
+
+        model.getCenter(key.targetPos[0], key.targetPos[1], key.targetPos[2]);
+
+        key.cameraPos[0] = key.targetPos[0];
+        key.cameraPos[1] = key.targetPos[1];
+        key.cameraPos[2] = key.targetPos[2] + model.getRadius() + CAMERA_ZNEAR + 0.4f;
+        key.heading = 0.0f;
+        key.pitch = 0.0f;
+
+        return key;
+    }
+
+    void DrawFrame(const Model &model, const ModelBuffers &buffers, const CameraPath::Key &key,
+        int width, int height)
+    {
+        glViewport(0, 0, width, height);
+        glClearColor(0.0f, 0.8f, 4.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        glMatrixMode(GL_PROJECTION);
+        glLoadIdentity();
+        gluPerspective(CAMERA_FOVY, static_cast<float>(width) / static_cast<float>(height),
+            CAMERA_ZNEAR, CAMERA_ZFAR);
+
+        glMatrixMode(GL_MODELVIEW);
+        glLoadIdentity();
+        gluLookAt(key.cameraPos[0], key.cameraPos[1], key.cameraPos[2],
+            key.targetPos[0], key.targetPos[1], key.targetPos[2],
+            0.0f, 1.0f, 0.0f);
+
+        glRotatef(key.pitch, 1.0f, 0.0f, 0.0f);
+        glRotatef(key.heading, 0.0f, 1.0f, 0.0f);
+
+        const GLubyte *pVertices = reinterpret_cast<const GLubyte *>(model.getVertexBuffer());
+        const int *pIndices = model.getIndexBuffer();
+
+        if (buffers.vertexBuffer)
+        {
+            pVertices = BufferOffset(0);
+            pIndices = reinterpret_cast<const int *>(BufferOffset(0));
+        }
+
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(3, GL_FLOAT, model.getVertexSize(), pVertices + offsetof(Model::Vertex, position));
+
+        if (model.hasNormals())
+        {
+            glEnableClientState(GL_NORMAL_ARRAY);
+            glNormalPointer(GL_FLOAT, model.getVertexSize(), pVertices + offsetof(Model::Vertex, normal));
+        }
+
+        for (int i = 0; i < model.getNumberOfMeshes(); ++i)
+        {
+            const Model::Mesh &mesh = model.getMesh(i);
+            const Model::Material *pMaterial = mesh.pMaterial;
+            int numberOfInstances = (mesh.prototype >= 0) ? model.getNumberOfInstances(mesh.prototype) : 1;
+
+            glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, pMaterial->ambient);
+            glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, pMaterial->diffuse);
+            glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, pMaterial->specular);
+            glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, pMaterial->shininess * 128.0f);
+
+            for (int j = 0; j < numberOfInstances; ++j)
+            {
+                if (mesh.prototype >= 0)
+                {
+                    glPushMatrix();
+                    glMultMatrixf(model.getInstanceTransform(mesh.prototype, j));
+                }
+
+                glDrawElements(GL_TRIANGLES, mesh.triangleCount * 3, GL_UNSIGNED_INT,
+                    pIndices + mesh.startIndex);
+
+                if (mesh.prototype >= 0)
+                    glPopMatrix();
+            }
+        }
+
+        glDisableClientState(GL_NORMAL_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+    }
+
+    bool WriteResults(const char *pszFilename, const std::vector<Result> &results)
+    {
+        FILE *pFile = fopen(pszFilename, "w");
+
+        if (!pFile)
+            return false;
+
+        fprintf(pFile, "[\n");
+
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const Result &result = results[i];
+
+            fprintf(pFile, "  {\"model\": \"%s\", \"triangles\": %d, \"frames\": %d, \"kb_per_frame\": %.1f, "
+                "\"average_ms\": %.3f, \"p50_ms\": %.3f, \"p95_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f}%s\n",
+                result.filename.c_str(), result.triangles, result.statistics.numberOfFrames,
+                result.bytesPerFrame / 1024.0f,
+                result.statistics.average * 1000.0f, result.statistics.p50 * 1000.0f,
+                result.statistics.p95 * 1000.0f, result.statistics.p99 * 1000.0f,
+                result.statistics.max * 1000.0f, (i + 1 < results.size()) ? "," : "");
+        }
+
+        fprintf(pFile, "]\n");
+        return fclose(pFile) == 0;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int width = 1280;
+    int height = 720;
+    int orbitFrames = 360;
+    bool useBuffers = false;
+    const char *pszPathFilename = 0;
+    const char *pszOutFilename = 0;
+    std::vector<const char *> filenames;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--width") == 0 && i + 1 < argc)
+            width = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--height") == 0 && i + 1 < argc)
+            height = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--orbit") == 0 && i + 1 < argc)
+            orbitFrames = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--path") == 0 && i + 1 < argc)
+            pszPathFilename = argv[++i];
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+            pszOutFilename = argv[++i];
+        else if (strcmp(argv[i], "--buffers") == 0)
+            useBuffers = true;
+        else
+            filenames.push_back(argv[i]);
+    }
+
+    if (filenames.empty())
+    {
+        fprintf(stderr, "usage: bench_replay [--width W] [--height H] [--orbit FRAMES] "
+            "[--path camera_path.txt] [--out results.json] [--buffers] model.obj...\n");
+        return 1;
+    }
+
+    HeadlessContext context(width, height);
+
+    if (!context.isValid())
+    {
+        fprintf(stderr, "failed to create a headless GL context\n");
+        return 1;
+    }
+
+    CameraPath recordedPath;
+
+    if (pszPathFilename && !recordedPath.load(pszPathFilename))
+    {
+        fprintf(stderr, "failed to load camera path %s\n", pszPathFilename);
+        return 1;
+    }
+
+#if defined(_WIN32)
+    GL2Init();
+
+    if (useBuffers && !GL2SupportsGLVersion(1, 5))
+    {
+        fprintf(stderr, "buffer objects are not supported\n");
+        return 1;
+    }
+#endif
+
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    glEnable(GL_LIGHTING);
+    glEnable(GL_LIGHT0);
+
+    std::vector<Result> results;
+
+    printf("GL renderer: %s, %dx%d, %s\n", reinterpret_cast<const char *>(glGetString(GL_RENDERER)),
+        width, height, useBuffers ? "buffer objects" : "client arrays");
+    printf("%-32s %10s %7s %9s %9s %9s %9s %9s\n", "model", "triangles", "frames", "KB/frame",
+        "p50 ms", "p95 ms", "p99 ms", "max ms");
+
+    for (size_t i = 0; i < filenames.size(); ++i)
+    {
+        Model model;
+
+        if (!model.import(filenames[i]))
+        {
+            fprintf(stderr, "failed to import %s\n", filenames[i]);
+            continue;
+        }
+
+        model.normalize();
+
+        CameraPath orbitPath;
+        const CameraPath *pPath = &recordedPath;
+
+        if (!pszPathFilename)
+        {
+            orbitPath.makeOrbit(GetStartKey(model), orbitFrames);
+            pPath = &orbitPath;
+        }
+
+        FrameProfiler profiler(1.0f / 60.0f);
+        ModelBuffers buffers = {0, 0};
+
+        if (useBuffers)
+            CreateModelBuffers(model, buffers);
+
+        profiler.reset(pPath->getNumberOfKeys());
+
+        // One untimed frame so that driver-side setup isn't counted.
+        DrawFrame(model, buffers, pPath->getKey(0), width, height);
+        glFinish();
+
+        for (int j = 0; j < pPath->getNumberOfKeys(); ++j)
+        {
+            profiler.beginFrame();
+
+            {
+                FrameProfiler::ScopedTimer timer(profiler, FrameProfiler::SCOPE_SUBMIT);
+                DrawFrame(model, buffers, pPath->getKey(j), width, height);
+            }
+
+            {
+                FrameProfiler::ScopedTimer timer(profiler, FrameProfiler::SCOPE_SWAP);
+                glFinish();
+            }
+
+            profiler.endFrame(0);
+        }
+
+        if (useBuffers)
+            DeleteModelBuffers(buffers);
+
+        Result result;
+
+        result.filename = filenames[i];
+        result.triangles = model.getNumberOfTriangles();
+        result.bytesPerFrame = useBuffers ? 0 : CountClientBytesPerFrame(model);
+        result.statistics = profiler.getStatistics();
+        results.push_back(result);
+
+        printf("%-32s %10d %7d %9.1f %9.3f %9.3f %9.3f %9.3f\n", filenames[i], result.triangles,
+            result.statistics.numberOfFrames, result.bytesPerFrame / 1024.0f, result.statistics.p50 * 1000.0f,
+            result.statistics.p95 * 1000.0f, result.statistics.p99 * 1000.0f,
+            result.statistics.max * 1000.0f);
+    }
+
+    if (pszOutFilename && !WriteResults(pszOutFilename, results))
+    {
+        fprintf(stderr, "failed to write %s\n", pszOutFilename);
+        return 1;
+    }
+
+    return results.empty() ? 1 : 0;
+}
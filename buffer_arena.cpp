@@ -0,0 +1,95 @@
+#include <algorithm>
+#include "buffer_arena.h"
+
+BufferArena::BufferArena() : m_capacity(0), m_used(0)
+{
+}
+
+int BufferArena::allocate(size_t size)
+{
+    // m_order holds the live blocks sorted by offset, so the gaps between
+    // neighbours are the free ranges.
+    size_t offset = 0;
+    size_t position = 0;
+
+    for (; position < m_order.size(); ++position)
+    {
+        const Block &block = m_blocks[m_order[position]];
+
+        if (block.offset - offset >= size)
+            break;
+
+        offset = block.offset + block.size;
+    }
+
+    if (position == m_order.size() && m_capacity - offset < size)
+        return -1;
+
+    Block block = {offset, size};
+    int handle = 0;
+
+    if (m_freeHandles.empty())
+    {
+        handle = static_cast<int>(m_blocks.size());
+        m_blocks.push_back(block);
+    }
+    else
+    {
+        handle = m_freeHandles.back();
+        m_freeHandles.pop_back();
+        m_blocks[handle] = block;
+    }
+
+    m_order.insert(m_order.begin() + position, handle);
+    m_used += size;
+
+    return handle;
+}
+
+bool BufferArena::compact()
+{
+    size_t offset = 0;
+    bool moved = false;
+
+    for (size_t i = 0; i < m_order.size(); ++i)
+    {
+        Block &block = m_blocks[m_order[i]];
+
+        if (block.offset != offset)
+        {
+            block.offset = offset;
+            moved = true;
+        }
+
+        offset += block.size;
+    }
+
+    return moved;
+}
+
+void BufferArena::free(int block)
+{
+    std::vector<int>::iterator i = std::find(m_order.begin(), m_order.end(), block);
+
+    if (i == m_order.end())
+        return;
+
+    m_order.erase(i);
+    m_used -= m_blocks[block].size;
+    m_freeHandles.push_back(block);
+}
+
+void BufferArena::reset(size_t capacity)
+{
+    m_capacity = capacity;
+    m_used = 0;
+    m_blocks.clear();
+    m_freeHandles.clear();
+    m_order.clear();
+}
+
+void BufferArena::setCapacity(size_t capacity)
+{
+    // Only grows: live blocks keep their offsets.
+    m_capacity = std::max(m_capacity, capacity);
+}
@@ -0,0 +1,55 @@
+#if !defined(BUFFER_ARENA_H)
+#define BUFFER_ARENA_H
+
+#include <cstddef>
+#include <vector>
+
+// Bookkeeping for sub-allocating one large buffer. Offsets and sizes are in
+// caller-defined units (vertices, indices). Blocks are placed first fit and
+// referred to by handles that stay valid until the block is freed. compact()
+// slides the live blocks to the front of the buffer in their current order;
+// the caller re-reads the offsets and moves the data.
+
+class BufferArena
+{
+public:
+    BufferArena();
+
+    int allocate(size_t size);
+    bool compact();
+    void free(int block);
+    void reset(size_t capacity = 0);
+    void setCapacity(size_t capacity);
+
+    size_t getCapacity() const;
+    size_t getOffset(int block) const;
+    size_t getSize(int block) const;
+    size_t getUsed() const;
+
+private:
+    struct Block
+    {
+        size_t offset;
+        size_t size;
+    };
+
+    size_t m_capacity;
+    size_t m_used;
+    std::vector<Block> m_blocks;
+    std::vector<int> m_freeHandles;
+    std::vector<int> m_order;
+};
+
+inline size_t BufferArena::getCapacity() const
+{ return m_capacity; }
+
+inline size_t BufferArena::getOffset(int block) const
+{ return m_blocks[block].offset; }
+
+inline size_t BufferArena::getSize(int block) const
+{ return m_blocks[block].size; }
+
+inline size_t BufferArena::getUsed() const
+{ return m_used; }
+
+#endif
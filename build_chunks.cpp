@@ -0,0 +1,51 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "chunk_builder.h"
+
+// Preprocesses an OBJ file into the chunk file that the viewer streams from
+// when a model is too large to import.
+
+int main(int argc, char *argv[])
+{
+    const char *pszObjFilename = 0;
+    const char *pszChunkFilename = 0;
+    ChunkBuilder builder;
+    ChunkBuilder::Options options = builder.getOptions();
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--triangles") == 0 && i + 1 < argc)
+            options.trianglesPerChunk = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--memory") == 0 && i + 1 < argc)
+            options.memoryBudget = static_cast<size_t>(atoi(argv[++i])) * 1024 * 1024;
+        else if (!pszObjFilename)
+            pszObjFilename = argv[i];
+        else
+            pszChunkFilename = argv[i];
+    }
+
+    if (!pszObjFilename || !pszChunkFilename || options.trianglesPerChunk <= 0 || options.memoryBudget == 0)
+    {
+        fprintf(stderr, "usage: build_chunks [--triangles 65536] [--memory 256] model.obj model.chunks\n");
+        return 1;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    builder.setOptions(options);
+
+    if (!builder.build(pszObjFilename, pszChunkFilename))
+    {
+        fprintf(stderr, "failed to build %s from %s\n", pszChunkFilename, pszObjFilename);
+        return 1;
+    }
+
+    const ChunkBuilder::Statistics &stats = builder.getStatistics();
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%lld triangles in %d chunks, largest %d, %lld faces skipped, %.3f s\n",
+        stats.numberOfTriangles, stats.numberOfChunks, stats.largestChunk, stats.skippedFaces, seconds);
+    return 0;
+}
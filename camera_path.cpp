@@ -0,0 +1,81 @@
+#include <cstdio>
+#include "camera_path.h"
+
+void CameraPath::add(const Key &key)
+{
+    m_keys.push_back(key);
+}
+
+void CameraPath::clear()
+{
+    m_keys.clear();
+}
+
+bool CameraPath::load(const char *pszFilename)
+{
+    FILE *pFile = fopen(pszFilename, "r");
+
+    if (!pFile)
+        return false;
+
+    char buffer[256] = {0};
+    int version = 0;
+    Key key;
+
+    m_keys.clear();
+
+    if (!fgets(buffer, sizeof(buffer), pFile) || sscanf(buffer, "camera_path %d", &version) != 1 || version != 1)
+    {
+        fclose(pFile);
+        return false;
+    }
+
+    while (fgets(buffer, sizeof(buffer), pFile))
+    {
+        if (sscanf(buffer, "%f %f %f %f %f %f %f %f",
+                &key.cameraPos[0], &key.cameraPos[1], &key.cameraPos[2],
+                &key.targetPos[0], &key.targetPos[1], &key.targetPos[2],
+                &key.heading, &key.pitch) == 8)
+        {
+            m_keys.push_back(key);
+        }
+    }
+
+    fclose(pFile);
+    return !m_keys.empty();
+}
+
+void CameraPath::makeOrbit(const Key &start, int numberOfKeys)
+{
+    Key key = start;
+
+    m_keys.clear();
+
+    for (int i = 0; i < numberOfKeys; ++i)
+    {
+        key.heading = start.heading + 360.0f * i / numberOfKeys;
+        m_keys.push_back(key);
+    }
+}
+
+bool CameraPath::save(const char *pszFilename) const
+{
+    FILE *pFile = fopen(pszFilename, "w");
+
+    if (!pFile)
+        return false;
+
+    fprintf(pFile, "camera_path 1\n");
+
+    for (size_t i = 0; i < m_keys.size(); ++i)
+    {
+        const Key &key = m_keys[i];
+
+        fprintf(pFile, "%.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n",
+            key.cameraPos[0], key.cameraPos[1], key.cameraPos[2],
+            key.targetPos[0], key.targetPos[1], key.targetPos[2],
+            key.heading, key.pitch);
+    }
+
+    return fclose(pFile) == 0;
+}
@@ -0,0 +1,40 @@
+#if !defined(CAMERA_PATH_H)
+#define CAMERA_PATH_H
+
+#include <vector>
+
+// A recorded sequence of viewer camera states, one per drawn frame. Paths
+// are stored as text: a "camera_path 1" header followed by one line per frame
+// with the camera position, target position, heading and pitch.
+
+class CameraPath
+{
+public:
+    struct Key
+    {
+        float cameraPos[3];
+        float targetPos[3];
+        float heading;
+        float pitch;
+    };
+
+    void add(const Key &key);
+    void clear();
+    bool load(const char *pszFilename);
+    void makeOrbit(const Key &start, int numberOfKeys);
+    bool save(const char *pszFilename) const;
+
+    const Key &getKey(int i) const;
+    int getNumberOfKeys() const;
+
+private:
+    std::vector<Key> m_keys;
+};
+
+inline const CameraPath::Key &CameraPath::getKey(int i) const
+{ return m_keys[i]; }
+
+inline int CameraPath::getNumberOfKeys() const
+{ return static_cast<int>(m_keys.size()); }
+
+#endif
@@ -0,0 +1,66 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "model_catalog.h"
+
+// Builds or refreshes the catalog index of the OBJ files under a directory
+// and lists what it holds. Only files that changed since the index was last
+// written are probed again.
+
+int main(int argc, char *argv[])
+{
+    const char *pszDirectory = 0;
+    const char *pszIndexFilename = "catalog.idx";
+    bool quiet = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--index") == 0 && i + 1 < argc)
+            pszIndexFilename = argv[++i];
+        else if (strcmp(argv[i], "--quiet") == 0)
+            quiet = true;
+        else
+            pszDirectory = argv[i];
+    }
+
+    if (!pszDirectory)
+    {
+        fprintf(stderr, "usage: catalog [--index catalog.idx] [--quiet] directory\n");
+        return 1;
+    }
+
+    ModelCatalog catalog;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    catalog.load(pszIndexFilename);
+
+    int probed = catalog.update(pszDirectory);
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+
+    if (!catalog.save(pszIndexFilename))
+    {
+        fprintf(stderr, "failed to write %s\n", pszIndexFilename);
+        return 1;
+    }
+
+    if (!quiet)
+    {
+        printf("%-40s %10s %10s %6s %6s %9s  %s\n", "model", "triangles", "vertices",
+            "groups", "mtls", "textures", "bounds");
+
+        for (int i = 0; i < catalog.getNumberOfEntries(); ++i)
+        {
+            const ModelCatalog::Entry &entry = catalog.getEntry(i);
+            const Model::ProbeResult &summary = entry.summary;
+
+            printf("%-40s %10d %10d %6d %6d %9d  [%g %g %g] - [%g %g %g]\n", entry.path.c_str(),
+                summary.numberOfTriangles, summary.numberOfVertexCoords, summary.numberOfGroups,
+                summary.numberOfMaterials, static_cast<int>(summary.textureFilenames.size()),
+                summary.minPosition[0], summary.minPosition[1], summary.minPosition[2],
+                summary.maxPosition[0], summary.maxPosition[1], summary.maxPosition[2]);
+        }
+    }
+
+    printf("%d models, %d probed in %.3f s\n", catalog.getNumberOfEntries(), probed, seconds);
+    return 0;
+}
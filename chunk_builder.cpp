@@ -0,0 +1,825 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+#include "chunk_builder.h"
+#include "job_system.h"
+#include "model_obj.h"
+#include "trace.h"
+
+namespace
+{
+    const int DEFAULT_TRIANGLES_PER_CHUNK = 65536;
+    const size_t DEFAULT_MEMORY_BUDGET = 256 * 1024 * 1024;
+    const int POSITION_BLOCK_SHIFT = 16;
+    const long long POSITIONS_PER_BLOCK = 1LL << POSITION_BLOCK_SHIFT;
+    const size_t POSITION_BLOCK_BYTES = POSITIONS_PER_BLOCK * 3 * sizeof(float);
+    const size_t READ_BLOCK_SIZE = 1 << 20;
+    const int FLOATS_PER_TRIANGLE = 9;
+    const int MAX_CELLS = 1 << 18;
+    const int MAX_SPLIT_DEPTH = 3;
+    const int MIN_CLUSTER_GRID_SIZE = 2;
+
+    struct ClusterTriangle
+    {
+        unsigned int v[3];
+
+        bool operator<(const ClusterTriangle &other) const
+        { return std::lexicographical_compare(v, v + 3, other.v, other.v + 3); }
+
+        bool operator==(const ClusterTriangle &other) const
+        { return std::equal(v, v + 3, other.v); }
+    };
+
+    bool IsBlank(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    bool SeekFile(FILE *pFile, long long offset)
+    {
+#if defined(_WIN32)
+        return _fseeki64(pFile, offset, SEEK_SET) == 0;
+#else
+        return fseeko(pFile, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+    }
+
+    void ClusterVertices(const std::vector<float> &vertices, const std::vector<unsigned int> &indices,
+                         const float minPosition[3], const float maxPosition[3], float cellSize,
+                         std::vector<float> &levelVertices, std::vector<unsigned int> &levelIndices)
+    {
+        // Merges the vertices in each grid cell into one at their average
+        // position and normal, like Model::buildDetailLevel(), and keeps the
+        // triangles that don't collapse.
+        const int stride = ChunkFile::FLOATS_PER_VERTEX;
+        int numVerts = static_cast<int>(vertices.size() / stride);
+        unsigned long long cellsPerAxis[3] = {0};
+        unsigned long long cell[3] = {0};
+        std::unordered_map<unsigned long long, unsigned int> cells;
+        std::vector<unsigned int> clusters(numVerts);
+        std::vector<float> sums;
+        std::vector<int> counts;
+
+        for (int i = 0; i < 3; ++i)
+            cellsPerAxis[i] = static_cast<unsigned long long>((maxPosition[i] - minPosition[i]) / cellSize) + 1;
+
+        for (int i = 0; i < numVerts; ++i)
+        {
+            const float *pVertex = &vertices[i * stride];
+
+            for (int j = 0; j < 3; ++j)
+            {
+                cell[j] = static_cast<unsigned long long>(std::max(0.0f, (pVertex[j] - minPosition[j]) / cellSize));
+                cell[j] = std::min(cell[j], cellsPerAxis[j] - 1);
+            }
+
+            unsigned long long key = (cell[0] * cellsPerAxis[1] + cell[1]) * cellsPerAxis[2] + cell[2];
+            unsigned int cluster = cells.insert(std::make_pair(key, static_cast<unsigned int>(counts.size()))).first->second;
+
+            if (cluster == counts.size())
+            {
+                sums.resize(sums.size() + stride, 0.0f);
+                counts.push_back(0);
+            }
+
+            for (int j = 0; j < stride; ++j)
+                sums[cluster * stride + j] += pVertex[j];
+
+            ++counts[cluster];
+            clusters[i] = cluster;
+        }
+
+        std::vector<ClusterTriangle> triangles;
+
+        triangles.reserve(indices.size() / 3);
+
+        for (size_t i = 0; i < indices.size(); i += 3)
+        {
+            ClusterTriangle triangle = {{clusters[indices[i]], clusters[indices[i + 1]], clusters[indices[i + 2]]}};
+
+            if (triangle.v[0] == triangle.v[1] || triangle.v[1] == triangle.v[2] ||
+                triangle.v[0] == triangle.v[2])
+                continue;
+
+            while (triangle.v[0] > triangle.v[1] || triangle.v[0] > triangle.v[2])
+                std::rotate(triangle.v, triangle.v + 1, triangle.v + 3);
+
+            triangles.push_back(triangle);
+        }
+
+        std::sort(triangles.begin(), triangles.end());
+        triangles.erase(std::unique(triangles.begin(), triangles.end()), triangles.end());
+
+        // Only clusters that are still referenced become vertices.
+        std::vector<unsigned int> remap(counts.size(), ~0u);
+
+        levelVertices.clear();
+        levelIndices.clear();
+        levelIndices.reserve(triangles.size() * 3);
+
+        for (size_t i = 0; i < triangles.size(); ++i)
+        {
+            for (int j = 0; j < 3; ++j)
+            {
+                unsigned int cluster = triangles[i].v[j];
+
+                if (remap[cluster] == ~0u)
+                {
+                    const float *pSum = &sums[cluster * stride];
+                    float length = std::sqrt(pSum[3] * pSum[3] + pSum[4] * pSum[4] + pSum[5] * pSum[5]);
+
+                    remap[cluster] = static_cast<unsigned int>(levelVertices.size() / stride);
+
+                    for (int k = 0; k < 3; ++k)
+                        levelVertices.push_back(pSum[k] / counts[cluster]);
+
+                    for (int k = 3; k < 6; ++k)
+                        levelVertices.push_back((length > 0.0f) ? pSum[k] / length : ((k == 5) ? 1.0f : 0.0f));
+                }
+
+                levelIndices.push_back(remap[cluster]);
+            }
+        }
+    }
+}
+
+struct ChunkBuilder::BuiltChunk
+{
+    ChunkFile::Chunk chunk;
+    std::vector<float> vertices[ChunkFile::MAX_DETAIL_LEVELS];
+    std::vector<unsigned int> indices[ChunkFile::MAX_DETAIL_LEVELS];
+};
+
+ChunkBuilder::ChunkBuilder()
+    : m_failed(false), m_cellSize(0.0f), m_cellBytes(0), m_pPositionFile(0), m_pTriangleFile(0),
+      m_numberOfPositions(0), m_triangleFileSize(0)
+{
+    m_options.trianglesPerChunk = DEFAULT_TRIANGLES_PER_CHUNK;
+    m_options.memoryBudget = DEFAULT_MEMORY_BUDGET;
+    memset(&m_stats, 0, sizeof(m_stats));
+    memset(m_minPosition, 0, sizeof(m_minPosition));
+    memset(m_maxPosition, 0, sizeof(m_maxPosition));
+    memset(m_cellsPerAxis, 0, sizeof(m_cellsPerAxis));
+}
+
+ChunkBuilder::~ChunkBuilder()
+{
+    cleanup();
+}
+
+bool ChunkBuilder::build(const char *pszObjFilename, const char *pszChunkFilename)
+{
+    TRACE_ZONE("ChunkBuilder::build");
+
+    cleanup();
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_failed = false;
+    m_positionFilename = std::string(pszChunkFilename) + ".positions.tmp";
+    m_triangleFilename = std::string(pszChunkFilename) + ".triangles.tmp";
+
+    if (!setupGrid(pszObjFilename))
+        return false;
+
+    size_t cacheSlots = std::max<size_t>(1, m_options.memoryBudget / 4 / POSITION_BLOCK_BYTES);
+
+    m_cachedBlocks.assign(cacheSlots, -1);
+    m_cachedPositions.resize(cacheSlots);
+    m_pPositionFile = fopen(m_positionFilename.c_str(), "w+b");
+    m_pTriangleFile = fopen(m_triangleFilename.c_str(), "w+b");
+
+    bool ok = m_pPositionFile && m_pTriangleFile && readFile(pszObjFilename) && !m_failed;
+
+    // The positions aren't needed any more once every face has been sorted
+    // into its cell.
+    if (m_pPositionFile)
+    {
+        fclose(m_pPositionFile);
+        m_pPositionFile = 0;
+        remove(m_positionFilename.c_str());
+    }
+
+    std::vector<float>().swap(m_positionBlock);
+    m_cachedBlocks.clear();
+    m_cachedPositions.clear();
+
+    ChunkFile file;
+
+    ok = ok && file.create(pszChunkFilename);
+    ok = ok && writeChunks(file) && file.finish(m_minPosition, m_maxPosition);
+
+    if (!ok)
+    {
+        file.close();
+        remove(pszChunkFilename);
+    }
+
+    cleanup();
+    return ok;
+}
+
+void ChunkBuilder::addFace(const std::vector<long long> &corners)
+{
+    // Polygons are split into a fan of triangles, the same as Model::import().
+    // Faces that refer to positions that don't exist, or not yet, are skipped.
+    float triangle[FLOATS_PER_TRIANGLE];
+    float centroid[3];
+    int cell[3];
+    const float *pPosition = 0;
+
+    if (corners.size() < 3)
+    {
+        ++m_stats.skippedFaces;
+        return;
+    }
+
+    for (size_t i = 0; i < corners.size(); ++i)
+    {
+        if (corners[i] < 0 || corners[i] >= m_numberOfPositions)
+        {
+            ++m_stats.skippedFaces;
+            return;
+        }
+    }
+
+    for (size_t i = 0; i < 2; ++i)
+    {
+        if (!(pPosition = getPosition(corners[i])))
+            return;
+
+        memcpy(&triangle[(i + 1) * 3], pPosition, 3 * sizeof(float));
+    }
+
+    memcpy(triangle, &triangle[3], 3 * sizeof(float));
+
+    for (size_t i = 2; i < corners.size(); ++i)
+    {
+        memcpy(&triangle[3], &triangle[6], 3 * sizeof(float));
+
+        if (!(pPosition = getPosition(corners[i])))
+            return;
+
+        memcpy(&triangle[6], pPosition, 3 * sizeof(float));
+
+        for (int j = 0; j < 3; ++j)
+        {
+            centroid[j] = (triangle[j] + triangle[3 + j] + triangle[6 + j]) / 3.0f;
+            cell[j] = static_cast<int>(std::max(0.0f, (centroid[j] - m_minPosition[j]) / m_cellSize));
+            cell[j] = std::min(cell[j], m_cellsPerAxis[j] - 1);
+        }
+
+        Cell &target = m_cells[(cell[0] * m_cellsPerAxis[1] + cell[1]) * m_cellsPerAxis[2] + cell[2]];
+
+        target.triangles.insert(target.triangles.end(), triangle, triangle + FLOATS_PER_TRIANGLE);
+        ++target.numberOfTriangles;
+        ++m_stats.numberOfTriangles;
+        m_cellBytes += sizeof(triangle);
+    }
+
+    if (m_cellBytes > m_options.memoryBudget / 2 && !flushCells())
+        m_failed = true;
+}
+
+void ChunkBuilder::addPosition(const float position[3])
+{
+    m_positionBlock.insert(m_positionBlock.end(), position, position + 3);
+
+    if (++m_numberOfPositions % POSITIONS_PER_BLOCK == 0 && !flushPositions())
+        m_failed = true;
+}
+
+void ChunkBuilder::buildChunks(std::vector<float> &triangles, const float minPosition[3],
+                               const float maxPosition[3], int depth,
+                               std::vector<BuiltChunk> &chunks) const
+{
+    int numberOfTriangles = static_cast<int>(triangles.size() / FLOATS_PER_TRIANGLE);
+
+    if (numberOfTriangles > m_options.trianglesPerChunk * 2 && depth < MAX_SPLIT_DEPTH)
+    {
+        std::vector<float> octants[8];
+        float center[3];
+
+        for (int i = 0; i < 3; ++i)
+            center[i] = (minPosition[i] + maxPosition[i]) * 0.5f;
+
+        for (int i = 0; i < numberOfTriangles; ++i)
+        {
+            const float *pTriangle = &triangles[i * FLOATS_PER_TRIANGLE];
+            int octant = 0;
+
+            for (int j = 0; j < 3; ++j)
+            {
+                if (pTriangle[j] + pTriangle[3 + j] + pTriangle[6 + j] > center[j] * 3.0f)
+                    octant |= 1 << j;
+            }
+
+            octants[octant].insert(octants[octant].end(), pTriangle, pTriangle + FLOATS_PER_TRIANGLE);
+        }
+
+        std::vector<float>().swap(triangles);
+
+        for (int i = 0; i < 8; ++i)
+        {
+            float octantMin[3];
+            float octantMax[3];
+
+            if (octants[i].empty())
+                continue;
+
+            for (int j = 0; j < 3; ++j)
+            {
+                octantMin[j] = (i & (1 << j)) ? center[j] : minPosition[j];
+                octantMax[j] = (i & (1 << j)) ? maxPosition[j] : center[j];
+            }
+
+            buildChunks(octants[i], octantMin, octantMax, depth + 1, chunks);
+        }
+
+        return;
+    }
+
+    // Corners at the same position become one vertex.
+    std::vector<unsigned int> order(numberOfTriangles * 3);
+    std::vector<unsigned int> corners(order.size());
+    const float *pCorners = triangles.empty() ? 0 : &triangles[0];
+
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = static_cast<unsigned int>(i);
+
+    std::sort(order.begin(), order.end(), [pCorners](unsigned int a, unsigned int b)
+        { return std::lexicographical_compare(pCorners + a * 3, pCorners + a * 3 + 3, pCorners + b * 3, pCorners + b * 3 + 3); });
+
+    BuiltChunk built;
+    ChunkFile::Chunk &chunk = built.chunk;
+    std::vector<float> &vertices = built.vertices[0];
+    std::vector<unsigned int> &indices = built.indices[0];
+    const int stride = ChunkFile::FLOATS_PER_VERTEX;
+
+    memset(&chunk, 0, sizeof(chunk));
+
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        const float *pCorner = pCorners + order[i] * 3;
+
+        if (i == 0 || !std::equal(pCorner, pCorner + 3, pCorners + order[i - 1] * 3))
+        {
+            vertices.insert(vertices.end(), pCorner, pCorner + 3);
+            vertices.insert(vertices.end(), 3, 0.0f);
+        }
+
+        corners[order[i]] = static_cast<unsigned int>(vertices.size() / stride - 1);
+    }
+
+    std::vector<unsigned int>().swap(order);
+    std::vector<float>().swap(triangles);
+    indices.reserve(corners.size());
+
+    // Area weighted face normals are summed at the vertices.
+    for (size_t i = 0; i < corners.size(); i += 3)
+    {
+        const unsigned int *pIndex = &corners[i];
+        float edges[2][3];
+        float normal[3];
+
+        if (pIndex[0] == pIndex[1] || pIndex[1] == pIndex[2] || pIndex[0] == pIndex[2])
+            continue;
+
+        for (int j = 0; j < 3; ++j)
+        {
+            edges[0][j] = vertices[pIndex[1] * stride + j] - vertices[pIndex[0] * stride + j];
+            edges[1][j] = vertices[pIndex[2] * stride + j] - vertices[pIndex[0] * stride + j];
+        }
+
+        normal[0] = edges[0][1] * edges[1][2] - edges[0][2] * edges[1][1];
+        normal[1] = edges[0][2] * edges[1][0] - edges[0][0] * edges[1][2];
+        normal[2] = edges[0][0] * edges[1][1] - edges[0][1] * edges[1][0];
+
+        for (int j = 0; j < 3; ++j)
+        {
+            for (int k = 0; k < 3; ++k)
+                vertices[pIndex[j] * stride + 3 + k] += normal[k];
+        }
+
+        indices.insert(indices.end(), pIndex, pIndex + 3);
+    }
+
+    if (indices.empty())
+        return;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        chunk.minPosition[i] = vertices[i];
+        chunk.maxPosition[i] = vertices[i];
+    }
+
+    for (size_t i = 0; i < vertices.size(); i += stride)
+    {
+        float *pNormal = &vertices[i + 3];
+        float length = std::sqrt(pNormal[0] * pNormal[0] + pNormal[1] * pNormal[1] + pNormal[2] * pNormal[2]);
+
+        for (int j = 0; j < 3; ++j)
+        {
+            chunk.minPosition[j] = std::min(chunk.minPosition[j], vertices[i + j]);
+            chunk.maxPosition[j] = std::max(chunk.maxPosition[j], vertices[i + j]);
+            pNormal[j] = (length > 0.0f) ? pNormal[j] / length : ((j == 2) ? 1.0f : 0.0f);
+        }
+    }
+
+    // Coarser levels halve the clustering grid each time and are only kept
+    // when they are a real step down from the previous one.
+    float size = std::max(std::max(chunk.maxPosition[0] - chunk.minPosition[0],
+        chunk.maxPosition[1] - chunk.minPosition[1]), chunk.maxPosition[2] - chunk.minPosition[2]);
+    int gridSize = static_cast<int>(std::sqrt(indices.size() / 24.0f));
+
+    chunk.numberOfLevels = 1;
+    chunk.levels[0].error = 0.0f;
+
+    for (; gridSize >= MIN_CLUSTER_GRID_SIZE && chunk.numberOfLevels < ChunkFile::MAX_DETAIL_LEVELS && size > 0.0f; gridSize /= 2)
+    {
+        int level = chunk.numberOfLevels;
+        float cellSize = size / gridSize;
+
+        ClusterVertices(vertices, indices, chunk.minPosition, chunk.maxPosition, cellSize,
+            built.vertices[level], built.indices[level]);
+
+        if (built.indices[level].empty() || built.indices[level].size() * 4 > built.indices[level - 1].size() * 3)
+        {
+            built.vertices[level].clear();
+            built.indices[level].clear();
+            continue;
+        }
+
+        chunk.levels[level].error = cellSize * std::sqrt(3.0f);
+        ++chunk.numberOfLevels;
+    }
+
+    chunks.push_back(BuiltChunk());
+    chunks.back().chunk = chunk;
+
+    for (int i = 0; i < chunk.numberOfLevels; ++i)
+    {
+        chunks.back().vertices[i].swap(built.vertices[i]);
+        chunks.back().indices[i].swap(built.indices[i]);
+    }
+}
+
+void ChunkBuilder::cleanup()
+{
+    if (m_pPositionFile)
+    {
+        fclose(m_pPositionFile);
+        m_pPositionFile = 0;
+        remove(m_positionFilename.c_str());
+    }
+
+    if (m_pTriangleFile)
+    {
+        fclose(m_pTriangleFile);
+        m_pTriangleFile = 0;
+        remove(m_triangleFilename.c_str());
+    }
+
+    m_cells.clear();
+    m_cellBytes = 0;
+    m_numberOfPositions = 0;
+    m_triangleFileSize = 0;
+    m_positionBlock.clear();
+    m_cachedBlocks.clear();
+    m_cachedPositions.clear();
+}
+
+bool ChunkBuilder::flushCells()
+{
+    TRACE_ZONE("ChunkBuilder::flushCells");
+
+    for (size_t i = 0; i < m_cells.size(); ++i)
+    {
+        Cell &cell = m_cells[i];
+
+        if (cell.triangles.empty())
+            continue;
+
+        Span span = {m_triangleFileSize, static_cast<int>(cell.triangles.size() / FLOATS_PER_TRIANGLE)};
+
+        if (!SeekFile(m_pTriangleFile, m_triangleFileSize) ||
+            fwrite(&cell.triangles[0], sizeof(float), cell.triangles.size(), m_pTriangleFile) != cell.triangles.size())
+            return false;
+
+        m_triangleFileSize += cell.triangles.size() * sizeof(float);
+        cell.spans.push_back(span);
+        std::vector<float>().swap(cell.triangles);
+    }
+
+    m_cellBytes = 0;
+    return true;
+}
+
+bool ChunkBuilder::flushPositions()
+{
+    long long block = (m_numberOfPositions - 1) >> POSITION_BLOCK_SHIFT;
+
+    if (!SeekFile(m_pPositionFile, block * static_cast<long long>(POSITION_BLOCK_BYTES)) ||
+        fwrite(&m_positionBlock[0], 1, POSITION_BLOCK_BYTES, m_pPositionFile) != POSITION_BLOCK_BYTES)
+        return false;
+
+    m_positionBlock.clear();
+    return true;
+}
+
+const float *ChunkBuilder::getPosition(long long index)
+{
+    // The block that is still being filled is in memory, the others are read
+    // back through a direct mapped cache.
+    long long block = index >> POSITION_BLOCK_SHIFT;
+    size_t offset = static_cast<size_t>(index & (POSITIONS_PER_BLOCK - 1)) * 3;
+
+    if (block == m_numberOfPositions >> POSITION_BLOCK_SHIFT)
+        return &m_positionBlock[offset];
+
+    size_t slot = static_cast<size_t>(block % m_cachedBlocks.size());
+    std::vector<float> &positions = m_cachedPositions[slot];
+
+    if (m_cachedBlocks[slot] != block)
+    {
+        positions.resize(POSITIONS_PER_BLOCK * 3);
+
+        if (!SeekFile(m_pPositionFile, block * static_cast<long long>(POSITION_BLOCK_BYTES)) ||
+            fread(&positions[0], 1, POSITION_BLOCK_BYTES, m_pPositionFile) != POSITION_BLOCK_BYTES)
+        {
+            m_cachedBlocks[slot] = -1;
+            m_failed = true;
+            return 0;
+        }
+
+        m_cachedBlocks[slot] = block;
+    }
+
+    return &positions[offset];
+}
+
+bool ChunkBuilder::readCell(Cell &cell, std::vector<float> &triangles)
+{
+    triangles.clear();
+    triangles.reserve(static_cast<size_t>(cell.numberOfTriangles) * FLOATS_PER_TRIANGLE);
+
+    for (size_t i = 0; i < cell.spans.size(); ++i)
+    {
+        size_t count = static_cast<size_t>(cell.spans[i].numberOfTriangles) * FLOATS_PER_TRIANGLE;
+        size_t offset = triangles.size();
+
+        triangles.resize(offset + count);
+
+        if (!SeekFile(m_pTriangleFile, cell.spans[i].offset) ||
+            fread(&triangles[offset], sizeof(float), count, m_pTriangleFile) != count)
+            return false;
+    }
+
+    triangles.insert(triangles.end(), cell.triangles.begin(), cell.triangles.end());
+    std::vector<float>().swap(cell.triangles);
+    std::vector<Span>().swap(cell.spans);
+
+    return true;
+}
+
+bool ChunkBuilder::readFile(const char *pszObjFilename)
+{
+    TRACE_ZONE("ChunkBuilder::readFile");
+
+    FILE *pFile = fopen(pszObjFilename, "rb");
+
+    if (!pFile)
+        return false;
+
+    std::vector<char> buffer(READ_BLOCK_SIZE + 1);
+    std::vector<long long> corners;
+    size_t length = 0;
+    size_t bytesRead = 0;
+    bool atEnd = false;
+
+    m_positionBlock.reserve(POSITIONS_PER_BLOCK * 3);
+
+    while (!atEnd && !m_failed)
+    {
+        if (length + 1 == buffer.size())
+            buffer.resize(buffer.size() * 2);
+
+        bytesRead = fread(&buffer[length], 1, buffer.size() - 1 - length, pFile);
+        atEnd = bytesRead == 0;
+        length += bytesRead;
+        buffer[length] = '\0';
+
+        const char *pszLine = &buffer[0];
+        const char *pszEnd = pszLine + length;
+
+        while (pszLine < pszEnd)
+        {
+            const char *pszNewline = static_cast<const char *>(memchr(pszLine, '\n', pszEnd - pszLine));
+
+            if (!pszNewline && !atEnd)
+                break;
+
+            if (!pszNewline)
+                pszNewline = pszEnd;
+
+            if (pszLine[0] == 'v' && IsBlank(pszLine[1]))
+            {
+                float position[3] = {0.0f, 0.0f, 0.0f};
+                const char *psz = pszLine + 1;
+                char *pszNext = 0;
+
+                for (int i = 0; i < 3 && psz < pszNewline; ++i)
+                {
+                    position[i] = strtof(psz, &pszNext);
+                    psz = pszNext;
+                }
+
+                addPosition(position);
+            }
+            else if (pszLine[0] == 'f' && IsBlank(pszLine[1]))
+            {
+                const char *psz = pszLine + 1;
+                char *pszNext = 0;
+
+                corners.clear();
+
+                while (psz < pszNewline)
+                {
+                    if (IsBlank(*psz))
+                    {
+                        ++psz;
+                        continue;
+                    }
+
+                    // Only the position index of "v", "v/vt", "v//vn" and
+                    // "v/vt/vn" matters.
+                    long long index = strtoll(psz, &pszNext, 10);
+
+                    if (pszNext == psz)
+                        break;
+
+                    corners.push_back((index < 0) ? m_numberOfPositions + index : index - 1);
+
+                    for (psz = pszNext; psz < pszNewline && !IsBlank(*psz); ++psz)
+                        ;
+                }
+
+                addFace(corners);
+            }
+
+            pszLine = pszNewline + 1;
+        }
+
+        if (pszLine < pszEnd)
+        {
+            length = pszEnd - pszLine;
+            memmove(&buffer[0], pszLine, length);
+        }
+        else
+        {
+            length = 0;
+        }
+    }
+
+    fclose(pFile);
+    return !m_failed;
+}
+
+bool ChunkBuilder::setupGrid(const char *pszObjFilename)
+{
+    // The grid is chosen from the bounds and triangle count reported by
+    // Model::probe() so that a cell of a solid would hold about
+    // trianglesPerChunk triangles. Surfaces leave most cells empty and put
+    // more into the others; buildChunks() splits those.
+    Model::ProbeResult summary;
+
+    if (!Model::probe(pszObjFilename, summary) || summary.numberOfTriangles == 0 ||
+        summary.minPosition[0] > summary.maxPosition[0])
+        return false;
+
+    float extents[3];
+    float size = 0.0f;
+    float volume = 1.0f;
+    long long numberOfCells = 0;
+    int targetCells = std::max(1, (summary.numberOfTriangles + m_options.trianglesPerChunk - 1) /
+        std::max(1, m_options.trianglesPerChunk));
+
+    for (int i = 0; i < 3; ++i)
+    {
+        m_minPosition[i] = summary.minPosition[i];
+        m_maxPosition[i] = summary.maxPosition[i];
+        size = std::max(size, m_maxPosition[i] - m_minPosition[i]);
+    }
+
+    if (size <= 0.0f)
+        size = 1.0f;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        extents[i] = std::max(m_maxPosition[i] - m_minPosition[i], size * 0.01f);
+        volume *= extents[i];
+    }
+
+    m_cellSize = std::pow(volume / targetCells, 1.0f / 3.0f);
+
+    do
+    {
+        numberOfCells = 1;
+
+        for (int i = 0; i < 3; ++i)
+        {
+            m_cellsPerAxis[i] = std::max(1, static_cast<int>(std::ceil(extents[i] / m_cellSize)));
+            numberOfCells *= m_cellsPerAxis[i];
+        }
+
+        if (numberOfCells > MAX_CELLS)
+            m_cellSize *= 1.25f;
+    }
+    while (numberOfCells > MAX_CELLS);
+
+    m_cells.assign(static_cast<size_t>(numberOfCells), Cell());
+
+    for (size_t i = 0; i < m_cells.size(); ++i)
+        m_cells[i].numberOfTriangles = 0;
+
+    return true;
+}
+
+bool ChunkBuilder::writeChunks(ChunkFile &file)
+{
+    TRACE_ZONE("ChunkBuilder::writeChunks");
+
+    // Cells are read a batch at a time, about a quarter of the memory budget
+    // each, and built in parallel.
+    size_t batchBytes = m_options.memoryBudget / 4;
+    size_t next = 0;
+    bool first = true;
+
+    while (next < m_cells.size())
+    {
+        std::vector<int> batch;
+        size_t bytes = 0;
+
+        for (; next < m_cells.size() && (batch.empty() || bytes < batchBytes); ++next)
+        {
+            if (m_cells[next].numberOfTriangles == 0)
+                continue;
+
+            batch.push_back(static_cast<int>(next));
+            bytes += static_cast<size_t>(m_cells[next].numberOfTriangles) * FLOATS_PER_TRIANGLE * sizeof(float);
+        }
+
+        std::vector<std::vector<float> > inputs(batch.size());
+        std::vector<std::vector<BuiltChunk> > outputs(batch.size());
+
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            if (!readCell(m_cells[batch[i]], inputs[i]))
+                return false;
+        }
+
+        JobSystem::instance().parallelFor(0, static_cast<int>(batch.size()), 1,
+            [this, &batch, &inputs, &outputs](int begin, int end)
+            {
+                for (int i = begin; i < end; ++i)
+                {
+                    int cell = batch[i];
+                    int coordinates[3] = {cell / (m_cellsPerAxis[1] * m_cellsPerAxis[2]),
+                        (cell / m_cellsPerAxis[2]) % m_cellsPerAxis[1], cell % m_cellsPerAxis[2]};
+                    float cellMin[3];
+                    float cellMax[3];
+
+                    for (int j = 0; j < 3; ++j)
+                    {
+                        cellMin[j] = m_minPosition[j] + coordinates[j] * m_cellSize;
+                        cellMax[j] = cellMin[j] + m_cellSize;
+                    }
+
+                    buildChunks(inputs[i], cellMin, cellMax, 0, outputs[i]);
+                }
+            });
+
+        for (size_t i = 0; i < outputs.size(); ++i)
+        {
+            for (size_t j = 0; j < outputs[i].size(); ++j)
+            {
+                BuiltChunk &built = outputs[i][j];
+
+                if (!file.writeChunk(built.chunk, built.vertices, built.indices))
+                    return false;
+
+                for (int k = 0; k < 3; ++k)
+                {
+                    m_minPosition[k] = first ? built.chunk.minPosition[k] : std::min(m_minPosition[k], built.chunk.minPosition[k]);
+                    m_maxPosition[k] = first ? built.chunk.maxPosition[k] : std::max(m_maxPosition[k], built.chunk.maxPosition[k]);
+                }
+
+                first = false;
+                ++m_stats.numberOfChunks;
+                m_stats.largestChunk = std::max(m_stats.largestChunk, built.chunk.levels[0].numberOfIndices / 3);
+            }
+        }
+    }
+
+    return m_stats.numberOfChunks > 0;
+}
@@ -0,0 +1,108 @@
+#if !defined(CHUNK_BUILDER_H)
+#define CHUNK_BUILDER_H
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "chunk_file.h"
+
+// Splits an OBJ file into a ChunkFile in one streaming pass, without loading
+// the whole model. Positions are spilled to a temporary file and read back
+// through a small block cache when faces refer to them, and triangles are
+// sorted into the cells of a uniform grid, which are spilled to a second
+// temporary file whenever they outgrow the memory budget. The cells are then
+// turned into chunks a few at a time on the job system; cells holding more
+// than twice the target number of triangles are split into octants first.
+// Only positions are kept: normals are generated per chunk, and texture
+// coordinates and materials are dropped.
+
+class ChunkBuilder
+{
+public:
+    struct Options
+    {
+        int trianglesPerChunk;
+        size_t memoryBudget;
+    };
+
+    struct Statistics
+    {
+        int numberOfChunks;
+        int largestChunk;
+        long long numberOfTriangles;
+        long long skippedFaces;
+    };
+
+    ChunkBuilder();
+    ~ChunkBuilder();
+
+    bool build(const char *pszObjFilename, const char *pszChunkFilename);
+
+    const Options &getOptions() const;
+    const Statistics &getStatistics() const;
+    void setOptions(const Options &options);
+
+private:
+    struct Span
+    {
+        long long offset;
+        int numberOfTriangles;
+    };
+
+    struct Cell
+    {
+        std::vector<float> triangles;
+        std::vector<Span> spans;
+        long long numberOfTriangles;
+    };
+
+    struct BuiltChunk;
+
+    ChunkBuilder(const ChunkBuilder &);
+    ChunkBuilder &operator=(const ChunkBuilder &);
+
+    void addFace(const std::vector<long long> &corners);
+    void addPosition(const float position[3]);
+    void buildChunks(std::vector<float> &triangles, const float minPosition[3],
+        const float maxPosition[3], int depth, std::vector<BuiltChunk> &chunks) const;
+    void cleanup();
+    bool flushCells();
+    bool flushPositions();
+    const float *getPosition(long long index);
+    bool readCell(Cell &cell, std::vector<float> &triangles);
+    bool readFile(const char *pszObjFilename);
+    bool setupGrid(const char *pszObjFilename);
+    bool writeChunks(ChunkFile &file);
+
+    Options m_options;
+    Statistics m_stats;
+    bool m_failed;
+    float m_minPosition[3];
+    float m_maxPosition[3];
+    float m_cellSize;
+    int m_cellsPerAxis[3];
+    std::vector<Cell> m_cells;
+    size_t m_cellBytes;
+
+    std::string m_positionFilename;
+    std::string m_triangleFilename;
+    FILE *m_pPositionFile;
+    FILE *m_pTriangleFile;
+    long long m_numberOfPositions;
+    long long m_triangleFileSize;
+    std::vector<float> m_positionBlock;
+    std::vector<long long> m_cachedBlocks;
+    std::vector<std::vector<float> > m_cachedPositions;
+};
+
+inline const ChunkBuilder::Options &ChunkBuilder::getOptions() const
+{ return m_options; }
+
+inline const ChunkBuilder::Statistics &ChunkBuilder::getStatistics() const
+{ return m_stats; }
+
+inline void ChunkBuilder::setOptions(const Options &options)
+{ m_options = options; }
+
+#endif
@@ -0,0 +1,221 @@
+#include <cstring>
+#include "chunk_file.h"
+
+namespace
+{
+    const char CHUNK_MAGIC[4] = {'C', 'H', 'K', '1'};
+
+    struct ChunkFileHeader
+    {
+        char magic[4];
+        unsigned int numberOfChunks;
+        long long tableOffset;
+        float minPosition[3];
+        float maxPosition[3];
+    };
+
+    bool SeekFile(FILE *pFile, long long offset)
+    {
+#if defined(_WIN32)
+        return _fseeki64(pFile, offset, SEEK_SET) == 0;
+#else
+        return fseeko(pFile, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+    }
+
+    long long GetFileSize(FILE *pFile)
+    {
+#if defined(_WIN32)
+        return (_fseeki64(pFile, 0, SEEK_END) == 0) ? _ftelli64(pFile) : -1;
+#else
+        return (fseeko(pFile, 0, SEEK_END) == 0) ? static_cast<long long>(ftello(pFile)) : -1;
+#endif
+    }
+
+    long long TellFile(FILE *pFile)
+    {
+#if defined(_WIN32)
+        return _ftelli64(pFile);
+#else
+        return static_cast<long long>(ftello(pFile));
+#endif
+    }
+}
+
+ChunkFile::ChunkFile() : m_pFile(0), m_writing(false)
+{
+    memset(m_minPosition, 0, sizeof(m_minPosition));
+    memset(m_maxPosition, 0, sizeof(m_maxPosition));
+}
+
+ChunkFile::~ChunkFile()
+{
+    close();
+}
+
+size_t ChunkFile::getLevelSize(const Level &level)
+{
+    return level.numberOfVertices * FLOATS_PER_VERTEX * sizeof(float) +
+        level.numberOfIndices * sizeof(unsigned int);
+}
+
+void ChunkFile::close()
+{
+    if (m_pFile)
+    {
+        fclose(m_pFile);
+        m_pFile = 0;
+    }
+
+    m_writing = false;
+    m_chunks.clear();
+}
+
+bool ChunkFile::open(const char *pszFilename)
+{
+    close();
+
+    if (!(m_pFile = fopen(pszFilename, "rb")))
+        return false;
+
+    // The table and every level have to lie inside the file, so that a
+    // damaged file fails here rather than when it is read.
+    ChunkFileHeader header;
+    long long fileSize = GetFileSize(m_pFile);
+    bool ok = fileSize >= 0 && SeekFile(m_pFile, 0) &&
+        fread(&header, sizeof(header), 1, m_pFile) == 1 &&
+        memcmp(header.magic, CHUNK_MAGIC, sizeof(CHUNK_MAGIC)) == 0 &&
+        header.tableOffset >= static_cast<long long>(sizeof(header)) && header.tableOffset <= fileSize &&
+        header.numberOfChunks <= static_cast<unsigned long long>(fileSize - header.tableOffset) / sizeof(Chunk) &&
+        SeekFile(m_pFile, header.tableOffset);
+
+    if (ok)
+    {
+        memcpy(m_minPosition, header.minPosition, sizeof(m_minPosition));
+        memcpy(m_maxPosition, header.maxPosition, sizeof(m_maxPosition));
+        m_chunks.resize(header.numberOfChunks);
+
+        ok = m_chunks.empty() ||
+            fread(&m_chunks[0], sizeof(Chunk), m_chunks.size(), m_pFile) == m_chunks.size();
+    }
+
+    for (size_t i = 0; ok && i < m_chunks.size(); ++i)
+    {
+        ok = m_chunks[i].numberOfLevels > 0 && m_chunks[i].numberOfLevels <= MAX_DETAIL_LEVELS;
+
+        for (int j = 0; ok && j < m_chunks[i].numberOfLevels; ++j)
+        {
+            const Level &level = m_chunks[i].levels[j];
+            long long size = static_cast<long long>(level.numberOfVertices) * FLOATS_PER_VERTEX * sizeof(float) +
+                static_cast<long long>(level.numberOfIndices) * sizeof(unsigned int);
+
+            ok = level.numberOfVertices >= 0 && level.numberOfIndices >= 0 &&
+                level.offset >= 0 && level.offset <= fileSize && size <= fileSize - level.offset;
+        }
+    }
+
+    if (!ok)
+        close();
+
+    return ok;
+}
+
+bool ChunkFile::readLevel(int chunk, int level, std::vector<float> &vertices,
+                          std::vector<unsigned int> &indices)
+{
+    const Level &source = m_chunks[chunk].levels[level];
+    size_t numberOfFloats = static_cast<size_t>(source.numberOfVertices) * FLOATS_PER_VERTEX;
+    size_t numberOfIndices = static_cast<size_t>(source.numberOfIndices);
+
+    vertices.resize(numberOfFloats);
+    indices.resize(numberOfIndices);
+
+    bool ok = !m_writing && SeekFile(m_pFile, source.offset) &&
+        (numberOfFloats == 0 || fread(&vertices[0], sizeof(float), numberOfFloats, m_pFile) == numberOfFloats) &&
+        (numberOfIndices == 0 || fread(&indices[0], sizeof(unsigned int), numberOfIndices, m_pFile) == numberOfIndices);
+
+    if (!ok)
+    {
+        vertices.clear();
+        indices.clear();
+    }
+
+    return ok;
+}
+
+bool ChunkFile::create(const char *pszFilename)
+{
+    close();
+
+    if (!(m_pFile = fopen(pszFilename, "wb")))
+        return false;
+
+    // The header is written again with the real values by finish().
+    ChunkFileHeader header;
+
+    memset(&header, 0, sizeof(header));
+    m_writing = true;
+
+    if (fwrite(&header, sizeof(header), 1, m_pFile) != 1)
+    {
+        close();
+        remove(pszFilename);
+        return false;
+    }
+
+    return true;
+}
+
+bool ChunkFile::finish(const float minPosition[3], const float maxPosition[3])
+{
+    ChunkFileHeader header;
+
+    memcpy(header.magic, CHUNK_MAGIC, sizeof(CHUNK_MAGIC));
+    memcpy(header.minPosition, minPosition, sizeof(header.minPosition));
+    memcpy(header.maxPosition, maxPosition, sizeof(header.maxPosition));
+    header.numberOfChunks = static_cast<unsigned int>(m_chunks.size());
+    header.tableOffset = TellFile(m_pFile);
+
+    bool ok = m_writing && header.tableOffset > 0 &&
+        (m_chunks.empty() || fwrite(&m_chunks[0], sizeof(Chunk), m_chunks.size(), m_pFile) == m_chunks.size()) &&
+        SeekFile(m_pFile, 0) && fwrite(&header, sizeof(header), 1, m_pFile) == 1;
+
+    if (fclose(m_pFile) != 0)
+        ok = false;
+
+    m_pFile = 0;
+    close();
+
+    return ok;
+}
+
+bool ChunkFile::writeChunk(Chunk &chunk, const std::vector<float> *pVertices,
+                           const std::vector<unsigned int> *pIndices)
+{
+    // pVertices and pIndices hold one array per level of the chunk.
+    bool ok = m_writing;
+
+    for (int i = 0; ok && i < chunk.numberOfLevels; ++i)
+    {
+        Level &level = chunk.levels[i];
+
+        level.offset = TellFile(m_pFile);
+        level.numberOfVertices = static_cast<int>(pVertices[i].size() / FLOATS_PER_VERTEX);
+        level.numberOfIndices = static_cast<int>(pIndices[i].size());
+
+        ok = level.offset > 0 &&
+            (pVertices[i].empty() || fwrite(&pVertices[i][0], sizeof(float), pVertices[i].size(), m_pFile) == pVertices[i].size()) &&
+            (pIndices[i].empty() || fwrite(&pIndices[i][0], sizeof(unsigned int), pIndices[i].size(), m_pFile) == pIndices[i].size());
+    }
+
+    if (ok)
+        m_chunks.push_back(chunk);
+
+    return ok;
+}
+
+void ChunkFile::getBounds(float minPosition[3], float maxPosition[3]) const
+{
+    memcpy(minPosition, m_minPosition, sizeof(m_minPosition));
+    memcpy(maxPosition, m_maxPosition, sizeof(m_maxPosition));
+}
@@ -0,0 +1,84 @@
+#if !defined(CHUNK_FILE_H)
+#define CHUNK_FILE_H
+
+#include <cstdio>
+#include <vector>
+
+// Spatial chunks of a model that is too large to import as a whole. Each
+// chunk holds the triangles whose centroid falls into one cell of a grid over
+// the model, at up to MAX_DETAIL_LEVELS levels of detail. Level 0 is the full
+// chunk and each further level is a vertex clustered version of it whose
+// geometric error is the size of the clustering cells. A level is stored as
+// interleaved positions and normals followed by 32-bit indices, so it can be
+// read with one seek and one read. The file starts with a "CHK1" tag, the
+// bounds and the number of chunks, and the chunk table follows the data.
+//
+// A ChunkFile is either being read or being written. Neither is thread safe,
+// so reads from another thread need their own ChunkFile.
+
+class ChunkFile
+{
+public:
+    enum
+    {
+        MAX_DETAIL_LEVELS = 4,
+        FLOATS_PER_VERTEX = 6
+    };
+
+    struct Level
+    {
+        long long offset;
+        int numberOfVertices;
+        int numberOfIndices;
+        float error;
+    };
+
+    struct Chunk
+    {
+        float minPosition[3];
+        float maxPosition[3];
+        int numberOfLevels;
+        Level levels[MAX_DETAIL_LEVELS];
+    };
+
+    ChunkFile();
+    ~ChunkFile();
+
+    static size_t getLevelSize(const Level &level);
+
+    void close();
+    bool open(const char *pszFilename);
+    bool readLevel(int chunk, int level, std::vector<float> &vertices,
+        std::vector<unsigned int> &indices);
+
+    bool create(const char *pszFilename);
+    bool finish(const float minPosition[3], const float maxPosition[3]);
+    bool writeChunk(Chunk &chunk, const std::vector<float> *pVertices,
+        const std::vector<unsigned int> *pIndices);
+
+    const Chunk &getChunk(int i) const;
+    void getBounds(float minPosition[3], float maxPosition[3]) const;
+    int getNumberOfChunks() const;
+    bool isOpen() const;
+
+private:
+    ChunkFile(const ChunkFile &);
+    ChunkFile &operator=(const ChunkFile &);
+
+    FILE *m_pFile;
+    bool m_writing;
+    float m_minPosition[3];
+    float m_maxPosition[3];
+    std::vector<Chunk> m_chunks;
+};
+
+inline const ChunkFile::Chunk &ChunkFile::getChunk(int i) const
+{ return m_chunks[i]; }
+
+inline int ChunkFile::getNumberOfChunks() const
+{ return static_cast<int>(m_chunks.size()); }
+
+inline bool ChunkFile::isOpen() const
+{ return m_pFile != 0; }
+
+#endif
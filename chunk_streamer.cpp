@@ -0,0 +1,395 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "chunk_streamer.h"
+#include "trace.h"
+
+namespace
+{
+    struct LevelRequest
+    {
+        int priority;
+        float distance;
+        int chunk;
+        int level;
+
+        bool operator<(const LevelRequest &other) const
+        { return (priority != other.priority) ? priority < other.priority : distance < other.distance; }
+    };
+
+    struct DrawItem
+    {
+        float distance;
+        ChunkStreamer::Level *pLevel;
+
+        bool operator<(const DrawItem &other) const
+        { return distance < other.distance; }
+    };
+}
+
+ChunkStreamer::ChunkStreamer(size_t memoryBudget)
+    : m_memoryBudget(memoryBudget), m_residentBytes(0), m_frame(0), m_quit(false), m_reading(0)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_thread = std::thread(&ChunkStreamer::ioMain, this);
+}
+
+ChunkStreamer::~ChunkStreamer()
+{
+    close();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+
+    m_requestAvailable.notify_all();
+    m_thread.join();
+}
+
+void ChunkStreamer::close()
+{
+    {
+        // A read in progress uses m_reader, so it has to finish first.
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        m_requests.clear();
+
+        while (m_reading)
+            m_readFinished.wait(lock);
+
+        for (size_t i = 0; i < m_completed.size(); ++i)
+            delete m_completed[i];
+
+        m_completed.clear();
+    }
+
+    for (std::map<Key, Resident>::iterator i = m_resident.begin(); i != m_resident.end(); ++i)
+        delete i->second.pLevel;
+
+    m_resident.clear();
+    m_lru.clear();
+    m_drawLevels.clear();
+    m_requested.clear();
+    m_residentBytes = 0;
+    memset(&m_stats, 0, sizeof(m_stats));
+
+    m_reader.close();
+    m_index.close();
+}
+
+bool ChunkStreamer::open(const char *pszFilename)
+{
+    close();
+
+    // The I/O thread is idle after close(), so it is safe to reopen its file.
+    if (!m_index.open(pszFilename) || !m_reader.open(pszFilename))
+    {
+        close();
+        return false;
+    }
+
+    m_requested.assign(m_index.getNumberOfChunks() * ChunkFile::MAX_DETAIL_LEVELS, 0);
+    return true;
+}
+
+bool ChunkStreamer::processCompleted()
+{
+    // Moves the levels that the I/O thread has read into the resident set.
+    // Returns whether anything arrived, in which case the view should be
+    // drawn again.
+    std::vector<Level *> completed;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        completed.swap(m_completed);
+    }
+
+    for (size_t i = 0; i < completed.size(); ++i)
+    {
+        Level *pLevel = completed[i];
+        Key key(pLevel->chunk, pLevel->level);
+        size_t sizeInBytes = pLevel->vertices.size() * sizeof(float) +
+            pLevel->indices.size() * sizeof(unsigned int);
+
+        m_requested[key.first * ChunkFile::MAX_DETAIL_LEVELS + key.second] = 0;
+        ++m_stats.reads;
+
+        if (m_resident.count(key) || !evict(sizeInBytes))
+        {
+            delete pLevel;
+            continue;
+        }
+
+        Resident &resident = m_resident[key];
+
+        resident.pLevel = pLevel;
+        resident.sizeInBytes = sizeInBytes;
+        resident.lastUsed = m_frame;
+        resident.lruPosition = m_lru.insert(m_lru.end(), key);
+        m_residentBytes += sizeInBytes;
+    }
+
+    return !completed.empty();
+}
+
+void ChunkStreamer::update(const float modelview[16], const float projection[16], int viewportHeight,
+                           float maxScreenError)
+{
+    TRACE_ZONE("ChunkStreamer::update");
+
+    // The matrices are OpenGL's column major ones and must map the chunk
+    // file's coordinates to the eye; the modelview may scale, but uniformly.
+    float clip[16];
+    float planes[6][4];
+    float eye[3];
+    float scale = modelview[0] * modelview[0] + modelview[1] * modelview[1] + modelview[2] * modelview[2];
+    float pixelsPerUnit = projection[5] * viewportHeight * 0.5f;
+    std::vector<LevelRequest> requests;
+    std::vector<DrawItem> drawItems;
+    size_t drawnBytes = 0;
+
+    ++m_frame;
+    m_drawLevels.clear();
+    m_stats.visibleChunks = 0;
+
+    if (!isOpen() || scale <= 0.0f)
+        return;
+
+    for (int column = 0; column < 4; ++column)
+    {
+        for (int row = 0; row < 4; ++row)
+        {
+            clip[column * 4 + row] = 0.0f;
+
+            for (int k = 0; k < 4; ++k)
+                clip[column * 4 + row] += projection[k * 4 + row] * modelview[column * 4 + k];
+        }
+    }
+
+    for (int i = 0; i < 6; ++i)
+    {
+        for (int j = 0; j < 4; ++j)
+            planes[i][j] = clip[j * 4 + 3] + ((i & 1) ? -clip[j * 4 + i / 2] : clip[j * 4 + i / 2]);
+    }
+
+    // The eye is at the origin of eye space, which is -R^T t / s^2 for a
+    // modelview of a rotation R scaled by s followed by a translation t.
+    for (int i = 0; i < 3; ++i)
+    {
+        eye[i] = -(modelview[i * 4 + 0] * modelview[12] + modelview[i * 4 + 1] * modelview[13] +
+            modelview[i * 4 + 2] * modelview[14]) / scale;
+    }
+
+    for (int i = 0; i < m_index.getNumberOfChunks(); ++i)
+    {
+        const ChunkFile::Chunk &chunk = m_index.getChunk(i);
+        bool visible = true;
+        float distance = 0.0f;
+
+        for (int j = 0; visible && j < 6; ++j)
+        {
+            float planeDistance = planes[j][3];
+
+            for (int k = 0; k < 3; ++k)
+            {
+                planeDistance += planes[j][k] * ((planes[j][k] >= 0.0f)
+                    ? chunk.maxPosition[k] : chunk.minPosition[k]);
+            }
+
+            visible = planeDistance >= 0.0f;
+        }
+
+        if (!visible)
+            continue;
+
+        ++m_stats.visibleChunks;
+
+        for (int j = 0; j < 3; ++j)
+        {
+            float outside = std::max(chunk.minPosition[j] - eye[j], eye[j] - chunk.maxPosition[j]);
+
+            if (outside > 0.0f)
+                distance += outside * outside;
+        }
+
+        distance = std::sqrt(distance);
+
+        // The coarsest level whose error covers at most maxScreenError pixels
+        // at the nearest point of the chunk. Level 0 has no error.
+        int wanted = 0;
+        int drawn = -1;
+
+        for (int j = chunk.numberOfLevels - 1; j > 0; --j)
+        {
+            if (chunk.levels[j].error * pixelsPerUnit <= maxScreenError * distance)
+            {
+                wanted = j;
+                break;
+            }
+        }
+
+        for (int j = 0; j < chunk.numberOfLevels; ++j)
+        {
+            if (m_resident.count(Key(i, j)) &&
+                (drawn < 0 || std::abs(j - wanted) < std::abs(drawn - wanted) ||
+                (std::abs(j - wanted) == std::abs(drawn - wanted) && j > drawn)))
+                drawn = j;
+        }
+
+        if (drawn >= 0)
+        {
+            Resident &resident = m_resident[Key(i, drawn)];
+
+            resident.lastUsed = m_frame;
+            m_lru.splice(m_lru.end(), m_lru, resident.lruPosition);
+            drawnBytes += resident.sizeInBytes;
+
+            DrawItem item = {distance, resident.pLevel};
+            drawItems.push_back(item);
+        }
+
+        if (drawn < 0)
+        {
+            LevelRequest request = {0, distance, i, chunk.numberOfLevels - 1};
+            requests.push_back(request);
+        }
+        else if (drawn != wanted)
+        {
+            LevelRequest request = {1, distance, i, wanted};
+            requests.push_back(request);
+        }
+    }
+
+    // Nearest first, so the front of the view fills in before the back.
+    std::sort(drawItems.begin(), drawItems.end());
+    std::sort(requests.begin(), requests.end());
+
+    for (size_t i = 0; i < drawItems.size(); ++i)
+        m_drawLevels.push_back(drawItems[i].pLevel);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        size_t requestedBytes = drawnBytes;
+
+        for (size_t i = 0; i < m_requests.size(); ++i)
+            m_requested[m_requests[i].first * ChunkFile::MAX_DETAIL_LEVELS + m_requests[i].second] = 0;
+
+        m_requests.clear();
+
+        for (size_t i = 0; i < requests.size(); ++i)
+        {
+            unsigned char &requested = m_requested[requests[i].chunk * ChunkFile::MAX_DETAIL_LEVELS + requests[i].level];
+            size_t sizeInBytes = ChunkFile::getLevelSize(m_index.getChunk(requests[i].chunk).levels[requests[i].level]);
+
+            // Levels that are being read are still counted against the budget.
+            if (requestedBytes + sizeInBytes > m_memoryBudget)
+                continue;
+
+            requestedBytes += sizeInBytes;
+
+            if (requested)
+                continue;
+
+            requested = 1;
+            m_requests.push_back(Key(requests[i].chunk, requests[i].level));
+        }
+    }
+
+    if (!m_requests.empty())
+        m_requestAvailable.notify_one();
+}
+
+void ChunkStreamer::getBounds(float minPosition[3], float maxPosition[3]) const
+{
+    m_index.getBounds(minPosition, maxPosition);
+}
+
+ChunkStreamer::Statistics ChunkStreamer::getStatistics() const
+{
+    Statistics stats = m_stats;
+
+    stats.residentLevels = static_cast<int>(m_resident.size());
+    stats.residentBytes = m_residentBytes;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        stats.pendingReads = static_cast<int>(m_requests.size()) + m_reading;
+    }
+
+    return stats;
+}
+
+bool ChunkStreamer::isBusy() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return !m_requests.empty() || m_reading || !m_completed.empty();
+}
+
+bool ChunkStreamer::evict(size_t sizeInBytes)
+{
+    // Levels drawn in the current frame are at the back of the list and are
+    // never evicted, since the draw list points to them.
+    while (m_residentBytes + sizeInBytes > m_memoryBudget)
+    {
+        if (m_lru.empty())
+            return false;
+
+        std::map<Key, Resident>::iterator i = m_resident.find(m_lru.front());
+
+        if (i->second.lastUsed == m_frame)
+            return false;
+
+        m_residentBytes -= i->second.sizeInBytes;
+        delete i->second.pLevel;
+        m_resident.erase(i);
+        m_lru.pop_front();
+        ++m_stats.evictions;
+    }
+
+    return true;
+}
+
+void ChunkStreamer::ioMain()
+{
+    Trace::setThreadName("chunk streamer");
+
+    while (true)
+    {
+        Key key;
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            while (!m_quit && m_requests.empty())
+                m_requestAvailable.wait(lock);
+
+            if (m_quit)
+                return;
+
+            key = m_requests.front();
+            m_requests.pop_front();
+            m_reading = 1;
+        }
+
+        // A level that can't be read stays empty, so it isn't asked for again.
+        Level *pLevel = new Level;
+
+        pLevel->chunk = key.first;
+        pLevel->level = key.second;
+
+        {
+            TRACE_ZONE("ChunkStreamer::read");
+            m_reader.readLevel(key.first, key.second, pLevel->vertices, pLevel->indices);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            m_completed.push_back(pLevel);
+            m_reading = 0;
+        }
+
+        m_readFinished.notify_all();
+    }
+}
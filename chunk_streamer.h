@@ -0,0 +1,114 @@
+#if !defined(CHUNK_STREAMER_H)
+#define CHUNK_STREAMER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "chunk_file.h"
+
+// Keeps the parts of a ChunkFile that the camera needs in memory, within a
+// fixed budget. update() picks a detail level for each chunk in the view
+// frustum from its geometric error projected to the screen, and queues the
+// missing levels for a background I/O thread, nearest chunks first. Chunks
+// that have nothing in memory yet ask for their coarsest level first, so the
+// whole view fills in quickly and then sharpens. Each visible chunk is drawn
+// at the resident level closest to the one it wants. Levels that weren't
+// drawn in the current frame are evicted least recently used first when a
+// new level doesn't fit into the budget, and a level is only requested when
+// it fits next to the ones being drawn.
+
+class ChunkStreamer
+{
+public:
+    struct Level
+    {
+        int chunk;
+        int level;
+        std::vector<float> vertices;
+        std::vector<unsigned int> indices;
+    };
+
+    struct Statistics
+    {
+        int visibleChunks;
+        int residentLevels;
+        int pendingReads;
+        int reads;
+        int evictions;
+        size_t residentBytes;
+    };
+
+    explicit ChunkStreamer(size_t memoryBudget);
+    ~ChunkStreamer();
+
+    void close();
+    bool open(const char *pszFilename);
+    bool processCompleted();
+    void update(const float modelview[16], const float projection[16], int viewportHeight,
+        float maxScreenError);
+
+    void getBounds(float minPosition[3], float maxPosition[3]) const;
+    const Level &getDrawLevel(int i) const;
+    size_t getMemoryBudget() const;
+    int getNumberOfDrawLevels() const;
+    Statistics getStatistics() const;
+    bool isBusy() const;
+    bool isOpen() const;
+
+private:
+    typedef std::pair<int, int> Key;
+
+    struct Resident
+    {
+        Level *pLevel;
+        size_t sizeInBytes;
+        unsigned int lastUsed;
+        std::list<Key>::iterator lruPosition;
+    };
+
+    ChunkStreamer(const ChunkStreamer &);
+    ChunkStreamer &operator=(const ChunkStreamer &);
+
+    bool evict(size_t sizeInBytes);
+    void ioMain();
+
+    ChunkFile m_index;
+    ChunkFile m_reader;
+    size_t m_memoryBudget;
+    size_t m_residentBytes;
+    unsigned int m_frame;
+    Statistics m_stats;
+    std::map<Key, Resident> m_resident;
+    std::list<Key> m_lru;
+    std::vector<Level *> m_drawLevels;
+    std::vector<unsigned char> m_requested;
+
+    bool m_quit;
+    int m_reading;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_requestAvailable;
+    std::condition_variable m_readFinished;
+    std::deque<Key> m_requests;
+    std::vector<Level *> m_completed;
+    std::thread m_thread;
+};
+
+inline const ChunkStreamer::Level &ChunkStreamer::getDrawLevel(int i) const
+{ return *m_drawLevels[i]; }
+
+inline size_t ChunkStreamer::getMemoryBudget() const
+{ return m_memoryBudget; }
+
+inline int ChunkStreamer::getNumberOfDrawLevels() const
+{ return static_cast<int>(m_drawLevels.size()); }
+
+inline bool ChunkStreamer::isOpen() const
+{ return m_index.isOpen(); }
+
+#endif
@@ -0,0 +1,558 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "compressed_texture.h"
+#include "job_system.h"
+#include "mipmap.h"
+
+namespace
+{
+    const char CACHE_MAGIC[4] = {'B', 'C', 'T', '1'};
+    const int BLOCKS_PER_TASK = 4096;
+
+    struct CacheHeader
+    {
+        char magic[4];
+        unsigned int format;
+        unsigned long long sourceHash;
+        unsigned int powerOfTwo;
+        unsigned int numberOfLevels;
+    };
+
+    struct CacheLevelHeader
+    {
+        int width;
+        int height;
+        unsigned int size;
+    };
+
+    int Pack565(const float *pRgb)
+    {
+        int r = static_cast<int>(std::min(255.0f, std::max(0.0f, pRgb[0])) * (31.0f / 255.0f) + 0.5f);
+        int g = static_cast<int>(std::min(255.0f, std::max(0.0f, pRgb[1])) * (63.0f / 255.0f) + 0.5f);
+        int b = static_cast<int>(std::min(255.0f, std::max(0.0f, pRgb[2])) * (31.0f / 255.0f) + 0.5f);
+
+        return (r << 11) | (g << 5) | b;
+    }
+
+    void Unpack565(int color, int *pRgb)
+    {
+        int r = (color >> 11) & 31;
+        int g = (color >> 5) & 63;
+        int b = color & 31;
+
+        pRgb[0] = (r << 3) | (r >> 2);
+        pRgb[1] = (g << 2) | (g >> 4);
+        pRgb[2] = (b << 3) | (b >> 2);
+    }
+
+    unsigned int FindIndicesBC1(const unsigned char *pBgra, int c0, int c1, int &error)
+    {
+        int palette[4][3];
+
+        Unpack565(c0, palette[0]);
+        Unpack565(c1, palette[1]);
+
+        for (int k = 0; k < 3; ++k)
+        {
+            palette[2][k] = (2 * palette[0][k] + palette[1][k]) / 3;
+            palette[3][k] = (palette[0][k] + 2 * palette[1][k]) / 3;
+        }
+
+        unsigned int indices = 0;
+
+        error = 0;
+
+        for (int i = 0; i < 16; ++i)
+        {
+            const unsigned char *pPixel = &pBgra[i * 4];
+            int best = 0;
+            int bestDistance = 0x7fffffff;
+
+            for (int j = 0; j < 4; ++j)
+            {
+                int dr = pPixel[2] - palette[j][0];
+                int dg = pPixel[1] - palette[j][1];
+                int db = pPixel[0] - palette[j][2];
+                int distance = dr * dr + dg * dg + db * db;
+
+                if (distance < bestDistance)
+                {
+                    best = j;
+                    bestDistance = distance;
+                }
+            }
+
+            indices |= best << (i * 2);
+            error += bestDistance;
+        }
+
+        return indices;
+    }
+
+    void FitEndpointsBC1(const unsigned char *pBgra, float *pMax, float *pMin)
+    {
+        float mean[3] = {0.0f, 0.0f, 0.0f};
+        float minColor[3] = {255.0f, 255.0f, 255.0f};
+        float maxColor[3] = {0.0f, 0.0f, 0.0f};
+
+        for (int i = 0; i < 16; ++i)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                float c = pBgra[i * 4 + 2 - k];
+
+                mean[k] += c;
+                minColor[k] = std::min(minColor[k], c);
+                maxColor[k] = std::max(maxColor[k], c);
+            }
+        }
+
+        for (int k = 0; k < 3; ++k)
+            mean[k] /= 16.0f;
+
+        float cov[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+
+        for (int i = 0; i < 16; ++i)
+        {
+            float r = pBgra[i * 4 + 2] - mean[0];
+            float g = pBgra[i * 4 + 1] - mean[1];
+            float b = pBgra[i * 4 + 0] - mean[2];
+
+            cov[0] += r * r;
+            cov[1] += r * g;
+            cov[2] += r * b;
+            cov[3] += g * g;
+            cov[4] += g * b;
+            cov[5] += b * b;
+        }
+
+        // Principal axis by power iteration, seeded with the bounding box
+        // diagonal.
+
+        float axis[3] =
+        {
+            maxColor[0] - minColor[0],
+            maxColor[1] - minColor[1],
+            maxColor[2] - minColor[2]
+        };
+
+        for (int iteration = 0; iteration < 4; ++iteration)
+        {
+            float x = axis[0] * cov[0] + axis[1] * cov[1] + axis[2] * cov[2];
+            float y = axis[0] * cov[1] + axis[1] * cov[3] + axis[2] * cov[4];
+            float z = axis[0] * cov[2] + axis[1] * cov[4] + axis[2] * cov[5];
+            float m = std::max(fabsf(x), std::max(fabsf(y), fabsf(z)));
+
+            if (m < 1e-6f)
+                break;
+
+            axis[0] = x / m;
+            axis[1] = y / m;
+            axis[2] = z / m;
+        }
+
+        float minDot = 1e30f;
+        float maxDot = -1e30f;
+        int minIndex = 0;
+        int maxIndex = 0;
+
+        for (int i = 0; i < 16; ++i)
+        {
+            float d = pBgra[i * 4 + 2] * axis[0] + pBgra[i * 4 + 1] * axis[1] +
+                pBgra[i * 4 + 0] * axis[2];
+
+            if (d < minDot)
+            {
+                minDot = d;
+                minIndex = i;
+            }
+
+            if (d > maxDot)
+            {
+                maxDot = d;
+                maxIndex = i;
+            }
+        }
+
+        for (int k = 0; k < 3; ++k)
+        {
+            float hi = pBgra[maxIndex * 4 + 2 - k];
+            float lo = pBgra[minIndex * 4 + 2 - k];
+            float inset = (hi - lo) / 16.0f;
+
+            pMax[k] = hi - inset;
+            pMin[k] = lo + inset;
+        }
+    }
+
+    bool RefineEndpointsBC1(const unsigned char *pBgra, unsigned int indices,
+                            float *pMax, float *pMin)
+    {
+        static const float WEIGHTS[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+
+        float aa = 0.0f;
+        float ab = 0.0f;
+        float bb = 0.0f;
+        float ax[3] = {0.0f, 0.0f, 0.0f};
+        float bx[3] = {0.0f, 0.0f, 0.0f};
+
+        for (int i = 0; i < 16; ++i)
+        {
+            float a = WEIGHTS[(indices >> (i * 2)) & 3];
+            float b = 1.0f - a;
+
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+
+            for (int k = 0; k < 3; ++k)
+            {
+                ax[k] += a * pBgra[i * 4 + 2 - k];
+                bx[k] += b * pBgra[i * 4 + 2 - k];
+            }
+        }
+
+        float det = aa * bb - ab * ab;
+
+        if (fabsf(det) < 1e-6f)
+            return false;
+
+        for (int k = 0; k < 3; ++k)
+        {
+            pMax[k] = (ax[k] * bb - bx[k] * ab) / det;
+            pMin[k] = (bx[k] * aa - ax[k] * ab) / det;
+        }
+
+        return true;
+    }
+
+    void WriteBC1(int c0, int c1, unsigned int indices, unsigned char *pBlock)
+    {
+        pBlock[0] = static_cast<unsigned char>(c0 & 0xff);
+        pBlock[1] = static_cast<unsigned char>(c0 >> 8);
+        pBlock[2] = static_cast<unsigned char>(c1 & 0xff);
+        pBlock[3] = static_cast<unsigned char>(c1 >> 8);
+        pBlock[4] = static_cast<unsigned char>(indices & 0xff);
+        pBlock[5] = static_cast<unsigned char>((indices >> 8) & 0xff);
+        pBlock[6] = static_cast<unsigned char>((indices >> 16) & 0xff);
+        pBlock[7] = static_cast<unsigned char>(indices >> 24);
+    }
+
+    void FetchBlock(const MipChain::Level &level, int blockX, int blockY, unsigned char *pBgra)
+    {
+        for (int y = 0; y < 4; ++y)
+        {
+            int sy = std::min(blockY * 4 + y, level.height - 1);
+            const unsigned char *pRow = &level.pixels[sy * level.width * 4];
+
+            for (int x = 0; x < 4; ++x)
+            {
+                int sx = std::min(blockX * 4 + x, level.width - 1);
+                memcpy(&pBgra[(y * 4 + x) * 4], &pRow[sx * 4], 4);
+            }
+        }
+    }
+}
+
+CompressedTexture::CompressedTexture() : m_format(FORMAT_BC1)
+{
+}
+
+CompressedTexture::~CompressedTexture()
+{
+}
+
+void CompressedTexture::clear()
+{
+    m_levels.clear();
+}
+
+bool CompressedTexture::compress(const MipChain &mipChain, Format format)
+{
+    clear();
+
+    if (mipChain.getNumberOfLevels() == 0)
+        return false;
+
+    int blockSize = getBlockSizeInBytes(format);
+
+    m_format = format;
+    m_levels.resize(mipChain.getNumberOfLevels());
+
+    for (int i = 0; i < mipChain.getNumberOfLevels(); ++i)
+    {
+        const MipChain::Level &src = mipChain.getLevel(i);
+        Level &dest = m_levels[i];
+        int blocksWide = (src.width + 3) / 4;
+        int blocksHigh = (src.height + 3) / 4;
+
+        dest.width = src.width;
+        dest.height = src.height;
+        dest.blocks.resize(blocksWide * blocksHigh * blockSize);
+
+        JobSystem::instance().parallelFor(0, blocksHigh,
+            std::max(1, BLOCKS_PER_TASK / blocksWide),
+            [&src, &dest, blocksWide, blockSize, format](int first, int last)
+            {
+                unsigned char texels[64];
+
+                for (int y = first; y < last; ++y)
+                {
+                    unsigned char *pBlock = &dest.blocks[y * blocksWide * blockSize];
+
+                    for (int x = 0; x < blocksWide; ++x, pBlock += blockSize)
+                    {
+                        FetchBlock(src, x, y, texels);
+
+                        switch (format)
+                        {
+                        case FORMAT_BC1:
+                            encodeBC1(texels, pBlock);
+                            break;
+
+                        case FORMAT_BC3:
+                            encodeBC3(texels, pBlock);
+                            break;
+
+                        case FORMAT_BC5:
+                            encodeBC5(texels, pBlock);
+                            break;
+                        }
+                    }
+                }
+            });
+    }
+
+    return true;
+}
+
+bool CompressedTexture::load(const char *pszFilename, unsigned long long sourceHash,
+                             bool powerOfTwo)
+{
+    clear();
+
+    FILE *pFile = fopen(pszFilename, "rb");
+
+    if (!pFile)
+        return false;
+
+    CacheHeader header;
+    bool ok = fread(&header, sizeof(header), 1, pFile) == 1 &&
+        memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0 &&
+        header.format <= FORMAT_BC5 &&
+        header.sourceHash == sourceHash &&
+        header.powerOfTwo == (powerOfTwo ? 1U : 0U) &&
+        header.numberOfLevels > 0 && header.numberOfLevels <= 32;
+
+    if (ok)
+    {
+        m_format = static_cast<Format>(header.format);
+        m_levels.resize(header.numberOfLevels);
+
+        for (unsigned int i = 0; ok && i < header.numberOfLevels; ++i)
+        {
+            CacheLevelHeader levelHeader;
+            Level &level = m_levels[i];
+
+            ok = fread(&levelHeader, sizeof(levelHeader), 1, pFile) == 1 &&
+                levelHeader.width > 0 && levelHeader.height > 0 &&
+                levelHeader.size == static_cast<unsigned int>(((levelHeader.width + 3) / 4) *
+                    ((levelHeader.height + 3) / 4) * getBlockSizeInBytes(m_format));
+
+            if (ok)
+            {
+                level.width = levelHeader.width;
+                level.height = levelHeader.height;
+                level.blocks.resize(levelHeader.size);
+                ok = fread(&level.blocks[0], 1, levelHeader.size, pFile) == levelHeader.size;
+            }
+        }
+    }
+
+    fclose(pFile);
+
+    if (!ok)
+        clear();
+
+    return ok;
+}
+
+bool CompressedTexture::save(const char *pszFilename, unsigned long long sourceHash,
+                             bool powerOfTwo) const
+{
+    if (m_levels.empty())
+        return false;
+
+    FILE *pFile = fopen(pszFilename, "wb");
+
+    if (!pFile)
+        return false;
+
+    CacheHeader header;
+
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.format = m_format;
+    header.sourceHash = sourceHash;
+    header.powerOfTwo = powerOfTwo ? 1 : 0;
+    header.numberOfLevels = static_cast<unsigned int>(m_levels.size());
+
+    bool ok = fwrite(&header, sizeof(header), 1, pFile) == 1;
+
+    for (size_t i = 0; ok && i < m_levels.size(); ++i)
+    {
+        const Level &level = m_levels[i];
+        CacheLevelHeader levelHeader = {level.width, level.height,
+            static_cast<unsigned int>(level.blocks.size())};
+
+        ok = fwrite(&levelHeader, sizeof(levelHeader), 1, pFile) == 1 &&
+            fwrite(&level.blocks[0], 1, level.blocks.size(), pFile) == level.blocks.size();
+    }
+
+    if (fclose(pFile) != 0)
+        ok = false;
+
+    if (!ok)
+        remove(pszFilename);
+
+    return ok;
+}
+
+size_t CompressedTexture::getSizeInBytes() const
+{
+    size_t size = 0;
+
+    for (size_t i = 0; i < m_levels.size(); ++i)
+        size += m_levels[i].blocks.size();
+
+    return size;
+}
+
+CompressedTexture::Format CompressedTexture::chooseFormat(const MipChain &mipChain, bool normalMap)
+{
+    if (normalMap)
+        return FORMAT_BC5;
+
+    if (mipChain.getNumberOfLevels() > 0)
+    {
+        const std::vector<unsigned char> &pixels = mipChain.getLevel(0).pixels;
+
+        for (size_t i = 3; i < pixels.size(); i += 4)
+        {
+            if (pixels[i] != 255)
+                return FORMAT_BC3;
+        }
+    }
+
+    return FORMAT_BC1;
+}
+
+void CompressedTexture::encodeBC1(const unsigned char *pBgra, unsigned char *pBlock)
+{
+    float maxColor[3];
+    float minColor[3];
+
+    FitEndpointsBC1(pBgra, maxColor, minColor);
+
+    int c0 = Pack565(maxColor);
+    int c1 = Pack565(minColor);
+    int error = 0;
+    unsigned int indices = FindIndicesBC1(pBgra, c0, c1, error);
+
+    if (c0 != c1 && RefineEndpointsBC1(pBgra, indices, maxColor, minColor))
+    {
+        int r0 = Pack565(maxColor);
+        int r1 = Pack565(minColor);
+        int refinedError = 0;
+        unsigned int refinedIndices = FindIndicesBC1(pBgra, r0, r1, refinedError);
+
+        if (refinedError < error)
+        {
+            c0 = r0;
+            c1 = r1;
+            indices = refinedIndices;
+        }
+    }
+
+    // Keep the block in four color mode (c0 > c1). Swapping the endpoints
+    // maps index 0 <-> 1 and 2 <-> 3.
+
+    if (c0 < c1)
+    {
+        std::swap(c0, c1);
+        indices ^= 0x55555555;
+    }
+    else if (c0 == c1)
+    {
+        indices = 0;
+    }
+
+    WriteBC1(c0, c1, indices, pBlock);
+}
+
+void CompressedTexture::encodeBC3(const unsigned char *pBgra, unsigned char *pBlock)
+{
+    encodeBC4(pBgra, 3, pBlock);
+    encodeBC1(pBgra, pBlock + 8);
+}
+
+void CompressedTexture::encodeBC4(const unsigned char *pBgra, int channel, unsigned char *pBlock)
+{
+    int minValue = 255;
+    int maxValue = 0;
+
+    for (int i = 0; i < 16; ++i)
+    {
+        int value = pBgra[i * 4 + channel];
+
+        minValue = std::min(minValue, value);
+        maxValue = std::max(maxValue, value);
+    }
+
+    unsigned long long indices = 0;
+
+    if (maxValue > minValue)
+    {
+        int palette[8];
+
+        palette[0] = maxValue;
+        palette[1] = minValue;
+
+        for (int j = 2; j < 8; ++j)
+            palette[j] = ((8 - j) * maxValue + (j - 1) * minValue + 3) / 7;
+
+        for (int i = 0; i < 16; ++i)
+        {
+            int value = pBgra[i * 4 + channel];
+            int best = 0;
+            int bestDistance = 256;
+
+            for (int j = 0; j < 8; ++j)
+            {
+                int distance = abs(value - palette[j]);
+
+                if (distance < bestDistance)
+                {
+                    best = j;
+                    bestDistance = distance;
+                }
+            }
+
+            indices |= static_cast<unsigned long long>(best) << (i * 3);
+        }
+    }
+
+    pBlock[0] = static_cast<unsigned char>(maxValue);
+    pBlock[1] = static_cast<unsigned char>(minValue);
+
+    for (int i = 0; i < 6; ++i)
+        pBlock[2 + i] = static_cast<unsigned char>((indices >> (i * 8)) & 0xff);
+}
+
+void CompressedTexture::encodeBC5(const unsigned char *pBgra, unsigned char *pBlock)
+{
+    encodeBC4(pBgra, 2, pBlock);
+    encodeBC4(pBgra, 1, pBlock + 8);
+}
@@ -0,0 +1,64 @@
+#if !defined(COMPRESSED_TEXTURE_H)
+#define COMPRESSED_TEXTURE_H
+
+#include <cstddef>
+#include <vector>
+
+class MipChain;
+
+class CompressedTexture
+{
+public:
+    enum Format
+    {
+        FORMAT_BC1,
+        FORMAT_BC3,
+        FORMAT_BC5
+    };
+
+    struct Level
+    {
+        int width;
+        int height;
+        std::vector<unsigned char> blocks;
+    };
+
+    CompressedTexture();
+    ~CompressedTexture();
+
+    void clear();
+    bool compress(const MipChain &mipChain, Format format);
+    bool load(const char *pszFilename, unsigned long long sourceHash, bool powerOfTwo);
+    bool save(const char *pszFilename, unsigned long long sourceHash, bool powerOfTwo) const;
+
+    Format getFormat() const;
+    const Level &getLevel(int i) const;
+    int getNumberOfLevels() const;
+    size_t getSizeInBytes() const;
+
+    static Format chooseFormat(const MipChain &mipChain, bool normalMap);
+    static int getBlockSizeInBytes(Format format);
+
+    static void encodeBC1(const unsigned char *pBgra, unsigned char *pBlock);
+    static void encodeBC3(const unsigned char *pBgra, unsigned char *pBlock);
+    static void encodeBC4(const unsigned char *pBgra, int channel, unsigned char *pBlock);
+    static void encodeBC5(const unsigned char *pBgra, unsigned char *pBlock);
+
+private:
+    Format m_format;
+    std::vector<Level> m_levels;
+};
+
+inline CompressedTexture::Format CompressedTexture::getFormat() const
+{ return m_format; }
+
+inline const CompressedTexture::Level &CompressedTexture::getLevel(int i) const
+{ return m_levels[i]; }
+
+inline int CompressedTexture::getNumberOfLevels() const
+{ return static_cast<int>(m_levels.size()); }
+
+inline int CompressedTexture::getBlockSizeInBytes(Format format)
+{ return (format == FORMAT_BC1) ? 8 : 16; }
+
+#endif
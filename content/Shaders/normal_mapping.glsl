@@ -29,6 +29,10 @@ The handedness is used to calculate the bitangent vector. The reason for the
 inclusion of the handedness component is to allow for triangles with mirrored
 texture mappings.
 
+Only the x and y components of the normal map are sampled; z is reconstructed
+in the fragment shader. This allows normal maps to be stored as two channel
+BC5 (RGTC2) textures.
+
 -------------------------------------------------------------------------------
 
 [vert]
@@ -71,7 +75,10 @@ varying vec3 halfVector;
 
 void main()
 {
-    vec3 n = normalize(texture2D(normalMap, gl_TexCoord[0].st).rgb * 2.0 - 1.0);
+    vec3 n;
+
+    n.xy = texture2D(normalMap, gl_TexCoord[0].st).rg * 2.0 - 1.0;
+    n.z = sqrt(max(0.0, 1.0 - dot(n.xy, n.xy)));
     vec3 l = normalize(lightDir);
     vec3 h = normalize(halfVector);
 
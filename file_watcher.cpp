@@ -0,0 +1,345 @@
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include "file_watcher.h"
+#include "trace.h"
+
+namespace
+{
+    const int POLL_INTERVAL = 100;
+    const int SETTLE_POLL_INTERVAL = 25;
+
+    std::string GetDirectory(const std::string &filename)
+    {
+        std::string::size_type offset = filename.find_last_of("\\/");
+        return (offset != std::string::npos) ? filename.substr(0, offset + 1) : std::string(".");
+    }
+
+    bool GetFileStamp(const char *pszFilename, long long &size, long long &modified)
+    {
+        // Saves that are only milliseconds apart have to compare different,
+        // so this uses the finest modification time there is.
+#if defined(_WIN32)
+        WIN32_FILE_ATTRIBUTE_DATA data;
+
+        if (!GetFileAttributesExA(pszFilename, GetFileExInfoStandard, &data))
+            return false;
+
+        size = (static_cast<long long>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+        modified = (static_cast<long long>(data.ftLastWriteTime.dwHighDateTime) << 32) |
+            data.ftLastWriteTime.dwLowDateTime;
+#else
+        struct stat info;
+
+        if (stat(pszFilename, &info) != 0)
+            return false;
+
+        size = static_cast<long long>(info.st_size);
+        modified = static_cast<long long>(info.st_mtim.tv_sec) * 1000000000LL + info.st_mtim.tv_nsec;
+#endif
+        return true;
+    }
+
+    long long GetMilliseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+FileWatcher::FileWatcher()
+    : m_pNotifyCallback(0), m_pNotifyContext(0), m_filesChanged(false), m_quit(false)
+{
+    m_thread = std::thread(&FileWatcher::watcherMain, this);
+}
+
+FileWatcher::~FileWatcher()
+{
+    m_quit = true;
+    m_thread.join();
+}
+
+bool FileWatcher::popChanges(std::vector<std::string> &filenames)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    filenames.clear();
+    filenames.swap(m_changes);
+
+    return !filenames.empty();
+}
+
+void FileWatcher::setNotifyCallback(NotifyCallback pCallback, void *pContext)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_pNotifyCallback = pCallback;
+    m_pNotifyContext = pContext;
+}
+
+void FileWatcher::watch(const std::vector<std::string> &filenames)
+{
+    // Files that stay watched keep their stamps, so a change that happened
+    // while the set was being replaced is still reported.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<File> files;
+
+    for (size_t i = 0; i < filenames.size(); ++i)
+    {
+        bool found = false;
+
+        for (size_t j = 0; !found && j < files.size(); ++j)
+            found = files[j].filename == filenames[i];
+
+        for (size_t j = 0; !found && j < m_files.size(); ++j)
+        {
+            if (m_files[j].filename == filenames[i])
+            {
+                files.push_back(m_files[j]);
+                found = true;
+            }
+        }
+
+        if (found)
+            continue;
+
+        File file;
+
+        file.filename = filenames[i];
+        file.directory = GetDirectory(filenames[i]);
+        file.size = -1;
+        file.modified = -1;
+        file.changedAt = -1;
+
+        GetFileStamp(file.filename.c_str(), file.size, file.modified);
+        files.push_back(file);
+    }
+
+    m_files.swap(files);
+    m_filesChanged = true;
+}
+
+bool FileWatcher::isWatching() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return !m_files.empty();
+}
+
+bool FileWatcher::checkFiles(const std::vector<std::string> &directories, long long now, bool &settling)
+{
+    // Only files in a directory that changed, and files that are still
+    // settling, are looked at again.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    bool changed = false;
+
+    settling = false;
+
+    for (size_t i = 0; i < m_files.size(); ++i)
+    {
+        File &file = m_files[i];
+
+        if (file.changedAt < 0 && std::find(directories.begin(), directories.end(), file.directory) == directories.end())
+            continue;
+
+        long long size = -1;
+        long long modified = -1;
+
+        GetFileStamp(file.filename.c_str(), size, modified);
+
+        if (size != file.size || modified != file.modified)
+        {
+            file.size = size;
+            file.modified = modified;
+            file.changedAt = now;
+        }
+        else if (file.changedAt >= 0 && now - file.changedAt >= SETTLE_TIME)
+        {
+            // A file that was removed is reported once it is back.
+            if (size >= 0 && std::find(m_changes.begin(), m_changes.end(), file.filename) == m_changes.end())
+            {
+                m_changes.push_back(file.filename);
+                changed = true;
+            }
+
+            file.changedAt = -1;
+        }
+
+        settling = settling || file.changedAt >= 0;
+    }
+
+    return changed;
+}
+
+void FileWatcher::watcherMain()
+{
+    Trace::setThreadName("file watcher");
+
+    std::vector<std::string> directories;
+    std::vector<std::string> changedDirectories;
+    bool settling = false;
+
+#if defined(_WIN32)
+    std::vector<HANDLE> handles;
+#else
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    std::vector<int> watches;
+#endif
+
+    while (!m_quit)
+    {
+        bool rebuild = false;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            if ((rebuild = m_filesChanged) != false)
+            {
+                m_filesChanged = false;
+                directories.clear();
+
+                for (size_t i = 0; i < m_files.size(); ++i)
+                {
+                    if (std::find(directories.begin(), directories.end(), m_files[i].directory) == directories.end())
+                        directories.push_back(m_files[i].directory);
+                }
+            }
+        }
+
+        if (rebuild)
+        {
+            // Directories that can't be watched are left out, which keeps the
+            // handles and watches lined up with the directories.
+#if defined(_WIN32)
+            for (size_t i = 0; i < handles.size(); ++i)
+                FindCloseChangeNotification(handles[i]);
+
+            handles.clear();
+
+            for (size_t i = 0; i < directories.size(); )
+            {
+                HANDLE handle = INVALID_HANDLE_VALUE;
+
+                if (handles.size() < MAXIMUM_WAIT_OBJECTS)
+                {
+                    handle = FindFirstChangeNotificationA(directories[i].c_str(), FALSE,
+                        FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+                }
+
+                if (handle == INVALID_HANDLE_VALUE)
+                {
+                    directories.erase(directories.begin() + i);
+                    continue;
+                }
+
+                handles.push_back(handle);
+                ++i;
+            }
+#else
+            for (size_t i = 0; i < watches.size(); ++i)
+                inotify_rm_watch(fd, watches[i]);
+
+            watches.clear();
+
+            for (size_t i = 0; i < directories.size(); )
+            {
+                int watch = (fd >= 0) ? inotify_add_watch(fd, directories[i].c_str(),
+                    IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ATTRIB) : -1;
+
+                if (watch < 0)
+                {
+                    directories.erase(directories.begin() + i);
+                    continue;
+                }
+
+                watches.push_back(watch);
+                ++i;
+            }
+#endif
+        }
+
+        int timeout = settling ? SETTLE_POLL_INTERVAL : POLL_INTERVAL;
+
+        changedDirectories.clear();
+
+#if defined(_WIN32)
+        if (handles.empty())
+        {
+            Sleep(timeout);
+        }
+        else if (WaitForMultipleObjects(static_cast<DWORD>(handles.size()), &handles[0], FALSE, timeout) != WAIT_TIMEOUT)
+        {
+            for (size_t i = 0; i < handles.size(); ++i)
+            {
+                if (WaitForSingleObject(handles[i], 0) == WAIT_OBJECT_0)
+                {
+                    changedDirectories.push_back(directories[i]);
+                    FindNextChangeNotification(handles[i]);
+                }
+            }
+        }
+#else
+        pollfd pollFd = {fd, POLLIN, 0};
+
+        if (fd < 0 || watches.empty())
+        {
+            usleep(timeout * 1000);
+        }
+        else if (poll(&pollFd, 1, timeout) > 0)
+        {
+            alignas(inotify_event) char buffer[4096];
+            ssize_t length = 0;
+
+            while ((length = read(fd, buffer, sizeof(buffer))) > 0)
+            {
+                for (char *pEvent = buffer; pEvent < buffer + length; )
+                {
+                    const inotify_event *pInotifyEvent = reinterpret_cast<const inotify_event *>(pEvent);
+                    size_t i = std::find(watches.begin(), watches.end(), pInotifyEvent->wd) - watches.begin();
+
+                    if (i < watches.size() && std::find(changedDirectories.begin(),
+                        changedDirectories.end(), directories[i]) == changedDirectories.end())
+                    {
+                        changedDirectories.push_back(directories[i]);
+                    }
+
+                    pEvent += sizeof(inotify_event) + pInotifyEvent->len;
+                }
+            }
+        }
+#endif
+
+        if (!checkFiles(changedDirectories, GetMilliseconds(), settling))
+            continue;
+
+        NotifyCallback pCallback = 0;
+        void *pContext = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            pCallback = m_pNotifyCallback;
+            pContext = m_pNotifyContext;
+        }
+
+        if (pCallback)
+            pCallback(pContext);
+    }
+
+#if defined(_WIN32)
+    for (size_t i = 0; i < handles.size(); ++i)
+        FindCloseChangeNotification(handles[i]);
+#else
+    if (fd >= 0)
+        close(fd);
+#endif
+}
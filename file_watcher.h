@@ -0,0 +1,68 @@
+#if !defined(FILE_WATCHER_H)
+#define FILE_WATCHER_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Reports files that were written to since watch() was given them. A
+// background thread waits for changes to the directories that hold the files
+// (inotify on Linux, change notifications on Windows) and compares the size
+// and modification time of each file in a directory that changed. A file is
+// reported once it has stayed the same for SETTLE_TIME milliseconds, so a
+// file that is written in several steps or saved through a temporary file
+// shows up once and complete. Files that don't exist yet are watched as well
+// and are reported when they appear.
+//
+// The notify callback is called on the watcher thread whenever there are new
+// changes for popChanges() to collect.
+
+class FileWatcher
+{
+public:
+    typedef void (*NotifyCallback)(void *pContext);
+
+    enum
+    {
+        SETTLE_TIME = 100
+    };
+
+    FileWatcher();
+    ~FileWatcher();
+
+    bool popChanges(std::vector<std::string> &filenames);
+    void setNotifyCallback(NotifyCallback pCallback, void *pContext);
+    void watch(const std::vector<std::string> &filenames);
+
+    bool isWatching() const;
+
+private:
+    struct File
+    {
+        std::string filename;
+        std::string directory;
+        long long size;
+        long long modified;
+        long long changedAt;
+    };
+
+    FileWatcher(const FileWatcher &);
+    FileWatcher &operator=(const FileWatcher &);
+
+    bool checkFiles(const std::vector<std::string> &directories, long long now, bool &settling);
+    void watcherMain();
+
+    mutable std::mutex m_mutex;
+    std::vector<File> m_files;
+    std::vector<std::string> m_changes;
+    NotifyCallback m_pNotifyCallback;
+    void *m_pNotifyContext;
+    bool m_filesChanged;
+
+    std::atomic<bool> m_quit;
+    std::thread m_thread;
+};
+
+#endif
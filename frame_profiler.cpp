@@ -0,0 +1,222 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "frame_profiler.h"
+
+namespace
+{
+    const char *SCOPE_NAMES[FrameProfiler::NUMBER_OF_SCOPES] =
+    {
+        "update", "cull", "submit", "swap"
+    };
+
+    float Percentile(std::vector<float> &samples, float percentile)
+    {
+        size_t n = static_cast<size_t>(percentile * (samples.size() - 1) + 0.5f);
+
+        std::nth_element(samples.begin(), samples.begin() + n, samples.end());
+        return samples[n];
+    }
+}
+
+FrameProfiler::ScopedTimer::ScopedTimer(FrameProfiler &profiler, Scope scope)
+    : m_profiler(profiler), m_scope(scope), m_start(Clock::now())
+{
+}
+
+FrameProfiler::ScopedTimer::~ScopedTimer()
+{
+    m_profiler.addScopeTime(m_scope,
+        std::chrono::duration<float>(Clock::now() - m_start).count());
+}
+
+FrameProfiler::FrameProfiler(float budgetSeconds)
+    : m_budget(budgetSeconds)
+{
+    reset();
+}
+
+std::string FrameProfiler::describeActivity(unsigned int activity)
+{
+    static const char *pszNames[] = {"loading", "texture upload", "interacting", "reduced detail"};
+    std::string description;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        if (activity & (1u << i))
+        {
+            if (!description.empty())
+                description += ", ";
+
+            description += pszNames[i];
+        }
+    }
+
+    return description.empty() ? "idle" : description;
+}
+
+const char *FrameProfiler::getScopeName(Scope scope)
+{
+    return SCOPE_NAMES[scope];
+}
+
+void FrameProfiler::beginFrame()
+{
+    memset(&m_current, 0, sizeof(m_current));
+    m_frameStart = Clock::now();
+}
+
+void FrameProfiler::endFrame(unsigned int activity)
+{
+    m_current.number = m_frameNumber++;
+    m_current.activity = activity;
+    m_current.seconds = std::chrono::duration<float>(Clock::now() - m_frameStart).count();
+
+    m_history[m_next] = m_current;
+    m_next = (m_next + 1) % m_historySize;
+    m_numberOfFrames = std::min(m_numberOfFrames + 1, m_historySize);
+
+    if (m_current.seconds > m_budget)
+    {
+        ++m_totalHitches;
+        m_hitches.push_back(m_current);
+
+        if (m_hitches.size() > MAX_HITCHES)
+            m_hitches.pop_front();
+    }
+}
+
+void FrameProfiler::addScopeTime(Scope scope, float seconds)
+{
+    m_current.scopeSeconds[scope] += seconds;
+}
+
+void FrameProfiler::reset(int historySize)
+{
+    m_historySize = std::max(1, historySize);
+    m_history.assign(m_historySize, Frame());
+    m_frameNumber = 0;
+    m_totalHitches = 0;
+    m_next = 0;
+    m_numberOfFrames = 0;
+    m_hitches.clear();
+    memset(&m_current, 0, sizeof(m_current));
+}
+
+bool FrameProfiler::writeCsv(const char *pszFilename) const
+{
+    FILE *pFile = fopen(pszFilename, "w");
+
+    if (!pFile)
+        return false;
+
+    fprintf(pFile, "frame,total_ms");
+
+    for (int i = 0; i < NUMBER_OF_SCOPES; ++i)
+        fprintf(pFile, ",%s_ms", SCOPE_NAMES[i]);
+
+    fprintf(pFile, ",over_budget,activity\n");
+
+    for (int i = 0; i < m_numberOfFrames; ++i)
+    {
+        const Frame &frame = getFrame(i);
+
+        fprintf(pFile, "%u,%.3f", frame.number, frame.seconds * 1000.0f);
+
+        for (int j = 0; j < NUMBER_OF_SCOPES; ++j)
+            fprintf(pFile, ",%.3f", frame.scopeSeconds[j] * 1000.0f);
+
+        fprintf(pFile, ",%d,\"%s\"\n", (frame.seconds > m_budget) ? 1 : 0,
+            describeActivity(frame.activity).c_str());
+    }
+
+    return fclose(pFile) == 0;
+}
+
+bool FrameProfiler::writeJson(const char *pszFilename) const
+{
+    FILE *pFile = fopen(pszFilename, "w");
+
+    if (!pFile)
+        return false;
+
+    int buckets[NUMBER_OF_BUCKETS];
+    Statistics statistics = getStatistics();
+
+    getHistogram(buckets);
+
+    fprintf(pFile, "{\n  \"budget_ms\": %.3f,\n  \"frames\": %d,\n", m_budget * 1000.0f, m_numberOfFrames);
+    fprintf(pFile, "  \"total\": {\"average_ms\": %.3f, \"p50_ms\": %.3f, \"p95_ms\": %.3f, "
+        "\"p99_ms\": %.3f, \"max_ms\": %.3f},\n", statistics.average * 1000.0f,
+        statistics.p50 * 1000.0f, statistics.p95 * 1000.0f, statistics.p99 * 1000.0f,
+        statistics.max * 1000.0f);
+    fprintf(pFile, "  \"scopes\": {\n");
+
+    for (int i = 0; i < NUMBER_OF_SCOPES; ++i)
+    {
+        statistics = getStatistics(static_cast<Scope>(i));
+        fprintf(pFile, "    \"%s\": {\"average_ms\": %.3f, \"p50_ms\": %.3f, \"p95_ms\": %.3f, "
+            "\"p99_ms\": %.3f, \"max_ms\": %.3f}%s\n", SCOPE_NAMES[i], statistics.average * 1000.0f,
+            statistics.p50 * 1000.0f, statistics.p95 * 1000.0f, statistics.p99 * 1000.0f,
+            statistics.max * 1000.0f, (i + 1 < NUMBER_OF_SCOPES) ? "," : "");
+    }
+
+    fprintf(pFile, "  },\n  \"histogram_bucket_ms\": %d,\n  \"histogram\": [", HISTOGRAM_BUCKET_MS);
+
+    for (int i = 0; i < NUMBER_OF_BUCKETS; ++i)
+        fprintf(pFile, "%s%d", (i > 0) ? ", " : "", buckets[i]);
+
+    fprintf(pFile, "],\n  \"total_hitches\": %u,\n  \"hitches\": [\n", m_totalHitches);
+
+    for (size_t i = 0; i < m_hitches.size(); ++i)
+    {
+        const Frame &frame = m_hitches[i];
+
+        fprintf(pFile, "    {\"frame\": %u, \"total_ms\": %.3f", frame.number, frame.seconds * 1000.0f);
+
+        for (int j = 0; j < NUMBER_OF_SCOPES; ++j)
+            fprintf(pFile, ", \"%s_ms\": %.3f", SCOPE_NAMES[j], frame.scopeSeconds[j] * 1000.0f);
+
+        fprintf(pFile, ", \"activity\": \"%s\"}%s\n", describeActivity(frame.activity).c_str(),
+            (i + 1 < m_hitches.size()) ? "," : "");
+    }
+
+    fprintf(pFile, "  ]\n}\n");
+
+    return fclose(pFile) == 0;
+}
+
+void FrameProfiler::getHistogram(int buckets[NUMBER_OF_BUCKETS]) const
+{
+    std::fill(buckets, buckets + NUMBER_OF_BUCKETS, 0);
+
+    for (int i = 0; i < m_numberOfFrames; ++i)
+    {
+        int bucket = static_cast<int>(m_history[i].seconds * 1000.0f / HISTOGRAM_BUCKET_MS);
+        ++buckets[std::min(bucket, NUMBER_OF_BUCKETS - 1)];
+    }
+}
+
+FrameProfiler::Statistics FrameProfiler::computeStatistics(int scope) const
+{
+    Statistics statistics = {m_numberOfFrames, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+
+    if (m_numberOfFrames == 0)
+        return statistics;
+
+    std::vector<float> samples(m_numberOfFrames);
+
+    for (int i = 0; i < m_numberOfFrames; ++i)
+    {
+        samples[i] = (scope < 0) ? m_history[i].seconds : m_history[i].scopeSeconds[scope];
+        statistics.average += samples[i];
+        statistics.max = std::max(statistics.max, samples[i]);
+    }
+
+    statistics.average /= m_numberOfFrames;
+    statistics.p50 = Percentile(samples, 0.50f);
+    statistics.p95 = Percentile(samples, 0.95f);
+    statistics.p99 = Percentile(samples, 0.99f);
+
+    return statistics;
+}
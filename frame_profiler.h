@@ -0,0 +1,145 @@
+#if !defined(FRAME_PROFILER_H)
+#define FRAME_PROFILER_H
+
+#include <chrono>
+#include <deque>
+#include <string>
+#include <vector>
+
+// CPU time of the stages of each drawn frame. The last HISTORY_SIZE frames,
+// or as many as were passed to reset(), are kept in a ring buffer for
+// percentiles and a histogram with HISTOGRAM_BUCKET_MS wide buckets, the last
+// of which also collects every slower frame. Frames that exceed the budget
+// are copied to a hitch log together with the activity flags passed to
+// endFrame().
+
+class FrameProfiler
+{
+public:
+    enum Scope
+    {
+        SCOPE_UPDATE,
+        SCOPE_CULL,
+        SCOPE_SUBMIT,
+        SCOPE_SWAP,
+        NUMBER_OF_SCOPES
+    };
+
+    enum Activity
+    {
+        ACTIVITY_LOADING = 1,
+        ACTIVITY_TEXTURE_UPLOAD = 2,
+        ACTIVITY_INTERACTING = 4,
+        ACTIVITY_REDUCED_DETAIL = 8
+    };
+
+    enum
+    {
+        HISTORY_SIZE = 1024,
+        MAX_HITCHES = 256,
+        HISTOGRAM_BUCKET_MS = 2,
+        NUMBER_OF_BUCKETS = 20
+    };
+
+    struct Frame
+    {
+        unsigned int number;
+        unsigned int activity;
+        float seconds;
+        float scopeSeconds[NUMBER_OF_SCOPES];
+    };
+
+    struct Statistics
+    {
+        int numberOfFrames;
+        float average;
+        float p50;
+        float p95;
+        float p99;
+        float max;
+    };
+
+    class ScopedTimer
+    {
+    public:
+        ScopedTimer(FrameProfiler &profiler, Scope scope);
+        ~ScopedTimer();
+
+    private:
+        ScopedTimer(const ScopedTimer &);
+        ScopedTimer &operator=(const ScopedTimer &);
+
+        FrameProfiler &m_profiler;
+        Scope m_scope;
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    explicit FrameProfiler(float budgetSeconds);
+
+    static std::string describeActivity(unsigned int activity);
+    static const char *getScopeName(Scope scope);
+
+    void beginFrame();
+    void endFrame(unsigned int activity);
+    void addScopeTime(Scope scope, float seconds);
+    void reset(int historySize = HISTORY_SIZE);
+
+    bool writeCsv(const char *pszFilename) const;
+    bool writeJson(const char *pszFilename) const;
+
+    float getBudget() const;
+    const Frame &getFrame(int i) const;
+    const Frame &getHitch(int i) const;
+    void getHistogram(int buckets[NUMBER_OF_BUCKETS]) const;
+    const Frame &getLastFrame() const;
+    int getNumberOfFrames() const;
+    int getNumberOfHitches() const;
+    Statistics getStatistics() const;
+    Statistics getStatistics(Scope scope) const;
+    unsigned int getTotalHitches() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    Statistics computeStatistics(int scope) const;
+
+    float m_budget;
+    unsigned int m_frameNumber;
+    unsigned int m_totalHitches;
+    int m_next;
+    int m_numberOfFrames;
+    int m_historySize;
+    Frame m_current;
+    Clock::time_point m_frameStart;
+    std::vector<Frame> m_history;
+    std::deque<Frame> m_hitches;
+};
+
+inline float FrameProfiler::getBudget() const
+{ return m_budget; }
+
+inline const FrameProfiler::Frame &FrameProfiler::getFrame(int i) const
+{ return m_history[(m_next - m_numberOfFrames + i + m_historySize) % m_historySize]; }
+
+inline const FrameProfiler::Frame &FrameProfiler::getHitch(int i) const
+{ return m_hitches[i]; }
+
+inline const FrameProfiler::Frame &FrameProfiler::getLastFrame() const
+{ return m_history[(m_next + m_historySize - 1) % m_historySize]; }
+
+inline int FrameProfiler::getNumberOfFrames() const
+{ return m_numberOfFrames; }
+
+inline int FrameProfiler::getNumberOfHitches() const
+{ return static_cast<int>(m_hitches.size()); }
+
+inline FrameProfiler::Statistics FrameProfiler::getStatistics() const
+{ return computeStatistics(-1); }
+
+inline FrameProfiler::Statistics FrameProfiler::getStatistics(Scope scope) const
+{ return computeStatistics(scope); }
+
+inline unsigned int FrameProfiler::getTotalHitches() const
+{ return m_totalHitches; }
+
+#endif
@@ -0,0 +1,375 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "frame_sequence.h"
+#include "trace.h"
+
+namespace
+{
+    const float QUANTIZATION_RANGE = 32767.0f;
+
+    bool FileExists(const std::string &filename)
+    {
+        FILE *pFile = fopen(filename.c_str(), "rb");
+
+        if (!pFile)
+            return false;
+
+        fclose(pFile);
+        return true;
+    }
+}
+
+FrameSequence::FrameSequence()
+    : m_isOpen(false), m_numberOfVertices(0), m_scale(1.0f), m_encodedSize(0),
+      m_quit(false), m_encoding(false)
+{
+    for (int i = 0; i < RING_SIZE; ++i)
+        m_slots[i].frame = -1;
+}
+
+FrameSequence::~FrameSequence()
+{
+    close();
+}
+
+void FrameSequence::findFrames(const std::string &filename, std::vector<std::string> &filenames)
+{
+    // The digits right before the extension number the frames. Frames follow
+    // the given file for as long as the next number exists, written with at
+    // least as many digits.
+    std::string::size_type separator = filename.find_last_of("\\/");
+    std::string::size_type extension = filename.rfind('.');
+    std::string::size_type digits = 0;
+
+    filenames.assign(1, filename);
+
+    if (extension == std::string::npos || (separator != std::string::npos && extension < separator))
+        extension = filename.size();
+
+    digits = extension;
+
+    while (digits > 0 && digits - 1 != separator && filename[digits - 1] >= '0' && filename[digits - 1] <= '9')
+        --digits;
+
+    if (digits == extension)
+        return;
+
+    std::string prefix = filename.substr(0, digits);
+    std::string suffix = filename.substr(extension);
+    int width = static_cast<int>(extension - digits);
+    long number = atol(filename.substr(digits, extension - digits).c_str());
+    char szNumber[32];
+
+    while (true)
+    {
+        snprintf(szNumber, sizeof(szNumber), "%0*ld", width, ++number);
+
+        std::string next = prefix + szNumber + suffix;
+
+        if (!FileExists(next))
+            break;
+
+        filenames.push_back(next);
+    }
+}
+
+void FrameSequence::close()
+{
+    if (m_thread.joinable())
+    {
+        m_quit = true;
+        m_thread.join();
+    }
+
+    // Decode jobs write into the slots and read the encoded frames.
+    for (int i = 0; i < RING_SIZE; ++i)
+    {
+        JobSystem::instance().wait(m_slots[i].decoded);
+        m_slots[i].frame = -1;
+        std::vector<float>().swap(m_slots[i].vertices);
+    }
+
+    for (size_t i = 0; i < m_frames.size(); ++i)
+        delete m_frames[i];
+
+    m_frames.clear();
+    m_filenames.clear();
+    m_indices.clear();
+    m_original.clear();
+    m_base.clear();
+    m_numberOfVertices = 0;
+    m_encodedSize = 0;
+    m_quit = false;
+    m_encoding = false;
+    m_isOpen = false;
+}
+
+bool FrameSequence::open(const std::string &filename, const Model::ImportFilter &filter)
+{
+    close();
+
+    if (!FileExists(filename))
+        return false;
+
+    findFrames(filename, m_filenames);
+    m_filter = filter;
+    m_isOpen = true;
+    m_encoding = true;
+    m_thread = std::thread(&FrameSequence::encoderMain, this);
+
+    return true;
+}
+
+void FrameSequence::prefetch(int frame)
+{
+    // Makes sure that frame and the ones after it are being decoded, wrapping
+    // around at the last frame. Slots holding frames outside of that range
+    // are reused once they are no longer being decoded.
+    int numberOfFrames = getNumberOfFrames();
+    int wanted[RING_SIZE];
+    int numberOfWanted = std::min(static_cast<int>(RING_SIZE), numberOfFrames);
+
+    if (numberOfFrames == 0)
+        return;
+
+    for (int i = 0; i < numberOfWanted; ++i)
+        wanted[i] = (frame + i) % numberOfFrames;
+
+    for (int i = 0; i < numberOfWanted; ++i)
+    {
+        Slot *pFree = 0;
+        bool found = false;
+
+        for (int j = 0; !found && j < RING_SIZE; ++j)
+            found = m_slots[j].frame == wanted[i];
+
+        for (int j = 0; !found && !pFree && j < RING_SIZE; ++j)
+        {
+            Slot &slot = m_slots[j];
+
+            if (slot.decoded.isDone() && std::find(wanted, wanted + numberOfWanted, slot.frame) == wanted + numberOfWanted)
+                pFree = &slot;
+        }
+
+        if (found || !pFree)
+            continue;
+
+        const EncodedFrame *pFrame = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            pFrame = m_frames[wanted[i]];
+        }
+
+        pFree->frame = wanted[i];
+
+        // Without workers a job would only run once somebody waits for it.
+        if (JobSystem::instance().getNumberOfWorkers() == 0)
+        {
+            decode(*pFrame, pFree->vertices);
+            continue;
+        }
+
+        JobSystem::instance().run([this, pFree, pFrame]()
+            {
+                TRACE_ZONE("FrameSequence::decode");
+                decode(*pFrame, pFree->vertices);
+            }, &pFree->decoded);
+    }
+}
+
+size_t FrameSequence::getEncodedSize() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_encodedSize;
+}
+
+const float *FrameSequence::getFrame(int frame) const
+{
+    for (int i = 0; i < RING_SIZE; ++i)
+    {
+        const Slot &slot = m_slots[i];
+
+        if (slot.frame == frame && slot.decoded.isDone() && !slot.vertices.empty())
+            return &slot.vertices[0];
+    }
+
+    return 0;
+}
+
+int FrameSequence::getNumberOfFrames() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return static_cast<int>(m_frames.size());
+}
+
+int FrameSequence::getNumberOfVertices() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_frames.empty() ? 0 : m_numberOfVertices;
+}
+
+bool FrameSequence::importCallback(void *pContext, Model::ImportPhase, long, long)
+{
+    return !static_cast<FrameSequence *>(pContext)->m_quit;
+}
+
+void FrameSequence::decode(const EncodedFrame &frame, std::vector<float> &vertices) const
+{
+    vertices = m_base;
+
+    if (frame.deltas.empty())
+        return;
+
+    const short *pDeltas = &frame.deltas[0];
+    float *pVertices = &vertices[0];
+
+    for (int i = 0; i < m_numberOfVertices; ++i)
+    {
+        float *pVertex = pVertices + i * FLOATS_PER_VERTEX;
+        const short *pDelta = pDeltas + i * FLOATS_PER_VERTEX;
+
+        for (int j = 0; j < FLOATS_PER_VERTEX; ++j)
+            pVertex[j] += pDelta[j] * frame.scales[j];
+
+        float length = std::sqrt(pVertex[3] * pVertex[3] + pVertex[4] * pVertex[4] + pVertex[5] * pVertex[5]);
+
+        if (length > 0.0f)
+        {
+            pVertex[3] /= length;
+            pVertex[4] /= length;
+            pVertex[5] /= length;
+        }
+    }
+}
+
+FrameSequence::EncodedFrame *FrameSequence::encode(const Model &model) const
+{
+    // Position differences are scaled the way Model::normalize() scaled the
+    // first frame, so they apply directly to the positions that are shown.
+    EncodedFrame *pFrame = new EncodedFrame;
+    std::vector<float> deltas(m_numberOfVertices * FLOATS_PER_VERTEX);
+    float largest[FLOATS_PER_VERTEX] = {0.0f};
+    bool changed = false;
+
+    for (int i = 0; i < m_numberOfVertices; ++i)
+    {
+        const Model::Vertex &vertex = model.getVertex(i);
+        const float *pOriginal = &m_original[i * FLOATS_PER_VERTEX];
+        float *pDelta = &deltas[i * FLOATS_PER_VERTEX];
+
+        for (int j = 0; j < 3; ++j)
+        {
+            pDelta[j] = (vertex.position[j] - pOriginal[j]) * m_scale;
+            pDelta[3 + j] = vertex.normal[j] - pOriginal[3 + j];
+        }
+
+        for (int j = 0; j < FLOATS_PER_VERTEX; ++j)
+            largest[j] = std::max(largest[j], std::fabs(pDelta[j]));
+    }
+
+    for (int i = 0; i < FLOATS_PER_VERTEX; ++i)
+    {
+        pFrame->scales[i] = largest[i] / QUANTIZATION_RANGE;
+        changed = changed || largest[i] > 0.0f;
+    }
+
+    // A frame that is the same as the first one needs no differences at all.
+    if (!changed)
+        return pFrame;
+
+    pFrame->deltas.resize(deltas.size());
+
+    for (size_t i = 0; i < deltas.size(); ++i)
+    {
+        float scale = pFrame->scales[i % FLOATS_PER_VERTEX];
+        pFrame->deltas[i] = (scale > 0.0f) ? static_cast<short>(std::floor(deltas[i] / scale + 0.5f)) : 0;
+    }
+
+    return pFrame;
+}
+
+void FrameSequence::encoderMain()
+{
+    // Frames are imported one at a time, since the import already runs its
+    // heavier steps on the job system.
+    JobSystem::setDefaultPriority(JobSystem::PRIORITY_LOW);
+    Trace::setThreadName("frame sequence");
+
+    Model first;
+
+    if (!importFrame(0, first) || first.getNumberOfPrototypes() > 0)
+    {
+        m_encoding = false;
+        return;
+    }
+
+    m_numberOfVertices = first.getNumberOfVertices();
+    m_scale = (first.getRadius() > 0.0f) ? 1.0f / first.getRadius() : 1.0f;
+    m_indices.assign(first.getIndexBuffer(), first.getIndexBuffer() + first.getNumberOfIndices());
+    m_original.resize(m_numberOfVertices * FLOATS_PER_VERTEX);
+    m_base.resize(m_numberOfVertices * FLOATS_PER_VERTEX);
+
+    for (int i = 0; i < m_numberOfVertices; ++i)
+    {
+        memcpy(&m_original[i * FLOATS_PER_VERTEX], first.getVertex(i).position, 3 * sizeof(float));
+        memcpy(&m_original[i * FLOATS_PER_VERTEX + 3], first.getVertex(i).normal, 3 * sizeof(float));
+    }
+
+    first.normalize();
+
+    for (int i = 0; i < m_numberOfVertices; ++i)
+    {
+        memcpy(&m_base[i * FLOATS_PER_VERTEX], first.getVertex(i).position, 3 * sizeof(float));
+        memcpy(&m_base[i * FLOATS_PER_VERTEX + 3], first.getVertex(i).normal, 3 * sizeof(float));
+    }
+
+    first.destroy();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_frames.push_back(new EncodedFrame);
+        memset(m_frames.back()->scales, 0, sizeof(m_frames.back()->scales));
+    }
+
+    for (int i = 1; i < getNumberOfFiles() && !m_quit; ++i)
+    {
+        Model model;
+
+        if (!importFrame(i, model) || model.getNumberOfVertices() != m_numberOfVertices ||
+            model.getNumberOfIndices() != static_cast<int>(m_indices.size()) ||
+            (!m_indices.empty() && memcmp(model.getIndexBuffer(), &m_indices[0], m_indices.size() * sizeof(int)) != 0))
+            break;
+
+        EncodedFrame *pFrame = 0;
+
+        {
+            TRACE_ZONE("FrameSequence::encode");
+            pFrame = encode(model);
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_frames.push_back(pFrame);
+        m_encodedSize += pFrame->deltas.size() * sizeof(short) + sizeof(EncodedFrame);
+    }
+
+    m_encoding = false;
+}
+
+bool FrameSequence::importFrame(int frame, Model &model) const
+{
+    TRACE_ZONE("FrameSequence::importFrame");
+
+    model.setImportCallback(importCallback, const_cast<FrameSequence *>(this));
+    model.setImportFilter(m_filter);
+
+    bool imported = model.import(m_filenames[frame].c_str());
+
+    model.setImportCallback(0, 0);
+    return imported;
+}
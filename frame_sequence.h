@@ -0,0 +1,108 @@
+#if !defined(FRAME_SEQUENCE_H)
+#define FRAME_SEQUENCE_H
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "job_system.h"
+#include "model_obj.h"
+
+// Plays back a simulation written as one OBJ file per time step, numbered
+// like "wave_0001.obj", "wave_0002.obj" and so on. open() takes the first
+// file, and a background thread imports it and the files after it in order.
+// A frame is kept when it has the same vertices and index buffer as the first
+// one, and is then stored as position and normal differences from the first
+// frame, quantized to 16 bits per component with a scale per frame and
+// component. The sequence ends at the first file that is missing, fails to
+// import or has different faces. Positions are in the space of the first
+// frame after Model::normalize(), the same as the model that the viewer shows.
+//
+// prefetch() decodes the next RING_SIZE frames into a ring of buffers on the
+// job system, and getFrame() returns a frame once its buffer is ready.
+// Tangents are those of the first frame.
+
+class FrameSequence
+{
+public:
+    enum
+    {
+        RING_SIZE = 8,
+        FLOATS_PER_VERTEX = 6
+    };
+
+    FrameSequence();
+    ~FrameSequence();
+
+    static void findFrames(const std::string &filename, std::vector<std::string> &filenames);
+
+    void close();
+    bool open(const std::string &filename, const Model::ImportFilter &filter);
+    void prefetch(int frame);
+
+    size_t getEncodedSize() const;
+    const float *getFrame(int frame) const;
+    int getNumberOfFiles() const;
+    int getNumberOfFrames() const;
+    int getNumberOfVertices() const;
+    bool isEncoding() const;
+    bool isOpen() const;
+
+private:
+    struct EncodedFrame
+    {
+        float scales[FLOATS_PER_VERTEX];
+        std::vector<short> deltas;
+    };
+
+    struct Slot
+    {
+        int frame;
+        std::vector<float> vertices;
+        JobSystem::Counter decoded;
+    };
+
+    FrameSequence(const FrameSequence &);
+    FrameSequence &operator=(const FrameSequence &);
+
+    static bool importCallback(void *pContext, Model::ImportPhase phase,
+        long bytesParsed, long bytesTotal);
+
+    void decode(const EncodedFrame &frame, std::vector<float> &vertices) const;
+    EncodedFrame *encode(const Model &model) const;
+    void encoderMain();
+    bool importFrame(int frame, Model &model) const;
+
+    std::vector<std::string> m_filenames;
+    Model::ImportFilter m_filter;
+    bool m_isOpen;
+
+    // Written by the encoder before it adds the first frame.
+    int m_numberOfVertices;
+    float m_scale;
+    std::vector<int> m_indices;
+    std::vector<float> m_original;
+    std::vector<float> m_base;
+
+    mutable std::mutex m_mutex;
+    std::vector<EncodedFrame *> m_frames;
+    size_t m_encodedSize;
+    std::atomic<bool> m_quit;
+    std::atomic<bool> m_encoding;
+    std::thread m_thread;
+
+    Slot m_slots[RING_SIZE];
+};
+
+inline int FrameSequence::getNumberOfFiles() const
+{ return static_cast<int>(m_filenames.size()); }
+
+inline bool FrameSequence::isEncoding() const
+{ return m_encoding; }
+
+inline bool FrameSequence::isOpen() const
+{ return m_isOpen; }
+
+#endif
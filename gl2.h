@@ -800,4 +800,593 @@ extern PFNGLUNIFORMMATRIX4X3FVPROC                glUniformMatrix4x3fv;
 
 }
 
+// Optional instrumented dispatch. When GL2_INSTRUMENT is defined before this
+// header is included, the GL calls redirected at the end of this file go
+// through wrappers that count draw calls, triangles, state changes, program
+// and texture binds, uniform lookups and bytes sent to the GL. Enable and
+// client state flags, the active texture units, the GL_TEXTURE_2D binding of
+// each unit, the array and element array buffer bindings and the current
+// program are compared against a shadow copy of the GL state and redundant
+// changes are dropped. Draws from client memory count the indices plus the
+// referenced vertex range of each enabled client-side array, which is what
+// the driver has to copy for every such draw. The shadow copy only sees
+// changes made through the wrappers and starts out as a new context's state;
+// call GL2InvalidateState() after making a new context current. Without
+// GL2_INSTRUMENT the counters stay zero.
+
+#define GL2_UNKNOWN_STATE 0xFFFFFFFF
+
+struct GL2Counters
+{
+    unsigned int drawCalls;
+    unsigned int triangles;
+    unsigned int stateChanges;
+    unsigned int redundantStateChanges;
+    unsigned int programBinds;
+    unsigned int textureBinds;
+    unsigned int uniformLookups;
+    size_t bytesTransferred;
+};
+
+struct GL2ShadowState
+{
+    enum
+    {
+        MAX_TEXTURE_UNITS = 8,
+        MAX_FLAGS = 32
+    };
+
+    struct Flag
+    {
+        GLenum name;
+        GLenum unit;
+        bool enabled;
+    };
+
+    // Vertex, normal and one texture coordinate array per unit.
+    struct ClientArray
+    {
+        GLsizei elementSize;
+        bool clientMemory;
+    };
+
+    GL2ShadowState()
+    { invalidate(); }
+
+    void invalidate()
+    {
+        activeTexture = GL2_UNKNOWN_STATE;
+        clientActiveTexture = GL2_UNKNOWN_STATE;
+        program = GL2_UNKNOWN_STATE;
+        arrayBuffer = 0;
+        elementArrayBuffer = 0;
+        numberOfFlags = 0;
+
+        for (int i = 0; i < MAX_TEXTURE_UNITS; ++i)
+            textures[i] = GL2_UNKNOWN_STATE;
+
+        for (int i = 0; i < MAX_TEXTURE_UNITS + 2; ++i)
+        {
+            arrays[i].elementSize = 0;
+            arrays[i].clientMemory = false;
+        }
+    }
+
+    GLenum activeTexture;
+    GLenum clientActiveTexture;
+    GLuint program;
+    GLuint arrayBuffer;
+    GLuint elementArrayBuffer;
+    GLuint textures[MAX_TEXTURE_UNITS];
+    int numberOfFlags;
+    Flag flags[MAX_FLAGS];
+    ClientArray arrays[MAX_TEXTURE_UNITS + 2];
+};
+
+inline GL2Counters &GL2GetMutableCounters()
+{
+    static GL2Counters counters;
+    return counters;
+}
+
+inline GL2ShadowState &GL2GetShadowState()
+{
+    static GL2ShadowState state;
+    return state;
+}
+
+inline const GL2Counters &GL2GetCounters()
+{
+    return GL2GetMutableCounters();
+}
+
+inline void GL2ResetCounters()
+{
+    GL2Counters &counters = GL2GetMutableCounters();
+    counters = GL2Counters();
+}
+
+inline void GL2InvalidateState()
+{
+    GL2GetShadowState().invalidate();
+}
+
+#if defined(GL2_INSTRUMENT)
+
+inline bool GL2CountStateChange(bool changed)
+{
+    if (changed)
+        ++GL2GetMutableCounters().stateChanges;
+    else
+        ++GL2GetMutableCounters().redundantStateChanges;
+
+    return changed;
+}
+
+inline unsigned int GL2CountTriangles(GLenum mode, GLsizei count)
+{
+    switch (mode)
+    {
+    case GL_TRIANGLES:
+        return count / 3;
+
+    case GL_TRIANGLE_STRIP:
+    case GL_TRIANGLE_FAN:
+    case GL_POLYGON:
+        return (count > 2) ? count - 2 : 0;
+
+    case GL_QUADS:
+        return count / 4 * 2;
+
+    case GL_QUAD_STRIP:
+        return (count > 3) ? (count - 2) / 2 * 2 : 0;
+
+    default:
+        return 0;
+    }
+}
+
+// Texture targets are enabled per texture unit and the texture coordinate
+// array per client texture unit; all other flags are global.
+inline GLenum GL2GetFlagUnit(GLenum name)
+{
+    switch (name)
+    {
+    case GL_TEXTURE_1D:
+    case GL_TEXTURE_2D:
+    case GL_TEXTURE_3D:
+    case GL_TEXTURE_CUBE_MAP:
+        return GL2GetShadowState().activeTexture;
+
+    case GL_TEXTURE_COORD_ARRAY:
+        return GL2GetShadowState().clientActiveTexture;
+
+    default:
+        return 0;
+    }
+}
+
+// Returns false if the flag is already known to have the requested value.
+inline bool GL2UpdateFlag(GLenum name, bool enabled)
+{
+    GL2ShadowState &state = GL2GetShadowState();
+    GLenum unit = GL2GetFlagUnit(name);
+
+    for (int i = 0; i < state.numberOfFlags; ++i)
+    {
+        GL2ShadowState::Flag &flag = state.flags[i];
+
+        if (flag.name != name)
+            continue;
+
+        if (unit == GL2_UNKNOWN_STATE)
+        {
+            flag = state.flags[--state.numberOfFlags];
+            --i;
+            continue;
+        }
+
+        if (flag.unit != unit)
+            continue;
+
+        if (flag.enabled == enabled)
+            return false;
+
+        flag.enabled = enabled;
+        return true;
+    }
+
+    if (unit != GL2_UNKNOWN_STATE && state.numberOfFlags < GL2ShadowState::MAX_FLAGS)
+    {
+        GL2ShadowState::Flag flag = {name, unit, enabled};
+        state.flags[state.numberOfFlags++] = flag;
+    }
+
+    return true;
+}
+
+inline bool GL2IsFlagEnabled(GLenum name, GLenum unit)
+{
+    const GL2ShadowState &state = GL2GetShadowState();
+
+    for (int i = 0; i < state.numberOfFlags; ++i)
+    {
+        if (state.flags[i].name == name && state.flags[i].unit == unit)
+            return state.flags[i].enabled;
+    }
+
+    return false;
+}
+
+inline GLsizei GL2GetTypeSize(GLenum type)
+{
+    switch (type)
+    {
+    case GL_BYTE:
+    case GL_UNSIGNED_BYTE:
+        return 1;
+
+    case GL_SHORT:
+    case GL_UNSIGNED_SHORT:
+        return 2;
+
+    case GL_DOUBLE:
+        return 8;
+
+    default:
+        return 4;
+    }
+}
+
+inline void GL2SetClientArray(int i, GLint size, GLenum type)
+{
+    GL2ShadowState &state = GL2GetShadowState();
+
+    state.arrays[i].elementSize = size * GL2GetTypeSize(type);
+    state.arrays[i].clientMemory = (state.arrayBuffer == 0);
+}
+
+// Bytes of the enabled client-side vertex arrays for the vertex range
+// [first, last].
+inline size_t GL2CountClientVertexBytes(GLuint first, GLuint last)
+{
+    const GL2ShadowState &state = GL2GetShadowState();
+    size_t bytes = 0;
+    size_t vertices = last - first + 1;
+
+    if (state.arrays[0].clientMemory && GL2IsFlagEnabled(GL_VERTEX_ARRAY, 0))
+        bytes += vertices * state.arrays[0].elementSize;
+
+    if (state.arrays[1].clientMemory && GL2IsFlagEnabled(GL_NORMAL_ARRAY, 0))
+        bytes += vertices * state.arrays[1].elementSize;
+
+    for (int i = 0; i < GL2ShadowState::MAX_TEXTURE_UNITS; ++i)
+    {
+        if (state.arrays[i + 2].clientMemory && GL2IsFlagEnabled(GL_TEXTURE_COORD_ARRAY, GL_TEXTURE0 + i))
+            bytes += vertices * state.arrays[i + 2].elementSize;
+    }
+
+    return bytes;
+}
+
+inline size_t GL2CountElementBytes(GLsizei count, GLenum type, const GLvoid *indices)
+{
+    if (GL2GetShadowState().elementArrayBuffer != 0 || count <= 0)
+        return 0;
+
+    GLuint first = 0xFFFFFFFF;
+    GLuint last = 0;
+    GLuint index = 0;
+
+    for (GLsizei i = 0; i < count; ++i)
+    {
+        switch (type)
+        {
+        case GL_UNSIGNED_BYTE:
+            index = static_cast<const GLubyte *>(indices)[i];
+            break;
+
+        case GL_UNSIGNED_SHORT:
+            index = static_cast<const GLushort *>(indices)[i];
+            break;
+
+        default:
+            index = static_cast<const GLuint *>(indices)[i];
+            break;
+        }
+
+        first = (index < first) ? index : first;
+        last = (index > last) ? index : last;
+    }
+
+    return count * GL2GetTypeSize(type) + GL2CountClientVertexBytes(first, last);
+}
+
+inline void GL2ActiveTexture(GLenum texture)
+{
+    GL2ShadowState &state = GL2GetShadowState();
+
+    if (GL2CountStateChange(state.activeTexture != texture))
+    {
+        state.activeTexture = texture;
+        glActiveTexture(texture);
+    }
+}
+
+inline void GL2BindBuffer(GLenum target, GLuint buffer)
+{
+    GL2ShadowState &state = GL2GetShadowState();
+    GLuint *pBound = 0;
+
+    if (target == GL_ARRAY_BUFFER)
+        pBound = &state.arrayBuffer;
+    else if (target == GL_ELEMENT_ARRAY_BUFFER)
+        pBound = &state.elementArrayBuffer;
+
+    if (GL2CountStateChange(!pBound || *pBound != buffer))
+    {
+        if (pBound)
+            *pBound = buffer;
+
+        glBindBuffer(target, buffer);
+    }
+}
+
+inline void GL2BindTexture(GLenum target, GLuint texture)
+{
+    GL2ShadowState &state = GL2GetShadowState();
+    GLuint unit = state.activeTexture - GL_TEXTURE0;
+
+    // The unsigned unit is out of range while the active texture is unknown.
+    if (target == GL_TEXTURE_2D && unit < GL2ShadowState::MAX_TEXTURE_UNITS)
+    {
+        if (!GL2CountStateChange(state.textures[unit] != texture))
+            return;
+
+        state.textures[unit] = texture;
+    }
+    else
+    {
+        if (target == GL_TEXTURE_2D)
+        {
+            for (int i = 0; i < GL2ShadowState::MAX_TEXTURE_UNITS; ++i)
+                state.textures[i] = GL2_UNKNOWN_STATE;
+        }
+
+        GL2CountStateChange(true);
+    }
+
+    ++GL2GetMutableCounters().textureBinds;
+    glBindTexture(target, texture);
+}
+
+inline void GL2BufferData(GLenum target, GLsizeiptr size, const GLvoid *data, GLenum usage)
+{
+    if (data)
+        GL2GetMutableCounters().bytesTransferred += size;
+
+    glBufferData(target, size, data, usage);
+}
+
+inline void GL2BufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid *data)
+{
+    GL2GetMutableCounters().bytesTransferred += size;
+    glBufferSubData(target, offset, size, data);
+}
+
+inline void GL2ClientActiveTexture(GLenum texture)
+{
+    GL2ShadowState &state = GL2GetShadowState();
+
+    if (GL2CountStateChange(state.clientActiveTexture != texture))
+    {
+        state.clientActiveTexture = texture;
+        glClientActiveTexture(texture);
+    }
+}
+
+inline void GL2DeleteBuffers(GLsizei n, const GLuint *buffers)
+{
+    GL2ShadowState &state = GL2GetShadowState();
+
+    // Deleting a bound buffer reverts the binding to zero.
+    for (GLsizei i = 0; i < n; ++i)
+    {
+        if (state.arrayBuffer == buffers[i])
+            state.arrayBuffer = 0;
+
+        if (state.elementArrayBuffer == buffers[i])
+            state.elementArrayBuffer = 0;
+    }
+
+    glDeleteBuffers(n, buffers);
+}
+
+inline void GL2DeleteTextures(GLsizei n, const GLuint *textures)
+{
+    GL2ShadowState &state = GL2GetShadowState();
+
+    // Deleting a bound texture reverts the binding to zero.
+    for (GLsizei i = 0; i < n; ++i)
+    {
+        for (int j = 0; j < GL2ShadowState::MAX_TEXTURE_UNITS; ++j)
+        {
+            if (state.textures[j] == textures[i])
+                state.textures[j] = 0;
+        }
+    }
+
+    glDeleteTextures(n, textures);
+}
+
+inline void GL2Disable(GLenum cap)
+{
+    if (GL2CountStateChange(GL2UpdateFlag(cap, false)))
+        glDisable(cap);
+}
+
+inline void GL2DisableClientState(GLenum array)
+{
+    if (GL2CountStateChange(GL2UpdateFlag(array, false)))
+        glDisableClientState(array);
+}
+
+inline void GL2DrawArrays(GLenum mode, GLint first, GLsizei count)
+{
+    GL2Counters &counters = GL2GetMutableCounters();
+
+    ++counters.drawCalls;
+    counters.triangles += GL2CountTriangles(mode, count);
+
+    if (count > 0)
+        counters.bytesTransferred += GL2CountClientVertexBytes(first, first + count - 1);
+
+    glDrawArrays(mode, first, count);
+}
+
+inline void GL2DrawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices)
+{
+    GL2Counters &counters = GL2GetMutableCounters();
+
+    ++counters.drawCalls;
+    counters.triangles += GL2CountTriangles(mode, count);
+    counters.bytesTransferred += GL2CountElementBytes(count, type, indices);
+    glDrawElements(mode, count, type, indices);
+}
+
+inline void GL2Enable(GLenum cap)
+{
+    if (GL2CountStateChange(GL2UpdateFlag(cap, true)))
+        glEnable(cap);
+}
+
+inline void GL2EnableClientState(GLenum array)
+{
+    if (GL2CountStateChange(GL2UpdateFlag(array, true)))
+        glEnableClientState(array);
+}
+
+inline GLint GL2GetUniformLocation(GLuint program, const GLchar *name)
+{
+    ++GL2GetMutableCounters().uniformLookups;
+    return glGetUniformLocation(program, name);
+}
+
+inline void GL2Materialf(GLenum face, GLenum pname, GLfloat param)
+{
+    GL2CountStateChange(true);
+    glMaterialf(face, pname, param);
+}
+
+inline void GL2Materialfv(GLenum face, GLenum pname, const GLfloat *params)
+{
+    GL2CountStateChange(true);
+    glMaterialfv(face, pname, params);
+}
+
+inline void GL2MultiDrawElements(GLenum mode, const GLsizei *count, GLenum type, const void **indices, GLsizei primcount)
+{
+    GL2Counters &counters = GL2GetMutableCounters();
+
+    ++counters.drawCalls;
+
+    for (GLsizei i = 0; i < primcount; ++i)
+    {
+        counters.triangles += GL2CountTriangles(mode, count[i]);
+        counters.bytesTransferred += GL2CountElementBytes(count[i], type, indices[i]);
+    }
+
+    glMultiDrawElements(mode, count, type, indices, primcount);
+}
+
+inline void GL2NormalPointer(GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+    GL2SetClientArray(1, 3, type);
+    glNormalPointer(type, stride, pointer);
+}
+
+inline void GL2PopAttrib()
+{
+    // Buffer bindings and array pointers are client state, which
+    // glPopAttrib() leaves alone.
+    GL2ShadowState &state = GL2GetShadowState();
+    GL2ShadowState clientState = state;
+
+    glPopAttrib();
+    state.invalidate();
+    state.arrayBuffer = clientState.arrayBuffer;
+    state.elementArrayBuffer = clientState.elementArrayBuffer;
+
+    for (int i = 0; i < GL2ShadowState::MAX_TEXTURE_UNITS + 2; ++i)
+        state.arrays[i] = clientState.arrays[i];
+}
+
+inline void GL2TexCoordPointer(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+    GLuint unit = GL2GetShadowState().clientActiveTexture - GL_TEXTURE0;
+
+    if (unit < GL2ShadowState::MAX_TEXTURE_UNITS)
+        GL2SetClientArray(unit + 2, size, type);
+
+    glTexCoordPointer(size, type, stride, pointer);
+}
+
+inline void GL2Uniform1f(GLint location, GLfloat v0)
+{
+    GL2CountStateChange(true);
+    glUniform1f(location, v0);
+}
+
+inline void GL2Uniform1i(GLint location, GLint v0)
+{
+    GL2CountStateChange(true);
+    glUniform1i(location, v0);
+}
+
+inline void GL2UseProgram(GLuint program)
+{
+    GL2ShadowState &state = GL2GetShadowState();
+
+    if (GL2CountStateChange(state.program != program))
+    {
+        state.program = program;
+        ++GL2GetMutableCounters().programBinds;
+        glUseProgram(program);
+    }
+}
+
+inline void GL2VertexPointer(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+    GL2SetClientArray(0, size, type);
+    glVertexPointer(size, type, stride, pointer);
+}
+
+#define glActiveTexture         GL2ActiveTexture
+#define glBindBuffer            GL2BindBuffer
+#define glBindTexture           GL2BindTexture
+#define glBufferData            GL2BufferData
+#define glBufferSubData         GL2BufferSubData
+#define glClientActiveTexture   GL2ClientActiveTexture
+#define glDeleteBuffers         GL2DeleteBuffers
+#define glDeleteTextures        GL2DeleteTextures
+#define glDisable               GL2Disable
+#define glDisableClientState    GL2DisableClientState
+#define glDrawArrays            GL2DrawArrays
+#define glDrawElements          GL2DrawElements
+#define glEnable                GL2Enable
+#define glEnableClientState     GL2EnableClientState
+#define glGetUniformLocation    GL2GetUniformLocation
+#define glMaterialf             GL2Materialf
+#define glMaterialfv            GL2Materialfv
+#define glMultiDrawElements     GL2MultiDrawElements
+#define glNormalPointer         GL2NormalPointer
+#define glPopAttrib             GL2PopAttrib
+#define glTexCoordPointer       GL2TexCoordPointer
+#define glUniform1f             GL2Uniform1f
+#define glUniform1i             GL2Uniform1i
+#define glUseProgram            GL2UseProgram
+#define glVertexPointer         GL2VertexPointer
+
+#endif
+
 #endif
\ No newline at end of file
@@ -0,0 +1,611 @@
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "image.h"
+#include "job_system.h"
+
+extern "C" {
+#include <jpeglib.h>
+}
+
+#include <png.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IMAGE_USE_SSE2
+#endif
+
+#if defined(__SSSE3__) || defined(__AVX__)
+#include <tmmintrin.h>
+#define IMAGE_USE_SSSE3
+#endif
+
+namespace
+{
+    enum ChannelOrder
+    {
+        ORDER_RGB,
+        ORDER_BGR
+    };
+
+    struct PngSource
+    {
+        const unsigned char *pData;
+        size_t size;
+        size_t offset;
+    };
+
+    void PngReadData(png_structp pPng, png_bytep pDest, png_size_t length)
+    {
+        PngSource *pSource = static_cast<PngSource *>(png_get_io_ptr(pPng));
+
+        if (pSource->offset + length > pSource->size)
+            png_error(pPng, "unexpected end of data");
+
+        memcpy(pDest, pSource->pData + pSource->offset, length);
+        pSource->offset += length;
+    }
+
+    // 4 channel rows: either a straight copy or an R/B swap. The SSE2 path
+    // swaps 4 pixels per iteration with shifts and masks.
+    void Convert4(const unsigned char *pSrc, unsigned char *pDest, int width, bool swap)
+    {
+        if (!swap)
+        {
+            memcpy(pDest, pSrc, width * 4);
+            return;
+        }
+
+        int x = 0;
+
+#if defined(IMAGE_USE_SSE2)
+        const __m128i maskAG = _mm_set1_epi32(static_cast<int>(0xFF00FF00));
+        const __m128i maskRB = _mm_set1_epi32(0x00FF00FF);
+
+        for (; x + 4 <= width; x += 4)
+        {
+            __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pSrc + x * 4));
+            __m128i ag = _mm_and_si128(px, maskAG);
+            __m128i rb = _mm_and_si128(px, maskRB);
+
+            rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(pDest + x * 4), _mm_or_si128(ag, rb));
+        }
+#endif
+
+        for (; x < width; ++x)
+        {
+            const unsigned char *pPixel = pSrc + x * 4;
+            unsigned char *pOut = pDest + x * 4;
+            unsigned char c0 = pPixel[0];
+
+            pOut[0] = pPixel[2];
+            pOut[1] = pPixel[1];
+            pOut[2] = c0;
+            pOut[3] = pPixel[3];
+        }
+    }
+
+    // 3 channel rows are expanded to 4 channels with an opaque alpha. With
+    // SSSE3 a single shuffle expands (and optionally swaps) 4 pixels at a time.
+    void Convert3(const unsigned char *pSrc, unsigned char *pDest, int width, bool swap)
+    {
+        int x = 0;
+
+#if defined(IMAGE_USE_SSSE3)
+        const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+        const __m128i shuffle = swap ?
+            _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1) :
+            _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+
+        for (; (x + 4) * 3 + 4 <= width * 3; x += 4)
+        {
+            __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pSrc + x * 3));
+            px = _mm_or_si128(_mm_shuffle_epi8(px, shuffle), alpha);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(pDest + x * 4), px);
+        }
+#endif
+
+        int r = swap ? 2 : 0;
+        int b = swap ? 0 : 2;
+
+        for (; x < width; ++x)
+        {
+            const unsigned char *pPixel = pSrc + x * 3;
+            unsigned char *pOut = pDest + x * 4;
+
+            pOut[0] = pPixel[r];
+            pOut[1] = pPixel[1];
+            pOut[2] = pPixel[b];
+            pOut[3] = 255;
+        }
+    }
+
+    void Convert1(const unsigned char *pSrc, unsigned char *pDest, int width)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            unsigned char *pOut = pDest + x * 4;
+            pOut[0] = pOut[1] = pOut[2] = pSrc[x];
+            pOut[3] = 255;
+        }
+    }
+
+    void ConvertRow(const unsigned char *pSrc, int channels, ChannelOrder order,
+                    Image::PixelFormat format, unsigned char *pDest, int width)
+    {
+        bool swap = (order == ORDER_RGB) != (format == Image::PIXEL_FORMAT_RGBA);
+
+        switch (channels)
+        {
+        case 1:
+            Convert1(pSrc, pDest, width);
+            break;
+
+        case 3:
+            Convert3(pSrc, pDest, width, swap);
+            break;
+
+        case 4:
+            Convert4(pSrc, pDest, width, swap);
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    struct JpegErrorManager
+    {
+        jpeg_error_mgr base;
+        jmp_buf jump;
+    };
+
+    void JpegErrorExit(j_common_ptr pInfo)
+    {
+        longjmp(reinterpret_cast<JpegErrorManager *>(pInfo->err)->jump, 1);
+    }
+
+    void JpegOutputMessage(j_common_ptr)
+    {
+    }
+
+    unsigned int ReadLE16(const unsigned char *p)
+    { return p[0] | (p[1] << 8); }
+
+    unsigned int ReadLE32(const unsigned char *p)
+    { return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<unsigned int>(p[3]) << 24); }
+}
+
+Image::Image() : m_width(0), m_height(0), m_format(PIXEL_FORMAT_BGRA), m_bottomUp(true)
+{
+}
+
+Image::~Image()
+{
+    destroy();
+}
+
+bool Image::create(int width, int height)
+{
+    if (width <= 0 || height <= 0 || width > 32768 || height > 32768)
+        return false;
+
+    m_width = width;
+    m_height = height;
+    m_pixels.resize(static_cast<size_t>(width) * height * 4);
+    return true;
+}
+
+void Image::destroy()
+{
+    m_width = 0;
+    m_height = 0;
+    m_pixels.clear();
+}
+
+unsigned char *Image::getRow(int y)
+{
+    int row = m_bottomUp ? m_height - 1 - y : y;
+    return &m_pixels[static_cast<size_t>(row) * m_width * 4];
+}
+
+bool Image::load(const char *pszFilename, PixelFormat format, bool bottomUp)
+{
+    std::vector<unsigned char> data;
+
+    if (!readFile(pszFilename, data))
+    {
+        destroy();
+        return false;
+    }
+
+    return load(&data[0], data.size(), format, bottomUp);
+}
+
+bool Image::load(const unsigned char *pData, size_t size, PixelFormat format, bool bottomUp)
+{
+    destroy();
+
+    m_format = format;
+    m_bottomUp = bottomUp;
+
+    bool loaded = false;
+
+    if (size > 3 && pData[0] == 0xFF && pData[1] == 0xD8 && pData[2] == 0xFF)
+        loaded = loadJpeg(pData, size);
+    else if (size > 8 && !png_sig_cmp(const_cast<png_bytep>(pData), 0, 8))
+        loaded = loadPng(pData, size);
+    else if (size > 2 && pData[0] == 'B' && pData[1] == 'M')
+        loaded = loadBmp(pData, size);
+    else
+        loaded = loadTga(pData, size);
+
+    if (!loaded)
+        destroy();
+
+    return loaded;
+}
+
+void Image::loadMany(const std::vector<std::string> &filenames, std::vector<Image> &images,
+                     PixelFormat format, bool bottomUp)
+{
+    std::vector<JobSystem::Job> jobs;
+
+    images.resize(filenames.size());
+
+    for (size_t i = 0; i < filenames.size(); ++i)
+    {
+        Image *pImage = &images[i];
+        const char *pszFilename = filenames[i].c_str();
+
+        jobs.push_back([pImage, pszFilename, format, bottomUp]()
+            { pImage->load(pszFilename, format, bottomUp); });
+    }
+
+    JobSystem::instance().run(jobs);
+}
+
+bool Image::loadBmp(const unsigned char *pData, size_t size)
+{
+    if (size < 54)
+        return false;
+
+    unsigned int dataOffset = ReadLE32(pData + 10);
+    unsigned int headerSize = ReadLE32(pData + 14);
+    int width = static_cast<int>(ReadLE32(pData + 18));
+    int height = static_cast<int>(ReadLE32(pData + 22));
+    unsigned int bitCount = ReadLE16(pData + 28);
+    unsigned int compression = ReadLE32(pData + 30);
+    unsigned int paletteSize = ReadLE32(pData + 46);
+    bool topDown = height < 0;
+    bool hasAlpha = false;
+
+    height = topDown ? -height : height;
+
+    if (compression != 0 && !(compression == 3 && bitCount == 32))
+        return false;
+
+    if (bitCount != 8 && bitCount != 24 && bitCount != 32)
+        return false;
+
+    if (!create(width, height))
+        return false;
+
+    size_t srcPitch = ((static_cast<size_t>(width) * bitCount + 31) / 32) * 4;
+
+    if (dataOffset > size || srcPitch * height > size - dataOffset)
+        return false;
+
+    const unsigned char *pPalette = pData + 14 + headerSize;
+    std::vector<unsigned char> expanded;
+
+    if (bitCount == 8)
+    {
+        if (paletteSize == 0)
+            paletteSize = 256;
+
+        // The header fields are checked one at a time so that their sum
+        // can't wrap around.
+        if (paletteSize > 256 || headerSize > size - 14 ||
+            static_cast<size_t>(paletteSize) * 4 > size - 14 - headerSize)
+        {
+            return false;
+        }
+
+        expanded.resize(width * 4);
+    }
+
+    // The fourth byte of a 32 bit pixel is padding, unless a version 3 or
+    // later header gives it an alpha mask.
+    if (bitCount == 32)
+    {
+        hasAlpha = compression == 3 && headerSize >= 56 && size >= 14 + 56 && ReadLE32(pData + 14 + 52) != 0;
+
+        if (!hasAlpha)
+            expanded.resize(width * 4);
+    }
+
+    for (int y = 0; y < height; ++y)
+    {
+        int srcRow = topDown ? y : height - 1 - y;
+        const unsigned char *pSrc = pData + dataOffset + srcPitch * srcRow;
+
+        switch (bitCount)
+        {
+        case 8:
+            for (int x = 0; x < width; ++x)
+            {
+                const unsigned char *pEntry = pPalette + std::min<unsigned int>(pSrc[x], paletteSize - 1) * 4;
+
+                expanded[x * 4 + 0] = pEntry[0];
+                expanded[x * 4 + 1] = pEntry[1];
+                expanded[x * 4 + 2] = pEntry[2];
+                expanded[x * 4 + 3] = 255;
+            }
+
+            ConvertRow(&expanded[0], 4, ORDER_BGR, m_format, getRow(y), width);
+            break;
+
+        case 24:
+            ConvertRow(pSrc, 3, ORDER_BGR, m_format, getRow(y), width);
+            break;
+
+        case 32:
+            if (hasAlpha)
+            {
+                ConvertRow(pSrc, 4, ORDER_BGR, m_format, getRow(y), width);
+                break;
+            }
+
+            memcpy(&expanded[0], pSrc, width * 4);
+
+            for (int x = 0; x < width; ++x)
+                expanded[x * 4 + 3] = 255;
+
+            ConvertRow(&expanded[0], 4, ORDER_BGR, m_format, getRow(y), width);
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool Image::loadJpeg(const unsigned char *pData, size_t size)
+{
+    jpeg_decompress_struct info;
+    JpegErrorManager error;
+    std::vector<unsigned char> scanline;
+
+    info.err = jpeg_std_error(&error.base);
+    error.base.error_exit = JpegErrorExit;
+    error.base.output_message = JpegOutputMessage;
+
+    if (setjmp(error.jump))
+    {
+        jpeg_destroy_decompress(&info);
+        return false;
+    }
+
+    jpeg_create_decompress(&info);
+    jpeg_mem_src(&info, const_cast<unsigned char *>(pData), static_cast<unsigned long>(size));
+    jpeg_read_header(&info, TRUE);
+
+    int channels = 3;
+    ChannelOrder order = ORDER_RGB;
+
+    if (info.jpeg_color_space == JCS_GRAYSCALE)
+    {
+        info.out_color_space = JCS_GRAYSCALE;
+        channels = 1;
+    }
+    else
+    {
+#if defined(JCS_EXTENSIONS)
+        info.out_color_space = (m_format == PIXEL_FORMAT_BGRA) ? JCS_EXT_BGRA : JCS_EXT_RGBA;
+        order = (m_format == PIXEL_FORMAT_BGRA) ? ORDER_BGR : ORDER_RGB;
+        channels = 4;
+#else
+        info.out_color_space = JCS_RGB;
+#endif
+    }
+
+    jpeg_start_decompress(&info);
+
+    if (!create(info.output_width, info.output_height))
+        longjmp(error.jump, 1);
+
+    scanline.resize(info.output_width * info.output_components);
+
+    while (info.output_scanline < info.output_height)
+    {
+        int y = info.output_scanline;
+        JSAMPROW pRow = &scanline[0];
+
+        if (channels == 4)
+            pRow = getRow(y);
+
+        jpeg_read_scanlines(&info, &pRow, 1);
+
+        if (channels != 4)
+            ConvertRow(&scanline[0], channels, order, m_format, getRow(y), m_width);
+    }
+
+    jpeg_finish_decompress(&info);
+    jpeg_destroy_decompress(&info);
+    return true;
+}
+
+bool Image::loadPng(const unsigned char *pData, size_t size)
+{
+    PngSource source = {pData, size, 0};
+    png_structp pPng = png_create_read_struct(PNG_LIBPNG_VER_STRING, 0, 0, 0);
+    png_infop pInfo = pPng ? png_create_info_struct(pPng) : 0;
+    std::vector<png_bytep> rows;
+
+    if (!pInfo)
+    {
+        png_destroy_read_struct(&pPng, 0, 0);
+        return false;
+    }
+
+    if (setjmp(png_jmpbuf(pPng)))
+    {
+        png_destroy_read_struct(&pPng, &pInfo, 0);
+        return false;
+    }
+
+    png_set_read_fn(pPng, &source, PngReadData);
+    png_read_info(pPng, pInfo);
+
+    int colorType = png_get_color_type(pPng, pInfo);
+
+    png_set_expand(pPng);
+    png_set_strip_16(pPng);
+
+    if (colorType == PNG_COLOR_TYPE_GRAY || colorType == PNG_COLOR_TYPE_GRAY_ALPHA)
+        png_set_gray_to_rgb(pPng);
+
+    if (!(colorType & PNG_COLOR_MASK_ALPHA) && !png_get_valid(pPng, pInfo, PNG_INFO_tRNS))
+        png_set_filler(pPng, 0xFF, PNG_FILLER_AFTER);
+
+    if (m_format == PIXEL_FORMAT_BGRA)
+        png_set_bgr(pPng);
+
+    png_set_interlace_handling(pPng);
+    png_read_update_info(pPng, pInfo);
+
+    if (!create(png_get_image_width(pPng, pInfo), png_get_image_height(pPng, pInfo)) ||
+        png_get_rowbytes(pPng, pInfo) != static_cast<png_size_t>(m_width) * 4)
+    {
+        png_destroy_read_struct(&pPng, &pInfo, 0);
+        return false;
+    }
+
+    rows.resize(m_height);
+
+    for (int y = 0; y < m_height; ++y)
+        rows[y] = getRow(y);
+
+    png_read_image(pPng, &rows[0]);
+    png_read_end(pPng, 0);
+    png_destroy_read_struct(&pPng, &pInfo, 0);
+    return true;
+}
+
+bool Image::readFile(const char *pszFilename, std::vector<unsigned char> &data)
+{
+    FILE *pFile = fopen(pszFilename, "rb");
+
+    if (!pFile)
+        return false;
+
+    fseek(pFile, 0, SEEK_END);
+    long size = ftell(pFile);
+    fseek(pFile, 0, SEEK_SET);
+
+    if (size <= 0)
+    {
+        fclose(pFile);
+        return false;
+    }
+
+    data.resize(size);
+    bool ok = fread(&data[0], 1, size, pFile) == static_cast<size_t>(size);
+
+    fclose(pFile);
+    return ok;
+}
+
+bool Image::loadTga(const unsigned char *pData, size_t size)
+{
+    if (size < 18)
+        return false;
+
+    unsigned int idLength = pData[0];
+    unsigned int colorMapType = pData[1];
+    unsigned int imageType = pData[2];
+    int width = static_cast<int>(ReadLE16(pData + 12));
+    int height = static_cast<int>(ReadLE16(pData + 14));
+    unsigned int bitCount = pData[16];
+    bool topDown = (pData[17] & 0x20) != 0;
+    bool rle = imageType == 10 || imageType == 11;
+    int channels = static_cast<int>(bitCount / 8);
+
+    if (colorMapType != 0 || (imageType != 2 && imageType != 3 && !rle))
+        return false;
+
+    if (channels != 1 && channels != 3 && channels != 4)
+        return false;
+
+    if (!create(width, height))
+        return false;
+
+    const unsigned char *pSrc = pData + 18 + idLength;
+    const unsigned char *pEnd = pData + size;
+    size_t rowBytes = static_cast<size_t>(width) * channels;
+    std::vector<unsigned char> row(rowBytes);
+    int packetCount = 0;
+    bool packetIsRun = false;
+    unsigned char runPixel[4] = {0};
+
+    for (int y = 0; y < height; ++y)
+    {
+        const unsigned char *pRow = pSrc;
+
+        if (!rle)
+        {
+            if (pSrc + rowBytes > pEnd)
+                return false;
+
+            pSrc += rowBytes;
+        }
+        else
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                if (packetCount == 0)
+                {
+                    if (pSrc >= pEnd)
+                        return false;
+
+                    packetIsRun = (*pSrc & 0x80) != 0;
+                    packetCount = (*pSrc++ & 0x7F) + 1;
+
+                    if (packetIsRun)
+                    {
+                        if (pSrc + channels > pEnd)
+                            return false;
+
+                        memcpy(runPixel, pSrc, channels);
+                        pSrc += channels;
+                    }
+                }
+
+                if (packetIsRun)
+                {
+                    memcpy(&row[x * channels], runPixel, channels);
+                }
+                else
+                {
+                    if (pSrc + channels > pEnd)
+                        return false;
+
+                    memcpy(&row[x * channels], pSrc, channels);
+                    pSrc += channels;
+                }
+
+                --packetCount;
+            }
+
+            pRow = &row[0];
+        }
+
+        int destRow = topDown ? y : height - 1 - y;
+        ConvertRow(pRow, channels, ORDER_BGR, m_format, getRow(destRow), width);
+    }
+
+    return true;
+}
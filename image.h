@@ -0,0 +1,76 @@
+#if !defined(IMAGE_H)
+#define IMAGE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class Image
+{
+public:
+    enum PixelFormat
+    {
+        PIXEL_FORMAT_BGRA,
+        PIXEL_FORMAT_RGBA
+    };
+
+    Image();
+    ~Image();
+
+    void destroy();
+    bool load(const char *pszFilename, PixelFormat format = PIXEL_FORMAT_BGRA,
+        bool bottomUp = true);
+    bool load(const unsigned char *pData, size_t size,
+        PixelFormat format = PIXEL_FORMAT_BGRA, bool bottomUp = true);
+
+    static void loadMany(const std::vector<std::string> &filenames,
+        std::vector<Image> &images, PixelFormat format = PIXEL_FORMAT_BGRA,
+        bool bottomUp = true);
+    static bool readFile(const char *pszFilename, std::vector<unsigned char> &data);
+
+    int getBytesPerPixel() const;
+    int getHeight() const;
+    int getPitch() const;
+    PixelFormat getPixelFormat() const;
+    const unsigned char *getPixels() const;
+    int getWidth() const;
+    bool isValid() const;
+
+private:
+    bool create(int width, int height);
+    unsigned char *getRow(int y);
+
+    bool loadBmp(const unsigned char *pData, size_t size);
+    bool loadJpeg(const unsigned char *pData, size_t size);
+    bool loadPng(const unsigned char *pData, size_t size);
+    bool loadTga(const unsigned char *pData, size_t size);
+
+    int m_width;
+    int m_height;
+    PixelFormat m_format;
+    bool m_bottomUp;
+    std::vector<unsigned char> m_pixels;
+};
+
+inline int Image::getBytesPerPixel() const
+{ return 4; }
+
+inline int Image::getHeight() const
+{ return m_height; }
+
+inline int Image::getPitch() const
+{ return m_width * 4; }
+
+inline Image::PixelFormat Image::getPixelFormat() const
+{ return m_format; }
+
+inline const unsigned char *Image::getPixels() const
+{ return m_pixels.empty() ? 0 : &m_pixels[0]; }
+
+inline int Image::getWidth() const
+{ return m_width; }
+
+inline bool Image::isValid() const
+{ return !m_pixels.empty(); }
+
+#endif
@@ -0,0 +1,468 @@
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include "job_system.h"
+#include "trace.h"
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    JobSystem::Options g_options = {0, 0};
+
+    thread_local JobSystem *t_pJobSystem = 0;
+    thread_local int t_worker = -1;
+    thread_local JobSystem::Priority t_priority = JobSystem::PRIORITY_HIGH;
+
+    int CountBits(unsigned long long mask)
+    {
+        int count = 0;
+
+        for (; mask != 0; mask &= mask - 1)
+            ++count;
+
+        return count;
+    }
+
+    unsigned long long GetNthBit(unsigned long long mask, int n)
+    {
+        for (int i = 0; i < n; ++i)
+            mask &= mask - 1;
+
+        return mask & (~mask + 1);
+    }
+
+    void PinCurrentThread(unsigned long long mask)
+    {
+#if defined(_WIN32)
+        SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(mask));
+#elif defined(__linux__)
+        cpu_set_t cpuSet;
+
+        CPU_ZERO(&cpuSet);
+
+        for (int i = 0; i < 64 && i < CPU_SETSIZE; ++i)
+        {
+            if (mask & (1ULL << i))
+                CPU_SET(i, &cpuSet);
+        }
+
+        pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+#else
+        (void)mask;
+#endif
+    }
+
+    double ToSeconds(long long ticks)
+    {
+        return std::chrono::duration<double>(Clock::duration(ticks)).count();
+    }
+}
+
+JobSystem::Counter::Counter() : m_pending(0)
+{
+}
+
+JobSystem::JobSystem(const Options &options) : m_quit(false), m_queued(0), m_scheduled(0)
+{
+    int numberOfWorkers = options.numberOfWorkers;
+
+    if (numberOfWorkers <= 0)
+    {
+        if (options.affinityMask != 0)
+            numberOfWorkers = CountBits(options.affinityMask);
+        else
+            numberOfWorkers = static_cast<int>(std::thread::hardware_concurrency()) - 1;
+    }
+
+    numberOfWorkers = std::max(0, numberOfWorkers);
+
+    for (int i = 0; i < numberOfWorkers; ++i)
+    {
+        Worker *pWorker = new Worker;
+
+        pWorker->jobsExecuted = 0;
+        pWorker->jobsStolen = 0;
+        pWorker->busyTicks = 0;
+        pWorker->idleTicks = 0;
+        m_workers.push_back(pWorker);
+    }
+
+    for (int i = 0; i < numberOfWorkers; ++i)
+    {
+        unsigned long long mask = 0;
+
+        if (options.affinityMask != 0)
+            mask = GetNthBit(options.affinityMask, i % CountBits(options.affinityMask));
+
+        m_threads.push_back(std::thread([this, i, mask]()
+            {
+                if (mask != 0)
+                    PinCurrentThread(mask);
+
+                Trace::setThreadName(("worker " + std::to_string(i + 1)).c_str());
+                workerMain(i);
+            }));
+    }
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_quit = true;
+    }
+
+    m_wake.notify_all();
+
+    for (size_t i = 0; i < m_threads.size(); ++i)
+        m_threads[i].join();
+
+    for (size_t i = 0; i < m_workers.size(); ++i)
+        delete m_workers[i];
+}
+
+void JobSystem::configure(const Options &options)
+{
+    g_options = options;
+}
+
+JobSystem &JobSystem::instance()
+{
+    static JobSystem jobSystem(g_options);
+    return jobSystem;
+}
+
+void JobSystem::setDefaultPriority(Priority priority)
+{
+    if (priority < NUMBER_OF_PRIORITIES)
+        t_priority = priority;
+}
+
+JobSystem::WorkerStatistics JobSystem::getWorkerStatistics(int worker) const
+{
+    const Worker *pWorker = m_workers[worker];
+    WorkerStatistics statistics;
+
+    statistics.jobsExecuted = pWorker->jobsExecuted;
+    statistics.jobsStolen = pWorker->jobsStolen;
+    statistics.busySeconds = ToSeconds(pWorker->busyTicks);
+    statistics.idleSeconds = ToSeconds(pWorker->idleTicks);
+
+    return statistics;
+}
+
+void JobSystem::resetStatistics()
+{
+    for (size_t i = 0; i < m_workers.size(); ++i)
+    {
+        m_workers[i]->jobsExecuted = 0;
+        m_workers[i]->jobsStolen = 0;
+        m_workers[i]->busyTicks = 0;
+        m_workers[i]->idleTicks = 0;
+    }
+}
+
+void JobSystem::parallelFor(int begin, int end, int grainSize, const RangeJob &job, Priority priority)
+{
+    if (end <= begin)
+        return;
+
+    grainSize = std::max(1, grainSize);
+
+    if (end - begin <= grainSize || m_workers.empty())
+    {
+        job(begin, end);
+        return;
+    }
+
+    Counter counter;
+
+    for (int first = begin; first < end; first += grainSize)
+    {
+        int last = std::min(end, first + grainSize);
+        run([&job, first, last]() { job(first, last); }, &counter, priority);
+    }
+
+    wait(counter);
+}
+
+void JobSystem::run(const std::vector<Job> &jobs, Priority priority)
+{
+    if (jobs.empty())
+        return;
+
+    Counter counter;
+
+    for (size_t i = 0; i < jobs.size(); ++i)
+        run(jobs[i], &counter, priority);
+
+    wait(counter);
+}
+
+void JobSystem::run(const Job &job, Counter *pCounter, Priority priority, Counter *pDependency)
+{
+    Entry entry = {job, pCounter, resolve(priority)};
+
+    if (pCounter)
+        ++pCounter->m_pending;
+
+    if (pDependency)
+    {
+        std::lock_guard<std::mutex> lock(pDependency->m_mutex);
+
+        if (pDependency->m_pending.load() != 0)
+        {
+            Counter::Continuation continuation = {entry.job, entry.pCounter, entry.priority};
+            pDependency->m_continuations.push_back(continuation);
+            return;
+        }
+    }
+
+    schedule(entry);
+}
+
+void JobSystem::wait(Counter &counter)
+{
+    int worker = (t_pJobSystem == this) ? t_worker : -1;
+
+    // The calling thread helps execute jobs so that nested parallelFor calls
+    // made from inside a job cannot starve the workers. It only picks up jobs
+    // of its own priority or higher, and lower priority jobs of the counter it
+    // waits on, so that waiting never runs unrelated background work.
+    while (!counter.isDone())
+    {
+        Entry entry;
+        unsigned int scheduled = m_scheduled.load();
+
+        if (tryGetJob(worker, entry, t_priority, &counter))
+        {
+            execute(entry);
+            continue;
+        }
+
+        // Jobs that are queued but can't be taken here don't count, so
+        // sleep until something new is scheduled.
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+
+        while (!counter.isDone() && m_scheduled.load() == scheduled)
+            m_wake.wait(lock);
+    }
+
+    // finish() decrements under the counter's mutex; taking it here makes sure
+    // that call has returned before the caller is allowed to destroy the counter.
+    std::lock_guard<std::mutex> lock(counter.m_mutex);
+}
+
+void JobSystem::execute(Entry &entry)
+{
+    Worker *pWorker = (t_pJobSystem == this && t_worker >= 0) ? m_workers[t_worker] : 0;
+    Priority previous = t_priority;
+    Clock::time_point start;
+
+    if (pWorker)
+        start = Clock::now();
+
+    t_priority = entry.priority;
+    entry.job();
+    t_priority = previous;
+
+    if (pWorker)
+    {
+        pWorker->busyTicks += (Clock::now() - start).count();
+        ++pWorker->jobsExecuted;
+    }
+
+    finish(entry.pCounter);
+}
+
+void JobSystem::finish(Counter *pCounter)
+{
+    if (!pCounter)
+        return;
+
+    std::vector<Counter::Continuation> continuations;
+
+    {
+        std::lock_guard<std::mutex> lock(pCounter->m_mutex);
+
+        if (--pCounter->m_pending != 0)
+            return;
+
+        continuations.swap(pCounter->m_continuations);
+    }
+
+    for (size_t i = 0; i < continuations.size(); ++i)
+    {
+        Entry entry = {continuations[i].job, continuations[i].pCounter, continuations[i].priority};
+        schedule(entry);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+    }
+
+    m_wake.notify_all();
+}
+
+JobSystem::Priority JobSystem::resolve(Priority priority) const
+{
+    return (priority < NUMBER_OF_PRIORITIES) ? priority : t_priority;
+}
+
+void JobSystem::schedule(const Entry &entry)
+{
+    if (t_pJobSystem == this && t_worker >= 0)
+    {
+        Worker *pWorker = m_workers[t_worker];
+        std::lock_guard<std::mutex> lock(pWorker->mutex);
+        pWorker->queues[entry.priority].push_back(entry);
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock(m_injectionMutex);
+        m_injection[entry.priority].push_back(entry);
+    }
+
+    ++m_queued;
+    ++m_scheduled;
+
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+    }
+
+    // A waiting thread may not be allowed to take this job, so it must not
+    // be the only one that is woken up.
+    m_wake.notify_all();
+}
+
+bool JobSystem::takeJob(std::deque<Entry> &queue, bool fromBack, bool anyJob,
+                        const Counter *pCounter, Entry &entry)
+{
+    if (queue.empty())
+        return false;
+
+    if (anyJob)
+    {
+        entry = fromBack ? queue.back() : queue.front();
+
+        if (fromBack)
+            queue.pop_back();
+        else
+            queue.pop_front();
+
+        return true;
+    }
+
+    for (std::deque<Entry>::iterator i = queue.begin(); i != queue.end(); ++i)
+    {
+        if (i->pCounter == pCounter)
+        {
+            entry = *i;
+            queue.erase(i);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool JobSystem::tryGetJob(int worker, Entry &entry, Priority lowest, const Counter *pCounter)
+{
+    // Lanes below lowest only give up jobs that count towards pCounter.
+    int numberOfWorkers = static_cast<int>(m_workers.size());
+
+    for (int priority = 0; priority < NUMBER_OF_PRIORITIES; ++priority)
+    {
+        bool anyJob = priority <= lowest;
+
+        if (!anyJob && !pCounter)
+            break;
+
+        if (worker >= 0)
+        {
+            Worker *pWorker = m_workers[worker];
+            std::lock_guard<std::mutex> lock(pWorker->mutex);
+
+            if (takeJob(pWorker->queues[priority], true, anyJob, pCounter, entry))
+            {
+                --m_queued;
+                return true;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_injectionMutex);
+
+            if (takeJob(m_injection[priority], false, anyJob, pCounter, entry))
+            {
+                --m_queued;
+                return true;
+            }
+        }
+
+        for (int i = 1; i <= numberOfWorkers; ++i)
+        {
+            int victim = (worker + i) % numberOfWorkers;
+
+            if (victim == worker)
+                continue;
+
+            Worker *pVictim = m_workers[victim];
+            std::lock_guard<std::mutex> lock(pVictim->mutex);
+
+            if (takeJob(pVictim->queues[priority], false, anyJob, pCounter, entry))
+            {
+                --m_queued;
+
+                if (worker >= 0)
+                    ++m_workers[worker]->jobsStolen;
+
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+void JobSystem::workerMain(int worker)
+{
+    Worker *pWorker = m_workers[worker];
+
+    t_pJobSystem = this;
+    t_worker = worker;
+
+    while (true)
+    {
+        Entry entry;
+
+        if (tryGetJob(worker, entry, PRIORITY_LOW, 0))
+        {
+            execute(entry);
+            continue;
+        }
+
+        Clock::time_point start = Clock::now();
+
+        {
+            std::unique_lock<std::mutex> lock(m_sleepMutex);
+
+            while (!m_quit && m_queued.load() == 0)
+                m_wake.wait(lock);
+
+            if (m_quit)
+                break;
+        }
+
+        pWorker->idleTicks += (Clock::now() - start).count();
+    }
+}
@@ -0,0 +1,147 @@
+#if !defined(JOB_SYSTEM_H)
+#define JOB_SYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing job scheduler. Each worker owns one deque per priority lane;
+// it pushes and pops at the back of its own deques and steals from the front
+// of other workers' deques when it runs dry. Threads that are not workers
+// submit through a shared injection queue and help execute jobs while they
+// wait on a counter, though only jobs of their own priority or higher and
+// the lower priority jobs of that counter.
+//
+// Jobs submitted without an explicit priority inherit the priority of the job
+// that submits them, or the thread's default priority outside of a job. An
+// affinity mask pins worker i to the i-th set bit of the mask, wrapping
+// around; a zero mask leaves placement to the OS. configure() only has an
+// effect before the first call to instance().
+
+class JobSystem
+{
+public:
+    typedef std::function<void()> Job;
+    typedef std::function<void(int, int)> RangeJob;
+
+    enum Priority
+    {
+        PRIORITY_HIGH,
+        PRIORITY_LOW,
+        NUMBER_OF_PRIORITIES,
+        PRIORITY_DEFAULT = NUMBER_OF_PRIORITIES
+    };
+
+    struct Options
+    {
+        int numberOfWorkers;
+        unsigned long long affinityMask;
+    };
+
+    struct WorkerStatistics
+    {
+        unsigned long long jobsExecuted;
+        unsigned long long jobsStolen;
+        double busySeconds;
+        double idleSeconds;
+    };
+
+    class Counter
+    {
+    public:
+        Counter();
+
+        bool isDone() const;
+
+    private:
+        friend class JobSystem;
+
+        struct Continuation
+        {
+            Job job;
+            Counter *pCounter;
+            Priority priority;
+        };
+
+        Counter(const Counter &);
+        Counter &operator=(const Counter &);
+
+        std::atomic<int> m_pending;
+        std::mutex m_mutex;
+        std::vector<Continuation> m_continuations;
+    };
+
+    explicit JobSystem(const Options &options);
+    ~JobSystem();
+
+    static void configure(const Options &options);
+    static JobSystem &instance();
+    static void setDefaultPriority(Priority priority);
+
+    int getNumberOfThreads() const;
+    int getNumberOfWorkers() const;
+    WorkerStatistics getWorkerStatistics(int worker) const;
+    void resetStatistics();
+
+    void parallelFor(int begin, int end, int grainSize, const RangeJob &job,
+        Priority priority = PRIORITY_DEFAULT);
+    void run(const std::vector<Job> &jobs, Priority priority = PRIORITY_DEFAULT);
+    void run(const Job &job, Counter *pCounter, Priority priority = PRIORITY_DEFAULT,
+        Counter *pDependency = 0);
+    void wait(Counter &counter);
+
+private:
+    struct Entry
+    {
+        Job job;
+        Counter *pCounter;
+        Priority priority;
+    };
+
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Entry> queues[NUMBER_OF_PRIORITIES];
+        std::atomic<unsigned long long> jobsExecuted;
+        std::atomic<unsigned long long> jobsStolen;
+        std::atomic<long long> busyTicks;
+        std::atomic<long long> idleTicks;
+    };
+
+    JobSystem(const JobSystem &);
+    JobSystem &operator=(const JobSystem &);
+
+    void execute(Entry &entry);
+    void finish(Counter *pCounter);
+    Priority resolve(Priority priority) const;
+    void schedule(const Entry &entry);
+    static bool takeJob(std::deque<Entry> &queue, bool fromBack, bool anyJob,
+        const Counter *pCounter, Entry &entry);
+    bool tryGetJob(int worker, Entry &entry, Priority lowest, const Counter *pCounter);
+    void workerMain(int worker);
+
+    bool m_quit;
+    std::atomic<int> m_queued;
+    std::atomic<unsigned int> m_scheduled;
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wake;
+    std::mutex m_injectionMutex;
+    std::deque<Entry> m_injection[NUMBER_OF_PRIORITIES];
+    std::vector<Worker *> m_workers;
+    std::vector<std::thread> m_threads;
+};
+
+inline bool JobSystem::Counter::isDone() const
+{ return m_pending.load() == 0; }
+
+inline int JobSystem::getNumberOfThreads() const
+{ return static_cast<int>(m_threads.size()) + 1; }
+
+inline int JobSystem::getNumberOfWorkers() const
+{ return static_cast<int>(m_threads.size()); }
+
+#endif
@@ -2,13 +2,20 @@
 #define WIN32_LEAN_AND_MEAN
 #endif
 
+#if !defined(DISABLE_GL_INSTRUMENTATION)
+#define GL2_INSTRUMENT
+#endif
+
 #include <windows.h>
 #include <commdlg.h>	
 #include <shellapi.h>   
 #include <GL/gl.h>
 #include <GL/glu.h>
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <map>
 #include <sstream>
 #include <stdexcept>
@@ -20,9 +27,24 @@
 #endif
 
 #include "bitmap.h"
+#include "buffer_arena.h"
+#include "camera_path.h"
+#include "chunk_streamer.h"
+#include "compressed_texture.h"
+#include "file_watcher.h"
+#include "frame_profiler.h"
+#include "frame_sequence.h"
 #include "gl2.h"
+#include "image.h"
+#include "job_system.h"
+#include "mipmap.h"
+#include "model_loader.h"
 #include "model_obj.h"
+#include "progressive_mesh.h"
+#include "render_list.h"
 #include "resource.h"
+#include "texture_cache.h"
+#include "trace.h"
 #include "WGL_ARB_multisample.h"
 
 #define APP_TITLE "OpenGL Model Viewer"
@@ -34,6 +56,10 @@
 #define GL_TEXTURE_MAX_ANISOTROPY_EXT     0x84FE
 #define GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT 0x84FF
 
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT   0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT  0x83F3
+#define GL_COMPRESSED_RG_RGTC2            0x8DBD
+
 #define CAMERA_FOVY  60.0f
 #define CAMERA_ZFAR  10.0f
 #define CAMERA_ZNEAR 0.1f
@@ -42,8 +68,95 @@
 #define MOUSE_DOLLY_SPEED 0.02f    
 #define MOUSE_TRACK_SPEED 0.005f    
 
+#define TEXTURE_CACHE_BUDGET (256 * 1024 * 1024)
+#define TEXTURE_UPLOAD_TIME_SLICE 0.004f
+
+#define FRAME_COUNTERS_TIMER 1
+#define LOADING_POLL_INTERVAL 15
+
+#define INTERACTIVE_FRAME_TIME (1.0f / 60.0f)
+#define INTERACTIVE_SAMPLE_FRAMES 4
+
+#define FRAME_PROFILE_FILENAME "frame_profile"
+#define TRACE_FILENAME "trace.json"
+
+#define CAMERA_PATH_FILENAME "camera_path.txt"
+#define REPLAY_RESULTS_FILENAME "replay"
+#define REPLAY_TIME_STEP (1.0f / 60.0f)
+#define OVERLAY_LINE_HEIGHT 14
+
+#define SCENE_BUFFER_MIN_VERTICES (1 << 16)
+#define SCENE_BUFFER_MIN_INDICES (1 << 18)
+#define GROUPS_PER_JOB 256
+
+#define CHUNK_MEMORY_BUDGET (512 * 1024 * 1024)
+#define CHUNK_SCREEN_ERROR 2.0f
+#define PROGRESSIVE_TIME_SLICE 0.004f
+#define PROGRESSIVE_SPLITS_PER_STEP 1024
+
+#define SEQUENCE_POLL_INTERVAL 1
+
 typedef std::map<std::string, GLuint> ModelTextures;
 
+struct ModelBuffers
+{
+    int vertexBlock;
+    int indexBlock;
+    std::vector<int> indexOffsets;
+};
+
+struct RenderState
+{
+    float ambient[4];
+    float diffuse[4];
+    float specular[4];
+    float shininess;
+    float alpha;
+    GLuint program;
+    GLuint colorMap;
+    GLuint normalMap;
+    int vertexFormat;
+    int model;
+    int prototype;
+};
+
+struct FrameCounters
+{
+    unsigned int framesDrawn;
+    unsigned int idleWaits;
+    unsigned int framesDrawnLastSecond;
+};
+
+struct PendingModel
+{
+    ModelLoader::Result *pResult;
+    ModelTextures modelTextures;
+    size_t texture;
+    int level;
+    GLuint id;
+};
+
+struct TextureSource
+{
+    std::string resolvedFilename;
+    bool linear;
+};
+
+struct ModelSource
+{
+    std::string filename;
+    std::map<std::string, TextureSource> textures;
+};
+
+struct SequencePlayback
+{
+    float frameRate;
+    int frame;
+    int lateFrames;
+    bool paused;
+    INT64 dueTime;
+};
+
 HWND                g_hWnd;
 HDC                 g_hDC;
 HGLRC               g_hRC;
@@ -52,9 +165,15 @@ int                 g_framesPerSecond;
 int                 g_windowWidth;
 int                 g_windowHeight;
 int                 g_msaaSamples;
+int                 g_detailLevel;
+int                 g_replayFrame = -1;
+int                 g_selectedGroup = -1;
 GLuint              g_nullTexture;
 GLuint              g_blinnPhongShader;
 GLuint              g_normalMappingShader;
+GLuint              g_overlayFont;
+GLuint              g_sceneVertexBuffer;
+GLuint              g_sceneIndexBuffer;
 float               g_maxAnisotrophy;
 float               g_heading;
 float               g_pitch;
@@ -65,40 +184,133 @@ bool                g_hasFocus;
 bool                g_enableWireframe;
 bool                g_enableTextures = true;
 bool                g_supportsProgrammablePipeline;
+bool                g_supportsNonPowerOfTwoTextures;
+bool                g_supportsS3TC;
+bool                g_supportsRGTC;
+bool                g_supportsVertexBufferObjects;
+bool                g_supportsMultiDraw;
+bool                g_enableTextureCompression = true;
 bool                g_cullBackFaces = true;
+bool                g_pinWorkerThreads = true;
+bool                g_needsRedraw = true;
+bool                g_isInteracting;
+bool                g_enableDetailLevels = true;
+bool                g_showFrameCounters;
+bool                g_showProfilerOverlay;
+bool                g_isRecordingCameraPath;
+bool                g_quitAfterReplay;
+FrameCounters       g_frameCounters;
+GL2Counters         g_glCounters;
+std::string         g_windowTitle = APP_TITLE;
+std::string         g_replayFilename;
+CameraPath          g_cameraPath;
+RenderList          g_renderList;
+BufferArena         g_vertexArena;
+BufferArena         g_indexArena;
 
 std::vector<Model> models;
 std::vector<ModelTextures> modelTexturesList;
-
+std::vector<ModelBuffers> modelBuffersList;
+std::vector<ModelSource> modelSourcesList;
+std::vector<int> g_groupOffsets;
+std::vector<unsigned char> g_visibleGroups;
+std::vector<int> g_visibleCounts;
+std::vector<const void *> g_visibleIndices;
+PendingModel g_pendingModel;
+SequencePlayback g_sequencePlayback;
+Model::ImportFilter g_importFilter;
+ProgressiveMesh g_progressiveMesh;
+
+void    ApplyCameraKey(const CameraPath::Key &key);
+void    ApplyChunkTransform();
+void    BeginPlainMeshes();
+void    BuildRenderList();
+void    CancelLoading();
 void    Cleanup();
 void    CleanupApp();
+void    CompactSceneBuffers();
 GLuint  CompileShader(GLenum type, const GLchar *pszSource, GLint length);
 HWND    CreateAppWindow(const WNDCLASSEX &wcl, const char *pszTitle);
+void    CreateModelBuffers(const Model &model, ModelBuffers &buffers);
 GLuint  CreateNullTexture(int width, int height);
+GLuint  CreateTexture(int numberOfLevels);
+void    CullChunks();
+void    CullGroups();
+void    DeleteModelBuffers(ModelBuffers &buffers);
+void    DeleteSceneBuffers();
+void    DeleteTexture(unsigned int id);
+void    DiscardLoadResult(ModelLoader::Result *pResult);
+void    DrawBatch(const RenderList::Batch &batch, int detailLevel);
+void    DrawChunks();
 void    DrawFrame();
 void    DrawModelUsingFixedFuncPipeline();
 void    DrawModelUsingProgrammablePipeline();
+void    DrawPlainMesh(const std::vector<float> &vertices, const std::vector<unsigned int> &indices);
+void    DrawProfilerOverlay();
+void    DrawProgressiveMesh();
+void    EndPlainMeshes();
+void    ExportFrameProfile();
 bool    ExtensionSupported(const char *pszExtensionName);
+void    FinishReload();
+CameraPath::Key GetCameraKey();
 float   GetElapsedTimeInSeconds();
+unsigned int GetFrameActivity();
+size_t  GetGroupModel(int group);
+ModelLoader::Options GetLoadOptions();
+void    GrowSceneBuffers(size_t numberOfVertices, size_t numberOfIndices);
+void    HideSelectedGroup();
 bool    Init();
 void    InitApp();
 void    InitGL();
+bool    IsBatchVisible(const RenderList::Batch &batch);
+void    IsolateSelectedGroup();
 GLuint  LinkShaders(GLuint vertShader, GLuint fragShader);
 void    LoadModel(const char *pszFilename);
 GLuint  LoadShaderProgramFromResource(const char *pResouceId, std::string &infoLog);
-GLuint  LoadTexture(const char *pszFilename);
 void    Log(const char *pszMessage);
+void    NotifyFilesChanged(void *);
+void    OpenChunkFile(const char *pszFilename);
 void    ProcessMenu(HWND hWnd, WPARAM wParam, LPARAM lParam);
 void    ProcessMouseInput(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam);
 void    ReadTextFileFromResource(const char *pResouceId, std::string &buffer);
+void    RecordModelTextures(ModelSource &source, const std::vector<ModelLoader::Texture> &textures);
 void    ResetCamera();
+void    SelectGroup(int step);
 void    SetProcessorAffinity();
+void    SetVertexArrays(const Model *pModel, const ModelBuffers *pBuffers, bool tangents);
+void    SetWindowTitle(const std::string &title);
+void    ShowAllGroups();
+void    StartReplay(const char *pszFilename);
+void    StopReplay();
+void    ToggleCameraRecording();
+void    ToggleFrameCounters();
 void    ToggleFullScreen();
+void    ToggleTracing();
 void    UnloadModel();
+void    UnloadModel(size_t model);
+void    UpdateCameraPath();
+void    UpdateDetailLevel(float frameTimeSec);
 void    UpdateFrame(float elapsedTimeSec);
+void    UpdateFrameCounters();
 void    UpdateFrameRate(float elapsedTimeSec);
+void    UpdateHotReload();
+void    UpdateLoading();
+void    UpdateSequence();
+void    UpdateStreaming();
+void    UploadModelBuffers(const Model &model, const ModelBuffers &buffers);
+void    UploadModelVertices(const Model &model, const ModelBuffers &buffers);
+void    UploadTextureLevel(const CompressedTexture &compressedTexture, int level);
+void    UploadTextureLevel(const MipChain &mipChain, int level);
+void    WatchModelFiles();
 LRESULT CALLBACK WindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam);
 
+TextureCache g_textureCache(DeleteTexture, TEXTURE_CACHE_BUDGET);
+ModelLoader g_modelLoader(g_textureCache);
+FrameProfiler g_frameProfiler(INTERACTIVE_FRAME_TIME);
+ChunkStreamer g_chunkStreamer(CHUNK_MEMORY_BUDGET);
+FrameSequence g_frameSequence;
+FileWatcher g_fileWatcher;
+
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nShowCmd)
 {
 #if defined _DEBUG
@@ -131,6 +343,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
     if (g_hWnd)
     {
         SetProcessorAffinity();
+        Trace::setThreadName("main");
 
         if (Init())
         {
@@ -151,15 +364,51 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
                 if (msg.message == WM_QUIT)
                     break;
 
-                if (g_hasFocus)
+                UpdateHotReload();
+                UpdateLoading();
+                UpdateSequence();
+                UpdateStreaming();
+
+                if (g_needsRedraw)
                 {
-                    UpdateFrame(GetElapsedTimeInSeconds());
+                    g_needsRedraw = false;
+                    g_frameProfiler.beginFrame();
+                    GL2ResetCounters();
+
+                    {
+                        FrameProfiler::ScopedTimer timer(g_frameProfiler, FrameProfiler::SCOPE_UPDATE);
+                        UpdateFrame((g_replayFrame >= 0) ? REPLAY_TIME_STEP : GetElapsedTimeInSeconds());
+                    }
+
                     DrawFrame();
-                    SwapBuffers(g_hDC);
+
+                    {
+                        FrameProfiler::ScopedTimer timer(g_frameProfiler, FrameProfiler::SCOPE_SWAP);
+                        SwapBuffers(g_hDC);
+                    }
+
+                    g_frameProfiler.endFrame(GetFrameActivity());
+                    g_glCounters = GL2GetCounters();
+                    UpdateDetailLevel(g_frameProfiler.getLastFrame().seconds);
+                    UpdateCameraPath();
+                    ++g_frameCounters.framesDrawn;
                 }
-                else
+                else if (!g_pendingModel.pResult)
                 {
-                    WaitMessage();
+                    // Nothing changed, so block until there is input. While a
+                    // model is loading or chunks are being read in the
+                    // background wake up periodically to pick them up; while
+                    // textures are being uploaded don't block at all. A frame
+                    // sequence that is playing needs its next frame on time.
+
+                    ++g_frameCounters.idleWaits;
+
+                    if (!g_sequencePlayback.paused && g_frameSequence.getNumberOfFrames() > 1)
+                        MsgWaitForMultipleObjects(0, 0, FALSE, SEQUENCE_POLL_INTERVAL, QS_ALLINPUT);
+                    else if (g_modelLoader.isBusy() || g_chunkStreamer.isBusy() || g_frameSequence.isEncoding())
+                        MsgWaitForMultipleObjects(0, 0, FALSE, LOADING_POLL_INTERVAL, QS_ALLINPUT);
+                    else
+                        WaitMessage();
                 }
             }
         }
@@ -200,7 +449,10 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
         switch (static_cast<int>(wParam))
         {
         case VK_ESCAPE:
-            PostMessage(hWnd, WM_CLOSE, 0, 0);
+            if (g_modelLoader.isBusy() || g_pendingModel.pResult)
+                CancelLoading();
+            else
+                PostMessage(hWnd, WM_CLOSE, 0, 0);
             break;
 
         case 'r':
@@ -225,12 +477,84 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 
 		case '8':
 			g_cameraPos[2] -= 0.05f;
+			g_needsRedraw = true;
 			break;
 
 		case '2':
 			g_cameraPos[2] += 0.05f;
+			g_needsRedraw = true;
 			break;
 
+        case 'f':
+        case 'F':
+            ToggleFrameCounters();
+            break;
+
+        case 'l':
+        case 'L':
+            g_enableDetailLevels = !g_enableDetailLevels;
+            g_needsRedraw = true;
+            break;
+
+        case 'p':
+        case 'P':
+            g_showProfilerOverlay = !g_showProfilerOverlay;
+            g_needsRedraw = true;
+            break;
+
+        case 'e':
+        case 'E':
+            ExportFrameProfile();
+            break;
+
+        case 'z':
+        case 'Z':
+            ToggleTracing();
+            break;
+
+        case 'k':
+        case 'K':
+            ToggleCameraRecording();
+            break;
+
+        case 'y':
+        case 'Y':
+            StartReplay(CAMERA_PATH_FILENAME);
+            break;
+
+        case '[':
+            SelectGroup(-1);
+            break;
+
+        case ']':
+            SelectGroup(1);
+            break;
+
+        case 'h':
+        case 'H':
+            HideSelectedGroup();
+            break;
+
+        case 'i':
+        case 'I':
+            IsolateSelectedGroup();
+            break;
+
+        case 'u':
+        case 'U':
+            ShowAllGroups();
+            break;
+
+        case VK_BACK:
+            if (!models.empty())
+                UnloadModel(models.size() - 1);
+            break;
+
+        case VK_SPACE:
+            g_sequencePlayback.paused = !g_sequencePlayback.paused;
+            g_sequencePlayback.dueTime = 0;
+            break;
+
         default:
             break;
         }
@@ -258,7 +582,10 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
             if (strstr(szFilename, ".obj") || strstr(szFilename, ".OBJ"))
             {
                 LoadModel(szFilename);
-                ResetCamera();
+            }
+            else if (strstr(szFilename, ".chunks"))
+            {
+                OpenChunkFile(szFilename);
             }
             else
             {
@@ -271,11 +598,21 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
         }
         return 0;
 
+    case WM_PAINT:
+        g_needsRedraw = true;
+        break;
+
     case WM_SIZE:
         g_windowWidth = static_cast<int>(LOWORD(lParam));
         g_windowHeight = static_cast<int>(HIWORD(lParam));
+        g_needsRedraw = true;
         break;
 
+    case WM_TIMER:
+        if (wParam == FRAME_COUNTERS_TIMER)
+            UpdateFrameCounters();
+        return 0;
+
     case WM_SYSKEYDOWN:
         if (wParam == VK_RETURN)
             PostMessage(hWnd, WM_COMMAND, MAKEWPARAM(MENU_VIEW_FULLSCREEN, 0), 0);
@@ -289,10 +626,250 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
     return DefWindowProc(hWnd, msg, wParam, lParam);
 }
 
+void ApplyCameraKey(const CameraPath::Key &key)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        g_cameraPos[i] = key.cameraPos[i];
+        g_targetPos[i] = key.targetPos[i];
+    }
+
+    g_heading = key.heading;
+    g_pitch = key.pitch;
+}
+
+void ApplyChunkTransform()
+{
+    // Scales the streamed chunks to unit size and centers them, the same as
+    // Model::normalize() does for loaded models.
+    float minPosition[3];
+    float maxPosition[3];
+    float size = 0.0f;
+
+    g_chunkStreamer.getBounds(minPosition, maxPosition);
+
+    for (int i = 0; i < 3; ++i)
+        size = std::max(size, maxPosition[i] - minPosition[i]);
+
+    if (size <= 0.0f)
+        size = 1.0f;
+
+    glScalef(1.0f / size, 1.0f / size, 1.0f / size);
+    glTranslatef(-(minPosition[0] + maxPosition[0]) * 0.5f,
+        -(minPosition[1] + maxPosition[1]) * 0.5f,
+        -(minPosition[2] + maxPosition[2]) * 0.5f);
+}
+
+void BeginPlainMeshes()
+{
+	// Streamed chunks and progressive previews only have positions and
+	// normals, so they are drawn with fixed function lighting in a plain grey
+	// material.
+	static const GLfloat ambient[4] = {0.2f, 0.2f, 0.2f, 1.0f};
+	static const GLfloat diffuse[4] = {0.8f, 0.8f, 0.8f, 1.0f};
+	static const GLfloat specular[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+
+	glPushAttrib(GL_ENABLE_BIT);
+	glDisable(GL_TEXTURE_2D);
+	glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, ambient);
+	glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, diffuse);
+	glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, specular);
+	glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 0.0f);
+
+	SetVertexArrays(0, 0, false);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+}
+
+void BuildRenderList()
+{
+    TRACE_ZONE("BuildRenderList");
+
+    // Meshes whose materials look the same share a state id, and so a batch,
+    // even across models as long as their vertices are in the scene buffers.
+    // The meshes of repeated parts only batch with those of the same part.
+    std::map<std::string, unsigned int> stateIds;
+    std::map<int, int> vertexSources;
+    RenderList::Command command;
+    RenderState state;
+    ModelTextures::const_iterator iter;
+    GLint blinnPhongAlphaLocation = -1;
+    GLint normalMappingAlphaLocation = -1;
+    int shader = 0;
+    int numberOfDetailLevels = 0;
+
+    if (g_supportsProgrammablePipeline)
+    {
+        blinnPhongAlphaLocation = glGetUniformLocation(g_blinnPhongShader, "materialAlpha");
+        normalMappingAlphaLocation = glGetUniformLocation(g_normalMappingShader, "materialAlpha");
+    }
+
+    g_renderList.clear();
+    g_groupOffsets.assign(1, 0);
+
+    for (size_t it = 0; it < models.size(); ++it)
+    {
+        const Model &model = models[it];
+        const ModelTextures &modelTextures = modelTexturesList[it];
+        bool isResident = modelBuffersList[it].vertexBlock >= 0;
+        int vertexFormat = (model.hasPositions() ? 1 : 0) | (model.hasNormals() ? 2 : 0)
+            | (model.hasTangents() ? 4 : 0);
+
+        numberOfDetailLevels = std::max(numberOfDetailLevels, model.getNumberOfDetailLevels());
+        g_groupOffsets.push_back(g_groupOffsets.back() + model.getNumberOfGroups());
+
+        // Resident models with the same vertex format draw from the same
+        // client array setup.
+        command.vertexSource = static_cast<int>(it);
+
+        if (isResident)
+        {
+            if (vertexSources.find(vertexFormat) == vertexSources.end())
+                vertexSources[vertexFormat] = static_cast<int>(it);
+
+            command.vertexSource = vertexSources[vertexFormat];
+        }
+
+        for (int i = 0; i < model.getNumberOfMeshes(); ++i)
+        {
+            const Model::Material *pMaterial = model.getMesh(i).pMaterial;
+
+            command.model = static_cast<int>(it);
+            command.mesh = i;
+            command.material = static_cast<int>(pMaterial - &model.getMaterial(0));
+            command.group = model.getMesh(i).group;
+            command.prototype = model.getMesh(i).prototype;
+            command.program = 0;
+            command.colorMap = 0;
+            command.normalMap = 0;
+            command.alphaLocation = -1;
+            shader = 0;
+
+            iter = modelTextures.find(pMaterial->colorMapFilename);
+
+            if (iter != modelTextures.end())
+                command.colorMap = iter->second;
+
+            if (g_supportsProgrammablePipeline)
+            {
+                iter = modelTextures.find(pMaterial->bumpMapFilename);
+
+                // Meshes without a loaded normal map use Blinn-Phong.
+                if (!pMaterial->bumpMapFilename.empty() && iter != modelTextures.end())
+                {
+                    shader = 2;
+                    command.program = g_normalMappingShader;
+                    command.normalMap = iter->second;
+                    command.alphaLocation = normalMappingAlphaLocation;
+                }
+                else
+                {
+                    shader = 1;
+                    command.program = g_blinnPhongShader;
+                    command.alphaLocation = blinnPhongAlphaLocation;
+                }
+            }
+
+            memset(&state, 0, sizeof(state));
+            memcpy(state.ambient, pMaterial->ambient, sizeof(state.ambient));
+            memcpy(state.diffuse, pMaterial->diffuse, sizeof(state.diffuse));
+            memcpy(state.specular, pMaterial->specular, sizeof(state.specular));
+            state.shininess = pMaterial->shininess;
+            state.alpha = pMaterial->alpha;
+            state.program = command.program;
+            state.colorMap = command.colorMap;
+            state.normalMap = command.normalMap;
+            state.vertexFormat = vertexFormat;
+            state.model = (isResident && command.prototype < 0) ? -1 : static_cast<int>(it);
+            state.prototype = command.prototype;
+
+            std::string bytes(reinterpret_cast<const char *>(&state), sizeof(state));
+            std::map<std::string, unsigned int>::iterator id = stateIds.find(bytes);
+
+            if (id == stateIds.end())
+                id = stateIds.insert(std::make_pair(bytes, static_cast<unsigned int>(stateIds.size()))).first;
+
+            command.key = RenderList::makeKey(
+                (pMaterial->alpha < 1.0f) ? RenderList::PASS_TRANSLUCENT : RenderList::PASS_OPAQUE,
+                shader, command.colorMap, id->second);
+
+            g_renderList.add(command);
+        }
+    }
+
+    g_renderList.sort();
+    g_renderList.setNumberOfDetailLevels(numberOfDetailLevels);
+    g_visibleGroups.assign(g_groupOffsets.back(), 1);
+
+    if (g_selectedGroup >= g_groupOffsets.back())
+        g_selectedGroup = -1;
+
+    for (int i = 0; i < g_renderList.getNumberOfCommands(); ++i)
+    {
+        const RenderList::Command &command = g_renderList.getCommand(i);
+        const Model &model = models[command.model];
+        const ModelBuffers &buffers = modelBuffersList[command.model];
+
+        for (int level = 0; level < numberOfDetailLevels; ++level)
+        {
+            int modelLevel = std::min(level, model.getNumberOfDetailLevels() - 1);
+            const Model::Mesh &mesh = model.getMesh(command.mesh, modelLevel);
+            const void *pIndices = model.getIndexBuffer(modelLevel) + mesh.startIndex;
+
+            if (buffers.indexBlock >= 0)
+            {
+                pIndices = BUFFER_OFFSET((g_indexArena.getOffset(buffers.indexBlock)
+                    + buffers.indexOffsets[modelLevel] + mesh.startIndex) * model.getIndexSize());
+            }
+
+            g_renderList.setRange(level, i, mesh.triangleCount * 3, pIndices);
+        }
+    }
+}
+
+void CancelLoading()
+{
+    ModelLoader::Result *pResult = 0;
+
+    g_modelLoader.cancel();
+
+    while ((pResult = g_modelLoader.popResult()) != 0)
+        DiscardLoadResult(pResult);
+
+    if (g_pendingModel.pResult)
+    {
+        if (g_pendingModel.id)
+            glDeleteTextures(1, &g_pendingModel.id);
+
+        ModelTextures::iterator i = g_pendingModel.modelTextures.begin();
+
+        while (i != g_pendingModel.modelTextures.end())
+        {
+            g_textureCache.release(i->second);
+            ++i;
+        }
+
+        delete g_pendingModel.pResult;
+
+        g_pendingModel.pResult = 0;
+        g_pendingModel.modelTextures.clear();
+        g_pendingModel.id = 0;
+    }
+
+    g_progressiveMesh.close();
+    SetWindowTitle(g_windowTitle);
+}
+
 void Cleanup()
 {
     CleanupApp();
 
+    if (Trace::isEnabled())
+    {
+        Trace::stop();
+        Trace::write(TRACE_FILENAME);
+    }
+
     if (g_hDC)
     {
         if (g_hRC)
@@ -310,6 +887,7 @@ void Cleanup()
 void CleanupApp()
 {
     UnloadModel();
+    g_textureCache.clear();
 
     if (g_nullTexture)
     {
@@ -317,6 +895,12 @@ void CleanupApp()
         g_nullTexture = 0;
     }
 
+    if (g_overlayFont)
+    {
+        glDeleteLists(g_overlayFont, 96);
+        g_overlayFont = 0;
+    }
+
     if (g_supportsProgrammablePipeline)
     {
         glUseProgram(0);
@@ -335,6 +919,43 @@ void CleanupApp()
     }
 }
 
+void CompactSceneBuffers()
+{
+    TRACE_ZONE("CompactSceneBuffers");
+
+    // Slides the remaining models to the front of the scene buffers. The moved
+    // ones are uploaded again from their client-side copies.
+    std::vector<size_t> vertexOffsets(models.size());
+    std::vector<size_t> indexOffsets(models.size());
+
+    for (size_t i = 0; i < models.size(); ++i)
+    {
+        if (modelBuffersList[i].vertexBlock >= 0)
+        {
+            vertexOffsets[i] = g_vertexArena.getOffset(modelBuffersList[i].vertexBlock);
+            indexOffsets[i] = g_indexArena.getOffset(modelBuffersList[i].indexBlock);
+        }
+    }
+
+    bool verticesMoved = g_vertexArena.compact();
+    bool indicesMoved = g_indexArena.compact();
+
+    if (!verticesMoved && !indicesMoved)
+        return;
+
+    for (size_t i = 0; i < models.size(); ++i)
+    {
+        const ModelBuffers &buffers = modelBuffersList[i];
+
+        if (buffers.vertexBlock >= 0 &&
+            (g_vertexArena.getOffset(buffers.vertexBlock) != vertexOffsets[i] ||
+             g_indexArena.getOffset(buffers.indexBlock) != indexOffsets[i]))
+        {
+            UploadModelBuffers(models[i], buffers);
+        }
+    }
+}
+
 GLuint CompileShader(GLenum type, const GLchar *pszSource, GLint length)
 {
     GLuint shader = glCreateShader(type);
@@ -394,6 +1015,55 @@ HWND CreateAppWindow(const WNDCLASSEX &wcl, const char *pszTitle)
     return hWnd;
 }
 
+void CreateModelBuffers(const Model &model, ModelBuffers &buffers)
+{
+    TRACE_ZONE("CreateModelBuffers");
+
+    // The vertices and the indices of all detail levels are placed in the
+    // scene-wide buffers. Without buffer object support, or when the GL runs
+    // out of memory, models are drawn from client memory instead.
+    int numberOfIndices = 0;
+
+    buffers.vertexBlock = -1;
+    buffers.indexBlock = -1;
+    buffers.indexOffsets.clear();
+
+    if (!g_supportsVertexBufferObjects)
+        return;
+
+    for (int i = 0; i < model.getNumberOfDetailLevels(); ++i)
+    {
+        buffers.indexOffsets.push_back(numberOfIndices);
+        numberOfIndices += model.getNumberOfIndices(i);
+    }
+
+    while (glGetError() != GL_NO_ERROR)
+        ;
+
+    buffers.vertexBlock = g_vertexArena.allocate(model.getNumberOfVertices());
+    buffers.indexBlock = g_indexArena.allocate(numberOfIndices);
+
+    if (buffers.vertexBlock < 0 || buffers.indexBlock < 0)
+    {
+        DeleteModelBuffers(buffers);
+        GrowSceneBuffers(model.getNumberOfVertices(), numberOfIndices);
+
+        buffers.vertexBlock = g_vertexArena.allocate(model.getNumberOfVertices());
+        buffers.indexBlock = g_indexArena.allocate(numberOfIndices);
+    }
+
+    if (buffers.vertexBlock < 0 || buffers.indexBlock < 0)
+    {
+        DeleteModelBuffers(buffers);
+        return;
+    }
+
+    UploadModelBuffers(model, buffers);
+
+    if (glGetError() != GL_NO_ERROR)
+        DeleteSceneBuffers();
+}
+
 GLuint CreateNullTexture(int width, int height)
 {
     int pitch = ((width * 32 + 31) & ~31) >> 3;
@@ -414,252 +1084,640 @@ GLuint CreateNullTexture(int width, int height)
     return texture;
 }
 
-void DrawFrame()
+GLuint CreateTexture(int numberOfLevels)
 {
-    glViewport(0, 0, g_windowWidth, g_windowHeight);
-    glClearColor(0.0f, 0.8f, 4.0f, 0.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    GLuint texture = 0;
 
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluPerspective(CAMERA_FOVY,
-        static_cast<float>(g_windowWidth) / static_cast<float>(g_windowHeight),
-        CAMERA_ZNEAR, CAMERA_ZFAR);
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
 
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
-    gluLookAt(g_cameraPos[0], g_cameraPos[1], g_cameraPos[2],
-        g_targetPos[0], g_targetPos[1], g_targetPos[2],
-        0.0f, 1.0f, 0.0f);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numberOfLevels - 1);
 
-    glRotatef(g_pitch, 1.0f, 0.0f, 0.0f);
-    glRotatef(g_heading, 0.0f, 1.0f, 0.0f);
+    if (g_maxAnisotrophy > 1.0f)
+    {
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT,
+            g_maxAnisotrophy);
+    }
 
-    if (g_supportsProgrammablePipeline)
-        DrawModelUsingProgrammablePipeline();
-    else
-        DrawModelUsingFixedFuncPipeline();
+    return texture;
 }
 
-void DrawModelUsingFixedFuncPipeline()
+void CullChunks()
 {
-	for (size_t it = 0; it < models.size(); ++it)
-	{
-		Model model = models[it];
-		ModelTextures modelTextures = modelTexturesList[it];
-
-		const Model::Mesh *pMesh = 0;
-		const Model::Material *pMaterial = 0;
-		const Model::Vertex *pVertices = 0;
-		ModelTextures::const_iterator iter;
+    if (!g_chunkStreamer.isOpen())
+        return;
 
-		for (int i = 0; i < model.getNumberOfMeshes(); ++i)
-		{
-			pMesh = &model.getMesh(i);
-			pMaterial = pMesh->pMaterial;
-			pVertices = model.getVertexBuffer();
+    GLfloat modelview[16];
+    GLfloat projection[16];
 
-			glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, pMaterial->ambient);
-			glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, pMaterial->diffuse);
-			glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, pMaterial->specular);
-			glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, pMaterial->shininess * 128.0f);
+    glPushMatrix();
+    ApplyChunkTransform();
+    glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+    glGetFloatv(GL_PROJECTION_MATRIX, projection);
+    glPopMatrix();
 
-			if (g_enableTextures)
-			{
-				iter = modelTextures.find(pMaterial->colorMapFilename);
-
-				if (iter == modelTextures.end())
-				{
-					glDisable(GL_TEXTURE_2D);
-				}
-				else
-				{
-					glEnable(GL_TEXTURE_2D);
-					glBindTexture(GL_TEXTURE_2D, iter->second);
-				}
-			}
-			else
-			{
-				glDisable(GL_TEXTURE_2D);
-			}
+    g_chunkStreamer.update(modelview, projection, g_windowHeight, CHUNK_SCREEN_ERROR);
+}
 
-			if (model.hasPositions())
-			{
-				glEnableClientState(GL_VERTEX_ARRAY);
-				glVertexPointer(3, GL_FLOAT, model.getVertexSize(),
-					model.getVertexBuffer()->position);
-			}
+void CullGroups()
+{
+    TRACE_ZONE("CullGroups");
 
-			if (model.hasTextureCoords())
-			{
-				glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-				glTexCoordPointer(2, GL_FLOAT, model.getVertexSize(),
-					model.getVertexBuffer()->texCoord);
-			}
+    // A group is drawn when it isn't hidden and its bounds aren't entirely
+    // behind one of the view frustum planes. The planes are sums and
+    // differences of the rows of the projection times modelview matrix.
+    GLfloat modelview[16];
+    GLfloat projection[16];
+    float clip[16];
+    float planes[6][4];
 
-			if (model.hasNormals())
-			{
-				glEnableClientState(GL_NORMAL_ARRAY);
-				glNormalPointer(GL_FLOAT, model.getVertexSize(),
-					model.getVertexBuffer()->normal);
-			}
+    if (g_visibleGroups.empty())
+        return;
 
-			glDrawElements(GL_TRIANGLES, pMesh->triangleCount * 3, GL_UNSIGNED_INT,
-				model.getIndexBuffer() + pMesh->startIndex);
+    glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+    glGetFloatv(GL_PROJECTION_MATRIX, projection);
 
-			if (model.hasNormals())
-				glDisableClientState(GL_NORMAL_ARRAY);
+    for (int column = 0; column < 4; ++column)
+    {
+        for (int row = 0; row < 4; ++row)
+        {
+            clip[column * 4 + row] = 0.0f;
 
-			if (model.hasTextureCoords())
-				glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+            for (int k = 0; k < 4; ++k)
+                clip[column * 4 + row] += projection[k * 4 + row] * modelview[column * 4 + k];
+        }
+    }
 
-			if (model.hasPositions())
-				glDisableClientState(GL_VERTEX_ARRAY);
-		}
-	}
-}
+    for (int i = 0; i < 6; ++i)
+    {
+        for (int j = 0; j < 4; ++j)
+            planes[i][j] = clip[j * 4 + 3] + ((i & 1) ? -clip[j * 4 + i / 2] : clip[j * 4 + i / 2]);
+    }
 
-void DrawModelUsingProgrammablePipeline()
-{
-	for (size_t it = 0; it < models.size(); ++it)
-	{
-		Model model = models[it];
-		ModelTextures modelTextures = modelTexturesList[it];
+    for (size_t it = 0; it < models.size(); ++it)
+    {
+        const Model &model = models[it];
+        unsigned char *pVisible = &g_visibleGroups[0] + g_groupOffsets[it];
 
-		const Model::Mesh *pMesh = 0;
-		const Model::Material *pMaterial = 0;
-		const Model::Vertex *pVertices = 0;
-		ModelTextures::const_iterator iter;
-		GLuint texture = 0;
+        JobSystem::instance().parallelFor(0, model.getNumberOfGroups(), GROUPS_PER_JOB,
+            [&model, &planes, pVisible](int first, int last)
+            {
+                for (int i = first; i < last; ++i)
+                {
+                    const Model::Group &group = model.getGroup(i);
+                    bool visible = !group.hidden;
 
-		glHint(GL_POLYGON_SMOOTH_HINT, GL_NICEST);
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                    // Tests the corner of the bounds furthest along each
+                    // plane's normal.
+                    for (int j = 0; visible && j < 6; ++j)
+                    {
+                        float distance = planes[j][3];
 
-		for (int i = 0; i < model.getNumberOfMeshes(); ++i)
-		{
-			pMesh = &model.getMesh(i);
-			pMaterial = pMesh->pMaterial;
-			pVertices = model.getVertexBuffer();
+                        for (int k = 0; k < 3; ++k)
+                        {
+                            distance += planes[j][k] * ((planes[j][k] >= 0.0f)
+                                ? group.maxPosition[k] : group.minPosition[k]);
+                        }
 
-			glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, pMaterial->ambient);
-			glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, pMaterial->diffuse);
-			glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, pMaterial->specular);
-			glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, pMaterial->shininess * 128.0f);
+                        visible = distance >= 0.0f;
+                    }
 
-			if (pMaterial->bumpMapFilename.empty())
-			{
-				glUseProgram(g_blinnPhongShader);
+                    pVisible[i] = visible ? 1 : 0;
+                }
+            });
+    }
+}
 
-				texture = g_nullTexture;
+void DeleteModelBuffers(ModelBuffers &buffers)
+{
+    if (buffers.vertexBlock >= 0)
+        g_vertexArena.free(buffers.vertexBlock);
 
-				if (g_enableTextures)
-				{
-					iter = modelTextures.find(pMaterial->colorMapFilename);
+    if (buffers.indexBlock >= 0)
+        g_indexArena.free(buffers.indexBlock);
 
-					if (iter != modelTextures.end())
-						texture = iter->second;
-				}
+    buffers.vertexBlock = -1;
+    buffers.indexBlock = -1;
+}
 
-				glActiveTexture(GL_TEXTURE0);
-				glEnable(GL_TEXTURE_2D);
-				glBindTexture(GL_TEXTURE_2D, texture);
+void DeleteSceneBuffers()
+{
+    // Every model falls back to drawing from client memory.
+    for (size_t i = 0; i < modelBuffersList.size(); ++i)
+    {
+        modelBuffersList[i].vertexBlock = -1;
+        modelBuffersList[i].indexBlock = -1;
+    }
 
-				glUniform1i(glGetUniformLocation(
-					g_blinnPhongShader, "colorMap"), 0);
-				glUniform1f(glGetUniformLocation(
-					g_blinnPhongShader, "materialAlpha"), pMaterial->alpha);
-			}
-			else
-			{
-				glUseProgram(g_normalMappingShader);
+    if (g_sceneVertexBuffer)
+        glDeleteBuffers(1, &g_sceneVertexBuffer);
 
-				iter = modelTextures.find(pMaterial->bumpMapFilename);
+    if (g_sceneIndexBuffer)
+        glDeleteBuffers(1, &g_sceneIndexBuffer);
 
-				if (iter != modelTextures.end())
-				{
-					glActiveTexture(GL_TEXTURE1);
-					glEnable(GL_TEXTURE_2D);
-					glBindTexture(GL_TEXTURE_2D, iter->second);
-				}
-				texture = g_nullTexture;
+    g_sceneVertexBuffer = 0;
+    g_sceneIndexBuffer = 0;
+    g_vertexArena.reset();
+    g_indexArena.reset();
+}
+
+void DeleteTexture(unsigned int id)
+{
+    GLuint texture = id;
+    glDeleteTextures(1, &texture);
+}
 
-				if (g_enableTextures)
-				{
-					iter = modelTextures.find(pMaterial->colorMapFilename);
+void DiscardLoadResult(ModelLoader::Result *pResult)
+{
+    for (size_t i = 0; i < pResult->textures.size(); ++i)
+    {
+        if (pResult->textures[i].id)
+            g_textureCache.release(pResult->textures[i].id);
+    }
 
-					if (iter != modelTextures.end())
-						texture = iter->second;
-				}
+    delete pResult;
+}
 
-				glActiveTexture(GL_TEXTURE0);
-				glEnable(GL_TEXTURE_2D);
-				glBindTexture(GL_TEXTURE_2D, texture);
-
-				glUniform1i(glGetUniformLocation(
-					g_normalMappingShader, "colorMap"), 0);
-				glUniform1i(glGetUniformLocation(
-					g_normalMappingShader, "normalMap"), 1);
-				glUniform1f(glGetUniformLocation(
-					g_normalMappingShader, "materialAlpha"), pMaterial->alpha);
-			}
+void DrawBatch(const RenderList::Batch &batch, int detailLevel)
+{
+    // Repeated parts are drawn once per instance with its transform on the
+    // modelview matrix, since GL 2 has no instanced draw calls.
+    // Meshes of culled or hidden groups are left out of the batch's ranges,
+    // which are only copied when some of them are.
+    const RenderList::Command &command = g_renderList.getCommand(batch.firstCommand);
+    const Model &model = models[command.model];
+    const int *pCounts = g_renderList.getCounts(detailLevel, batch);
+    const void *const *pIndices = g_renderList.getIndices(detailLevel, batch);
+    const unsigned char *pVisible = &g_visibleGroups[0] + g_groupOffsets[command.model];
+    int numberOfInstances = (command.prototype >= 0) ? model.getNumberOfInstances(command.prototype) : 1;
+    int numberOfRanges = batch.numberOfCommands;
+
+    if (command.prototype < 0)
+    {
+        g_visibleCounts.resize(batch.numberOfCommands);
+        g_visibleIndices.resize(batch.numberOfCommands);
+        numberOfRanges = 0;
 
-			if (model.hasPositions())
-			{
-				glEnableClientState(GL_VERTEX_ARRAY);
-				glVertexPointer(3, GL_FLOAT, model.getVertexSize(),
-					model.getVertexBuffer()->position);
-			}
+        for (int i = 0; i < batch.numberOfCommands; ++i)
+        {
+            const RenderList::Command &other = g_renderList.getCommand(batch.firstCommand + i);
 
-			if (model.hasTextureCoords())
-			{
-				glClientActiveTexture(GL_TEXTURE0);
-				glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-				glTexCoordPointer(2, GL_FLOAT, model.getVertexSize(),
-					model.getVertexBuffer()->texCoord);
-			}
+            if (g_visibleGroups[g_groupOffsets[other.model] + other.group])
+            {
+                g_visibleCounts[numberOfRanges] = pCounts[i];
+                g_visibleIndices[numberOfRanges] = pIndices[i];
+                ++numberOfRanges;
+            }
+        }
+
+        if (numberOfRanges < batch.numberOfCommands)
+        {
+            pCounts = &g_visibleCounts[0];
+            pIndices = &g_visibleIndices[0];
+        }
+    }
+
+    for (int instance = 0; instance < numberOfInstances; ++instance)
+    {
+        if (command.prototype >= 0)
+        {
+            if (!pVisible[model.getInstanceGroup(command.prototype, instance)])
+                continue;
+
+            glPushMatrix();
+            glMultMatrixf(model.getInstanceTransform(command.prototype, instance));
+        }
+
+        if (g_supportsMultiDraw)
+        {
+            glMultiDrawElements(GL_TRIANGLES, pCounts, GL_UNSIGNED_INT,
+                const_cast<const void **>(pIndices), numberOfRanges);
+        }
+        else
+        {
+            for (int i = 0; i < numberOfRanges; ++i)
+                glDrawElements(GL_TRIANGLES, pCounts[i], GL_UNSIGNED_INT, pIndices[i]);
+        }
+
+        if (command.prototype >= 0)
+            glPopMatrix();
+    }
+}
+
+void DrawChunks()
+{
+	TRACE_ZONE("DrawChunks");
+
+	if (g_chunkStreamer.getNumberOfDrawLevels() == 0)
+		return;
+
+	BeginPlainMeshes();
+	glPushMatrix();
+	ApplyChunkTransform();
+
+	for (int i = 0; i < g_chunkStreamer.getNumberOfDrawLevels(); ++i)
+	{
+		const ChunkStreamer::Level &level = g_chunkStreamer.getDrawLevel(i);
+		DrawPlainMesh(level.vertices, level.indices);
+	}
+
+	glPopMatrix();
+	EndPlainMeshes();
+}
+
+void DrawFrame()
+{
+    TRACE_ZONE("DrawFrame");
+
+    glViewport(0, 0, g_windowWidth, g_windowHeight);
+    glClearColor(0.0f, 0.8f, 4.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluPerspective(CAMERA_FOVY,
+        static_cast<float>(g_windowWidth) / static_cast<float>(g_windowHeight),
+        CAMERA_ZNEAR, CAMERA_ZFAR);
+
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    gluLookAt(g_cameraPos[0], g_cameraPos[1], g_cameraPos[2],
+        g_targetPos[0], g_targetPos[1], g_targetPos[2],
+        0.0f, 1.0f, 0.0f);
+
+    glRotatef(g_pitch, 1.0f, 0.0f, 0.0f);
+    glRotatef(g_heading, 0.0f, 1.0f, 0.0f);
+
+    {
+        FrameProfiler::ScopedTimer timer(g_frameProfiler, FrameProfiler::SCOPE_CULL);
+        CullGroups();
+        CullChunks();
+    }
+
+    {
+        FrameProfiler::ScopedTimer timer(g_frameProfiler, FrameProfiler::SCOPE_SUBMIT);
+
+        if (g_supportsProgrammablePipeline)
+            DrawModelUsingProgrammablePipeline();
+        else
+            DrawModelUsingFixedFuncPipeline();
+
+        DrawChunks();
+        DrawProgressiveMesh();
+    }
+
+    if (g_showProfilerOverlay)
+        DrawProfilerOverlay();
+}
+
+void DrawModelUsingFixedFuncPipeline()
+{
+	TRACE_ZONE("DrawModelUsingFixedFuncPipeline");
+
+	const Model::Material *pMaterial = 0;
+	int vertexSource = -1;
+	int detailLevel = 0;
+	GLuint colorMap = GL2_UNKNOWN_STATE;
+	GLuint texture = 0;
 
-			if (model.hasNormals())
+	if (g_isInteracting && g_enableDetailLevels)
+		detailLevel = std::max(0, std::min(g_detailLevel, g_renderList.getNumberOfDetailLevels() - 1));
+
+	for (int i = 0; i < g_renderList.getNumberOfBatches(); ++i)
+	{
+		const RenderList::Batch &batch = g_renderList.getBatch(i);
+		const RenderList::Command &command = g_renderList.getCommand(batch.firstCommand);
+
+		if (!IsBatchVisible(batch))
+			continue;
+
+		if (command.vertexSource != vertexSource)
+		{
+			vertexSource = command.vertexSource;
+			SetVertexArrays(&models[vertexSource], &modelBuffersList[vertexSource], false);
+		}
+
+		pMaterial = &models[command.model].getMaterial(command.material);
+
+		glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, pMaterial->ambient);
+		glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, pMaterial->diffuse);
+		glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, pMaterial->specular);
+		glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, pMaterial->shininess * 128.0f);
+
+		texture = g_enableTextures ? command.colorMap : 0;
+
+		if (texture != colorMap)
+		{
+			colorMap = texture;
+
+			if (colorMap)
 			{
-				glEnableClientState(GL_NORMAL_ARRAY);
-				glNormalPointer(GL_FLOAT, model.getVertexSize(),
-					model.getVertexBuffer()->normal);
+				glEnable(GL_TEXTURE_2D);
+				glBindTexture(GL_TEXTURE_2D, colorMap);
 			}
-
-			if (model.hasTangents())
+			else
 			{
-				glClientActiveTexture(GL_TEXTURE1);
-				glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-				glTexCoordPointer(4, GL_FLOAT, model.getVertexSize(),
-					model.getVertexBuffer()->tangent);
+				glDisable(GL_TEXTURE_2D);
 			}
+		}
 
-			glDrawElements(GL_TRIANGLES, pMesh->triangleCount * 3, GL_UNSIGNED_INT,
-				model.getIndexBuffer() + pMesh->startIndex);
+		DrawBatch(batch, detailLevel);
+	}
 
-			if (model.hasTangents())
-			{
-				glClientActiveTexture(GL_TEXTURE1);
-				glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-			}
+	SetVertexArrays(0, 0, false);
+}
+
+void DrawModelUsingProgrammablePipeline()
+{
+	TRACE_ZONE("DrawModelUsingProgrammablePipeline");
+
+	const Model::Material *pMaterial = 0;
+	int vertexSource = -1;
+	int detailLevel = 0;
+	GLuint program = GL2_UNKNOWN_STATE;
+	GLuint colorMap = GL2_UNKNOWN_STATE;
+	GLuint normalMap = GL2_UNKNOWN_STATE;
+	GLuint texture = 0;
+
+	if (g_isInteracting && g_enableDetailLevels)
+		detailLevel = std::max(0, std::min(g_detailLevel, g_renderList.getNumberOfDetailLevels() - 1));
+
+	glHint(GL_POLYGON_SMOOTH_HINT, GL_NICEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glActiveTexture(GL_TEXTURE0);
+	glEnable(GL_TEXTURE_2D);
+
+	for (int i = 0; i < g_renderList.getNumberOfBatches(); ++i)
+	{
+		const RenderList::Batch &batch = g_renderList.getBatch(i);
+		const RenderList::Command &command = g_renderList.getCommand(batch.firstCommand);
 
-			if (model.hasNormals())
-				glDisableClientState(GL_NORMAL_ARRAY);
+		if (!IsBatchVisible(batch))
+			continue;
 
-			if (model.hasTextureCoords())
-			{
-				glClientActiveTexture(GL_TEXTURE0);
-				glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-			}
+		if (command.vertexSource != vertexSource)
+		{
+			vertexSource = command.vertexSource;
+			SetVertexArrays(&models[vertexSource], &modelBuffersList[vertexSource], true);
+		}
+
+		if (command.program != program)
+		{
+			program = command.program;
+			glUseProgram(program);
+		}
 
-			if (model.hasPositions())
-				glDisableClientState(GL_VERTEX_ARRAY);
+		pMaterial = &models[command.model].getMaterial(command.material);
+
+		glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, pMaterial->ambient);
+		glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, pMaterial->diffuse);
+		glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, pMaterial->specular);
+		glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, pMaterial->shininess * 128.0f);
+		glUniform1f(command.alphaLocation, pMaterial->alpha);
+
+		if (command.normalMap && command.normalMap != normalMap)
+		{
+			normalMap = command.normalMap;
+
+			glActiveTexture(GL_TEXTURE1);
+			glEnable(GL_TEXTURE_2D);
+			glBindTexture(GL_TEXTURE_2D, normalMap);
+			glActiveTexture(GL_TEXTURE0);
+		}
+
+		texture = (g_enableTextures && command.colorMap) ? command.colorMap : g_nullTexture;
+
+		if (texture != colorMap)
+		{
+			colorMap = texture;
+			glBindTexture(GL_TEXTURE_2D, colorMap);
 		}
 
-		glBindTexture(GL_TEXTURE_2D, 0);
-		glUseProgram(0);
-		glDisable(GL_BLEND);
+		DrawBatch(batch, detailLevel);
 	}
+
+	SetVertexArrays(0, 0, true);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glUseProgram(0);
+	glDisable(GL_BLEND);
+}
+
+void DrawPlainMesh(const std::vector<float> &vertices, const std::vector<unsigned int> &indices)
+{
+	// Vertices are a position followed by a normal, as in chunk files and
+	// progressive meshes alike.
+	const GLsizei stride = ChunkFile::FLOATS_PER_VERTEX * sizeof(float);
+
+	if (indices.empty())
+		return;
+
+	glVertexPointer(3, GL_FLOAT, stride, &vertices[0]);
+	glNormalPointer(GL_FLOAT, stride, &vertices[3]);
+	glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(indices.size()), GL_UNSIGNED_INT, &indices[0]);
+}
+
+void DrawProfilerOverlay()
+{
+    if (!g_overlayFont)
+    {
+        HGDIOBJ hPrevFont = SelectObject(g_hDC, GetStockObject(ANSI_FIXED_FONT));
+
+        g_overlayFont = glGenLists(96);
+        wglUseFontBitmaps(g_hDC, 32, 96, g_overlayFont);
+        SelectObject(g_hDC, hPrevFont);
+    }
+
+    std::vector<std::string> lines;
+    std::ostringstream output;
+    FrameProfiler::Statistics statistics = g_frameProfiler.getStatistics();
+    int buckets[FrameProfiler::NUMBER_OF_BUCKETS];
+
+    output.setf(std::ios::fixed);
+    output.precision(2);
+
+    output << g_framesPerSecond << " fps, " << statistics.numberOfFrames << " frames, budget "
+           << g_frameProfiler.getBudget() * 1000.0f << " ms";
+    lines.push_back(output.str());
+
+    for (int i = -1; i < FrameProfiler::NUMBER_OF_SCOPES; ++i)
+    {
+        if (i >= 0)
+            statistics = g_frameProfiler.getStatistics(static_cast<FrameProfiler::Scope>(i));
+
+        output.str("");
+        output.width(7);
+        output << std::left << ((i < 0) ? "frame" : FrameProfiler::getScopeName(static_cast<FrameProfiler::Scope>(i)))
+               << std::right << " p50 " << statistics.p50 * 1000.0f << "  p95 " << statistics.p95 * 1000.0f
+               << "  p99 " << statistics.p99 * 1000.0f << "  max " << statistics.max * 1000.0f << " ms";
+        lines.push_back(output.str());
+    }
+
+    g_frameProfiler.getHistogram(buckets);
+
+    int lastBucket = 0;
+    int maxCount = 1;
+
+    for (int i = 0; i < FrameProfiler::NUMBER_OF_BUCKETS; ++i)
+    {
+        if (buckets[i] > 0)
+            lastBucket = i;
+
+        maxCount = std::max(maxCount, buckets[i]);
+    }
+
+    for (int i = 0; i <= lastBucket; ++i)
+    {
+        output.str("");
+        output.width(3);
+        output << i * FrameProfiler::HISTOGRAM_BUCKET_MS
+               << ((i + 1 < FrameProfiler::NUMBER_OF_BUCKETS) ? " ms " : "+ms ")
+               << std::string((buckets[i] * 40 + maxCount - 1) / maxCount, '#') << ' ' << buckets[i];
+        lines.push_back(output.str());
+    }
+
+    output.str("");
+    output << g_glCounters.drawCalls << " draws, " << g_glCounters.triangles << " triangles, "
+           << g_glCounters.programBinds << " program binds, " << g_glCounters.textureBinds
+           << " texture binds, " << g_glCounters.uniformLookups << " uniform lookups, "
+           << g_glCounters.bytesTransferred / 1024 << " KB transferred";
+    lines.push_back(output.str());
+
+    output.str("");
+    output << g_glCounters.stateChanges << " state changes, "
+           << g_glCounters.redundantStateChanges << " redundant dropped";
+    lines.push_back(output.str());
+
+    output.str("");
+    output << g_renderList.getNumberOfBatches() << " batches for " << g_renderList.getNumberOfCommands()
+           << " meshes, scene buffers " << g_vertexArena.getUsed() << '/' << g_vertexArena.getCapacity()
+           << " vertices, " << g_indexArena.getUsed() << '/' << g_indexArena.getCapacity() << " indices";
+    lines.push_back(output.str());
+
+    output.str("");
+    output << std::count(g_visibleGroups.begin(), g_visibleGroups.end(), 1) << '/'
+           << g_visibleGroups.size() << " groups drawn";
+
+    if (g_selectedGroup >= 0)
+    {
+        size_t it = GetGroupModel(g_selectedGroup);
+        const Model::Group &group = models[it].getGroup(g_selectedGroup - g_groupOffsets[it]);
+
+        output << ", selected " << g_selectedGroup + 1 << ' ' << group.name
+               << (group.hidden ? " (hidden)" : "");
+    }
+
+    lines.push_back(output.str());
+
+    if (g_chunkStreamer.isOpen())
+    {
+        ChunkStreamer::Statistics stats = g_chunkStreamer.getStatistics();
+
+        output.str("");
+        output << g_chunkStreamer.getNumberOfDrawLevels() << '/' << stats.visibleChunks << " chunks drawn, "
+               << stats.residentLevels << " levels resident, " << stats.pendingReads << " reads pending, "
+               << stats.residentBytes / (1024 * 1024) << '/' << g_chunkStreamer.getMemoryBudget() / (1024 * 1024)
+               << " MB, " << stats.evictions << " evictions";
+        lines.push_back(output.str());
+    }
+
+    if (g_frameSequence.isOpen())
+    {
+        output.str("");
+        output << "frame " << g_sequencePlayback.frame + 1 << '/' << g_frameSequence.getNumberOfFrames()
+               << (g_frameSequence.isEncoding() ? " (importing)" : "") << ", "
+               << g_frameSequence.getEncodedSize() / (1024 * 1024) << " MB, "
+               << g_sequencePlayback.lateFrames << " late" << (g_sequencePlayback.paused ? ", paused" : "");
+        lines.push_back(output.str());
+    }
+
+    if (g_progressiveMesh.isOpen())
+    {
+        output.str("");
+        output << "preview " << g_progressiveMesh.getNumberOfTriangles() << " triangles, "
+               << g_progressiveMesh.getNumberOfSplitsApplied() << '/' << g_progressiveMesh.getNumberOfSplits()
+               << " splits";
+        lines.push_back(output.str());
+    }
+
+    output.str("");
+    output << g_frameProfiler.getTotalHitches() << " hitches";
+    lines.push_back(output.str());
+
+    for (int i = std::max(0, g_frameProfiler.getNumberOfHitches() - 5); i < g_frameProfiler.getNumberOfHitches(); ++i)
+    {
+        const FrameProfiler::Frame &hitch = g_frameProfiler.getHitch(i);
+
+        output.str("");
+        output << "  #" << hitch.number << ' ' << hitch.seconds * 1000.0f << " ms ("
+               << FrameProfiler::describeActivity(hitch.activity) << ')';
+        lines.push_back(output.str());
+    }
+
+    glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT | GL_LIST_BIT);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_TEXTURE_2D);
+    glDisable(GL_BLEND);
+
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    glOrtho(0.0, g_windowWidth, 0.0, g_windowHeight, -1.0, 1.0);
+
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+
+    glColor3f(1.0f, 1.0f, 0.0f);
+    glListBase(g_overlayFont - 32);
+
+    for (size_t i = 0; i < lines.size(); ++i)
+    {
+        glRasterPos2i(8, g_windowHeight - static_cast<int>(i + 1) * OVERLAY_LINE_HEIGHT);
+        glCallLists(static_cast<GLsizei>(lines[i].length()), GL_UNSIGNED_BYTE, lines[i].c_str());
+    }
+
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopAttrib();
+}
+
+void DrawProgressiveMesh()
+{
+	TRACE_ZONE("DrawProgressiveMesh");
+
+	// The preview is built from the normalized model, so it needs no transform.
+	if (!g_progressiveMesh.isOpen())
+		return;
+
+	BeginPlainMeshes();
+	DrawPlainMesh(g_progressiveMesh.getVertices(), g_progressiveMesh.getIndices());
+	EndPlainMeshes();
+}
+
+void EndPlainMeshes()
+{
+	SetVertexArrays(0, 0, false);
+	glPopAttrib();
+}
+
+void ExportFrameProfile()
+{
+    std::string filename = FRAME_PROFILE_FILENAME;
+
+    if (!g_frameProfiler.writeCsv((filename + ".csv").c_str()) ||
+        !g_frameProfiler.writeJson((filename + ".json").c_str()))
+    {
+        Log("Failed to write the frame profile.");
+    }
 }
 
 bool ExtensionSupported(const char *pszExtensionName)
@@ -691,6 +1749,92 @@ bool ExtensionSupported(const char *pszExtensionName)
     return true;
 }
 
+void FinishReload()
+{
+    // Hands a reload over to the model that was loaded from the same file.
+    // Textures that were read again replace only their own entries, while a
+    // model that was imported again replaces the whole model in place. The
+    // result is dropped if the model was unloaded in the meantime.
+    PendingModel &pending = g_pendingModel;
+    ModelLoader::Result &result = *pending.pResult;
+    size_t model = 0;
+
+    while (model < modelSourcesList.size() && modelSourcesList[model].filename != result.filename)
+        ++model;
+
+    if (model == models.size())
+    {
+        for (ModelTextures::iterator i = pending.modelTextures.begin(); i != pending.modelTextures.end(); ++i)
+            g_textureCache.release(i->second);
+    }
+    else if (result.type == ModelLoader::REQUEST_RELOAD_TEXTURES)
+    {
+        ModelTextures &modelTextures = modelTexturesList[model];
+
+        for (ModelTextures::iterator i = pending.modelTextures.begin(); i != pending.modelTextures.end(); ++i)
+        {
+            ModelTextures::iterator previous = modelTextures.find(i->first);
+
+            if (previous != modelTextures.end())
+                g_textureCache.release(previous->second);
+
+            modelTextures[i->first] = i->second;
+        }
+
+        RecordModelTextures(modelSourcesList[model], result.textures);
+    }
+    else
+    {
+        ModelTextures &modelTextures = modelTexturesList[model];
+
+        for (ModelTextures::iterator i = modelTextures.begin(); i != modelTextures.end(); ++i)
+            g_textureCache.release(i->second);
+
+        modelTextures.swap(pending.modelTextures);
+        DeleteModelBuffers(modelBuffersList[model]);
+        models[model].swap(result.model);
+        CreateModelBuffers(models[model], modelBuffersList[model]);
+
+        modelSourcesList[model].textures.clear();
+        RecordModelTextures(modelSourcesList[model], result.textures);
+
+        // The sequence is stored relative to the first frame, which is the
+        // file that just changed.
+        if (model == 0 && g_frameSequence.isOpen())
+        {
+            g_frameSequence.open(result.filename, g_importFilter);
+            g_sequencePlayback.frame = 0;
+            g_sequencePlayback.lateFrames = 0;
+            g_sequencePlayback.dueTime = 0;
+        }
+    }
+
+    delete pending.pResult;
+    pending.pResult = 0;
+    pending.modelTextures.clear();
+
+    BuildRenderList();
+    WatchModelFiles();
+    SetWindowTitle(g_windowTitle);
+    g_needsRedraw = true;
+}
+
+CameraPath::Key GetCameraKey()
+{
+    CameraPath::Key key;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        key.cameraPos[i] = g_cameraPos[i];
+        key.targetPos[i] = g_targetPos[i];
+    }
+
+    key.heading = g_heading;
+    key.pitch = g_pitch;
+
+    return key;
+}
+
 float GetElapsedTimeInSeconds()
 {
     static const int MAX_SAMPLE_COUNT = 50;
@@ -701,6 +1845,7 @@ float GetElapsedTimeInSeconds()
     static INT64 freq = 0;
     static INT64 lastTime = 0;
     static int sampleCount = 0;
+    static int nextSample = 0;
     static bool initialized = false;
 
     INT64 time = 0;
@@ -720,8 +1865,8 @@ float GetElapsedTimeInSeconds()
 
     if (fabsf(elapsedTimeSec - actualElapsedTimeSec) < 1.0f)
     {
-        memmove(&frameTimes[1], frameTimes, sizeof(frameTimes) - sizeof(frameTimes[0]));
-        frameTimes[0] = elapsedTimeSec;
+        frameTimes[nextSample] = elapsedTimeSec;
+        nextSample = (nextSample + 1) % MAX_SAMPLE_COUNT;
 
         if (sampleCount < MAX_SAMPLE_COUNT)
             ++sampleCount;
@@ -738,19 +1883,108 @@ float GetElapsedTimeInSeconds()
     return actualElapsedTimeSec;
 }
 
-bool Init()
+unsigned int GetFrameActivity()
 {
-    try
+    unsigned int activity = 0;
+
+    if (g_modelLoader.isBusy() || g_chunkStreamer.isBusy() || g_frameSequence.isEncoding() ||
+        (g_progressiveMesh.isOpen() && !g_progressiveMesh.isComplete()))
+        activity |= FrameProfiler::ACTIVITY_LOADING;
+
+    if (g_pendingModel.pResult)
+        activity |= FrameProfiler::ACTIVITY_TEXTURE_UPLOAD;
+
+    if (g_isInteracting)
     {
-        InitGL();
-        InitApp();
-        return true;
+        activity |= FrameProfiler::ACTIVITY_INTERACTING;
+
+        if (g_enableDetailLevels && g_detailLevel > 0)
+            activity |= FrameProfiler::ACTIVITY_REDUCED_DETAIL;
     }
-    catch (const std::exception &e)
-    {
-        std::ostringstream msg;
 
-        msg << "Application initialization failed!" << std::endl << std::endl;
+    return activity;
+}
+
+size_t GetGroupModel(int group)
+{
+    // Groups are numbered across all models in load order.
+    return std::upper_bound(g_groupOffsets.begin(), g_groupOffsets.end(), group) - g_groupOffsets.begin() - 1;
+}
+
+ModelLoader::Options GetLoadOptions()
+{
+    ModelLoader::Options options;
+
+    options.powerOfTwo = !g_supportsNonPowerOfTwoTextures;
+    options.compressColorMaps = g_enableTextureCompression && g_supportsS3TC;
+    options.compressNormalMaps = g_enableTextureCompression && g_supportsRGTC;
+    options.writeProgressiveMesh = g_importFilter.groupPatterns.empty() &&
+        g_importFilter.materialNames.empty() && !g_importFilter.hasRegion;
+    options.filter = g_importFilter;
+
+    return options;
+}
+
+void GrowSceneBuffers(size_t numberOfVertices, size_t numberOfIndices)
+{
+    TRACE_ZONE("GrowSceneBuffers");
+
+    // Buffer objects can't be resized in place, so both are recreated at least
+    // twice as large and every model in them is uploaded again.
+    g_vertexArena.compact();
+    g_indexArena.compact();
+
+    g_vertexArena.setCapacity(std::max<size_t>(SCENE_BUFFER_MIN_VERTICES,
+        std::max(g_vertexArena.getCapacity() * 2, g_vertexArena.getUsed() + numberOfVertices)));
+    g_indexArena.setCapacity(std::max<size_t>(SCENE_BUFFER_MIN_INDICES,
+        std::max(g_indexArena.getCapacity() * 2, g_indexArena.getUsed() + numberOfIndices)));
+
+    if (!g_sceneVertexBuffer)
+        glGenBuffers(1, &g_sceneVertexBuffer);
+
+    if (!g_sceneIndexBuffer)
+        glGenBuffers(1, &g_sceneIndexBuffer);
+
+    glBindBuffer(GL_ARRAY_BUFFER, g_sceneVertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, g_vertexArena.getCapacity() * sizeof(Model::Vertex), 0, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_sceneIndexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, g_indexArena.getCapacity() * sizeof(int), 0, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    for (size_t i = 0; i < models.size(); ++i)
+    {
+        if (modelBuffersList[i].vertexBlock >= 0)
+            UploadModelBuffers(models[i], modelBuffersList[i]);
+    }
+}
+
+void HideSelectedGroup()
+{
+    if (g_selectedGroup < 0)
+        return;
+
+    size_t it = GetGroupModel(g_selectedGroup);
+    int group = g_selectedGroup - g_groupOffsets[it];
+
+    models[it].setGroupHidden(group, !models[it].getGroup(group).hidden);
+    g_needsRedraw = true;
+}
+
+bool Init()
+{
+    try
+    {
+        InitGL();
+        InitApp();
+        return true;
+    }
+    catch (const std::exception &e)
+    {
+        std::ostringstream msg;
+
+        msg << "Application initialization failed!" << std::endl << std::endl;
         msg << e.what();
 
         Log(msg.str().c_str());
@@ -792,15 +2026,61 @@ void InitApp()
             reinterpret_cast<const char *>(SHADER_NORMAL_MAPPING), infoLog)))
             throw std::runtime_error("Failed to load normal mapping shader.\n" + infoLog);
 
+        // Sampler uniforms never change, so they are set once here.
+        glUseProgram(g_blinnPhongShader);
+        glUniform1i(glGetUniformLocation(g_blinnPhongShader, "colorMap"), 0);
+        glUseProgram(g_normalMappingShader);
+        glUniform1i(glGetUniformLocation(g_normalMappingShader, "colorMap"), 0);
+        glUniform1i(glGetUniformLocation(g_normalMappingShader, "normalMap"), 1);
+        glUseProgram(0);
+
         if (!(g_nullTexture = CreateNullTexture(2, 2)))
             throw std::runtime_error("Failed to create null texture.");
     }
 
-    if (__argc == 2)
+    // viewer <model> -replay <camera path> replays the path once the model
+    // has loaded, writes the frame timings and exits. -group <pattern>,
+    // -material <name> and -region <min x y z> <max x y z> only import the
+    // matching faces of the models loaded in this session. -sequence <fps>
+    // plays a model numbered like "frame_0001.obj" and the files after it as
+    // a frame sequence.
+    for (int i = 2; i < __argc; ++i)
     {
-        LoadModel(__argv[1]);
-        ResetCamera();
+        if (strcmp(__argv[i], "-replay") == 0 && i + 1 < __argc)
+        {
+            g_replayFilename = __argv[++i];
+            g_quitAfterReplay = true;
+        }
+        else if (strcmp(__argv[i], "-group") == 0 && i + 1 < __argc)
+        {
+            g_importFilter.groupPatterns.push_back(__argv[++i]);
+        }
+        else if (strcmp(__argv[i], "-material") == 0 && i + 1 < __argc)
+        {
+            g_importFilter.materialNames.push_back(__argv[++i]);
+        }
+        else if (strcmp(__argv[i], "-sequence") == 0 && i + 1 < __argc)
+        {
+            g_sequencePlayback.frameRate = static_cast<float>(atof(__argv[++i]));
+        }
+        else if (strcmp(__argv[i], "-region") == 0 && i + 6 < __argc)
+        {
+            g_importFilter.hasRegion = true;
+
+            for (int j = 0; j < 6; ++j)
+            {
+                float &bound = (j < 3) ? g_importFilter.minPosition[j] : g_importFilter.maxPosition[j - 3];
+                bound = static_cast<float>(atof(__argv[++i]));
+            }
+        }
     }
+
+    g_fileWatcher.setNotifyCallback(NotifyFilesChanged, 0);
+
+    if (__argc >= 2 && strstr(__argv[1], ".chunks"))
+        OpenChunkFile(__argv[1]);
+    else if (__argc >= 2)
+        LoadModel(__argv[1]);
 }
 
 void InitGL()
@@ -843,15 +2123,70 @@ void InitGL()
         throw std::runtime_error("wglMakeCurrent() failed.");
 
     GL2Init();
+    GL2InvalidateState();
 
     g_supportsProgrammablePipeline = GL2SupportsGLVersion(2, 0);
 
+    g_supportsNonPowerOfTwoTextures = g_supportsProgrammablePipeline ||
+        ExtensionSupported("GL_ARB_texture_non_power_of_two");
+
+    g_supportsS3TC = ExtensionSupported("GL_EXT_texture_compression_s3tc");
+
+    g_supportsRGTC = GL2SupportsGLVersion(3, 0) ||
+        ExtensionSupported("GL_ARB_texture_compression_rgtc") ||
+        ExtensionSupported("GL_EXT_texture_compression_rgtc");
+
+    g_supportsVertexBufferObjects = GL2SupportsGLVersion(1, 5);
+    g_supportsMultiDraw = GL2SupportsGLVersion(1, 4);
+
     if (ExtensionSupported("GL_EXT_texture_filter_anisotropic"))
         glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &g_maxAnisotrophy);
     else
         g_maxAnisotrophy = 1.0f;
 }
 
+bool IsBatchVisible(const RenderList::Batch &batch)
+{
+    const RenderList::Command &command = g_renderList.getCommand(batch.firstCommand);
+
+    if (command.prototype >= 0)
+    {
+        const Model &model = models[command.model];
+
+        for (int i = 0; i < model.getNumberOfInstances(command.prototype); ++i)
+        {
+            if (g_visibleGroups[g_groupOffsets[command.model] + model.getInstanceGroup(command.prototype, i)])
+                return true;
+        }
+
+        return false;
+    }
+
+    for (int i = 0; i < batch.numberOfCommands; ++i)
+    {
+        const RenderList::Command &other = g_renderList.getCommand(batch.firstCommand + i);
+
+        if (g_visibleGroups[g_groupOffsets[other.model] + other.group])
+            return true;
+    }
+
+    return false;
+}
+
+void IsolateSelectedGroup()
+{
+    if (g_selectedGroup < 0)
+        return;
+
+    for (size_t it = 0; it < models.size(); ++it)
+    {
+        for (int i = 0; i < models[it].getNumberOfGroups(); ++i)
+            models[it].setGroupHidden(i, g_groupOffsets[it] + i != g_selectedGroup);
+    }
+
+    g_needsRedraw = true;
+}
+
 GLuint LinkShaders(GLuint vertShader, GLuint fragShader)
 {
     GLuint program = glCreateProgram();
@@ -892,80 +2227,20 @@ GLuint LinkShaders(GLuint vertShader, GLuint fragShader)
 
 void LoadModel(const char *pszFilename)
 {
-	Model model;
-	ModelTextures modelTextures;
-
-    SetCursor(LoadCursor(0, IDC_WAIT));
-
-    if (!model.import(pszFilename))
-    {
-        SetCursor(LoadCursor(0, IDC_ARROW));
-        throw std::runtime_error("Failed to load model.");
-    }
+    TRACE_ZONE("LoadModel");
 
-	model.normalize();
+    ModelLoader::Options options = GetLoadOptions();
 
-    const Model::Material *pMaterial = 0;
-    GLuint textureId = 0;
-    std::string::size_type offset = 0;
-    std::string filename;
+    g_modelLoader.load(pszFilename, options);
 
-	for (int i = 0; i < model.getNumberOfMaterials(); ++i)
+    // A progressive mesh written by an earlier load is shown until the model
+    // itself arrives, coarse at first and refined a little every frame.
+    if (options.writeProgressiveMesh && models.empty() && !g_progressiveMesh.isOpen() &&
+        g_progressiveMesh.open(pszFilename))
     {
-		pMaterial = &model.getMaterial(i);
-
-        if (pMaterial->colorMapFilename.empty())
-            continue;
-        textureId = LoadTexture(pMaterial->colorMapFilename.c_str());
-
-        if (!textureId)
-        {
-            offset = pMaterial->colorMapFilename.find_last_of('\\');
-
-            if (offset != std::string::npos)
-                filename = pMaterial->colorMapFilename.substr(++offset);
-            else
-                filename = pMaterial->colorMapFilename;
-
-            textureId = LoadTexture((model.getPath() + filename).c_str());
-        }
-
-        if (textureId)
-            modelTextures[pMaterial->colorMapFilename] = textureId;
-
-        if (pMaterial->bumpMapFilename.empty())
-            continue;
-
-        textureId = LoadTexture(pMaterial->bumpMapFilename.c_str());
-
-        if (!textureId)
-        {
-            offset = pMaterial->bumpMapFilename.find_last_of('\\');
-
-            if (offset != std::string::npos)
-                filename = pMaterial->bumpMapFilename.substr(++offset);
-            else
-                filename = pMaterial->bumpMapFilename;
-
-			textureId = LoadTexture((model.getPath() + filename).c_str());
-        }
-
-        if (textureId)
-            modelTextures[pMaterial->bumpMapFilename] = textureId;
+        ResetCamera();
+        g_needsRedraw = true;
     }
-
-    SetCursor(LoadCursor(0, IDC_ARROW));
-
-    std::ostringstream caption;
-    const char *pszBareFilename = strrchr(pszFilename, '\\');
-
-	models.push_back(model);
-	modelTexturesList.push_back(modelTextures);
-
-    pszBareFilename = (pszBareFilename != 0) ? ++pszBareFilename : pszFilename;
-    caption << APP_TITLE << " - " << pszBareFilename;
-
-    SetWindowText(g_hWnd, caption.str().c_str());
 }
 
 GLuint LoadShaderProgramFromResource(const char *pResouceId, std::string &infoLog)
@@ -1016,39 +2291,38 @@ GLuint LoadShaderProgramFromResource(const char *pResouceId, std::string &infoLo
     return program;
 }
 
-GLuint LoadTexture(const char *pszFilename)
+void Log(const char *pszMessage)
 {
-    GLuint id = 0;
-    Bitmap bitmap;
-
-    if (bitmap.loadPicture(pszFilename))
-    {
-        bitmap.flipVertical();
-
-        glGenTextures(1, &id);
-        glBindTexture(GL_TEXTURE_2D, id);
+    MessageBox(0, pszMessage, "Error", MB_ICONSTOP);
+}
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+void NotifyFilesChanged(void *)
+{
+    // Called on the file watcher's thread. The message only wakes up the
+    // main loop, which then picks up the changes in UpdateHotReload().
+    PostMessage(g_hWnd, WM_NULL, 0, 0);
+}
 
-        if (g_maxAnisotrophy > 1.0f)
-        {
-            glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT,
-                g_maxAnisotrophy);
-        }
+void OpenChunkFile(const char *pszFilename)
+{
+    TRACE_ZONE("OpenChunkFile");
 
-        gluBuild2DMipmaps(GL_TEXTURE_2D, 4, bitmap.width, bitmap.height,
-            GL_BGRA_EXT, GL_UNSIGNED_BYTE, bitmap.getPixels());
+    // A chunk file replaces the one that was open before. Nothing is read
+    // until the first frame asks for the visible chunks.
+    if (!g_chunkStreamer.open(pszFilename))
+    {
+        Log((std::string("Failed to open chunk file ") + pszFilename).c_str());
+        return;
     }
 
-    return id;
-}
+    std::ostringstream text;
+    const char *pszBareFilename = strrchr(pszFilename, '\\');
 
-void Log(const char *pszMessage)
-{
-    MessageBox(0, pszMessage, "Error", MB_ICONSTOP);
+    text << APP_TITLE << " - " << (pszBareFilename ? pszBareFilename + 1 : pszFilename);
+    SetWindowTitle(text.str());
+
+    ResetCamera();
+    g_needsRedraw = true;
 }
 
 void ProcessMenu(HWND hWnd, WPARAM wParam, LPARAM lParam)
@@ -1061,7 +2335,7 @@ void ProcessMenu(HWND hWnd, WPARAM wParam, LPARAM lParam)
     case MENU_FILE_OPEN:
         ofn.lStructSize = sizeof(ofn);
         ofn.hwndOwner = hWnd;
-        ofn.lpstrFilter = "Alias|Wavefront (*.OBJ)\0*.obj\0";
+        ofn.lpstrFilter = "Alias|Wavefront (*.OBJ)\0*.obj\0Model chunks (*.CHUNKS)\0*.chunks\0";
         ofn.lpstrCustomFilter = 0;
         ofn.nFilterIndex = 1;
         ofn.lpstrFile = szFilename;
@@ -1074,8 +2348,11 @@ void ProcessMenu(HWND hWnd, WPARAM wParam, LPARAM lParam)
         if (GetOpenFileName(reinterpret_cast<LPOPENFILENAME>(&ofn)))
         {
             UnloadModel();
-            LoadModel(szFilename);
-            ResetCamera();
+
+            if (strstr(szFilename, ".chunks"))
+                OpenChunkFile(szFilename);
+            else
+                LoadModel(szFilename);
         }
 
         break;
@@ -1137,6 +2414,8 @@ void ProcessMenu(HWND hWnd, WPARAM wParam, LPARAM lParam)
     default:
         break;
     }
+
+    g_needsRedraw = true;
 }
 
 void ProcessMouseInput(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
@@ -1154,6 +2433,7 @@ void ProcessMouseInput(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
     {
     case WM_LBUTTONDOWN:
         cameraMode = CAMERA_TRACK;
+        g_isInteracting = true;
         ++mouseButtonsDown;
         SetCapture(hWnd);
         ptMousePrev.x = static_cast<int>(static_cast<short>(LOWORD(lParam)));
@@ -1163,6 +2443,7 @@ void ProcessMouseInput(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 
     case WM_RBUTTONDOWN:
         cameraMode = CAMERA_ORBIT;
+        g_isInteracting = true;
         ++mouseButtonsDown;
         SetCapture(hWnd);
         ptMousePrev.x = static_cast<int>(static_cast<short>(LOWORD(lParam)));
@@ -1172,6 +2453,7 @@ void ProcessMouseInput(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 
     case WM_MBUTTONDOWN:
         cameraMode = CAMERA_DOLLY;
+        g_isInteracting = true;
         ++mouseButtonsDown;
         SetCapture(hWnd);
         ptMousePrev.x = static_cast<int>(static_cast<short>(LOWORD(lParam)));
@@ -1235,6 +2517,9 @@ void ProcessMouseInput(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
             break;
         }
 
+        if (cameraMode != CAMERA_NONE)
+            g_needsRedraw = true;
+
         ptMousePrev.x = ptMouseCurrent.x;
         ptMousePrev.y = ptMouseCurrent.y;
         break;
@@ -1247,6 +2532,10 @@ void ProcessMouseInput(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
             mouseButtonsDown = 0;
             cameraMode = CAMERA_NONE;
             ReleaseCapture();
+
+            // Replace the last reduced detail frame with a full quality one.
+            g_isInteracting = false;
+            g_needsRedraw = true;
         }
         else
         {
@@ -1285,18 +2574,65 @@ void ReadTextFileFromResource(const char *pResouceId, std::string &buffer)
     }
 }
 
+void RecordModelTextures(ModelSource &source, const std::vector<ModelLoader::Texture> &textures)
+{
+    // Maps that couldn't be read are recorded as well, so that they are
+    // loaded once they appear.
+    for (size_t i = 0; i < textures.size(); ++i)
+    {
+        if (textures[i].resolvedFilename.empty())
+            continue;
+
+        TextureSource &texture = source.textures[textures[i].filename];
+
+        texture.resolvedFilename = textures[i].resolvedFilename;
+        texture.linear = textures[i].linear;
+    }
+}
+
 void ResetCamera()
 {
-    models[0].getCenter(g_targetPos[0], g_targetPos[1], g_targetPos[2]);
+    // Streamed chunks and progressive previews are scaled to the same unit
+    // size as loaded models.
+    float radius = 1.0f;
+
+    if (!models.empty())
+    {
+        models[0].getCenter(g_targetPos[0], g_targetPos[1], g_targetPos[2]);
+        radius = models[0].getRadius();
+    }
+    else if (g_chunkStreamer.isOpen() || g_progressiveMesh.isOpen())
+    {
+        g_targetPos[0] = g_targetPos[1] = g_targetPos[2] = 0.0f;
+    }
+    else
+    {
+        return;
+    }
 
     g_cameraPos[0] = g_targetPos[0];
     g_cameraPos[1] = g_targetPos[1];
-    g_cameraPos[2] = g_targetPos[2] + models[0].getRadius() + CAMERA_ZNEAR + 0.4f;
+    g_cameraPos[2] = g_targetPos[2] + radius + CAMERA_ZNEAR + 0.4f;
 	
     g_pitch = 0.0f;
     g_heading = 0.0f;
 }
 
+void SelectGroup(int step)
+{
+    int numberOfGroups = g_groupOffsets.empty() ? 0 : g_groupOffsets.back();
+
+    if (numberOfGroups == 0)
+        return;
+
+    if (g_selectedGroup < 0)
+        g_selectedGroup = (step > 0) ? 0 : numberOfGroups - 1;
+    else
+        g_selectedGroup = (g_selectedGroup + step + numberOfGroups) % numberOfGroups;
+
+    g_needsRedraw = true;
+}
+
 void SetProcessorAffinity()
 {
     DWORD_PTR dwProcessAffinityMask = 0;
@@ -1306,6 +2642,8 @@ void SetProcessorAffinity()
     if (!GetProcessAffinityMask(hCurrentProcess, &dwProcessAffinityMask, &dwSystemAffinityMask))
         return;
 
+    JobSystem::Options options = {0, 0};
+
     if (dwProcessAffinityMask)
     {
         DWORD_PTR dwAffinityMask = (dwProcessAffinityMask & ((~dwProcessAffinityMask) + 1));
@@ -1317,11 +2655,202 @@ void SetProcessorAffinity()
             SetThreadAffinityMask(hCurrentThread, dwAffinityMask);
             CloseHandle(hCurrentThread);
         }
+
+        // The main thread keeps the lowest core to itself; the job system's
+        // workers get one of the remaining cores each.
+        if (g_pinWorkerThreads)
+            options.affinityMask = dwProcessAffinityMask & ~dwAffinityMask;
     }
 
+    JobSystem::configure(options);
     CloseHandle(hCurrentProcess);
 }
 
+void SetVertexArrays(const Model *pModel, const ModelBuffers *pBuffers, bool tangents)
+{
+    // Points the client arrays at the model's vertices, or disables them all
+    // when pModel is null. Models in the scene buffers are drawn from them and
+    // the others from client memory. Tangents go to texture unit 1 for normal
+    // mapping.
+    const GLubyte *pVertices = 0;
+    GLsizei stride = pModel ? pModel->getVertexSize() : 0;
+
+    if (pBuffers && pBuffers->vertexBlock >= 0)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, g_sceneVertexBuffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_sceneIndexBuffer);
+        pVertices = BUFFER_OFFSET(0);
+    }
+    else
+    {
+        if (g_supportsVertexBufferObjects)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        }
+
+        if (pModel)
+            pVertices = reinterpret_cast<const GLubyte *>(pModel->getVertexBuffer());
+    }
+
+    if (pModel && pModel->hasPositions())
+    {
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(3, GL_FLOAT, stride, pVertices + offsetof(Model::Vertex, position));
+    }
+    else
+    {
+        glDisableClientState(GL_VERTEX_ARRAY);
+    }
+
+    if (pModel && pModel->hasNormals())
+    {
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glNormalPointer(GL_FLOAT, stride, pVertices + offsetof(Model::Vertex, normal));
+    }
+    else
+    {
+        glDisableClientState(GL_NORMAL_ARRAY);
+    }
+
+    if (tangents)
+    {
+        glClientActiveTexture(GL_TEXTURE1);
+
+        if (pModel && pModel->hasTangents())
+        {
+            glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+            glTexCoordPointer(4, GL_FLOAT, stride, pVertices + offsetof(Model::Vertex, tangent));
+        }
+        else
+        {
+            glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        }
+
+        glClientActiveTexture(GL_TEXTURE0);
+    }
+
+    if (pModel && pModel->hasTextureCoords())
+    {
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glTexCoordPointer(2, GL_FLOAT, stride, pVertices + offsetof(Model::Vertex, texCoord));
+    }
+    else
+    {
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    }
+}
+
+void SetWindowTitle(const std::string &title)
+{
+    std::ostringstream text;
+
+    g_windowTitle = title;
+    text << title;
+
+    if (g_showFrameCounters)
+    {
+        text << " [" << g_frameCounters.framesDrawnLastSecond << " fps, "
+             << g_frameCounters.framesDrawn << " frames drawn, "
+             << g_frameCounters.idleWaits << " idle waits]";
+    }
+
+    if (g_isRecordingCameraPath)
+        text << " [recording camera path, " << g_cameraPath.getNumberOfKeys() << " frames]";
+
+    SetWindowText(g_hWnd, text.str().c_str());
+}
+
+void ShowAllGroups()
+{
+    for (size_t it = 0; it < models.size(); ++it)
+    {
+        for (int i = 0; i < models[it].getNumberOfGroups(); ++i)
+            models[it].setGroupHidden(i, false);
+    }
+
+    g_needsRedraw = true;
+}
+
+void StartReplay(const char *pszFilename)
+{
+    if (!g_cameraPath.load(pszFilename))
+    {
+        Log(("Failed to load camera path " + std::string(pszFilename)).c_str());
+        g_quitAfterReplay = false;
+        return;
+    }
+
+    if (g_isRecordingCameraPath)
+        ToggleCameraRecording();
+
+    // Every key of the path is drawn exactly once with a fixed time step, so
+    // runs on different builds are directly comparable frame by frame.
+
+    g_frameProfiler.reset(std::max(static_cast<int>(FrameProfiler::HISTORY_SIZE), g_cameraPath.getNumberOfKeys()));
+    g_replayFrame = 0;
+    ApplyCameraKey(g_cameraPath.getKey(0));
+    g_needsRedraw = true;
+}
+
+void StopReplay()
+{
+    std::string filename = REPLAY_RESULTS_FILENAME;
+    FrameProfiler::Statistics statistics = g_frameProfiler.getStatistics();
+
+    g_replayFrame = -1;
+
+    if (!g_frameProfiler.writeCsv((filename + ".csv").c_str()) ||
+        !g_frameProfiler.writeJson((filename + ".json").c_str()))
+    {
+        Log("Failed to write the replay results.");
+    }
+
+    g_frameProfiler.reset();
+
+    if (g_quitAfterReplay)
+    {
+        PostMessage(g_hWnd, WM_CLOSE, 0, 0);
+        return;
+    }
+
+    std::ostringstream text;
+
+    text.setf(std::ios::fixed);
+    text.precision(2);
+    text << APP_TITLE << " - Replayed " << statistics.numberOfFrames << " frames: p50 "
+         << statistics.p50 * 1000.0f << " ms, p95 " << statistics.p95 * 1000.0f << " ms, p99 "
+         << statistics.p99 * 1000.0f << " ms";
+    SetWindowTitle(text.str());
+}
+
+void ToggleCameraRecording()
+{
+    if (!g_isRecordingCameraPath)
+    {
+        g_cameraPath.clear();
+        g_isRecordingCameraPath = true;
+        SetWindowTitle(g_windowTitle);
+        return;
+    }
+
+    g_isRecordingCameraPath = false;
+    SetWindowTitle(g_windowTitle);
+
+    if (!g_cameraPath.save(CAMERA_PATH_FILENAME))
+        Log("Failed to write the camera path.");
+}
+
+void ToggleFrameCounters()
+{
+    if (g_showFrameCounters = !g_showFrameCounters)
+        SetTimer(g_hWnd, FRAME_COUNTERS_TIMER, 1000, 0);
+    else
+        KillTimer(g_hWnd, FRAME_COUNTERS_TIMER);
+
+    UpdateFrameCounters();
+}
+
 void ToggleFullScreen()
 {
     static DWORD savedExStyle;
@@ -1362,29 +2891,136 @@ void ToggleFullScreen()
     }
 }
 
+void ToggleTracing()
+{
+    if (!Trace::isEnabled())
+    {
+        Trace::start();
+        return;
+    }
+
+    Trace::stop();
+
+    if (!Trace::write(TRACE_FILENAME))
+        Log("Failed to write the trace.");
+}
+
 void UnloadModel()
 {
+    CancelLoading();
     SetCursor(LoadCursor(0, IDC_WAIT));
 
 	for (size_t it = 0; it < models.size(); ++it)
 	{
-		Model model = models[it];
-		ModelTextures modelTextures = modelTexturesList[it];
-
+		ModelTextures &modelTextures = modelTexturesList[it];
 		ModelTextures::iterator i = modelTextures.begin();
 
 		while (i != modelTextures.end())
 		{
-			glDeleteTextures(1, &i->second);
+			g_textureCache.release(i->second);
 			++i;
 		}
 
-		modelTextures.clear();
-		model.destroy();
+		DeleteModelBuffers(modelBuffersList[it]);
+		models[it].destroy();
 	}
 
+    models.clear();
+    modelTexturesList.clear();
+    modelBuffersList.clear();
+    modelSourcesList.clear();
+    g_renderList.clear();
+    DeleteSceneBuffers();
+    g_chunkStreamer.close();
+    g_frameSequence.close();
+    WatchModelFiles();
+
     SetCursor(LoadCursor(0, IDC_ARROW));
-    SetWindowText(g_hWnd, APP_TITLE);
+    SetWindowTitle(APP_TITLE);
+}
+
+void UnloadModel(size_t model)
+{
+    ModelTextures &modelTextures = modelTexturesList[model];
+
+    for (ModelTextures::iterator i = modelTextures.begin(); i != modelTextures.end(); ++i)
+        g_textureCache.release(i->second);
+
+    DeleteModelBuffers(modelBuffersList[model]);
+    models[model].destroy();
+
+    if (model == 0)
+        g_frameSequence.close();
+
+    models.erase(models.begin() + model);
+    modelTexturesList.erase(modelTexturesList.begin() + model);
+    modelBuffersList.erase(modelBuffersList.begin() + model);
+    modelSourcesList.erase(modelSourcesList.begin() + model);
+
+    CompactSceneBuffers();
+    BuildRenderList();
+    WatchModelFiles();
+
+    if (models.empty())
+        SetWindowTitle(APP_TITLE);
+
+    g_needsRedraw = true;
+}
+
+void UpdateCameraPath()
+{
+    if (g_isRecordingCameraPath)
+        g_cameraPath.add(GetCameraKey());
+
+    if (g_replayFrame < 0)
+        return;
+
+    if (++g_replayFrame < g_cameraPath.getNumberOfKeys())
+    {
+        ApplyCameraKey(g_cameraPath.getKey(g_replayFrame));
+        g_needsRedraw = true;
+    }
+    else
+    {
+        StopReplay();
+    }
+}
+
+void UpdateDetailLevel(float frameTimeSec)
+{
+    // While the camera is being moved pick the finest detail level that
+    // still draws within INTERACTIVE_FRAME_TIME. Decisions are made on the
+    // average of a few frames, and the upper threshold leaves room for a
+    // SwapBuffers that waits for the vertical blank.
+
+    static float accumTimeSec = 0.0f;
+    static int frames = 0;
+
+    if (!g_isInteracting)
+    {
+        accumTimeSec = 0.0f;
+        frames = 0;
+        return;
+    }
+
+    accumTimeSec += frameTimeSec;
+
+    if (++frames < INTERACTIVE_SAMPLE_FRAMES)
+        return;
+
+    float averageTimeSec = accumTimeSec / frames;
+    int numberOfDetailLevels = 1;
+
+    accumTimeSec = 0.0f;
+    frames = 0;
+
+    for (size_t i = 0; i < models.size(); ++i)
+        numberOfDetailLevels = std::max(numberOfDetailLevels, models[i].getNumberOfDetailLevels());
+
+    if (averageTimeSec > INTERACTIVE_FRAME_TIME * 1.25f)
+        g_detailLevel = std::min(g_detailLevel + 1, numberOfDetailLevels - 1);
+    else if (averageTimeSec < INTERACTIVE_FRAME_TIME * 0.4f)
+        g_detailLevel = std::max(g_detailLevel - 1, 0);
 }
 
 void UpdateFrame(float elapsedTimeSec)
@@ -1392,6 +3028,18 @@ void UpdateFrame(float elapsedTimeSec)
     UpdateFrameRate(elapsedTimeSec);
 }
 
+void UpdateFrameCounters()
+{
+    static unsigned int lastFramesDrawn = 0;
+
+    g_frameCounters.framesDrawnLastSecond = g_frameCounters.framesDrawn - lastFramesDrawn;
+    lastFramesDrawn = g_frameCounters.framesDrawn;
+
+    // The loading progress caption takes precedence.
+    if (!g_modelLoader.isBusy() && !g_pendingModel.pResult)
+        SetWindowTitle(g_windowTitle);
+}
+
 void UpdateFrameRate(float elapsedTimeSec)
 {
     static float accumTimeSec = 0.0f;
@@ -1410,4 +3058,442 @@ void UpdateFrameRate(float elapsedTimeSec)
     {
         ++frames;
     }
+}
+
+void UpdateHotReload()
+{
+    // Sorts the files that were saved since the last frame by the model they
+    // belong to. A changed OBJ file is imported again in the background and
+    // replaces its model once it is ready. A changed material library only
+    // updates the materials, and changed textures are the only ones that are
+    // read and decoded again.
+    std::vector<std::string> filenames;
+    bool materialsChanged = false;
+
+    if (!g_fileWatcher.popChanges(filenames))
+        return;
+
+    for (size_t it = 0; it < modelSourcesList.size(); ++it)
+    {
+        const ModelSource &source = modelSourcesList[it];
+        const std::vector<std::string> &libraries = models[it].getMaterialLibraries();
+        std::vector<std::string> colorMaps;
+        std::vector<std::string> bumpMaps;
+        bool reloadModel = false;
+        bool reloadMaterials = false;
+
+        for (size_t i = 0; i < filenames.size(); ++i)
+        {
+            if (filenames[i] == source.filename)
+                reloadModel = true;
+            else if (std::find(libraries.begin(), libraries.end(), filenames[i]) != libraries.end())
+                reloadMaterials = true;
+
+            std::map<std::string, TextureSource>::const_iterator texture = source.textures.begin();
+
+            for (; texture != source.textures.end(); ++texture)
+            {
+                if (texture->second.resolvedFilename == filenames[i])
+                    (texture->second.linear ? bumpMaps : colorMaps).push_back(texture->first);
+            }
+        }
+
+        if (reloadModel)
+        {
+            g_modelLoader.reload(source.filename, GetLoadOptions());
+            continue;
+        }
+
+        if (reloadMaterials && models[it].reloadMaterials())
+        {
+            const ModelTextures &modelTextures = modelTexturesList[it];
+
+            materialsChanged = true;
+
+            // Maps that a material refers to for the first time.
+            for (int i = 0; i < models[it].getNumberOfMaterials(); ++i)
+            {
+                const Model::Material &material = models[it].getMaterial(i);
+
+                if (!material.colorMapFilename.empty() && modelTextures.find(material.colorMapFilename) == modelTextures.end())
+                    colorMaps.push_back(material.colorMapFilename);
+
+                if (!material.bumpMapFilename.empty() && modelTextures.find(material.bumpMapFilename) == modelTextures.end())
+                    bumpMaps.push_back(material.bumpMapFilename);
+            }
+        }
+
+        if (!colorMaps.empty() || !bumpMaps.empty())
+            g_modelLoader.reloadTextures(source.filename, colorMaps, bumpMaps, GetLoadOptions());
+    }
+
+    if (materialsChanged)
+    {
+        BuildRenderList();
+        g_needsRedraw = true;
+    }
+}
+
+void UpdateLoading()
+{
+    PendingModel &pending = g_pendingModel;
+
+    if (!pending.pResult)
+    {
+        while ((pending.pResult = g_modelLoader.popResult()) != 0)
+        {
+            if (!pending.pResult->cancelled && pending.pResult->succeeded)
+                break;
+
+            // A cancelled result may be left over from before the preview
+            // was opened.
+            if (!pending.pResult->cancelled)
+            {
+                Log(("Failed to load model " + pending.pResult->filename).c_str());
+                g_progressiveMesh.close();
+                SetWindowTitle(g_windowTitle);
+            }
+
+            DiscardLoadResult(pending.pResult);
+        }
+
+        if (!pending.pResult)
+        {
+            if (g_modelLoader.isBusy())
+            {
+                ModelLoader::Progress progress = g_modelLoader.getProgress();
+                std::ostringstream text;
+
+                text << APP_TITLE << " - Loading";
+
+                switch (progress.phase)
+                {
+                case ModelLoader::PHASE_PARSING:
+                    text << ": parsing pass " << progress.pass << " "
+                         << (progress.bytesTotal ? 100 * static_cast<INT64>(progress.bytesParsed) / progress.bytesTotal : 0)
+                         << "% (" << progress.bytesParsed / 1024 << " KB)";
+
+                    if (progress.numberOfTextures > 0)
+                        text << ", textures " << progress.texturesLoaded << "/" << progress.numberOfTextures;
+                    break;
+
+                case ModelLoader::PHASE_PROCESSING:
+                    text << ": processing geometry";
+                    break;
+
+                case ModelLoader::PHASE_LOADING_TEXTURES:
+                    text << ": textures " << progress.texturesLoaded << "/" << progress.numberOfTextures;
+                    break;
+
+                default:
+                    break;
+                }
+
+                text << " (Esc to cancel)";
+
+                char szCaption[256] = {'\0'};
+                GetWindowText(g_hWnd, szCaption, sizeof(szCaption));
+
+                if (text.str() != szCaption)
+                    SetWindowText(g_hWnd, text.str().c_str());
+            }
+
+            return;
+        }
+
+        pending.modelTextures.clear();
+        pending.texture = 0;
+        pending.level = 0;
+        pending.id = 0;
+    }
+
+    // Upload at most TEXTURE_UPLOAD_TIME_SLICE worth of mip levels per frame
+    // so the scene that is already loaded keeps rendering smoothly.
+
+    INT64 freq = 0;
+    INT64 start = 0;
+    INT64 now = 0;
+
+    QueryPerformanceFrequency(reinterpret_cast<LARGE_INTEGER*>(&freq));
+    QueryPerformanceCounter(reinterpret_cast<LARGE_INTEGER*>(&start));
+
+    std::vector<ModelLoader::Texture> &textures = pending.pResult->textures;
+
+    while (pending.texture < textures.size())
+    {
+        ModelLoader::Texture &texture = textures[pending.texture];
+        int numberOfLevels = texture.compressedTexture.getNumberOfLevels();
+
+        if (numberOfLevels == 0)
+            numberOfLevels = texture.mipChain.getNumberOfLevels();
+
+        if (texture.id || texture.source >= 0 || numberOfLevels == 0)
+        {
+            if (!texture.id && texture.source >= 0)
+            {
+                const ModelLoader::Texture &source = textures[texture.source];
+                texture.id = g_textureCache.acquire(source.resolvedFilename, source.hash, source.linear);
+            }
+
+            if (texture.id)
+                pending.modelTextures[texture.filename] = texture.id;
+
+            texture.id = 0;
+            ++pending.texture;
+            continue;
+        }
+
+        if (pending.level == 0)
+            pending.id = CreateTexture(numberOfLevels);
+        else
+            glBindTexture(GL_TEXTURE_2D, pending.id);
+
+        if (texture.compressedTexture.getNumberOfLevels() > 0)
+            UploadTextureLevel(texture.compressedTexture, pending.level);
+        else
+            UploadTextureLevel(texture.mipChain, pending.level);
+
+        if (++pending.level == numberOfLevels)
+        {
+            size_t size = texture.compressedTexture.getSizeInBytes() + texture.mipChain.getSizeInBytes();
+
+            g_textureCache.insert(texture.resolvedFilename, texture.hash, texture.linear, pending.id, size);
+            pending.modelTextures[texture.filename] = pending.id;
+
+            texture.compressedTexture.clear();
+            texture.mipChain.clear();
+
+            pending.id = 0;
+            pending.level = 0;
+            ++pending.texture;
+        }
+
+        QueryPerformanceCounter(reinterpret_cast<LARGE_INTEGER*>(&now));
+
+        if (static_cast<float>(now - start) / freq >= TEXTURE_UPLOAD_TIME_SLICE)
+            return;
+    }
+
+    if (pending.pResult->type != ModelLoader::REQUEST_LOAD)
+    {
+        FinishReload();
+        return;
+    }
+
+    models.push_back(Model());
+    models.back().swap(pending.pResult->model);
+    modelTexturesList.push_back(pending.modelTextures);
+    modelBuffersList.push_back(ModelBuffers());
+    modelSourcesList.push_back(ModelSource());
+    modelSourcesList.back().filename = pending.pResult->filename;
+    RecordModelTextures(modelSourcesList.back(), pending.pResult->textures);
+    CreateModelBuffers(models.back(), modelBuffersList.back());
+    BuildRenderList();
+    WatchModelFiles();
+
+    std::ostringstream text;
+    const char *pszFilename = pending.pResult->filename.c_str();
+    const char *pszBareFilename = strrchr(pszFilename, '\\');
+
+    pszBareFilename = (pszBareFilename != 0) ? ++pszBareFilename : pszFilename;
+    text << APP_TITLE << " - " << pszBareFilename;
+    SetWindowTitle(text.str());
+
+    if (g_sequencePlayback.frameRate > 0.0f && models.size() == 1)
+    {
+        g_frameSequence.open(pszFilename, g_importFilter);
+        g_sequencePlayback.frame = 0;
+        g_sequencePlayback.lateFrames = 0;
+        g_sequencePlayback.dueTime = 0;
+    }
+
+    delete pending.pResult;
+    pending.pResult = 0;
+    pending.modelTextures.clear();
+
+    // The camera was already placed for the preview and may have moved since.
+    if (!g_progressiveMesh.isOpen())
+        ResetCamera();
+
+    g_progressiveMesh.close();
+    g_needsRedraw = true;
+
+    if (!g_replayFilename.empty() && !g_modelLoader.isBusy())
+    {
+        StartReplay(g_replayFilename.c_str());
+        g_replayFilename.clear();
+    }
+}
+
+void UpdateSequence()
+{
+    // Shows the next frame of the sequence once it is due and decoded, while
+    // the frames after it are decoded in the background. A frame that isn't
+    // ready in time keeps the current one on screen instead of blocking, and
+    // counts as late. Playback applies to the first frame's model and only
+    // while it is the only one loaded.
+    SequencePlayback &playback = g_sequencePlayback;
+
+    if (!g_frameSequence.isOpen() || models.size() != 1)
+        return;
+
+    int numberOfFrames = g_frameSequence.getNumberOfFrames();
+
+    if (numberOfFrames < 2 || g_frameSequence.getNumberOfVertices() != models[0].getNumberOfVertices())
+        return;
+
+    int next = (playback.frame + 1) % numberOfFrames;
+
+    g_frameSequence.prefetch(next);
+
+    if (playback.paused)
+        return;
+
+    INT64 freq = 0;
+    INT64 now = 0;
+
+    QueryPerformanceFrequency(reinterpret_cast<LARGE_INTEGER*>(&freq));
+    QueryPerformanceCounter(reinterpret_cast<LARGE_INTEGER*>(&now));
+
+    INT64 period = static_cast<INT64>(freq / playback.frameRate);
+    const float *pVertices = 0;
+
+    if (now < playback.dueTime || (pVertices = g_frameSequence.getFrame(next)) == 0)
+        return;
+
+    if (playback.dueTime && now - playback.dueTime > period)
+        ++playback.lateFrames;
+
+    playback.dueTime = (playback.dueTime && now - playback.dueTime <= period) ? playback.dueTime + period : now + period;
+    playback.frame = next;
+
+    models[0].setPositionsAndNormals(pVertices);
+
+    if (modelBuffersList[0].vertexBlock >= 0)
+        UploadModelVertices(models[0], modelBuffersList[0]);
+
+    g_needsRedraw = true;
+}
+
+void UpdateStreaming()
+{
+    if (g_chunkStreamer.processCompleted())
+        g_needsRedraw = true;
+
+    if (!g_progressiveMesh.isOpen() || g_progressiveMesh.isComplete())
+        return;
+
+    // Apply split records for at most PROGRESSIVE_TIME_SLICE per frame, so
+    // the preview refines without holding up the frames that show it.
+
+    INT64 freq = 0;
+    INT64 start = 0;
+    INT64 now = 0;
+
+    QueryPerformanceFrequency(reinterpret_cast<LARGE_INTEGER*>(&freq));
+    QueryPerformanceCounter(reinterpret_cast<LARGE_INTEGER*>(&start));
+
+    while (g_progressiveMesh.refine(PROGRESSIVE_SPLITS_PER_STEP) > 0)
+    {
+        QueryPerformanceCounter(reinterpret_cast<LARGE_INTEGER*>(&now));
+
+        if (static_cast<float>(now - start) / freq >= PROGRESSIVE_TIME_SLICE)
+            break;
+    }
+
+    g_needsRedraw = true;
+}
+
+void UploadModelBuffers(const Model &model, const ModelBuffers &buffers)
+{
+    // Indices are rebased onto the model's first vertex in the scene buffer.
+    size_t firstVertex = g_vertexArena.getOffset(buffers.vertexBlock);
+    size_t firstIndex = g_indexArena.getOffset(buffers.indexBlock);
+    std::vector<int> indices;
+
+    UploadModelVertices(model, buffers);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_sceneIndexBuffer);
+
+    for (int i = 0; i < model.getNumberOfDetailLevels(); ++i)
+    {
+        const int *pIndices = model.getIndexBuffer(i);
+
+        indices.assign(pIndices, pIndices + model.getNumberOfIndices(i));
+
+        for (size_t j = 0; j < indices.size(); ++j)
+            indices[j] += static_cast<int>(firstVertex);
+
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, (firstIndex + buffers.indexOffsets[i]) * model.getIndexSize(),
+            indices.size() * model.getIndexSize(), &indices[0]);
+    }
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void UploadModelVertices(const Model &model, const ModelBuffers &buffers)
+{
+    size_t firstVertex = g_vertexArena.getOffset(buffers.vertexBlock);
+
+    glBindBuffer(GL_ARRAY_BUFFER, g_sceneVertexBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, firstVertex * model.getVertexSize(),
+        model.getNumberOfVertices() * model.getVertexSize(), model.getVertexBuffer());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void UploadTextureLevel(const CompressedTexture &compressedTexture, int level)
+{
+    TRACE_ZONE("UploadTextureLevel");
+
+    const CompressedTexture::Level &data = compressedTexture.getLevel(level);
+    GLenum internalFormat = 0;
+
+    switch (compressedTexture.getFormat())
+    {
+    case CompressedTexture::FORMAT_BC1:
+        internalFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        break;
+
+    case CompressedTexture::FORMAT_BC3:
+        internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        break;
+
+    case CompressedTexture::FORMAT_BC5:
+        internalFormat = GL_COMPRESSED_RG_RGTC2;
+        break;
+    }
+
+    glCompressedTexImage2D(GL_TEXTURE_2D, level, internalFormat, data.width, data.height,
+        0, static_cast<GLsizei>(data.blocks.size()), &data.blocks[0]);
+}
+
+void UploadTextureLevel(const MipChain &mipChain, int level)
+{
+    TRACE_ZONE("UploadTextureLevel");
+
+    const MipChain::Level &data = mipChain.getLevel(level);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, data.width, data.height, 0,
+        GL_BGRA_EXT, GL_UNSIGNED_BYTE, &data.pixels[0]);
+}
+
+void WatchModelFiles()
+{
+    // The OBJ file, material libraries and textures of every loaded model.
+    std::vector<std::string> filenames;
+
+    for (size_t it = 0; it < modelSourcesList.size(); ++it)
+    {
+        const ModelSource &source = modelSourcesList[it];
+        const std::vector<std::string> &libraries = models[it].getMaterialLibraries();
+        std::map<std::string, TextureSource>::const_iterator texture = source.textures.begin();
+
+        filenames.push_back(source.filename);
+        filenames.insert(filenames.end(), libraries.begin(), libraries.end());
+
+        for (; texture != source.textures.end(); ++texture)
+            filenames.push_back(texture->second.resolvedFilename);
+    }
+
+    g_fileWatcher.watch(filenames);
 }
\ No newline at end of file
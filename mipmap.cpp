@@ -0,0 +1,404 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "job_system.h"
+#include "mipmap.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define MIPMAP_USE_SSE
+#endif
+
+namespace
+{
+    const int KAISER_RADIUS = 3;
+    const float KAISER_ALPHA = 4.0f;
+    const int ENCODE_TABLE_SIZE = 4096;
+    const int PIXELS_PER_TASK = 64 * 1024;
+
+    struct Kernel
+    {
+        std::vector<int> first;
+        std::vector<int> count;
+        std::vector<int> indices;
+        std::vector<float> weights;
+    };
+
+    struct GammaTables
+    {
+        float decode[256];
+        unsigned char encode[ENCODE_TABLE_SIZE];
+
+        GammaTables()
+        {
+            for (int i = 0; i < 256; ++i)
+            {
+                float c = i / 255.0f;
+                decode[i] = (c <= 0.04045f) ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+            }
+
+            for (int i = 0; i < ENCODE_TABLE_SIZE; ++i)
+            {
+                float l = static_cast<float>(i) / (ENCODE_TABLE_SIZE - 1);
+                float c = (l <= 0.0031308f) ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+                encode[i] = static_cast<unsigned char>(std::min(255.0f, c * 255.0f + 0.5f));
+            }
+        }
+    };
+
+    const GammaTables &GetGammaTables()
+    {
+        static const GammaTables tables;
+        return tables;
+    }
+
+    float BesselI0(float x)
+    {
+        float sum = 1.0f;
+        float term = 1.0f;
+        float halfX = x * 0.5f;
+
+        for (int k = 1; k < 32; ++k)
+        {
+            term *= (halfX / k) * (halfX / k);
+            sum += term;
+
+            if (term < sum * 1e-7f)
+                break;
+        }
+
+        return sum;
+    }
+
+    float KaiserSinc(float x, float radius)
+    {
+        const float PI = 3.14159265f;
+
+        if (fabsf(x) >= radius)
+            return 0.0f;
+
+        float t = x / radius;
+        float window = BesselI0(KAISER_ALPHA * sqrtf(1.0f - t * t)) / BesselI0(KAISER_ALPHA);
+        float sinc = (fabsf(x) < 1e-5f) ? 1.0f : sinf(PI * x) / (PI * x);
+
+        return sinc * window;
+    }
+
+    void BuildKernel(int srcSize, int destSize, MipChain::Filter filter, Kernel &kernel)
+    {
+        float scale = static_cast<float>(srcSize) / destSize;
+        float filterScale = std::max(scale, 1.0f);
+        float support = (filter == MipChain::FILTER_BOX) ?
+            0.5f * filterScale : KAISER_RADIUS * filterScale;
+
+        kernel.first.resize(destSize);
+        kernel.count.resize(destSize);
+        kernel.indices.clear();
+        kernel.weights.clear();
+
+        for (int i = 0; i < destSize; ++i)
+        {
+            float center = (i + 0.5f) * scale;
+            int lo = static_cast<int>(floorf(center - support));
+            int hi = static_cast<int>(ceilf(center + support));
+            int first = static_cast<int>(kernel.weights.size());
+            float total = 0.0f;
+
+            for (int j = lo; j < hi; ++j)
+            {
+                float w = 0.0f;
+
+                if (filter == MipChain::FILTER_BOX)
+                {
+                    if (scale >= 1.0f)
+                        w = std::min(center + support, j + 1.0f) - std::max(center - support, static_cast<float>(j));
+                    else
+                        w = 1.0f - fabsf(j + 0.5f - center);
+                }
+                else
+                {
+                    w = KaiserSinc((j + 0.5f - center) / filterScale, static_cast<float>(KAISER_RADIUS));
+                }
+
+                if (w == 0.0f || (w < 0.0f && filter == MipChain::FILTER_BOX))
+                    continue;
+
+                kernel.indices.push_back(std::min(std::max(j, 0), srcSize - 1));
+                kernel.weights.push_back(w);
+                total += w;
+            }
+
+            if (kernel.weights.size() == static_cast<size_t>(first))
+            {
+                kernel.indices.push_back(std::min(std::max(static_cast<int>(center), 0), srcSize - 1));
+                kernel.weights.push_back(1.0f);
+                total = 1.0f;
+            }
+
+            for (size_t k = first; k < kernel.weights.size(); ++k)
+                kernel.weights[k] /= total;
+
+            kernel.first[i] = first;
+            kernel.count[i] = static_cast<int>(kernel.weights.size()) - first;
+        }
+    }
+
+    void DecodeRow(const unsigned char *pSrc, int width, bool gammaCorrect, float *pDest)
+    {
+        const float *pDecode = GetGammaTables().decode;
+        const float inv255 = 1.0f / 255.0f;
+
+        if (gammaCorrect)
+        {
+            for (int x = 0; x < width; ++x, pSrc += 4, pDest += 4)
+            {
+                pDest[0] = pDecode[pSrc[0]];
+                pDest[1] = pDecode[pSrc[1]];
+                pDest[2] = pDecode[pSrc[2]];
+                pDest[3] = pSrc[3] * inv255;
+            }
+        }
+        else
+        {
+            for (int x = 0; x < width * 4; ++x)
+                pDest[x] = pSrc[x] * inv255;
+        }
+    }
+
+    void EncodeRow(const float *pSrc, int width, bool gammaCorrect, unsigned char *pDest)
+    {
+        const unsigned char *pEncode = GetGammaTables().encode;
+        const float tableScale = static_cast<float>(ENCODE_TABLE_SIZE - 1);
+
+        for (int x = 0; x < width; ++x, pSrc += 4, pDest += 4)
+        {
+            float c[4];
+
+            for (int i = 0; i < 4; ++i)
+                c[i] = std::min(std::max(pSrc[i], 0.0f), 1.0f);
+
+            if (gammaCorrect)
+            {
+                pDest[0] = pEncode[static_cast<int>(c[0] * tableScale + 0.5f)];
+                pDest[1] = pEncode[static_cast<int>(c[1] * tableScale + 0.5f)];
+                pDest[2] = pEncode[static_cast<int>(c[2] * tableScale + 0.5f)];
+            }
+            else
+            {
+                pDest[0] = static_cast<unsigned char>(c[0] * 255.0f + 0.5f);
+                pDest[1] = static_cast<unsigned char>(c[1] * 255.0f + 0.5f);
+                pDest[2] = static_cast<unsigned char>(c[2] * 255.0f + 0.5f);
+            }
+
+            pDest[3] = static_cast<unsigned char>(c[3] * 255.0f + 0.5f);
+        }
+    }
+
+    // Accumulates count weighted float4 pixels. Each pixel is one SSE register
+    // so all four channels are filtered at once.
+    inline void FilterPixel(const float *pSrc, const int *pIndices, const float *pWeights,
+                            int count, int stride, float *pDest)
+    {
+#if defined(MIPMAP_USE_SSE)
+        __m128 acc = _mm_setzero_ps();
+
+        for (int k = 0; k < count; ++k)
+        {
+            __m128 px = _mm_loadu_ps(pSrc + pIndices[k] * stride);
+            acc = _mm_add_ps(acc, _mm_mul_ps(px, _mm_set1_ps(pWeights[k])));
+        }
+
+        _mm_storeu_ps(pDest, acc);
+#else
+        float acc[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+
+        for (int k = 0; k < count; ++k)
+        {
+            const float *pPixel = pSrc + pIndices[k] * stride;
+
+            acc[0] += pPixel[0] * pWeights[k];
+            acc[1] += pPixel[1] * pWeights[k];
+            acc[2] += pPixel[2] * pWeights[k];
+            acc[3] += pPixel[3] * pWeights[k];
+        }
+
+        memcpy(pDest, acc, sizeof(acc));
+#endif
+    }
+
+    inline void AccumulateRow(const float *pSrc, float weight, int numFloats, float *pDest)
+    {
+        int i = 0;
+
+#if defined(MIPMAP_USE_SSE)
+        __m128 w = _mm_set1_ps(weight);
+
+        for (; i + 4 <= numFloats; i += 4)
+        {
+            __m128 acc = _mm_loadu_ps(pDest + i);
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(pSrc + i), w));
+            _mm_storeu_ps(pDest + i, acc);
+        }
+#endif
+
+        for (; i < numFloats; ++i)
+            pDest[i] += pSrc[i] * weight;
+    }
+
+    void ResampleRows(const unsigned char *pSrc, int srcWidth, int srcPitch,
+                      unsigned char *pDest, int destWidth, bool gammaCorrect,
+                      const Kernel &horz, const Kernel &vert, int y0, int y1)
+    {
+        int rowMin = vert.indices[vert.first[y0]];
+        int rowMax = rowMin;
+
+        for (int y = y0; y < y1; ++y)
+        {
+            for (int k = 0; k < vert.count[y]; ++k)
+            {
+                int row = vert.indices[vert.first[y] + k];
+                rowMin = std::min(rowMin, row);
+                rowMax = std::max(rowMax, row);
+            }
+        }
+
+        int numRows = rowMax - rowMin + 1;
+        int destFloats = destWidth * 4;
+        std::vector<float> decoded(srcWidth * 4);
+        std::vector<float> filtered(numRows * destFloats);
+        std::vector<float> accum(destFloats);
+
+        for (int row = 0; row < numRows; ++row)
+        {
+            float *pRow = &filtered[row * destFloats];
+
+            DecodeRow(pSrc + (rowMin + row) * srcPitch, srcWidth, gammaCorrect, &decoded[0]);
+
+            for (int x = 0; x < destWidth; ++x)
+            {
+                FilterPixel(&decoded[0], &horz.indices[horz.first[x]],
+                    &horz.weights[horz.first[x]], horz.count[x], 4, pRow + x * 4);
+            }
+        }
+
+        for (int y = y0; y < y1; ++y)
+        {
+            std::fill(accum.begin(), accum.end(), 0.0f);
+
+            for (int k = 0; k < vert.count[y]; ++k)
+            {
+                int row = vert.indices[vert.first[y] + k] - rowMin;
+                AccumulateRow(&filtered[row * destFloats], vert.weights[vert.first[y] + k],
+                    destFloats, &accum[0]);
+            }
+
+            EncodeRow(&accum[0], destWidth, gammaCorrect, pDest + y * destWidth * 4);
+        }
+    }
+
+    int NearestPowerOfTwo(int n)
+    {
+        int lower = 1;
+
+        while (lower * 2 <= n)
+            lower *= 2;
+
+        return (n - lower < lower * 2 - n) ? lower : lower * 2;
+    }
+}
+
+MipChain::MipChain()
+{
+}
+
+MipChain::~MipChain()
+{
+    clear();
+}
+
+void MipChain::clear()
+{
+    m_levels.clear();
+}
+
+bool MipChain::generate(const unsigned char *pPixels, int width, int height, int pitch,
+                        Filter filter, bool gammaCorrect, bool powerOfTwo)
+{
+    clear();
+
+    if (!pPixels || width <= 0 || height <= 0)
+        return false;
+
+    int baseWidth = powerOfTwo ? NearestPowerOfTwo(width) : width;
+    int baseHeight = powerOfTwo ? NearestPowerOfTwo(height) : height;
+    int numLevels = 1;
+
+    for (int w = baseWidth, h = baseHeight; w > 1 || h > 1; ++numLevels)
+    {
+        w = std::max(1, w / 2);
+        h = std::max(1, h / 2);
+    }
+
+    m_levels.resize(numLevels);
+
+    Level *pLevel = &m_levels[0];
+    pLevel->width = baseWidth;
+    pLevel->height = baseHeight;
+    pLevel->pixels.resize(baseWidth * baseHeight * 4);
+
+    if (baseWidth == width && baseHeight == height)
+    {
+        for (int y = 0; y < height; ++y)
+            memcpy(&pLevel->pixels[y * width * 4], pPixels + y * pitch, width * 4);
+    }
+    else
+    {
+        resample(pPixels, width, height, pitch, &pLevel->pixels[0],
+            baseWidth, baseHeight, filter, gammaCorrect);
+    }
+
+    for (int i = 1; i < numLevels; ++i)
+    {
+        const Level &prev = m_levels[i - 1];
+
+        pLevel = &m_levels[i];
+        pLevel->width = std::max(1, prev.width / 2);
+        pLevel->height = std::max(1, prev.height / 2);
+        pLevel->pixels.resize(pLevel->width * pLevel->height * 4);
+
+        resample(&prev.pixels[0], prev.width, prev.height, prev.width * 4,
+            &pLevel->pixels[0], pLevel->width, pLevel->height, filter, gammaCorrect);
+    }
+
+    return true;
+}
+
+size_t MipChain::getSizeInBytes() const
+{
+    size_t size = 0;
+
+    for (size_t i = 0; i < m_levels.size(); ++i)
+        size += m_levels[i].pixels.size();
+
+    return size;
+}
+
+void MipChain::resample(const unsigned char *pSrc, int srcWidth, int srcHeight,
+                        int srcPitch, unsigned char *pDest, int destWidth, int destHeight,
+                        Filter filter, bool gammaCorrect)
+{
+    Kernel horz;
+    Kernel vert;
+
+    BuildKernel(srcWidth, destWidth, filter, horz);
+    BuildKernel(srcHeight, destHeight, filter, vert);
+
+    int grainSize = std::max(1, PIXELS_PER_TASK / destWidth);
+
+    JobSystem::instance().parallelFor(0, destHeight, grainSize,
+        [&](int y0, int y1)
+        {
+            ResampleRows(pSrc, srcWidth, srcPitch, pDest, destWidth, gammaCorrect,
+                horz, vert, y0, y1);
+        });
+}
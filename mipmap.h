@@ -0,0 +1,48 @@
+#if !defined(MIPMAP_H)
+#define MIPMAP_H
+
+#include <cstddef>
+#include <vector>
+
+class MipChain
+{
+public:
+    enum Filter
+    {
+        FILTER_BOX,
+        FILTER_KAISER
+    };
+
+    struct Level
+    {
+        int width;
+        int height;
+        std::vector<unsigned char> pixels;
+    };
+
+    MipChain();
+    ~MipChain();
+
+    void clear();
+    bool generate(const unsigned char *pPixels, int width, int height, int pitch,
+        Filter filter = FILTER_BOX, bool gammaCorrect = true, bool powerOfTwo = false);
+
+    const Level &getLevel(int i) const;
+    int getNumberOfLevels() const;
+    size_t getSizeInBytes() const;
+
+    static void resample(const unsigned char *pSrc, int srcWidth, int srcHeight,
+        int srcPitch, unsigned char *pDest, int destWidth, int destHeight,
+        Filter filter, bool gammaCorrect);
+
+private:
+    std::vector<Level> m_levels;
+};
+
+inline const MipChain::Level &MipChain::getLevel(int i) const
+{ return m_levels[i]; }
+
+inline int MipChain::getNumberOfLevels() const
+{ return static_cast<int>(m_levels.size()); }
+
+#endif
@@ -0,0 +1,354 @@
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include "job_system.h"
+#include "model_catalog.h"
+#include "trace.h"
+
+namespace
+{
+    const char CATALOG_MAGIC[4] = {'M', 'C', 'A', '1'};
+
+    struct CatalogHeader
+    {
+        char magic[4];
+        unsigned int numberOfEntries;
+    };
+
+    struct CatalogEntryHeader
+    {
+        long long size;
+        long long modified;
+        long long librariesStamp;
+        int counts[6];
+        float minPosition[3];
+        float maxPosition[3];
+        unsigned int numberOfLibraries;
+        unsigned int numberOfTextures;
+    };
+
+    bool GetFileStamp(const std::string &path, long long &size, long long &modified)
+    {
+#if defined(_WIN32)
+        struct __stat64 info;
+
+        if (_stat64(path.c_str(), &info) != 0)
+            return false;
+#else
+        struct stat info;
+
+        if (stat(path.c_str(), &info) != 0)
+            return false;
+#endif
+
+        size = static_cast<long long>(info.st_size);
+        modified = static_cast<long long>(info.st_mtime);
+        return true;
+    }
+
+    long long GetLibrariesStamp(const Model::ProbeResult &summary)
+    {
+        // Changes when a material library is edited, replaced or removed.
+        long long stamp = 0;
+        long long size = -1;
+        long long modified = -1;
+
+        for (size_t i = 0; i < summary.materialLibraries.size(); ++i)
+        {
+            if (!GetFileStamp(summary.materialLibraries[i], size, modified))
+                size = modified = -1;
+
+            stamp = stamp * 31 + modified * 7 + size;
+        }
+
+        return stamp;
+    }
+
+    bool IsModelFile(const std::string &filename)
+    {
+        std::string::size_type length = filename.length();
+
+        return length > 4 && filename[length - 4] == '.' &&
+            (filename[length - 3] == 'o' || filename[length - 3] == 'O') &&
+            (filename[length - 2] == 'b' || filename[length - 2] == 'B') &&
+            (filename[length - 1] == 'j' || filename[length - 1] == 'J');
+    }
+
+    void ListModelFiles(const std::string &directory, std::vector<std::string> &files)
+    {
+#if defined(_WIN32)
+        WIN32_FIND_DATAA findData;
+        HANDLE hFind = FindFirstFileA((directory + "\\*").c_str(), &findData);
+
+        if (hFind == INVALID_HANDLE_VALUE)
+            return;
+
+        do
+        {
+            std::string name = findData.cFileName;
+
+            if (name == "." || name == "..")
+                continue;
+
+            if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+                ListModelFiles(directory + "\\" + name, files);
+            else if (IsModelFile(name))
+                files.push_back(directory + "\\" + name);
+        }
+        while (FindNextFileA(hFind, &findData));
+
+        FindClose(hFind);
+#else
+        DIR *pDir = opendir(directory.c_str());
+        struct dirent *pEntry = 0;
+        struct stat info;
+
+        if (!pDir)
+            return;
+
+        while ((pEntry = readdir(pDir)) != 0)
+        {
+            std::string name = pEntry->d_name;
+            std::string path = directory + "/" + name;
+
+            if (name == "." || name == ".." || stat(path.c_str(), &info) != 0)
+                continue;
+
+            if (S_ISDIR(info.st_mode))
+                ListModelFiles(path, files);
+            else if (IsModelFile(name))
+                files.push_back(path);
+        }
+
+        closedir(pDir);
+#endif
+    }
+
+    long GetBytesLeft(FILE *pFile, long fileSize)
+    {
+        long offset = ftell(pFile);
+        return (offset < 0 || offset > fileSize) ? 0 : fileSize - offset;
+    }
+
+    bool ReadString(FILE *pFile, std::string &text)
+    {
+        unsigned int length = 0;
+
+        if (fread(&length, sizeof(length), 1, pFile) != 1 || length > 0xffff)
+            return false;
+
+        text.resize(length);
+        return length == 0 || fread(&text[0], 1, length, pFile) == length;
+    }
+
+    bool WriteString(FILE *pFile, const std::string &text)
+    {
+        unsigned int length = static_cast<unsigned int>(text.length());
+
+        return fwrite(&length, sizeof(length), 1, pFile) == 1 &&
+            (length == 0 || fwrite(text.data(), 1, length, pFile) == length);
+    }
+}
+
+void ModelCatalog::clear()
+{
+    m_entries.clear();
+}
+
+bool ModelCatalog::load(const char *pszFilename)
+{
+    clear();
+
+    FILE *pFile = fopen(pszFilename, "rb");
+
+    if (!pFile)
+        return false;
+
+    // Counts are checked against the bytes that are left before anything is
+    // sized from them, so that a damaged catalog is merely rebuilt.
+    CatalogHeader header;
+    long fileSize = (fseek(pFile, 0, SEEK_END) == 0) ? ftell(pFile) : -1;
+    bool ok = fileSize >= 0 && fseek(pFile, 0, SEEK_SET) == 0 &&
+        fread(&header, sizeof(header), 1, pFile) == 1 &&
+        memcmp(header.magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC)) == 0 &&
+        header.numberOfEntries <= GetBytesLeft(pFile, fileSize) / (sizeof(unsigned int) + sizeof(CatalogEntryHeader));
+
+    if (ok)
+        m_entries.resize(header.numberOfEntries);
+
+    for (unsigned int i = 0; ok && i < header.numberOfEntries; ++i)
+    {
+        CatalogEntryHeader entryHeader;
+        Entry &entry = m_entries[i];
+        Model::ProbeResult &summary = entry.summary;
+
+        ok = ReadString(pFile, entry.path) && fread(&entryHeader, sizeof(entryHeader), 1, pFile) == 1;
+
+        if (!ok)
+            break;
+
+        entry.size = entryHeader.size;
+        entry.modified = entryHeader.modified;
+        entry.librariesStamp = entryHeader.librariesStamp;
+        summary.numberOfVertexCoords = entryHeader.counts[0];
+        summary.numberOfTextureCoords = entryHeader.counts[1];
+        summary.numberOfNormals = entryHeader.counts[2];
+        summary.numberOfTriangles = entryHeader.counts[3];
+        summary.numberOfGroups = entryHeader.counts[4];
+        summary.numberOfMaterials = entryHeader.counts[5];
+        memcpy(summary.minPosition, entryHeader.minPosition, sizeof(summary.minPosition));
+        memcpy(summary.maxPosition, entryHeader.maxPosition, sizeof(summary.maxPosition));
+
+        if (static_cast<unsigned long long>(entryHeader.numberOfLibraries) + entryHeader.numberOfTextures >
+            GetBytesLeft(pFile, fileSize) / sizeof(unsigned int))
+        {
+            ok = false;
+            break;
+        }
+
+        summary.materialLibraries.resize(entryHeader.numberOfLibraries);
+        summary.textureFilenames.resize(entryHeader.numberOfTextures);
+
+        for (unsigned int j = 0; ok && j < entryHeader.numberOfLibraries; ++j)
+            ok = ReadString(pFile, summary.materialLibraries[j]);
+
+        for (unsigned int j = 0; ok && j < entryHeader.numberOfTextures; ++j)
+            ok = ReadString(pFile, summary.textureFilenames[j]);
+    }
+
+    fclose(pFile);
+
+    if (!ok)
+        clear();
+
+    return ok;
+}
+
+bool ModelCatalog::save(const char *pszFilename) const
+{
+    FILE *pFile = fopen(pszFilename, "wb");
+
+    if (!pFile)
+        return false;
+
+    CatalogHeader header;
+
+    memcpy(header.magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC));
+    header.numberOfEntries = static_cast<unsigned int>(m_entries.size());
+
+    bool ok = fwrite(&header, sizeof(header), 1, pFile) == 1;
+
+    for (size_t i = 0; ok && i < m_entries.size(); ++i)
+    {
+        const Entry &entry = m_entries[i];
+        const Model::ProbeResult &summary = entry.summary;
+        CatalogEntryHeader entryHeader;
+
+        entryHeader.size = entry.size;
+        entryHeader.modified = entry.modified;
+        entryHeader.librariesStamp = entry.librariesStamp;
+        entryHeader.counts[0] = summary.numberOfVertexCoords;
+        entryHeader.counts[1] = summary.numberOfTextureCoords;
+        entryHeader.counts[2] = summary.numberOfNormals;
+        entryHeader.counts[3] = summary.numberOfTriangles;
+        entryHeader.counts[4] = summary.numberOfGroups;
+        entryHeader.counts[5] = summary.numberOfMaterials;
+        memcpy(entryHeader.minPosition, summary.minPosition, sizeof(entryHeader.minPosition));
+        memcpy(entryHeader.maxPosition, summary.maxPosition, sizeof(entryHeader.maxPosition));
+        entryHeader.numberOfLibraries = static_cast<unsigned int>(summary.materialLibraries.size());
+        entryHeader.numberOfTextures = static_cast<unsigned int>(summary.textureFilenames.size());
+
+        ok = WriteString(pFile, entry.path) && fwrite(&entryHeader, sizeof(entryHeader), 1, pFile) == 1;
+
+        for (size_t j = 0; ok && j < summary.materialLibraries.size(); ++j)
+            ok = WriteString(pFile, summary.materialLibraries[j]);
+
+        for (size_t j = 0; ok && j < summary.textureFilenames.size(); ++j)
+            ok = WriteString(pFile, summary.textureFilenames[j]);
+    }
+
+    if (fclose(pFile) != 0)
+        ok = false;
+
+    if (!ok)
+        remove(pszFilename);
+
+    return ok;
+}
+
+int ModelCatalog::update(const char *pszDirectory)
+{
+    TRACE_ZONE("ModelCatalog::update");
+
+    // Returns the number of files that were probed. Entries of files that no
+    // longer exist or can't be read are dropped.
+
+    std::vector<std::string> files;
+    std::map<std::string, const Entry *> previous;
+    std::vector<Entry> entries;
+    std::vector<int> stale;
+    std::vector<unsigned char> probed;
+
+    ListModelFiles(pszDirectory, files);
+    std::sort(files.begin(), files.end());
+
+    for (size_t i = 0; i < m_entries.size(); ++i)
+        previous[m_entries[i].path] = &m_entries[i];
+
+    entries.resize(files.size());
+
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        Entry &entry = entries[i];
+        std::map<std::string, const Entry *>::const_iterator iter = previous.find(files[i]);
+
+        entry.path = files[i];
+        entry.size = entry.modified = -1;
+        GetFileStamp(entry.path, entry.size, entry.modified);
+
+        if (iter != previous.end() && iter->second->size == entry.size &&
+            iter->second->modified == entry.modified &&
+            iter->second->librariesStamp == GetLibrariesStamp(iter->second->summary))
+        {
+            entry = *iter->second;
+        }
+        else
+        {
+            stale.push_back(static_cast<int>(i));
+        }
+    }
+
+    probed.assign(entries.size(), 1);
+
+    JobSystem::instance().parallelFor(0, static_cast<int>(stale.size()), 1,
+        [&entries, &stale, &probed](int first, int last)
+        {
+            for (int i = first; i < last; ++i)
+            {
+                Entry &entry = entries[stale[i]];
+
+                probed[stale[i]] = Model::probe(entry.path.c_str(), entry.summary) ? 1 : 0;
+                entry.librariesStamp = GetLibrariesStamp(entry.summary);
+            }
+        });
+
+    m_entries.clear();
+
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        if (probed[i])
+            m_entries.push_back(entries[i]);
+    }
+
+    return static_cast<int>(stale.size());
+}
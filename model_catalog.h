@@ -0,0 +1,45 @@
+#if !defined(MODEL_CATALOG_H)
+#define MODEL_CATALOG_H
+
+#include <string>
+#include <vector>
+#include "model_obj.h"
+
+// An index of the OBJ files under a directory tree with what Model::probe()
+// reports for each of them. update() only probes the files that are new or
+// whose size or modification time, or that of one of their material
+// libraries, changed since the last update, and probes them in parallel on
+// the job system. The index is saved as a compact binary file: an "MCA1" tag
+// and the number of records, then one record per file.
+
+class ModelCatalog
+{
+public:
+    struct Entry
+    {
+        std::string path;
+        long long size;
+        long long modified;
+        long long librariesStamp;
+        Model::ProbeResult summary;
+    };
+
+    void clear();
+    bool load(const char *pszFilename);
+    bool save(const char *pszFilename) const;
+    int update(const char *pszDirectory);
+
+    const Entry &getEntry(int i) const;
+    int getNumberOfEntries() const;
+
+private:
+    std::vector<Entry> m_entries;
+};
+
+inline const ModelCatalog::Entry &ModelCatalog::getEntry(int i) const
+{ return m_entries[i]; }
+
+inline int ModelCatalog::getNumberOfEntries() const
+{ return static_cast<int>(m_entries.size()); }
+
+#endif
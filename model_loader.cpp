@@ -0,0 +1,508 @@
+#include <algorithm>
+#include <chrono>
+#include "image.h"
+#include "job_system.h"
+#include "model_loader.h"
+#include "progressive_mesh.h"
+#include "trace.h"
+
+namespace
+{
+    void AddTexture(std::vector<ModelLoader::Texture> &textures, const std::string &filename, bool linear)
+    {
+        for (size_t i = 0; i < textures.size(); ++i)
+        {
+            if (textures[i].filename == filename)
+                return;
+        }
+
+        textures.push_back(ModelLoader::Texture());
+        textures.back().filename = filename;
+        textures.back().hash = 0;
+        textures.back().linear = linear;
+        textures.back().id = 0;
+        textures.back().source = -1;
+    }
+
+    std::string GetDirectoryPath(const std::string &filename)
+    {
+        std::string::size_type offset = filename.find_last_of("\\/");
+        return (offset == std::string::npos) ? std::string() : filename.substr(0, offset + 1);
+    }
+
+    bool ReadTextureFile(const std::string &filename, const std::string &path,
+                         std::string &resolvedFilename, std::vector<unsigned char> &data)
+    {
+        resolvedFilename = filename;
+
+        if (!Image::readFile(resolvedFilename.c_str(), data))
+        {
+            std::string::size_type offset = filename.find_last_of("\\/");
+            std::string bareFilename = filename;
+
+            if (offset != std::string::npos)
+                bareFilename = filename.substr(++offset);
+
+            resolvedFilename = path + bareFilename;
+
+            if (!Image::readFile(resolvedFilename.c_str(), data))
+                return false;
+        }
+
+        return true;
+    }
+
+    std::string GetCacheFilename(const std::string &filename, const std::string &path, bool linear)
+    {
+        std::string::size_type offset = filename.find_last_of("\\/");
+        std::string cacheFilename = path;
+
+        cacheFilename += filename.substr((offset != std::string::npos) ? offset + 1 : 0);
+        cacheFilename += linear ? ".normal.bct" : ".color.bct";
+
+        return cacheFilename;
+    }
+}
+
+ModelLoader::ModelLoader(TextureCache &textureCache)
+    : m_textureCache(textureCache), m_quit(false), m_generation(0),
+      m_activeGeneration(0), m_pending(0), m_phase(PHASE_IDLE), m_pass(0),
+      m_bytesParsed(0), m_bytesTotal(0), m_texturesLoaded(0), m_numberOfTextures(0),
+      m_pActiveRequest(0), m_pActiveResult(0)
+{
+    m_thread = std::thread(&ModelLoader::workerMain, this);
+}
+
+ModelLoader::~ModelLoader()
+{
+    cancel();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+
+    m_requestAvailable.notify_all();
+    m_thread.join();
+
+    Result *pResult = 0;
+
+    while (m_results.pop(pResult))
+        delete pResult;
+}
+
+void ModelLoader::cancel()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_pending -= static_cast<int>(m_requests.size());
+    m_requests.clear();
+    ++m_generation;
+}
+
+void ModelLoader::load(const std::string &filename, const Options &options)
+{
+    Request request;
+
+    request.filename = filename;
+    request.type = REQUEST_LOAD;
+    request.options = options;
+
+    addRequest(request);
+}
+
+void ModelLoader::reload(const std::string &filename, const Options &options)
+{
+    Request request;
+
+    request.filename = filename;
+    request.type = REQUEST_RELOAD;
+    request.options = options;
+
+    addRequest(request);
+}
+
+void ModelLoader::reloadTextures(const std::string &filename, const std::vector<std::string> &colorMaps,
+                                 const std::vector<std::string> &bumpMaps, const Options &options)
+{
+    // Only the given maps of the model loaded from filename are read and
+    // decoded again; the model itself isn't imported.
+    Request request;
+
+    request.filename = filename;
+    request.type = REQUEST_RELOAD_TEXTURES;
+    request.options = options;
+    request.colorMaps = colorMaps;
+    request.bumpMaps = bumpMaps;
+
+    addRequest(request);
+}
+
+ModelLoader::Progress ModelLoader::getProgress() const
+{
+    Progress progress;
+
+    progress.phase = static_cast<Phase>(m_phase.load());
+    progress.pass = m_pass;
+    progress.bytesParsed = m_bytesParsed;
+    progress.bytesTotal = m_bytesTotal;
+    progress.texturesLoaded = m_texturesLoaded;
+    progress.numberOfTextures = m_numberOfTextures;
+
+    return progress;
+}
+
+bool ModelLoader::isBusy() const
+{
+    return m_pending > 0 || !m_results.empty();
+}
+
+ModelLoader::Result *ModelLoader::popResult()
+{
+    Result *pResult = 0;
+
+    if (!m_results.pop(pResult))
+        return 0;
+
+    // A cancel() that raced with the worker finishing still has to win.
+
+    if (isCancelled(pResult->generation))
+        pResult->cancelled = true;
+
+    return pResult;
+}
+
+void ModelLoader::addRequest(Request &request)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        request.generation = m_generation;
+        m_requests.push_back(request);
+        ++m_pending;
+    }
+
+    m_requestAvailable.notify_one();
+}
+
+bool ModelLoader::importCallback(void *pContext, Model::ImportPhase phase,
+                                 long bytesParsed, long bytesTotal)
+{
+    ModelLoader *pLoader = static_cast<ModelLoader *>(pContext);
+
+    switch (phase)
+    {
+    case Model::IMPORT_PHASE_FIRST_PASS:
+        pLoader->m_phase = PHASE_PARSING;
+        pLoader->m_pass = 1;
+        break;
+
+    case Model::IMPORT_PHASE_MATERIALS:
+        // A filter may drop materials after the second pass, so their
+        // textures are only started once it's known which ones are used.
+        if (!pLoader->m_pActiveResult->model.hasImportFilter())
+            pLoader->startTextures(*pLoader->m_pActiveRequest, *pLoader->m_pActiveResult);
+        break;
+
+    case Model::IMPORT_PHASE_SECOND_PASS:
+        pLoader->m_phase = PHASE_PARSING;
+        pLoader->m_pass = 2;
+        break;
+
+    case Model::IMPORT_PHASE_POST_PROCESS:
+        pLoader->m_phase = PHASE_PROCESSING;
+        break;
+    }
+
+    pLoader->m_bytesParsed = bytesParsed;
+    pLoader->m_bytesTotal = bytesTotal;
+
+    return !pLoader->isCancelled(pLoader->m_activeGeneration);
+}
+
+bool ModelLoader::progressiveMeshCallback(void *pContext)
+{
+    // Building is given up for a cancel and for the next load alike.
+    ModelLoader *pLoader = static_cast<ModelLoader *>(pContext);
+    return !pLoader->isCancelled(pLoader->m_activeGeneration) && pLoader->m_pending == 0;
+}
+
+void ModelLoader::finishTextures()
+{
+    JobSystem::instance().wait(m_textureJobs);
+    m_fileData.clear();
+}
+
+bool ModelLoader::isCancelled(unsigned int generation) const
+{
+    return generation != m_generation.load();
+}
+
+void ModelLoader::loadTextures(const Request &request, Result &result, size_t firstTexture,
+                               const std::string &path)
+{
+    JobSystem &jobSystem = JobSystem::instance();
+    std::vector<Texture> &textures = result.textures;
+    std::vector<std::vector<unsigned char> > &fileData = m_fileData;
+    const Options &options = request.options;
+    unsigned int generation = request.generation;
+
+    for (size_t i = firstTexture; i < textures.size(); ++i)
+    {
+        Texture &texture = textures[i];
+
+        if (isCancelled(generation))
+            return;
+
+        if (fileData[i].empty())
+        {
+            ++m_texturesLoaded;
+            continue;
+        }
+
+        if ((texture.id = m_textureCache.acquire(texture.resolvedFilename, texture.hash, texture.linear)) != 0)
+        {
+            std::vector<unsigned char>().swap(fileData[i]);
+            ++m_texturesLoaded;
+            continue;
+        }
+
+        for (size_t j = 0; j < i; ++j)
+        {
+            if (textures[j].id == 0 && textures[j].source < 0 && !fileData[j].empty() &&
+                textures[j].hash == texture.hash && textures[j].linear == texture.linear)
+            {
+                texture.source = static_cast<int>(j);
+                break;
+            }
+        }
+
+        if (texture.source >= 0)
+        {
+            ++m_texturesLoaded;
+            continue;
+        }
+
+        bool compress = texture.linear ? options.compressNormalMaps : options.compressColorMaps;
+        std::string cacheFilename = compress ? GetCacheFilename(texture.filename, path, texture.linear) : std::string();
+        const std::vector<unsigned char> *pData = &fileData[i];
+        Texture *pTexture = &textures[i];
+        bool powerOfTwo = options.powerOfTwo;
+
+        jobSystem.run([this, pTexture, pData, cacheFilename, compress, powerOfTwo, generation]()
+            {
+                TRACE_ZONE("LoadTexture");
+
+                if (isCancelled(generation))
+                    return;
+
+                if (compress && pTexture->compressedTexture.load(cacheFilename.c_str(), pTexture->hash, powerOfTwo))
+                {
+                    ++m_texturesLoaded;
+                    return;
+                }
+
+                Image image;
+
+                if (image.load(&(*pData)[0], pData->size()))
+                {
+                    pTexture->mipChain.generate(image.getPixels(), image.getWidth(), image.getHeight(),
+                        image.getPitch(), MipChain::FILTER_BOX, !pTexture->linear, powerOfTwo);
+
+                    if (compress)
+                    {
+                        pTexture->compressedTexture.compress(pTexture->mipChain,
+                            CompressedTexture::chooseFormat(pTexture->mipChain, pTexture->linear));
+                        pTexture->compressedTexture.save(cacheFilename.c_str(), pTexture->hash, powerOfTwo);
+                        pTexture->mipChain.clear();
+                    }
+                }
+
+                ++m_texturesLoaded;
+            }, &m_textureJobs);
+    }
+}
+
+void ModelLoader::readTextures(const Request &request, Result &result, size_t firstTexture,
+                               const std::string &path)
+{
+    JobSystem &jobSystem = JobSystem::instance();
+    std::vector<Texture> &textures = result.textures;
+
+    if (firstTexture == textures.size())
+        return;
+
+    m_numberOfTextures = static_cast<int>(textures.size());
+    m_fileData.resize(textures.size());
+
+    for (size_t i = firstTexture; i < textures.size(); ++i)
+    {
+        Texture *pTexture = &textures[i];
+        std::vector<unsigned char> *pData = &m_fileData[i];
+
+        jobSystem.run([pTexture, pData, path]()
+            {
+                TRACE_ZONE("ReadTextureFile");
+
+                if (ReadTextureFile(pTexture->filename, path, pTexture->resolvedFilename, *pData))
+                    pTexture->hash = TextureCache::hash(&(*pData)[0], pData->size());
+            }, &m_textureReads);
+    }
+
+    // Cache lookups and deduplication need every hash of this batch, so they
+    // run as one job once all the reads are done. It queues the decode jobs on
+    // the same counter, which therefore cannot drop to zero in between.
+    jobSystem.run([this, &request, &result, firstTexture, path]()
+        { loadTextures(request, result, firstTexture, path); },
+        &m_textureJobs, JobSystem::PRIORITY_DEFAULT, &m_textureReads);
+}
+
+void ModelLoader::run(const Request &request, Result &result, ProgressiveMesh::Source *&pProgressiveSource)
+{
+    TRACE_ZONE("ModelLoader::run");
+
+    m_activeGeneration = request.generation;
+    m_phase = PHASE_PARSING;
+    m_pass = 1;
+    m_bytesParsed = 0;
+    m_bytesTotal = 0;
+    m_texturesLoaded = 0;
+    m_numberOfTextures = 0;
+
+    m_pActiveRequest = &request;
+    m_pActiveResult = &result;
+
+    if (request.type == REQUEST_RELOAD_TEXTURES)
+    {
+        m_phase = PHASE_LOADING_TEXTURES;
+
+        for (size_t i = 0; i < request.colorMaps.size(); ++i)
+            AddTexture(result.textures, request.colorMaps[i], false);
+
+        for (size_t i = 0; i < request.bumpMaps.size(); ++i)
+            AddTexture(result.textures, request.bumpMaps[i], true);
+
+        readTextures(request, result, 0, GetDirectoryPath(request.filename));
+        result.succeeded = true;
+    }
+    else
+    {
+        result.model.setImportCallback(importCallback, this);
+        result.model.setImportFilter(request.options.filter);
+        bool imported = result.model.import(request.filename.c_str());
+        result.model.setImportCallback(0, 0);
+
+        if (imported && !isCancelled(request.generation))
+        {
+            m_phase = PHASE_PROCESSING;
+            result.model.normalize();
+
+            // The model is handed over to the render thread before the
+            // progressive mesh is built, so the build works on a copy of
+            // the positions and faces.
+            if (request.options.writeProgressiveMesh && !ProgressiveMesh::isCurrent(request.filename.c_str()))
+            {
+                pProgressiveSource = new ProgressiveMesh::Source;
+                ProgressiveMesh::getSource(result.model, *pProgressiveSource);
+            }
+
+            m_phase = PHASE_LOADING_TEXTURES;
+            startTextures(request, result);
+            result.succeeded = true;
+        }
+    }
+
+    // Texture jobs started while parsing refer to the result, so they have to
+    // finish even if the import failed or was cancelled.
+    finishTextures();
+
+    m_pActiveRequest = 0;
+    m_pActiveResult = 0;
+}
+
+void ModelLoader::startTextures(const Request &request, Result &result)
+{
+    const Model &model = result.model;
+    const Model::Material *pMaterial = 0;
+    std::vector<Texture> &textures = result.textures;
+
+    // Jobs from an earlier material library hold pointers into the vectors
+    // that are about to grow.
+    JobSystem::instance().wait(m_textureJobs);
+
+    size_t firstTexture = textures.size();
+
+    for (int i = 0; i < model.getNumberOfMaterials(); ++i)
+    {
+        pMaterial = &model.getMaterial(i);
+
+        if (!pMaterial->colorMapFilename.empty())
+            AddTexture(textures, pMaterial->colorMapFilename, false);
+
+        if (!pMaterial->bumpMapFilename.empty())
+            AddTexture(textures, pMaterial->bumpMapFilename, true);
+    }
+
+    readTextures(request, result, firstTexture, model.getPath());
+}
+
+void ModelLoader::workerMain()
+{
+    // Loads must never hold up jobs submitted by the render thread.
+    JobSystem::setDefaultPriority(JobSystem::PRIORITY_LOW);
+    Trace::setThreadName("model loader");
+
+    while (true)
+    {
+        Request request;
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            while (!m_quit && m_requests.empty())
+                m_requestAvailable.wait(lock);
+
+            if (m_quit)
+                return;
+
+            request = m_requests.front();
+            m_requests.pop_front();
+        }
+
+        Result *pResult = new Result;
+        ProgressiveMesh::Source *pProgressiveSource = 0;
+
+        pResult->filename = request.filename;
+        pResult->type = request.type;
+        pResult->generation = request.generation;
+        pResult->cancelled = false;
+        pResult->succeeded = false;
+
+        run(request, *pResult, pProgressiveSource);
+
+        pResult->cancelled = isCancelled(request.generation);
+        m_phase = PHASE_IDLE;
+
+        while (!m_results.push(pResult))
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            if (m_quit)
+            {
+                delete pResult;
+                delete pProgressiveSource;
+                return;
+            }
+
+            m_requestAvailable.wait_for(lock, std::chrono::milliseconds(1));
+        }
+
+        --m_pending;
+
+        if (pProgressiveSource)
+        {
+            ProgressiveMesh::build(*pProgressiveSource, request.filename.c_str(), progressiveMeshCallback, this);
+            delete pProgressiveSource;
+        }
+    }
+}
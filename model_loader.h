@@ -0,0 +1,149 @@
+#if !defined(MODEL_LOADER_H)
+#define MODEL_LOADER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "compressed_texture.h"
+#include "job_system.h"
+#include "mipmap.h"
+#include "model_obj.h"
+#include "progressive_mesh.h"
+#include "spsc_queue.h"
+#include "texture_cache.h"
+
+class ModelLoader
+{
+public:
+    enum Phase
+    {
+        PHASE_IDLE,
+        PHASE_PARSING,
+        PHASE_PROCESSING,
+        PHASE_LOADING_TEXTURES
+    };
+
+    enum RequestType
+    {
+        REQUEST_LOAD,
+        REQUEST_RELOAD,
+        REQUEST_RELOAD_TEXTURES
+    };
+
+    struct Options
+    {
+        bool powerOfTwo;
+        bool compressColorMaps;
+        bool compressNormalMaps;
+        bool writeProgressiveMesh;
+        Model::ImportFilter filter;
+    };
+
+    struct Progress
+    {
+        Phase phase;
+        int pass;
+        long bytesParsed;
+        long bytesTotal;
+        int texturesLoaded;
+        int numberOfTextures;
+    };
+
+    struct Texture
+    {
+        std::string filename;
+        std::string resolvedFilename;
+        TextureCache::Hash hash;
+        bool linear;
+        unsigned int id;
+        int source;
+        MipChain mipChain;
+        CompressedTexture compressedTexture;
+    };
+
+    struct Result
+    {
+        std::string filename;
+        RequestType type;
+        unsigned int generation;
+        bool cancelled;
+        bool succeeded;
+        Model model;
+        std::vector<Texture> textures;
+    };
+
+    explicit ModelLoader(TextureCache &textureCache);
+    ~ModelLoader();
+
+    void cancel();
+    void load(const std::string &filename, const Options &options);
+    void reload(const std::string &filename, const Options &options);
+    void reloadTextures(const std::string &filename, const std::vector<std::string> &colorMaps,
+        const std::vector<std::string> &bumpMaps, const Options &options);
+
+    Progress getProgress() const;
+    bool isBusy() const;
+
+    Result *popResult();
+
+private:
+    struct Request
+    {
+        std::string filename;
+        RequestType type;
+        Options options;
+        unsigned int generation;
+        std::vector<std::string> colorMaps;
+        std::vector<std::string> bumpMaps;
+    };
+
+    ModelLoader(const ModelLoader &);
+    ModelLoader &operator=(const ModelLoader &);
+
+    static bool importCallback(void *pContext, Model::ImportPhase phase,
+        long bytesParsed, long bytesTotal);
+    static bool progressiveMeshCallback(void *pContext);
+
+    void addRequest(Request &request);
+    void finishTextures();
+    bool isCancelled(unsigned int generation) const;
+    void loadTextures(const Request &request, Result &result, size_t firstTexture,
+        const std::string &path);
+    void readTextures(const Request &request, Result &result, size_t firstTexture,
+        const std::string &path);
+    void run(const Request &request, Result &result, ProgressiveMesh::Source *&pProgressiveSource);
+    void startTextures(const Request &request, Result &result);
+    void workerMain();
+
+    TextureCache &m_textureCache;
+
+    bool m_quit;
+    std::mutex m_mutex;
+    std::condition_variable m_requestAvailable;
+    std::deque<Request> m_requests;
+    std::thread m_thread;
+
+    SpscQueue<Result *, 16> m_results;
+
+    std::atomic<unsigned int> m_generation;
+    std::atomic<unsigned int> m_activeGeneration;
+    std::atomic<int> m_pending;
+    std::atomic<int> m_phase;
+    std::atomic<int> m_pass;
+    std::atomic<long> m_bytesParsed;
+    std::atomic<long> m_bytesTotal;
+    std::atomic<int> m_texturesLoaded;
+    std::atomic<int> m_numberOfTextures;
+
+    const Request *m_pActiveRequest;
+    Result *m_pActiveResult;
+    JobSystem::Counter m_textureReads;
+    JobSystem::Counter m_textureJobs;
+    std::vector<std::vector<unsigned char> > m_fileData;
+};
+
+#endif
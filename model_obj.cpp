@@ -1,16 +1,531 @@
 #include <algorithm>
 #include <cmath>
+#include <cstdlib>
 #include <cstring>
 #include <limits>
 #include <string>
+#include <unordered_map>
+#include "job_system.h"
 #include "model_obj.h"
+#include "trace.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define MODEL_OBJ_USE_SSE
+#endif
 
 namespace
 {
+    const int DETAIL_LEVEL_MIN_TRIANGLES = 65536;
+    const unsigned long long FNV_OFFSET_BASIS = 14695981039346656037ULL;
+    const unsigned long long FNV_PRIME = 1099511628211ULL;
+    const float INSTANCE_DIRECTION_TOLERANCE = 1e-3f;
+    const float INSTANCE_MIN_SPREAD = 1e-4f;
+    const int INSTANCE_MIN_TRIANGLES = 128;
+    const float INSTANCE_POSITION_TOLERANCE = 1e-4f;
+    const int MAX_DETAIL_LEVELS = 4;
+    const int MIN_DETAIL_GRID_SIZE = 8;
+    const int PARTS_PER_JOB = 64;
+    const int PROBE_BLOCK_SIZE = 1 << 20;
+    const int PROGRESS_INTERVAL = 4096;
+    const int TRIANGLES_PER_JOB = 16384;
+    const int VERTICES_PER_JOB = 16384;
+    const float ZERO_TEX_COORD[2] = {0.0f, 0.0f};
+    const float IDENTITY_TRANSFORM[16] =
+    {
+        1.0f, 0.0f, 0.0f, 0.0f,
+        0.0f, 1.0f, 0.0f, 0.0f,
+        0.0f, 0.0f, 1.0f, 0.0f,
+        0.0f, 0.0f, 0.0f, 1.0f
+    };
+
+    void ExtentsToBounds(const float minPosition[3], const float maxPosition[3], float center[3],
+                         float &width, float &height, float &length, float &radius)
+    {
+        if (minPosition[0] > maxPosition[0])
+        {
+            center[0] = center[1] = center[2] = 0.0f;
+            width = height = length = radius = 0.0f;
+            return;
+        }
+
+        center[0] = (minPosition[0] + maxPosition[0]) / 2.0f;
+        center[1] = (minPosition[1] + maxPosition[1]) / 2.0f;
+        center[2] = (minPosition[2] + maxPosition[2]) / 2.0f;
+
+        width = maxPosition[0] - minPosition[0];
+        height = maxPosition[1] - minPosition[1];
+        length = maxPosition[2] - minPosition[2];
+
+        radius = std::max(std::max(width, height), length);
+    }
+
+    void GrowExtents(const float position[3], float minPosition[3], float maxPosition[3])
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            if (position[i] < minPosition[i])
+                minPosition[i] = position[i];
+
+            if (position[i] > maxPosition[i])
+                maxPosition[i] = position[i];
+        }
+    }
+
+    void ResetExtents(float minPosition[3], float maxPosition[3])
+    {
+        minPosition[0] = minPosition[1] = minPosition[2] = std::numeric_limits<float>::max();
+        maxPosition[0] = maxPosition[1] = maxPosition[2] = -std::numeric_limits<float>::max();
+    }
+
+    // Lists the triangles that reference each vertex, in triangle order, so
+    // that per-vertex sums can be computed in parallel and still add up the
+    // face contributions in exactly the same order as a sequential loop.
+    void BuildVertexTriangles(const std::vector<int> &indexBuffer, int totalVertices,
+                              std::vector<int> &offsets, std::vector<int> &triangles)
+    {
+        offsets.assign(totalVertices + 1, 0);
+        triangles.resize(indexBuffer.size());
+
+        for (size_t i = 0; i < indexBuffer.size(); ++i)
+            ++offsets[indexBuffer[i] + 1];
+
+        for (int i = 0; i < totalVertices; ++i)
+            offsets[i + 1] += offsets[i];
+
+        std::vector<int> next(offsets.begin(), offsets.end() - 1);
+
+        for (size_t i = 0; i < indexBuffer.size(); ++i)
+            triangles[next[indexBuffer[i]]++] = static_cast<int>(i / 3);
+    }
+
+    struct Triangle
+    {
+        int v[3];
+    };
+
+    bool TriangleCompFunc(const Triangle &lhs, const Triangle &rhs)
+    {
+        if (lhs.v[0] != rhs.v[0])
+            return lhs.v[0] < rhs.v[0];
+
+        if (lhs.v[1] != rhs.v[1])
+            return lhs.v[1] < rhs.v[1];
+
+        return lhs.v[2] < rhs.v[2];
+    }
+
+    bool TriangleEqualFunc(const Triangle &lhs, const Triangle &rhs)
+    {
+        return lhs.v[0] == rhs.v[0] && lhs.v[1] == rhs.v[1] && lhs.v[2] == rhs.v[2];
+    }
+
     bool MeshCompFunc(const Model::Mesh &lhs, const Model::Mesh &rhs)
     {
         return lhs.pMaterial->alpha > rhs.pMaterial->alpha;
     }
+
+    struct Part
+    {
+        int group;
+        int firstTriangle;
+        int lastTriangle;
+        int prototype;
+        unsigned long long hash;
+        float transform[16];
+        std::vector<int> vertices;
+        std::vector<int> localIndices;
+    };
+
+    void Cross(const float a[3], const float b[3], float result[3])
+    {
+        result[0] = (a[1] * b[2]) - (a[2] * b[1]);
+        result[1] = (a[2] * b[0]) - (a[0] * b[2]);
+        result[2] = (a[0] * b[1]) - (a[1] * b[0]);
+    }
+
+    float Dot(const float a[3], const float b[3])
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    unsigned long long HashBytes(unsigned long long hash, const void *pData, size_t size)
+    {
+        const unsigned char *pBytes = static_cast<const unsigned char *>(pData);
+
+        for (size_t i = 0; i < size; ++i)
+            hash = (hash ^ pBytes[i]) * FNV_PRIME;
+
+        return hash;
+    }
+
+    void Normalize(const float v[3], float result[3])
+    {
+        float length = 1.0f / sqrtf(Dot(v, v));
+
+        result[0] = v[0] * length;
+        result[1] = v[1] * length;
+        result[2] = v[2] * length;
+    }
+
+    void Rotate(const float rotation[3][3], const float v[3], float result[3])
+    {
+        result[0] = Dot(rotation[0], v);
+        result[1] = Dot(rotation[1], v);
+        result[2] = Dot(rotation[2], v);
+    }
+
+    bool RotatesOnto(const float rotation[3][3], const float from[3], const float to[3])
+    {
+        float rotated[3] = {0.0f};
+        float difference[3] = {0.0f};
+
+        Rotate(rotation, from, rotated);
+        difference[0] = rotated[0] - to[0];
+        difference[1] = rotated[1] - to[1];
+        difference[2] = rotated[2] - to[2];
+
+        return Dot(difference, difference) <= INSTANCE_DIRECTION_TOLERANCE * INSTANCE_DIRECTION_TOLERANCE;
+    }
+
+    void Subtract(const float a[3], const float b[3], float result[3])
+    {
+        result[0] = a[0] - b[0];
+        result[1] = a[1] - b[1];
+        result[2] = a[2] - b[2];
+    }
+
+    bool InsideExtents(const float position[3], const float minPosition[3], const float maxPosition[3])
+    {
+        return position[0] >= minPosition[0] && position[0] <= maxPosition[0]
+            && position[1] >= minPosition[1] && position[1] <= maxPosition[1]
+            && position[2] >= minPosition[2] && position[2] <= maxPosition[2];
+    }
+
+    int CountBits(unsigned int bits)
+    {
+        bits = bits - ((bits >> 1) & 0x55555555u);
+        bits = (bits & 0x33333333u) + ((bits >> 2) & 0x33333333u);
+        return static_cast<int>((((bits + (bits >> 4)) & 0x0f0f0f0fu) * 0x01010101u) >> 24);
+    }
+
+    std::string GroupName(const char *pszName)
+    {
+        std::string name(pszName + strspn(pszName, " \t"));
+
+        name.erase(name.find_last_not_of(" \t\r\n") + 1);
+        return name.empty() ? "default" : name;
+    }
+
+    bool MatchPattern(const char *pszPattern, const char *pszName)
+    {
+        // Backtracks to the last '*' on a mismatch.
+        const char *pszStar = 0;
+        const char *pszResume = 0;
+
+        while (*pszName)
+        {
+            if (*pszPattern == '*')
+            {
+                pszStar = pszPattern++;
+                pszResume = pszName;
+            }
+            else if (*pszPattern == '?' || *pszPattern == *pszName)
+            {
+                ++pszPattern;
+                ++pszName;
+            }
+            else if (pszStar)
+            {
+                pszPattern = pszStar + 1;
+                pszName = ++pszResume;
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        while (*pszPattern == '*')
+            ++pszPattern;
+
+        return *pszPattern == '\0';
+    }
+
+    bool SelectsGroup(const Model::ImportFilter &filter, const std::string &name)
+    {
+        for (size_t i = 0; i < filter.groupPatterns.size(); ++i)
+        {
+            if (MatchPattern(filter.groupPatterns[i].c_str(), name.c_str()))
+                return true;
+        }
+
+        return filter.groupPatterns.empty();
+    }
+
+    bool SelectsMaterial(const Model::ImportFilter &filter, const char *pszName)
+    {
+        return filter.materialNames.empty() || std::find(filter.materialNames.begin(),
+            filter.materialNames.end(), pszName) != filter.materialNames.end();
+    }
+
+    std::string DirectoryPath(const std::string &filename)
+    {
+        std::string::size_type offset = filename.find_last_of('\\');
+
+        if (offset == std::string::npos)
+            offset = filename.find_last_of('/');
+
+        return (offset == std::string::npos) ? std::string() : filename.substr(0, offset + 1);
+    }
+
+    bool IsBlank(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\0';
+    }
+
+    std::string FirstToken(const char *pszText, const char *pszEnd)
+    {
+        while (pszText < pszEnd && IsBlank(*pszText))
+            ++pszText;
+
+        const char *pszToken = pszText;
+
+        while (pszText < pszEnd && !IsBlank(*pszText))
+            ++pszText;
+
+        return std::string(pszToken, pszText);
+    }
+
+    // Running bounds of the positions seen by Model::probe(). With SSE the
+    // minimum and maximum are each kept in one register, so a position is
+    // folded in with two instructions. The position is the first operand
+    // because minps and maxps return the second one when either is a NaN,
+    // which skips NaN coordinates the same way GrowExtents() does.
+    struct ProbeExtents
+    {
+#if defined(MODEL_OBJ_USE_SSE)
+        __m128 minPosition;
+        __m128 maxPosition;
+#else
+        float minPosition[3];
+        float maxPosition[3];
+#endif
+    };
+
+    inline void GrowProbeExtents(const float position[3], ProbeExtents &extents)
+    {
+#if defined(MODEL_OBJ_USE_SSE)
+        __m128 p = _mm_set_ps(0.0f, position[2], position[1], position[0]);
+
+        extents.minPosition = _mm_min_ps(p, extents.minPosition);
+        extents.maxPosition = _mm_max_ps(p, extents.maxPosition);
+#else
+        GrowExtents(position, extents.minPosition, extents.maxPosition);
+#endif
+    }
+
+    void ResetProbeExtents(ProbeExtents &extents)
+    {
+#if defined(MODEL_OBJ_USE_SSE)
+        extents.minPosition = _mm_set1_ps(std::numeric_limits<float>::max());
+        extents.maxPosition = _mm_set1_ps(-std::numeric_limits<float>::max());
+#else
+        ResetExtents(extents.minPosition, extents.maxPosition);
+#endif
+    }
+
+    void StoreProbeExtents(const ProbeExtents &extents, float minPosition[3], float maxPosition[3])
+    {
+#if defined(MODEL_OBJ_USE_SSE)
+        float values[4];
+
+        _mm_storeu_ps(values, extents.minPosition);
+        memcpy(minPosition, values, sizeof(float) * 3);
+        _mm_storeu_ps(values, extents.maxPosition);
+        memcpy(maxPosition, values, sizeof(float) * 3);
+#else
+        memcpy(minPosition, extents.minPosition, sizeof(float) * 3);
+        memcpy(maxPosition, extents.maxPosition, sizeof(float) * 3);
+#endif
+    }
+
+    void ProbeLine(const char *pszLine, const char *pszEnd, const std::string &directoryPath,
+                   bool computeBounds, bool &newGroup, ProbeExtents &extents,
+                   Model::ProbeResult &result)
+    {
+        // Looks at the same records as Model::importGeometryFirstPass().
+
+        while (pszLine < pszEnd && (*pszLine == ' ' || *pszLine == '\t'))
+            ++pszLine;
+
+        if (pszLine == pszEnd)
+            return;
+
+        switch (pszLine[0])
+        {
+        case 'f':
+            if (IsBlank(pszLine[1]))
+            {
+                int corners = 0;
+
+                for (const char *psz = pszLine + 1; psz < pszEnd; ++psz)
+                {
+                    if (!IsBlank(*psz) && IsBlank(psz[-1]))
+                        ++corners;
+                }
+
+                if (corners >= 3)
+                    result.numberOfTriangles += corners - 2;
+
+                if (newGroup)
+                {
+                    ++result.numberOfGroups;
+                    newGroup = false;
+                }
+            }
+            break;
+
+        case 'g':
+        case 'o':
+            if (IsBlank(pszLine[1]))
+                newGroup = true;
+            break;
+
+        case 'm':
+            if (strncmp(pszLine, "mtllib", 6) == 0 && IsBlank(pszLine[6]))
+                result.materialLibraries.push_back(directoryPath + FirstToken(pszLine + 6, pszEnd));
+            break;
+
+        case 'v':
+            if (IsBlank(pszLine[1]))
+            {
+                ++result.numberOfVertexCoords;
+
+                if (computeBounds)
+                {
+                    char *pszNext = const_cast<char *>(pszLine + 1);
+                    float position[3];
+
+                    position[0] = strtof(pszNext, &pszNext);
+                    position[1] = strtof(pszNext, &pszNext);
+                    position[2] = strtof(pszNext, &pszNext);
+                    GrowProbeExtents(position, extents);
+                }
+            }
+            else if (pszLine[1] == 't' && IsBlank(pszLine[2]))
+            {
+                ++result.numberOfTextureCoords;
+            }
+            else if (pszLine[1] == 'n' && IsBlank(pszLine[2]))
+            {
+                ++result.numberOfNormals;
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    void ProbeMaterials(const std::string &filename, Model::ProbeResult &result)
+    {
+        // Counts materials and collects texture maps the way
+        // Model::importMaterials() reads them.
+
+        FILE *pFile = fopen(filename.c_str(), "r");
+
+        if (!pFile)
+            return;
+
+        char buffer[256] = {0};
+        const char *pszEnd = 0;
+        std::string texture;
+
+        while (fgets(buffer, sizeof(buffer), pFile))
+        {
+            const char *pszLine = buffer + strspn(buffer, " \t");
+
+            pszEnd = buffer + strlen(buffer);
+
+            if (strncmp(pszLine, "newmtl", 6) == 0)
+            {
+                ++result.numberOfMaterials;
+            }
+            else if (strncmp(pszLine, "map_Kd", 6) == 0 || strncmp(pszLine, "map_bump", 8) == 0)
+            {
+                texture = FirstToken(pszLine + strcspn(pszLine, " \t"), pszEnd);
+
+                if (!texture.empty() && std::find(result.textureFilenames.begin(),
+                        result.textureFilenames.end(), texture) == result.textureFilenames.end())
+                {
+                    result.textureFilenames.push_back(texture);
+                }
+            }
+        }
+
+        fclose(pFile);
+    }
+
+    int ResolveIndex(int index, int count)
+    {
+        // OBJ indices are 1-based, or relative to the end when negative. An
+        // absent index (0) resolves to -1.
+        return (index < 0) ? count + index : index - 1;
+    }
+}
+
+Model::ImportFilter::ImportFilter()
+{
+    hasRegion = false;
+    ResetExtents(minPosition, maxPosition);
+}
+
+Model::ProbeResult::ProbeResult()
+{
+    numberOfVertexCoords = 0;
+    numberOfTextureCoords = 0;
+    numberOfNormals = 0;
+    numberOfTriangles = 0;
+    numberOfGroups = 0;
+    numberOfMaterials = 0;
+    ResetExtents(minPosition, maxPosition);
+}
+
+bool Model::IndexSet::contains(int i) const
+{
+    return i >= 0 && static_cast<size_t>(i >> 5) < bits.size() && (bits[i >> 5] & (1u << (i & 31))) != 0;
+}
+
+int Model::IndexSet::find(int i) const
+{
+    return ranks[i >> 5] + CountBits(bits[i >> 5] & ((1u << (i & 31)) - 1));
+}
+
+void Model::IndexSet::insert(int i)
+{
+    if (i < 0)
+        return;
+
+    if (static_cast<size_t>(i >> 5) >= bits.size())
+        bits.resize((i >> 5) + 1, 0);
+
+    bits[i >> 5] |= 1u << (i & 31);
+}
+
+int Model::IndexSet::rank()
+{
+    int count = 0;
+
+    ranks.resize(bits.size());
+
+    for (size_t i = 0; i < bits.size(); ++i)
+    {
+        ranks[i] = count;
+        count += CountBits(bits[i]);
+    }
+
+    return count;
 }
 
 Model::Model()
@@ -29,6 +544,91 @@ Model::Model()
 
     m_center[0] = m_center[1] = m_center[2] = 0.0f;
     m_width = m_height = m_length = m_radius = 0.0f;
+    ResetExtents(m_minPosition, m_maxPosition);
+
+    m_pImportCallback = 0;
+    m_pImportContext = 0;
+    m_importFileSize = 0;
+}
+
+Model::Model(const Model &other)
+{
+    m_hasPositions = other.m_hasPositions;
+    m_hasTextureCoords = other.m_hasTextureCoords;
+    m_hasNormals = other.m_hasNormals;
+    m_hasTangents = other.m_hasTangents;
+
+    m_numberOfVertexCoords = other.m_numberOfVertexCoords;
+    m_numberOfTextureCoords = other.m_numberOfTextureCoords;
+    m_numberOfNormals = other.m_numberOfNormals;
+    m_numberOfTriangles = other.m_numberOfTriangles;
+    m_numberOfMaterials = other.m_numberOfMaterials;
+    m_numberOfMeshes = other.m_numberOfMeshes;
+
+    m_center[0] = other.m_center[0];
+    m_center[1] = other.m_center[1];
+    m_center[2] = other.m_center[2];
+    m_width = other.m_width;
+    m_height = other.m_height;
+    m_length = other.m_length;
+    m_radius = other.m_radius;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        m_minPosition[i] = other.m_minPosition[i];
+        m_maxPosition[i] = other.m_maxPosition[i];
+    }
+
+    m_directoryPath = other.m_directoryPath;
+    m_materialLibraries = other.m_materialLibraries;
+
+    m_pImportCallback = 0;
+    m_pImportContext = 0;
+    m_importFileSize = 0;
+    m_importFilter = other.m_importFilter;
+
+    m_meshes = other.m_meshes;
+    m_materials = other.m_materials;
+    m_vertexBuffer = other.m_vertexBuffer;
+    m_indexBuffer = other.m_indexBuffer;
+    m_attributeBuffer = other.m_attributeBuffer;
+    m_vertexCoords = other.m_vertexCoords;
+    m_textureCoords = other.m_textureCoords;
+    m_normals = other.m_normals;
+
+    m_faceSources = other.m_faceSources;
+    m_faceNormals = other.m_faceNormals;
+    m_faceTangents = other.m_faceTangents;
+
+    m_detailLevels = other.m_detailLevels;
+
+    m_groups = other.m_groups;
+    m_instanceOffsets = other.m_instanceOffsets;
+    m_instanceTransforms = other.m_instanceTransforms;
+    m_instanceGroups = other.m_instanceGroups;
+
+    m_materialCache = other.m_materialCache;
+    m_vertexCache = other.m_vertexCache;
+
+    // Mesh::pMaterial points into m_materials so it has to be rebased onto
+    // this model's copy of the materials.
+
+    for (size_t i = 0; i < m_meshes.size(); ++i)
+    {
+        if (m_meshes[i].pMaterial)
+            m_meshes[i].pMaterial = &m_materials[m_meshes[i].pMaterial - &other.m_materials[0]];
+    }
+
+    for (size_t i = 0; i < m_detailLevels.size(); ++i)
+    {
+        std::vector<Mesh> &meshes = m_detailLevels[i].meshes;
+
+        for (size_t j = 0; j < meshes.size(); ++j)
+        {
+            if (meshes[j].pMaterial)
+                meshes[j].pMaterial = &m_materials[meshes[j].pMaterial - &other.m_materials[0]];
+        }
+    }
 }
 
 Model::~Model()
@@ -36,57 +636,63 @@ Model::~Model()
     destroy();
 }
 
-void Model::bounds(float center[3], float &width, float &height,
-                      float &length, float &radius) const
+Model &Model::operator=(const Model &other)
 {
-    float xMax = std::numeric_limits<float>::min();
-    float yMax = std::numeric_limits<float>::min();
-    float zMax = std::numeric_limits<float>::min();
-
-    float xMin = std::numeric_limits<float>::max();
-    float yMin = std::numeric_limits<float>::max();
-    float zMin = std::numeric_limits<float>::max();
+    if (this != &other)
+    {
+        Model copy(other);
+        swap(copy);
+    }
 
-    float x = 0.0f;
-    float y = 0.0f;
-    float z = 0.0f;
+    return *this;
+}
 
+void Model::bounds(float center[3], float &width, float &height,
+                      float &length, float &radius) const
+{
     int numVerts = static_cast<int>(m_vertexBuffer.size());
+    int numChunks = (numVerts + VERTICES_PER_JOB - 1) / VERTICES_PER_JOB;
+    std::vector<float> chunkBounds(std::max(1, numChunks) * 6);
 
-    for (int i = 0; i < numVerts; ++i)
+    for (size_t i = 0; i < chunkBounds.size(); i += 6)
     {
-        x = m_vertexBuffer[i].position[0];
-        y = m_vertexBuffer[i].position[1];
-        z = m_vertexBuffer[i].position[2];
+        chunkBounds[i + 0] = chunkBounds[i + 1] = chunkBounds[i + 2] = std::numeric_limits<float>::max();
+        chunkBounds[i + 3] = chunkBounds[i + 4] = chunkBounds[i + 5] = -std::numeric_limits<float>::max();
+    }
 
-        if (x < xMin)
-            xMin = x;
+    JobSystem::instance().parallelFor(0, numVerts, VERTICES_PER_JOB, [&](int first, int last)
+        {
+            float *pBounds = &chunkBounds[(first / VERTICES_PER_JOB) * 6];
+            const float *pPosition = 0;
 
-        if (x > xMax)
-            xMax = x;
+            for (int i = first; i < last; ++i)
+            {
+                pPosition = m_vertexBuffer[i].position;
 
-        if (y < yMin)
-            yMin = y;
+                for (int j = 0; j < 3; ++j)
+                {
+                    if (pPosition[j] < pBounds[j])
+                        pBounds[j] = pPosition[j];
 
-        if (y > yMax)
-            yMax = y;
+                    if (pPosition[j] > pBounds[j + 3])
+                        pBounds[j + 3] = pPosition[j];
+                }
+            }
+        });
 
-        if (z < zMin)
-            zMin = z;
+    float minPosition[3] = {chunkBounds[0], chunkBounds[1], chunkBounds[2]};
+    float maxPosition[3] = {chunkBounds[3], chunkBounds[4], chunkBounds[5]};
 
-        if (z > zMax)
-            zMax = z;
+    for (size_t i = 6; i < chunkBounds.size(); i += 6)
+    {
+        for (int j = 0; j < 3; ++j)
+        {
+            minPosition[j] = std::min(minPosition[j], chunkBounds[i + j]);
+            maxPosition[j] = std::max(maxPosition[j], chunkBounds[i + j + 3]);
+        }
     }
 
-    center[0] = (xMin + xMax) / 2.0f;
-    center[1] = (yMin + yMax) / 2.0f;
-    center[2] = (zMin + zMax) / 2.0f;
-
-    width = xMax - xMin;
-    height = yMax - yMin;
-    length = zMax - zMin;
-
-    radius = std::max(std::max(width, height), length);
+    ExtentsToBounds(minPosition, maxPosition, center, width, height, length, radius);
 }
 
 void Model::destroy()
@@ -105,8 +711,10 @@ void Model::destroy()
 
     m_center[0] = m_center[1] = m_center[2] = 0.0f;
     m_width = m_height = m_length = m_radius = 0.0f;
+    ResetExtents(m_minPosition, m_maxPosition);
 
     m_directoryPath.clear();
+    m_materialLibraries.clear();
 
     m_meshes.clear();
     m_materials.clear();
@@ -118,73 +726,140 @@ void Model::destroy()
     m_textureCoords.clear();
     m_normals.clear();
 
+    m_faceSources.clear();
+    m_faceNormals.clear();
+    m_faceTangents.clear();
+
+    m_selectedVertexCoords = IndexSet();
+    m_selectedTextureCoords = IndexSet();
+    m_selectedNormals = IndexSet();
+    m_verticesInRegion = IndexSet();
+    m_selectedFaces.clear();
+
+    m_detailLevels.clear();
+
+    m_groups.clear();
+    m_instanceOffsets.clear();
+    m_instanceTransforms.clear();
+    m_instanceGroups.clear();
+
     m_materialCache.clear();
     m_vertexCache.clear();
 }
 
 bool Model::import(const char *pszFilename, bool rebuildNormals)
 {
+    TRACE_ZONE("Model::import");
+
     FILE *pFile = fopen(pszFilename, "r");
 
     if (!pFile)
         return false;
 
-    m_directoryPath.clear();
+    fseek(pFile, 0, SEEK_END);
+    m_importFileSize = ftell(pFile);
+    rewind(pFile);
 
-    std::string filename = pszFilename;
-    std::string::size_type offset = filename.find_last_of('\\');
+    m_directoryPath = DirectoryPath(pszFilename);
 
-    if (offset != std::string::npos)
+    // An import filter that selects no faces fails the import.
+    if (!importGeometryFirstPass(pFile) || (hasImportFilter() && m_numberOfTriangles == 0))
     {
-        m_directoryPath = filename.substr(0, ++offset);
+        fclose(pFile);
+        destroy();
+        return false;
     }
-    else
+
+    rewind(pFile);
+
+    // Face normals and tangents only depend on the triangle's own corners, so
+    // the second pass computes them per mesh while it is still parsing.
+    // Only the per-vertex sums have to wait for the whole file.
+
+    bool rebuildTangents = false;
+
+    for (int i = 0; i < m_numberOfMaterials; ++i)
     {
-        offset = filename.find_last_of('/');
+        if (!m_materials[i].bumpMapFilename.empty())
+        {
+            rebuildTangents = true;
+            break;
+        }
+    }
+
+    rebuildNormals = rebuildNormals || !hasNormals();
+
+    if (rebuildNormals)
+        m_faceNormals.resize(m_numberOfTriangles * 3);
+
+    if (rebuildTangents)
+        m_faceTangents.resize(m_numberOfTriangles * 6);
+
+    if (rebuildNormals || rebuildTangents)
+        m_faceSources.assign(m_numberOfTriangles * 6, -1);
 
-        if (offset != std::string::npos)
-            m_directoryPath = filename.substr(0, ++offset);
+    if (!importGeometrySecondPass(pFile))
+    {
+        fclose(pFile);
+        destroy();
+        return false;
     }
 
-    importGeometryFirstPass(pFile);
-    rewind(pFile);
-    importGeometrySecondPass(pFile);
     fclose(pFile);
+    std::vector<int>().swap(m_faceSources);
+
+    if (hasImportFilter())
+    {
+        m_selectedVertexCoords = IndexSet();
+        m_selectedTextureCoords = IndexSet();
+        m_selectedNormals = IndexSet();
+        std::vector<bool>().swap(m_selectedFaces);
+        removeUnusedMaterials();
+    }
+
+    if (!reportProgress(IMPORT_PHASE_POST_PROCESS, m_importFileSize))
+    {
+        destroy();
+        return false;
+    }
 
     buildMeshes();
-    bounds(m_center, m_width, m_height, m_length, m_radius);
+    ExtentsToBounds(m_minPosition, m_maxPosition, m_center, m_width, m_height, m_length, m_radius);
 
     if (rebuildNormals)
-    {
         generateNormals();
-    }
-    else
+
+    if (!reportProgress(IMPORT_PHASE_POST_PROCESS, m_importFileSize))
     {
-        if (!hasNormals())
-            generateNormals();
+        destroy();
+        return false;
     }
 
-    for (int i = 0; i < m_numberOfMaterials; ++i)
+    if (rebuildTangents)
+        generateTangents();
+
+    if (!reportProgress(IMPORT_PHASE_POST_PROCESS, m_importFileSize))
     {
-        if (!m_materials[i].bumpMapFilename.empty())
-        {
-            generateTangents();
-            break;
-        }
+        destroy();
+        return false;
     }
 
+    buildInstances();
+    buildDetailLevels();
     return true;
 }
 
 void Model::normalize(float scaleTo, bool center)
 {
+    TRACE_ZONE("Model::normalize");
+
     float width = 0.0f;
     float height = 0.0f;
     float length = 0.0f;
     float radius = 0.0f;
     float centerPos[3] = {0.0f};
 
-    bounds(centerPos, width, height, length, radius);
+    ExtentsToBounds(m_minPosition, m_maxPosition, centerPos, width, height, length, radius);
 
     float scalingFactor = scaleTo / radius;
     float offset[3] = {0.0f};
@@ -204,7 +879,111 @@ void Model::normalize(float scaleTo, bool center)
     }
 
     scale(scalingFactor, offset);
-    bounds(m_center, m_width, m_height, m_length, m_radius);
+    ExtentsToBounds(m_minPosition, m_maxPosition, m_center, m_width, m_height, m_length, m_radius);
+}
+
+bool Model::probe(const char *pszFilename, ProbeResult &result, bool computeBounds)
+{
+    TRACE_ZONE("Model::probe");
+
+    // Reads the file in large blocks and only looks at the start of each line
+    // to count records. Nothing is stored, and numbers are only parsed for
+    // the bounds.
+
+    FILE *pFile = fopen(pszFilename, "rb");
+
+    if (!pFile)
+        return false;
+
+    std::string directoryPath = DirectoryPath(pszFilename);
+    std::vector<char> buffer(PROBE_BLOCK_SIZE + 1);
+    size_t length = 0;
+    size_t bytesRead = 0;
+    bool newGroup = true;
+    bool atEnd = false;
+    ProbeExtents extents;
+
+    result = ProbeResult();
+    ResetProbeExtents(extents);
+
+    while (!atEnd)
+    {
+        // A line that doesn't fit into the buffer grows it.
+        if (length + 1 == buffer.size())
+            buffer.resize(buffer.size() * 2);
+
+        bytesRead = fread(&buffer[length], 1, buffer.size() - 1 - length, pFile);
+        atEnd = bytesRead == 0;
+        length += bytesRead;
+        buffer[length] = '\0';
+
+        const char *pszLine = &buffer[0];
+        const char *pszEnd = pszLine + length;
+
+        while (pszLine < pszEnd)
+        {
+            const char *pszNewline = static_cast<const char *>(memchr(pszLine, '\n', pszEnd - pszLine));
+
+            if (!pszNewline && !atEnd)
+                break;
+
+            if (!pszNewline)
+                pszNewline = pszEnd;
+
+            ProbeLine(pszLine, pszNewline, directoryPath, computeBounds, newGroup, extents, result);
+            pszLine = pszNewline + 1;
+        }
+
+        if (pszLine < pszEnd)
+        {
+            length = pszEnd - pszLine;
+            memmove(&buffer[0], pszLine, length);
+        }
+        else
+        {
+            length = 0;
+        }
+    }
+
+    fclose(pFile);
+    StoreProbeExtents(extents, result.minPosition, result.maxPosition);
+
+    for (size_t i = 0; i < result.materialLibraries.size(); ++i)
+        ProbeMaterials(result.materialLibraries[i], result);
+
+    return true;
+}
+
+bool Model::reloadMaterials()
+{
+    // Reads the material libraries again and updates the materials that the
+    // model already has in place, so meshes keep pointing at them. Materials
+    // are matched by name; ones that were added to a library are ignored.
+    bool reloaded = false;
+
+    for (size_t i = 0; i < m_materialLibraries.size(); ++i)
+    {
+        Model library;
+
+        if (!library.importMaterials(m_materialLibraries[i].c_str()))
+            continue;
+
+        for (size_t j = 0; j < library.m_materials.size(); ++j)
+        {
+            const Material &material = library.m_materials[j];
+            std::map<std::string, int>::const_iterator iter = m_materialCache.find(material.name);
+
+            if (iter != m_materialCache.end() && iter->second < static_cast<int>(m_materials.size()) &&
+                m_materials[iter->second].name == material.name)
+            {
+                m_materials[iter->second] = material;
+            }
+        }
+
+        reloaded = true;
+    }
+
+    return reloaded;
 }
 
 void Model::reverseWinding()
@@ -218,21 +997,138 @@ void Model::reverseWinding()
         m_indexBuffer[i + 2] = swap;
     }
 
-    float *pNormal = 0;
-    float *pTangent = 0;
+    for (size_t i = 0; i < m_detailLevels.size(); ++i)
+    {
+        std::vector<int> &indexBuffer = m_detailLevels[i].indexBuffer;
+
+        for (size_t j = 0; j < indexBuffer.size(); j += 3)
+            std::swap(indexBuffer[j + 1], indexBuffer[j + 2]);
+    }
+
+    float *pNormal = 0;
+    float *pTangent = 0;
+
+    for (int i = 0; i < static_cast<int>(m_vertexBuffer.size()); ++i)
+    {
+        pNormal = m_vertexBuffer[i].normal;
+        pNormal[0] = -pNormal[0];
+        pNormal[1] = -pNormal[1];
+        pNormal[2] = -pNormal[2];
+
+        pTangent = m_vertexBuffer[i].tangent;
+        pTangent[0] = -pTangent[0];
+        pTangent[1] = -pTangent[1];
+        pTangent[2] = -pTangent[2];
+    }
+}
+
+void Model::setGroupHidden(int i, bool hidden)
+{
+    m_groups[i].hidden = hidden;
+}
+
+void Model::setImportCallback(ImportCallback pCallback, void *pContext)
+{
+    m_pImportCallback = pCallback;
+    m_pImportContext = pContext;
+}
+
+void Model::setImportFilter(const ImportFilter &filter)
+{
+    m_importFilter = filter;
+}
+
+void Model::setPositionsAndNormals(const float *pVertices)
+{
+    TRACE_ZONE("Model::setPositionsAndNormals");
+
+    // Replaces the position and normal of every vertex, given as six floats
+    // per vertex, for models that are animated without changing their faces.
+    // Tangents are kept. The model and group bounds follow the new positions.
+
+    ResetExtents(m_minPosition, m_maxPosition);
+
+    for (size_t i = 0; i < m_vertexBuffer.size(); ++i)
+    {
+        Vertex &vertex = m_vertexBuffer[i];
+        const float *pVertex = &pVertices[i * 6];
+
+        memcpy(vertex.position, pVertex, sizeof(vertex.position));
+        memcpy(vertex.normal, pVertex + 3, sizeof(vertex.normal));
+        GrowExtents(vertex.position, m_minPosition, m_maxPosition);
+    }
+
+    for (size_t i = 0; i < m_groups.size(); ++i)
+    {
+        Group &group = m_groups[i];
+
+        ResetExtents(group.minPosition, group.maxPosition);
+
+        for (int j = group.startIndex; j < group.startIndex + group.triangleCount * 3; ++j)
+            GrowExtents(m_vertexBuffer[m_indexBuffer[j]].position, group.minPosition, group.maxPosition);
+    }
+
+    ExtentsToBounds(m_minPosition, m_maxPosition, m_center, m_width, m_height, m_length, m_radius);
+}
+
+void Model::swap(Model &other)
+{
+    std::swap(m_hasPositions, other.m_hasPositions);
+    std::swap(m_hasTextureCoords, other.m_hasTextureCoords);
+    std::swap(m_hasNormals, other.m_hasNormals);
+    std::swap(m_hasTangents, other.m_hasTangents);
+
+    std::swap(m_numberOfVertexCoords, other.m_numberOfVertexCoords);
+    std::swap(m_numberOfTextureCoords, other.m_numberOfTextureCoords);
+    std::swap(m_numberOfNormals, other.m_numberOfNormals);
+    std::swap(m_numberOfTriangles, other.m_numberOfTriangles);
+    std::swap(m_numberOfMaterials, other.m_numberOfMaterials);
+    std::swap(m_numberOfMeshes, other.m_numberOfMeshes);
+
+    std::swap(m_center[0], other.m_center[0]);
+    std::swap(m_center[1], other.m_center[1]);
+    std::swap(m_center[2], other.m_center[2]);
+    std::swap(m_width, other.m_width);
+    std::swap(m_height, other.m_height);
+    std::swap(m_length, other.m_length);
+    std::swap(m_radius, other.m_radius);
+
+    for (int i = 0; i < 3; ++i)
+    {
+        std::swap(m_minPosition[i], other.m_minPosition[i]);
+        std::swap(m_maxPosition[i], other.m_maxPosition[i]);
+    }
+
+    m_directoryPath.swap(other.m_directoryPath);
+    m_materialLibraries.swap(other.m_materialLibraries);
 
-    for (int i = 0; i < static_cast<int>(m_vertexBuffer.size()); ++i)
-    {
-        pNormal = m_vertexBuffer[i].normal;
-        pNormal[0] = -pNormal[0];
-        pNormal[1] = -pNormal[1];
-        pNormal[2] = -pNormal[2];
+    std::swap(m_pImportCallback, other.m_pImportCallback);
+    std::swap(m_pImportContext, other.m_pImportContext);
+    std::swap(m_importFilter, other.m_importFilter);
+    std::swap(m_importFileSize, other.m_importFileSize);
 
-        pTangent = m_vertexBuffer[i].tangent;
-        pTangent[0] = -pTangent[0];
-        pTangent[1] = -pTangent[1];
-        pTangent[2] = -pTangent[2];
-    }
+    m_meshes.swap(other.m_meshes);
+    m_materials.swap(other.m_materials);
+    m_vertexBuffer.swap(other.m_vertexBuffer);
+    m_indexBuffer.swap(other.m_indexBuffer);
+    m_attributeBuffer.swap(other.m_attributeBuffer);
+    m_vertexCoords.swap(other.m_vertexCoords);
+    m_textureCoords.swap(other.m_textureCoords);
+    m_normals.swap(other.m_normals);
+
+    m_faceSources.swap(other.m_faceSources);
+    m_faceNormals.swap(other.m_faceNormals);
+    m_faceTangents.swap(other.m_faceTangents);
+
+    m_detailLevels.swap(other.m_detailLevels);
+
+    m_groups.swap(other.m_groups);
+    m_instanceOffsets.swap(other.m_instanceOffsets);
+    m_instanceTransforms.swap(other.m_instanceTransforms);
+    m_instanceGroups.swap(other.m_instanceGroups);
+
+    m_materialCache.swap(other.m_materialCache);
+    m_vertexCache.swap(other.m_vertexCache);
 }
 
 void Model::scale(float scaleFactor, float offset[3])
@@ -251,6 +1147,65 @@ void Model::scale(float scaleFactor, float offset[3])
         pPosition[1] *= scaleFactor;
         pPosition[2] *= scaleFactor;
     }
+
+    // The instance transforms move into the new space as well: a copy at
+    // R * p + t ends up at R * p' + (t + offset - R * offset) * scaleFactor.
+    for (size_t i = 0; i < m_instanceTransforms.size(); i += 16)
+    {
+        float *pTransform = &m_instanceTransforms[i];
+
+        for (int j = 0; j < 3; ++j)
+        {
+            pTransform[12 + j] = (pTransform[12 + j] + offset[j] - pTransform[j] * offset[0]
+                - pTransform[4 + j] * offset[1] - pTransform[8 + j] * offset[2]) * scaleFactor;
+        }
+    }
+
+    // The same operations applied to the extents give exactly the extents of
+    // the transformed positions, since rounding is monotonic.
+    if (!m_vertexBuffer.empty())
+    {
+        float a = 0.0f;
+        float b = 0.0f;
+
+        for (int i = 0; i < 3; ++i)
+        {
+            a = (m_minPosition[i] + offset[i]) * scaleFactor;
+            b = (m_maxPosition[i] + offset[i]) * scaleFactor;
+            m_minPosition[i] = std::min(a, b);
+            m_maxPosition[i] = std::max(a, b);
+
+            for (size_t j = 0; j < m_groups.size(); ++j)
+            {
+                a = (m_groups[j].minPosition[i] + offset[i]) * scaleFactor;
+                b = (m_groups[j].maxPosition[i] + offset[i]) * scaleFactor;
+                m_groups[j].minPosition[i] = std::min(a, b);
+                m_groups[j].maxPosition[i] = std::max(a, b);
+            }
+        }
+    }
+}
+
+void Model::addGroup(const char *pszName, int triangle)
+{
+    // A group that hasn't received any faces yet is renamed instead, as when
+    // an "o" record is directly followed by a "g" record.
+
+    if (m_groups.empty() || m_groups.back().startIndex != triangle * 3)
+    {
+        Group group;
+
+        group.startIndex = triangle * 3;
+        group.triangleCount = 0;
+        group.prototype = -1;
+        group.instance = 0;
+        group.hidden = false;
+        ResetExtents(group.minPosition, group.maxPosition);
+
+        m_groups.push_back(group);
+    }
+
+    m_groups.back().name = GroupName(pszName);
 }
 
 void Model::addTrianglePos(int index, int material, int v0, int v1, int v2)
@@ -263,6 +1218,7 @@ void Model::addTrianglePos(int index, int material, int v0, int v1, int v2)
     };
 
     m_attributeBuffer[index] = material;
+    setFaceSources(index, v0, v1, v2, -1, -1, -1);
 
     vertex.position[0] = m_vertexCoords[v0 * 3];
     vertex.position[1] = m_vertexCoords[v0 * 3 + 1];
@@ -292,6 +1248,7 @@ void Model::addTrianglePosNormal(int index, int material, int v0, int v1,
     };
 
     m_attributeBuffer[index] = material;
+    setFaceSources(index, v0, v1, v2, -1, -1, -1);
 
     vertex.position[0] = m_vertexCoords[v0 * 3];
     vertex.position[1] = m_vertexCoords[v0 * 3 + 1];
@@ -330,6 +1287,7 @@ void Model::addTrianglePosTexCoord(int index, int material, int v0, int v1,
     };
 
     m_attributeBuffer[index] = material;
+    setFaceSources(index, v0, v1, v2, vt0, vt1, vt2);
 
     vertex.position[0] = m_vertexCoords[v0 * 3];
     vertex.position[1] = m_vertexCoords[v0 * 3 + 1];
@@ -366,6 +1324,7 @@ void Model::addTrianglePosTexCoordNormal(int index, int material, int v0,
     };
 
     m_attributeBuffer[index] = material;
+    setFaceSources(index, v0, v1, v2, vt0, vt1, vt2);
 
     vertex.position[0] = m_vertexCoords[v0 * 3];
     vertex.position[1] = m_vertexCoords[v0 * 3 + 1];
@@ -403,10 +1362,13 @@ int Model::addVertex(int hash, const Vertex *pVertex)
     int index = -1;
     std::map<int, std::vector<int> >::const_iterator iter = m_vertexCache.find(hash);
 
+    GrowExtents(pVertex->position, m_groups.back().minPosition, m_groups.back().maxPosition);
+
     if (iter == m_vertexCache.end())
     {
         index = static_cast<int>(m_vertexBuffer.size());
         m_vertexBuffer.push_back(*pVertex);
+        GrowExtents(pVertex->position, m_minPosition, m_maxPosition);
         m_vertexCache.insert(std::make_pair(hash, std::vector<int>(1, index)));
     }
     else
@@ -427,271 +1389,787 @@ int Model::addVertex(int hash, const Vertex *pVertex)
             }
         }
 
-        if (!found)
+        if (!found)
+        {
+            index = static_cast<int>(m_vertexBuffer.size());
+            m_vertexBuffer.push_back(*pVertex);
+            GrowExtents(pVertex->position, m_minPosition, m_maxPosition);
+            m_vertexCache[hash].push_back(index);
+        }
+    }
+
+    return index;
+}
+
+void Model::buildDetailLevel(int gridSize, DetailLevel &level) const
+{
+    float size = std::max(std::max(m_maxPosition[0] - m_minPosition[0],
+        m_maxPosition[1] - m_minPosition[1]), m_maxPosition[2] - m_minPosition[2]);
+    float cellSize = size / gridSize;
+    unsigned long long cellsPerAxis[3] = {0};
+
+    for (int i = 0; i < 3; ++i)
+        cellsPerAxis[i] = static_cast<unsigned long long>((m_maxPosition[i] - m_minPosition[i]) / cellSize) + 1;
+
+    // Every vertex is snapped to the first vertex that falls into the same
+    // grid cell, so the level can reuse the full resolution vertex buffer.
+
+    int numVerts = static_cast<int>(m_vertexBuffer.size());
+    std::vector<int> representatives(numVerts);
+    std::unordered_map<unsigned long long, int> cells;
+    const float *pPosition = 0;
+    unsigned long long cell[3] = {0};
+
+    cells.reserve(m_numberOfTriangles / 2);
+
+    for (int i = 0; i < numVerts; ++i)
+    {
+        pPosition = m_vertexBuffer[i].position;
+
+        for (int j = 0; j < 3; ++j)
+        {
+            cell[j] = static_cast<unsigned long long>(std::max(0.0f, (pPosition[j] - m_minPosition[j]) / cellSize));
+            cell[j] = std::min(cell[j], cellsPerAxis[j] - 1);
+        }
+
+        unsigned long long key = (cell[0] * cellsPerAxis[1] + cell[1]) * cellsPerAxis[2] + cell[2];
+        representatives[i] = cells.insert(std::make_pair(key, i)).first->second;
+    }
+
+    std::vector<Triangle> triangles;
+    const int *pIndex = 0;
+
+    level.indexBuffer.clear();
+    level.meshes.resize(m_meshes.size());
+
+    for (size_t i = 0; i < m_meshes.size(); ++i)
+    {
+        const Mesh &mesh = m_meshes[i];
+
+        triangles.clear();
+
+        for (int j = 0; j < mesh.triangleCount; ++j)
+        {
+            pIndex = &m_indexBuffer[mesh.startIndex + j * 3];
+
+            Triangle triangle = {{representatives[pIndex[0]], representatives[pIndex[1]],
+                representatives[pIndex[2]]}};
+
+            if (triangle.v[0] == triangle.v[1] || triangle.v[1] == triangle.v[2] ||
+                triangle.v[0] == triangle.v[2])
+                continue;
+
+            // Rotating the smallest index to the front keeps the winding and
+            // lets duplicates of the same collapsed triangle compare equal.
+            while (triangle.v[0] > triangle.v[1] || triangle.v[0] > triangle.v[2])
+                std::rotate(triangle.v, triangle.v + 1, triangle.v + 3);
+
+            triangles.push_back(triangle);
+        }
+
+        std::sort(triangles.begin(), triangles.end(), TriangleCompFunc);
+        triangles.erase(std::unique(triangles.begin(), triangles.end(), TriangleEqualFunc), triangles.end());
+
+        level.meshes[i].startIndex = static_cast<int>(level.indexBuffer.size());
+        level.meshes[i].triangleCount = static_cast<int>(triangles.size());
+        level.meshes[i].pMaterial = mesh.pMaterial;
+        level.meshes[i].group = mesh.group;
+        level.meshes[i].prototype = mesh.prototype;
+
+        for (size_t j = 0; j < triangles.size(); ++j)
+            level.indexBuffer.insert(level.indexBuffer.end(), triangles[j].v, triangles[j].v + 3);
+    }
+}
+
+void Model::buildDetailLevels()
+{
+    TRACE_ZONE("Model::buildDetailLevels");
+
+    // Coarser versions of the model for drawing while the camera moves. Each
+    // level halves the vertex clustering grid of the one before it, which
+    // leaves roughly a quarter of the triangles of a closed surface.
+
+    m_detailLevels.clear();
+
+    if (m_numberOfTriangles < DETAIL_LEVEL_MIN_TRIANGLES || m_minPosition[0] > m_maxPosition[0])
+        return;
+
+    std::vector<DetailLevel> levels;
+    std::vector<JobSystem::Job> jobs;
+    int gridSize = static_cast<int>(std::sqrt(m_numberOfTriangles / 8.0f));
+
+    levels.reserve(MAX_DETAIL_LEVELS);
+
+    for (; gridSize >= MIN_DETAIL_GRID_SIZE && static_cast<int>(levels.size()) < MAX_DETAIL_LEVELS; gridSize /= 2)
+    {
+        levels.push_back(DetailLevel());
+
+        DetailLevel *pLevel = &levels.back();
+        jobs.push_back([this, pLevel, gridSize]() { buildDetailLevel(gridSize, *pLevel); });
+    }
+
+    JobSystem::instance().run(jobs);
+
+    // Only keep levels that are a real step down from the previous one.
+
+    size_t triangleCount = m_indexBuffer.size();
+
+    for (size_t i = 0; i < levels.size(); ++i)
+    {
+        if (levels[i].indexBuffer.empty() || levels[i].indexBuffer.size() * 4 > triangleCount * 3)
+            continue;
+
+        triangleCount = levels[i].indexBuffer.size();
+        m_detailLevels.push_back(DetailLevel());
+        m_detailLevels.back().indexBuffer.swap(levels[i].indexBuffer);
+        m_detailLevels.back().meshes.swap(levels[i].meshes);
+    }
+}
+
+void Model::buildInstances()
+{
+    TRACE_ZONE("Model::buildInstances");
+
+    // Groups ("g" and "o") with the same triangle list, materials and texture
+    // coordinates, whose vertices map onto each other under a rotation and a
+    // translation, are copies of the same part. Only the first copy of each
+    // part is kept. It is moved behind the other triangles, and the transforms
+    // of all copies, starting with the identity, are stored instead.
+
+    m_instanceOffsets.clear();
+    m_instanceTransforms.clear();
+    m_instanceGroups.clear();
+
+    std::vector<Part> parts;
+
+    for (size_t i = 0; i < m_groups.size(); ++i)
+    {
+        if (m_groups[i].triangleCount >= INSTANCE_MIN_TRIANGLES)
+        {
+            parts.push_back(Part());
+            parts.back().group = static_cast<int>(i);
+            parts.back().firstTriangle = m_groups[i].startIndex / 3;
+            parts.back().lastTriangle = parts.back().firstTriangle + m_groups[i].triangleCount;
+            parts.back().prototype = -1;
+        }
+    }
+
+    if (parts.size() < 2)
+        return;
+
+    // The canonical form of a part numbers its vertices in the order in which
+    // its triangles first use them, so copies written out the same way have
+    // identical local index lists whatever their placement in the file.
+    JobSystem::instance().parallelFor(0, static_cast<int>(parts.size()), PARTS_PER_JOB, [this, &parts](int first, int last)
+        {
+            std::unordered_map<int, int> localIndices;
+
+            for (int i = first; i < last; ++i)
+            {
+                Part &part = parts[i];
+                unsigned long long hash = HashBytes(FNV_OFFSET_BASIS, &m_attributeBuffer[part.firstTriangle],
+                    (part.lastTriangle - part.firstTriangle) * sizeof(int));
+
+                localIndices.clear();
+
+                for (int j = part.firstTriangle * 3; j < part.lastTriangle * 3; ++j)
+                {
+                    std::pair<std::unordered_map<int, int>::iterator, bool> result = localIndices.insert(
+                        std::make_pair(m_indexBuffer[j], static_cast<int>(part.vertices.size())));
+
+                    if (result.second)
+                        part.vertices.push_back(m_indexBuffer[j]);
+
+                    part.localIndices.push_back(result.first->second);
+                }
+
+                hash = HashBytes(hash, &part.localIndices[0], part.localIndices.size() * sizeof(int));
+
+                for (size_t j = 0; j < part.vertices.size(); ++j)
+                    hash = HashBytes(hash, m_vertexBuffer[part.vertices[j]].texCoord, sizeof(float) * 2);
+
+                part.hash = hash;
+            }
+        });
+
+    std::unordered_map<unsigned long long, std::vector<int> > prototypes;
+    std::vector<int> numberOfCopies(parts.size(), 0);
+    int totalCopies = 0;
+
+    for (size_t i = 0; i < parts.size(); ++i)
+    {
+        Part &part = parts[i];
+        std::vector<int> &candidates = prototypes[part.hash];
+
+        for (size_t j = 0; j < candidates.size() && part.prototype < 0; ++j)
+        {
+            const Part &candidate = parts[candidates[j]];
+
+            if (candidate.localIndices == part.localIndices &&
+                std::equal(m_attributeBuffer.begin() + part.firstTriangle,
+                    m_attributeBuffer.begin() + part.lastTriangle,
+                    m_attributeBuffer.begin() + candidate.firstTriangle) &&
+                findInstanceTransform(candidate.vertices, part.vertices, part.transform))
+            {
+                part.prototype = candidates[j];
+                ++numberOfCopies[candidates[j]];
+                ++totalCopies;
+            }
+        }
+
+        if (part.prototype < 0)
+            candidates.push_back(static_cast<int>(i));
+    }
+
+    if (totalCopies == 0)
+        return;
+
+    // Groups that aren't repeated keep their order at the front, followed by
+    // the prototypes. The groups of the copies point at their prototype's
+    // triangles.
+
+    std::vector<int> partOfGroup(m_groups.size(), -1);
+    std::vector<int> indexBuffer;
+    std::vector<int> attributeBuffer;
+
+    for (size_t i = 0; i < parts.size(); ++i)
+    {
+        if (parts[i].prototype >= 0 || numberOfCopies[i] > 0)
+            partOfGroup[parts[i].group] = static_cast<int>(i);
+    }
+
+    for (size_t i = 0; i < m_groups.size(); ++i)
+    {
+        Group &group = m_groups[i];
+
+        if (partOfGroup[i] >= 0)
+            continue;
+
+        indexBuffer.insert(indexBuffer.end(), m_indexBuffer.begin() + group.startIndex,
+            m_indexBuffer.begin() + group.startIndex + group.triangleCount * 3);
+        attributeBuffer.insert(attributeBuffer.end(), m_attributeBuffer.begin() + group.startIndex / 3,
+            m_attributeBuffer.begin() + group.startIndex / 3 + group.triangleCount);
+        group.startIndex = static_cast<int>(indexBuffer.size()) - group.triangleCount * 3;
+    }
+
+    for (size_t i = 0; i < parts.size(); ++i)
+    {
+        const Part &part = parts[i];
+        int prototype = static_cast<int>(m_instanceOffsets.size());
+        int startIndex = static_cast<int>(indexBuffer.size());
+
+        if (numberOfCopies[i] == 0)
+            continue;
+
+        m_instanceOffsets.push_back(static_cast<int>(m_instanceGroups.size()));
+
+        indexBuffer.insert(indexBuffer.end(), m_indexBuffer.begin() + part.firstTriangle * 3,
+            m_indexBuffer.begin() + part.lastTriangle * 3);
+        attributeBuffer.insert(attributeBuffer.end(), m_attributeBuffer.begin() + part.firstTriangle,
+            m_attributeBuffer.begin() + part.lastTriangle);
+
+        for (size_t j = i; j < parts.size(); ++j)
+        {
+            if (j != i && parts[j].prototype != static_cast<int>(i))
+                continue;
+
+            Group &group = m_groups[parts[j].group];
+
+            group.startIndex = startIndex;
+            group.prototype = prototype;
+            group.instance = static_cast<int>(m_instanceGroups.size()) - m_instanceOffsets.back();
+
+            if (j == i)
+                m_instanceTransforms.insert(m_instanceTransforms.end(), IDENTITY_TRANSFORM, IDENTITY_TRANSFORM + 16);
+            else
+                m_instanceTransforms.insert(m_instanceTransforms.end(), parts[j].transform, parts[j].transform + 16);
+
+            m_instanceGroups.push_back(parts[j].group);
+        }
+    }
+
+    m_instanceOffsets.push_back(static_cast<int>(m_instanceGroups.size()));
+
+    // Drop the vertices only the removed copies used.
+
+    std::vector<int> vertexMap(m_vertexBuffer.size(), -1);
+    std::vector<Vertex> vertexBuffer;
+
+    for (size_t i = 0; i < indexBuffer.size(); ++i)
+        vertexMap[indexBuffer[i]] = 0;
+
+    for (size_t i = 0; i < m_vertexBuffer.size(); ++i)
+    {
+        if (vertexMap[i] == 0)
+        {
+            vertexMap[i] = static_cast<int>(vertexBuffer.size());
+            vertexBuffer.push_back(m_vertexBuffer[i]);
+        }
+    }
+
+    for (size_t i = 0; i < indexBuffer.size(); ++i)
+        indexBuffer[i] = vertexMap[indexBuffer[i]];
+
+    m_vertexBuffer.swap(vertexBuffer);
+    m_indexBuffer.swap(indexBuffer);
+    m_attributeBuffer.swap(attributeBuffer);
+    m_numberOfTriangles = static_cast<int>(m_attributeBuffer.size());
+    m_vertexCache.clear();
+
+    buildMeshes();
+}
+
+void Model::buildMeshes()
+{
+    TRACE_ZONE("Model::buildMeshes");
+
+    // Meshes don't span groups, so that each group can be culled or hidden on
+    // its own. The copies of a repeated part share its prototype's meshes.
+
+    std::vector<int> groups;
+    Mesh *pMesh = 0;
+    int materialId = -1;
+    int group = -1;
+    size_t nextGroup = 0;
+    int numMeshes = 0;
+
+    for (size_t i = 0; i < m_groups.size(); ++i)
+    {
+        if (m_groups[i].instance == 0)
+            groups.push_back(static_cast<int>(i));
+    }
+
+    std::sort(groups.begin(), groups.end(), [this](int lhs, int rhs)
+        { return m_groups[lhs].startIndex < m_groups[rhs].startIndex; });
+
+    for (int i = 0; i < static_cast<int>(m_attributeBuffer.size()); ++i)
+    {
+        if (nextGroup < groups.size() && m_groups[groups[nextGroup]].startIndex == i * 3)
+        {
+            ++nextGroup;
+            materialId = -1;
+        }
+
+        if (m_attributeBuffer[i] != materialId)
+        {
+            materialId = m_attributeBuffer[i];
+            ++numMeshes;
+        }
+    }
+
+    m_numberOfMeshes = numMeshes;
+    m_meshes.assign(m_numberOfMeshes, Mesh());
+    numMeshes = 0;
+    materialId = -1;
+    nextGroup = 0;
+
+    for (int i = 0; i < static_cast<int>(m_attributeBuffer.size()); ++i)
+    {
+        if (nextGroup < groups.size() && m_groups[groups[nextGroup]].startIndex == i * 3)
+        {
+            group = groups[nextGroup++];
+            materialId = -1;
+        }
+
+        if (m_attributeBuffer[i] != materialId)
+        {
+            materialId = m_attributeBuffer[i];
+            pMesh = &m_meshes[numMeshes++];            
+            pMesh->pMaterial = &m_materials[materialId];
+            pMesh->startIndex = i * 3;
+            pMesh->group = group;
+            pMesh->prototype = (group >= 0) ? m_groups[group].prototype : -1;
+            ++pMesh->triangleCount;
+        }
+        else
+        {
+            ++pMesh->triangleCount;
+        }
+    }
+
+    std::sort(m_meshes.begin(), m_meshes.end(), MeshCompFunc);
+}
+
+void Model::computeFaces(int firstTriangle, int lastTriangle, bool normals, bool tangents)
+{
+    TRACE_ZONE("Model::computeFaces");
+
+    const float *pPosition0 = 0;
+    const float *pPosition1 = 0;
+    const float *pPosition2 = 0;
+    const float *pTexCoord0 = 0;
+    const float *pTexCoord1 = 0;
+    const float *pTexCoord2 = 0;
+    float edge1[3] = {0.0f, 0.0f, 0.0f};
+    float edge2[3] = {0.0f, 0.0f, 0.0f};
+    float texEdge1[2] = {0.0f, 0.0f};
+    float texEdge2[2] = {0.0f, 0.0f};
+    float *pNormal = 0;
+    float *pTangent = 0;
+    float *pBitangent = 0;
+    float det = 0.0f;
+
+    for (int i = firstTriangle; i < lastTriangle; ++i)
+    {
+        pPosition0 = getFacePosition(i, 0);
+        pPosition1 = getFacePosition(i, 1);
+        pPosition2 = getFacePosition(i, 2);
+
+        edge1[0] = pPosition1[0] - pPosition0[0];
+        edge1[1] = pPosition1[1] - pPosition0[1];
+        edge1[2] = pPosition1[2] - pPosition0[2];
+
+        edge2[0] = pPosition2[0] - pPosition0[0];
+        edge2[1] = pPosition2[1] - pPosition0[1];
+        edge2[2] = pPosition2[2] - pPosition0[2];
+
+        if (normals)
+        {
+            pNormal = &m_faceNormals[i * 3];
+            pNormal[0] = (edge1[1] * edge2[2]) - (edge1[2] * edge2[1]);
+            pNormal[1] = (edge1[2] * edge2[0]) - (edge1[0] * edge2[2]);
+            pNormal[2] = (edge1[0] * edge2[1]) - (edge1[1] * edge2[0]);
+        }
+
+        if (!tangents)
+            continue;
+
+        pTexCoord0 = getFaceTexCoord(i, 0);
+        pTexCoord1 = getFaceTexCoord(i, 1);
+        pTexCoord2 = getFaceTexCoord(i, 2);
+
+        texEdge1[0] = pTexCoord1[0] - pTexCoord0[0];
+        texEdge1[1] = pTexCoord1[1] - pTexCoord0[1];
+
+        texEdge2[0] = pTexCoord2[0] - pTexCoord0[0];
+        texEdge2[1] = pTexCoord2[1] - pTexCoord0[1];
+
+        det = texEdge1[0] * texEdge2[1] - texEdge2[0] * texEdge1[1];
+
+        pTangent = &m_faceTangents[i * 6];
+        pBitangent = pTangent + 3;
+
+        if (fabs(det) < 1e-6f)
+        {
+            pTangent[0] = 1.0f;
+            pTangent[1] = 0.0f;
+            pTangent[2] = 0.0f;
+
+            pBitangent[0] = 0.0f;
+            pBitangent[1] = 1.0f;
+            pBitangent[2] = 0.0f;
+        }
+        else
         {
-            index = static_cast<int>(m_vertexBuffer.size());
-            m_vertexBuffer.push_back(*pVertex);
-            m_vertexCache[hash].push_back(index);
+            det = 1.0f / det;
+
+            pTangent[0] = (texEdge2[1] * edge1[0] - texEdge1[1] * edge2[0]) * det;
+            pTangent[1] = (texEdge2[1] * edge1[1] - texEdge1[1] * edge2[1]) * det;
+            pTangent[2] = (texEdge2[1] * edge1[2] - texEdge1[1] * edge2[2]) * det;
+
+            pBitangent[0] = (-texEdge2[0] * edge1[0] + texEdge1[0] * edge2[0]) * det;
+            pBitangent[1] = (-texEdge2[0] * edge1[1] + texEdge1[0] * edge2[1]) * det;
+            pBitangent[2] = (-texEdge2[0] * edge1[2] + texEdge1[0] * edge2[2]) * det;
         }
     }
-
-    return index;
 }
 
-void Model::buildMeshes()
+bool Model::findInstanceTransform(const std::vector<int> &prototype,
+                                  const std::vector<int> &instance, float transform[16]) const
 {
-    Mesh *pMesh = 0;
-    int materialId = -1;
-    int numMeshes = 0;
-
-    for (int i = 0; i < static_cast<int>(m_attributeBuffer.size()); ++i)
+    // Both parts list their vertices in corresponding order. Three of them,
+    // the first, the one farthest from it and the one farthest from the line
+    // through both, define an orthonormal frame in each part. The rotation
+    // that maps one frame onto the other has to carry every other vertex to
+    // its counterpart within the tolerance.
+
+    const float *p0 = m_vertexBuffer[prototype[0]].position;
+    const float *q0 = m_vertexBuffer[instance[0]].position;
+    float edge1[3] = {0.0f};
+    float edge2[3] = {0.0f};
+    float normal[3] = {0.0f};
+    float frames[2][3][3] = {{{0.0f}}};
+    float rotation[3][3] = {{0.0f}};
+    float translation[3] = {0.0f};
+    float position[3] = {0.0f};
+    float maxLengthSq = 0.0f;
+    float maxAreaSq = 0.0f;
+    float toleranceSq = 0.0f;
+    size_t farthest = 0;
+    size_t widest = 0;
+
+    for (size_t i = 1; i < prototype.size(); ++i)
     {
-        if (m_attributeBuffer[i] != materialId)
+        Subtract(m_vertexBuffer[prototype[i]].position, p0, edge1);
+
+        if (Dot(edge1, edge1) > maxLengthSq)
         {
-            materialId = m_attributeBuffer[i];
-            ++numMeshes;
+            maxLengthSq = Dot(edge1, edge1);
+            farthest = i;
         }
     }
 
-    m_numberOfMeshes = numMeshes;
-    m_meshes.resize(m_numberOfMeshes);
-    numMeshes = 0;
-    materialId = -1;
+    Subtract(m_vertexBuffer[prototype[farthest]].position, p0, edge1);
 
-    for (int i = 0; i < static_cast<int>(m_attributeBuffer.size()); ++i)
+    for (size_t i = 1; i < prototype.size(); ++i)
     {
-        if (m_attributeBuffer[i] != materialId)
-        {
-            materialId = m_attributeBuffer[i];
-            pMesh = &m_meshes[numMeshes++];            
-            pMesh->pMaterial = &m_materials[materialId];
-            pMesh->startIndex = i * 3;
-            ++pMesh->triangleCount;
-        }
-        else
+        Subtract(m_vertexBuffer[prototype[i]].position, p0, edge2);
+        Cross(edge1, edge2, normal);
+
+        if (Dot(normal, normal) > maxAreaSq)
         {
-            ++pMesh->triangleCount;
+            maxAreaSq = Dot(normal, normal);
+            widest = i;
         }
     }
 
-    std::sort(m_meshes.begin(), m_meshes.end(), MeshCompFunc);
-}
-
-void Model::generateNormals()
-{
-    const int *pTriangle = 0;
-    Vertex *pVertex0 = 0;
-    Vertex *pVertex1 = 0;
-    Vertex *pVertex2 = 0;
-    float edge1[3] = {0.0f, 0.0f, 0.0f};
-    float edge2[3] = {0.0f, 0.0f, 0.0f};
-    float normal[3] = {0.0f, 0.0f, 0.0f};
-    float length = 0.0f;
-    int totalVertices = getNumberOfVertices();
-    int totalTriangles = getNumberOfTriangles();
+    // Flat slivers and collinear parts have no well-defined frame.
+    if (maxLengthSq <= 0.0f || maxAreaSq <= maxLengthSq * maxLengthSq * INSTANCE_MIN_SPREAD)
+        return false;
 
-    for (int i = 0; i < totalVertices; ++i)
+    for (int i = 0; i < 2; ++i)
     {
-        pVertex0 = &m_vertexBuffer[i];
-        pVertex0->normal[0] = 0.0f;
-        pVertex0->normal[1] = 0.0f;
-        pVertex0->normal[2] = 0.0f;
+        const std::vector<int> &vertices = (i == 0) ? prototype : instance;
+        const float *pOrigin = m_vertexBuffer[vertices[0]].position;
+
+        Subtract(m_vertexBuffer[vertices[farthest]].position, pOrigin, edge1);
+        Subtract(m_vertexBuffer[vertices[widest]].position, pOrigin, edge2);
+        Cross(edge1, edge2, normal);
+
+        Normalize(edge1, frames[i][0]);
+        Normalize(normal, frames[i][2]);
+        Cross(frames[i][2], frames[i][0], frames[i][1]);
     }
 
-    for (int i = 0; i < totalTriangles; ++i)
+    for (int i = 0; i < 3; ++i)
     {
-        pTriangle = &m_indexBuffer[i * 3];
+        for (int j = 0; j < 3; ++j)
+        {
+            rotation[i][j] = frames[1][0][i] * frames[0][0][j] + frames[1][1][i] * frames[0][1][j]
+                + frames[1][2][i] * frames[0][2][j];
+        }
+    }
 
-        pVertex0 = &m_vertexBuffer[pTriangle[0]];
-        pVertex1 = &m_vertexBuffer[pTriangle[1]];
-        pVertex2 = &m_vertexBuffer[pTriangle[2]];
+    Rotate(rotation, p0, position);
+    Subtract(q0, position, translation);
 
-        edge1[0] = pVertex1->position[0] - pVertex0->position[0];
-        edge1[1] = pVertex1->position[1] - pVertex0->position[1];
-        edge1[2] = pVertex1->position[2] - pVertex0->position[2];
+    toleranceSq = maxLengthSq * INSTANCE_POSITION_TOLERANCE * INSTANCE_POSITION_TOLERANCE;
 
-        edge2[0] = pVertex2->position[0] - pVertex0->position[0];
-        edge2[1] = pVertex2->position[1] - pVertex0->position[1];
-        edge2[2] = pVertex2->position[2] - pVertex0->position[2];
+    for (size_t i = 0; i < prototype.size(); ++i)
+    {
+        const Vertex &from = m_vertexBuffer[prototype[i]];
+        const Vertex &to = m_vertexBuffer[instance[i]];
 
-        normal[0] = (edge1[1] * edge2[2]) - (edge1[2] * edge2[1]);
-        normal[1] = (edge1[2] * edge2[0]) - (edge1[0] * edge2[2]);
-        normal[2] = (edge1[0] * edge2[1]) - (edge1[1] * edge2[0]);
+        Rotate(rotation, from.position, position);
+        position[0] += translation[0] - to.position[0];
+        position[1] += translation[1] - to.position[1];
+        position[2] += translation[2] - to.position[2];
 
-        pVertex0->normal[0] += normal[0];
-        pVertex0->normal[1] += normal[1];
-        pVertex0->normal[2] += normal[2];
+        if (Dot(position, position) > toleranceSq)
+            return false;
 
-        pVertex1->normal[0] += normal[0];
-        pVertex1->normal[1] += normal[1];
-        pVertex1->normal[2] += normal[2];
+        if (m_hasNormals && !RotatesOnto(rotation, from.normal, to.normal))
+            return false;
 
-        pVertex2->normal[0] += normal[0];
-        pVertex2->normal[1] += normal[1];
-        pVertex2->normal[2] += normal[2];
+        if (m_hasTangents && (from.tangent[3] != to.tangent[3] ||
+            !RotatesOnto(rotation, from.tangent, to.tangent) ||
+            !RotatesOnto(rotation, from.bitangent, to.bitangent)))
+        {
+            return false;
+        }
     }
 
-    for (int i = 0; i < totalVertices; ++i)
+    // Column-major, as glMultMatrixf() expects it.
+    for (int i = 0; i < 3; ++i)
     {
-        pVertex0 = &m_vertexBuffer[i];
-
-        length = 1.0f / sqrtf(pVertex0->normal[0] * pVertex0->normal[0] +
-            pVertex0->normal[1] * pVertex0->normal[1] +
-            pVertex0->normal[2] * pVertex0->normal[2]);
+        for (int j = 0; j < 3; ++j)
+            transform[j * 4 + i] = rotation[i][j];
 
-        pVertex0->normal[0] *= length;
-        pVertex0->normal[1] *= length;
-        pVertex0->normal[2] *= length;
+        transform[i * 4 + 3] = 0.0f;
+        transform[12 + i] = translation[i];
     }
 
-    m_hasNormals = true;
+    transform[15] = 1.0f;
+    return true;
 }
 
-void Model::generateTangents()
+void Model::generateNormals()
 {
-    const int *pTriangle = 0;
-    Vertex *pVertex0 = 0;
-    Vertex *pVertex1 = 0;
-    Vertex *pVertex2 = 0;
-    float edge1[3] = {0.0f, 0.0f, 0.0f};
-    float edge2[3] = {0.0f, 0.0f, 0.0f};
-    float texEdge1[2] = {0.0f, 0.0f};
-    float texEdge2[2] = {0.0f, 0.0f};
-    float tangent[3] = {0.0f, 0.0f, 0.0f};
-    float bitangent[3] = {0.0f, 0.0f, 0.0f};
-    float det = 0.0f;
-    float nDotT = 0.0f;
-    float bDotB = 0.0f;
-    float length = 0.0f;
+    TRACE_ZONE("Model::generateNormals");
+
     int totalVertices = getNumberOfVertices();
     int totalTriangles = getNumberOfTriangles();
+    std::vector<int> offsets;
+    std::vector<int> triangles;
 
-    for (int i = 0; i < totalVertices; ++i)
+    // import() fills in the face normals while parsing.
+    if (static_cast<int>(m_faceNormals.size()) != totalTriangles * 3)
     {
-        pVertex0 = &m_vertexBuffer[i];
-
-        pVertex0->tangent[0] = 0.0f;
-        pVertex0->tangent[1] = 0.0f;
-        pVertex0->tangent[2] = 0.0f;
-        pVertex0->tangent[3] = 0.0f;
+        m_faceNormals.resize(totalTriangles * 3);
 
-        pVertex0->bitangent[0] = 0.0f;
-        pVertex0->bitangent[1] = 0.0f;
-        pVertex0->bitangent[2] = 0.0f;
+        JobSystem::instance().parallelFor(0, totalTriangles, TRIANGLES_PER_JOB, [this](int first, int last)
+            { computeFaces(first, last, true, false); });
     }
 
-    for (int i = 0; i < totalTriangles; ++i)
-    {
-        pTriangle = &m_indexBuffer[i * 3];
+    BuildVertexTriangles(m_indexBuffer, totalVertices, offsets, triangles);
 
-        pVertex0 = &m_vertexBuffer[pTriangle[0]];
-        pVertex1 = &m_vertexBuffer[pTriangle[1]];
-        pVertex2 = &m_vertexBuffer[pTriangle[2]];
+    JobSystem::instance().parallelFor(0, totalVertices, VERTICES_PER_JOB, [&](int first, int last)
+        {
+            Vertex *pVertex = 0;
+            const float *pNormal = 0;
+            float length = 0.0f;
 
-        edge1[0] = pVertex1->position[0] - pVertex0->position[0];
-        edge1[1] = pVertex1->position[1] - pVertex0->position[1];
-        edge1[2] = pVertex1->position[2] - pVertex0->position[2];
+            for (int i = first; i < last; ++i)
+            {
+                pVertex = &m_vertexBuffer[i];
+                pVertex->normal[0] = 0.0f;
+                pVertex->normal[1] = 0.0f;
+                pVertex->normal[2] = 0.0f;
 
-        edge2[0] = pVertex2->position[0] - pVertex0->position[0];
-        edge2[1] = pVertex2->position[1] - pVertex0->position[1];
-        edge2[2] = pVertex2->position[2] - pVertex0->position[2];
+                for (int j = offsets[i]; j < offsets[i + 1]; ++j)
+                {
+                    pNormal = &m_faceNormals[triangles[j] * 3];
+                    pVertex->normal[0] += pNormal[0];
+                    pVertex->normal[1] += pNormal[1];
+                    pVertex->normal[2] += pNormal[2];
+                }
 
-        texEdge1[0] = pVertex1->texCoord[0] - pVertex0->texCoord[0];
-        texEdge1[1] = pVertex1->texCoord[1] - pVertex0->texCoord[1];
+                length = 1.0f / sqrtf(pVertex->normal[0] * pVertex->normal[0] +
+                    pVertex->normal[1] * pVertex->normal[1] +
+                    pVertex->normal[2] * pVertex->normal[2]);
 
-        texEdge2[0] = pVertex2->texCoord[0] - pVertex0->texCoord[0];
-        texEdge2[1] = pVertex2->texCoord[1] - pVertex0->texCoord[1];
+                pVertex->normal[0] *= length;
+                pVertex->normal[1] *= length;
+                pVertex->normal[2] *= length;
+            }
+        });
 
-        det = texEdge1[0] * texEdge2[1] - texEdge2[0] * texEdge1[1];
+    std::vector<float>().swap(m_faceNormals);
+    m_hasNormals = true;
+}
 
-        if (fabs(det) < 1e-6f)
-        {
-            tangent[0] = 1.0f;
-            tangent[1] = 0.0f;
-            tangent[2] = 0.0f;
+void Model::generateTangents()
+{
+    TRACE_ZONE("Model::generateTangents");
 
-            bitangent[0] = 0.0f;
-            bitangent[1] = 1.0f;
-            bitangent[2] = 0.0f;
-        }
-        else
+    int totalVertices = getNumberOfVertices();
+    int totalTriangles = getNumberOfTriangles();
+    std::vector<int> offsets;
+    std::vector<int> triangles;
+
+    // import() fills in the face tangents while parsing.
+    if (static_cast<int>(m_faceTangents.size()) != totalTriangles * 6)
+    {
+        m_faceTangents.resize(totalTriangles * 6);
+
+        JobSystem::instance().parallelFor(0, totalTriangles, TRIANGLES_PER_JOB, [this](int first, int last)
+            { computeFaces(first, last, false, true); });
+    }
+
+    BuildVertexTriangles(m_indexBuffer, totalVertices, offsets, triangles);
+
+    JobSystem::instance().parallelFor(0, totalVertices, VERTICES_PER_JOB, [&](int first, int last)
         {
-            det = 1.0f / det;
+            Vertex *pVertex0 = 0;
+            const float *pFace = 0;
+            float bitangent[3] = {0.0f, 0.0f, 0.0f};
+            float nDotT = 0.0f;
+            float bDotB = 0.0f;
+            float length = 0.0f;
+
+            for (int i = first; i < last; ++i)
+            {
+                pVertex0 = &m_vertexBuffer[i];
 
-            tangent[0] = (texEdge2[1] * edge1[0] - texEdge1[1] * edge2[0]) * det;
-            tangent[1] = (texEdge2[1] * edge1[1] - texEdge1[1] * edge2[1]) * det;
-            tangent[2] = (texEdge2[1] * edge1[2] - texEdge1[1] * edge2[2]) * det;
+                pVertex0->tangent[0] = 0.0f;
+                pVertex0->tangent[1] = 0.0f;
+                pVertex0->tangent[2] = 0.0f;
+                pVertex0->tangent[3] = 0.0f;
 
-            bitangent[0] = (-texEdge2[0] * edge1[0] + texEdge1[0] * edge2[0]) * det;
-            bitangent[1] = (-texEdge2[0] * edge1[1] + texEdge1[0] * edge2[1]) * det;
-            bitangent[2] = (-texEdge2[0] * edge1[2] + texEdge1[0] * edge2[2]) * det;
-        }
+                pVertex0->bitangent[0] = 0.0f;
+                pVertex0->bitangent[1] = 0.0f;
+                pVertex0->bitangent[2] = 0.0f;
 
-        pVertex0->tangent[0] += tangent[0];
-        pVertex0->tangent[1] += tangent[1];
-        pVertex0->tangent[2] += tangent[2];
-        pVertex0->bitangent[0] += bitangent[0];
-        pVertex0->bitangent[1] += bitangent[1];
-        pVertex0->bitangent[2] += bitangent[2];
+                for (int j = offsets[i]; j < offsets[i + 1]; ++j)
+                {
+                    pFace = &m_faceTangents[triangles[j] * 6];
+
+                    pVertex0->tangent[0] += pFace[0];
+                    pVertex0->tangent[1] += pFace[1];
+                    pVertex0->tangent[2] += pFace[2];
+                    pVertex0->bitangent[0] += pFace[3];
+                    pVertex0->bitangent[1] += pFace[4];
+                    pVertex0->bitangent[2] += pFace[5];
+                }
 
-        pVertex1->tangent[0] += tangent[0];
-        pVertex1->tangent[1] += tangent[1];
-        pVertex1->tangent[2] += tangent[2];
-        pVertex1->bitangent[0] += bitangent[0];
-        pVertex1->bitangent[1] += bitangent[1];
-        pVertex1->bitangent[2] += bitangent[2];
+                nDotT = pVertex0->normal[0] * pVertex0->tangent[0] +
+                        pVertex0->normal[1] * pVertex0->tangent[1] +
+                        pVertex0->normal[2] * pVertex0->tangent[2];
 
-        pVertex2->tangent[0] += tangent[0];
-        pVertex2->tangent[1] += tangent[1];
-        pVertex2->tangent[2] += tangent[2];
-        pVertex2->bitangent[0] += bitangent[0];
-        pVertex2->bitangent[1] += bitangent[1];
-        pVertex2->bitangent[2] += bitangent[2];
-    }
+                pVertex0->tangent[0] -= pVertex0->normal[0] * nDotT;
+                pVertex0->tangent[1] -= pVertex0->normal[1] * nDotT;
+                pVertex0->tangent[2] -= pVertex0->normal[2] * nDotT;
 
-    for (int i = 0; i < totalVertices; ++i)
-    {
-        pVertex0 = &m_vertexBuffer[i];
+                length = 1.0f / sqrtf(pVertex0->tangent[0] * pVertex0->tangent[0] +
+                                      pVertex0->tangent[1] * pVertex0->tangent[1] +
+                                      pVertex0->tangent[2] * pVertex0->tangent[2]);
 
-        nDotT = pVertex0->normal[0] * pVertex0->tangent[0] +
-                pVertex0->normal[1] * pVertex0->tangent[1] +
-                pVertex0->normal[2] * pVertex0->tangent[2];
+                pVertex0->tangent[0] *= length;
+                pVertex0->tangent[1] *= length;
+                pVertex0->tangent[2] *= length;
 
-        pVertex0->tangent[0] -= pVertex0->normal[0] * nDotT;
-        pVertex0->tangent[1] -= pVertex0->normal[1] * nDotT;
-        pVertex0->tangent[2] -= pVertex0->normal[2] * nDotT;
+                bitangent[0] = (pVertex0->normal[1] * pVertex0->tangent[2]) - 
+                               (pVertex0->normal[2] * pVertex0->tangent[1]);
+                bitangent[1] = (pVertex0->normal[2] * pVertex0->tangent[0]) -
+                               (pVertex0->normal[0] * pVertex0->tangent[2]);
+                bitangent[2] = (pVertex0->normal[0] * pVertex0->tangent[1]) - 
+                               (pVertex0->normal[1] * pVertex0->tangent[0]);
 
-        length = 1.0f / sqrtf(pVertex0->tangent[0] * pVertex0->tangent[0] +
-                              pVertex0->tangent[1] * pVertex0->tangent[1] +
-                              pVertex0->tangent[2] * pVertex0->tangent[2]);
+                bDotB = bitangent[0] * pVertex0->bitangent[0] + 
+                        bitangent[1] * pVertex0->bitangent[1] + 
+                        bitangent[2] * pVertex0->bitangent[2];
 
-        pVertex0->tangent[0] *= length;
-        pVertex0->tangent[1] *= length;
-        pVertex0->tangent[2] *= length;
+                pVertex0->tangent[3] = (bDotB < 0.0f) ? 1.0f : -1.0f;
 
-        bitangent[0] = (pVertex0->normal[1] * pVertex0->tangent[2]) - 
-                       (pVertex0->normal[2] * pVertex0->tangent[1]);
-        bitangent[1] = (pVertex0->normal[2] * pVertex0->tangent[0]) -
-                       (pVertex0->normal[0] * pVertex0->tangent[2]);
-        bitangent[2] = (pVertex0->normal[0] * pVertex0->tangent[1]) - 
-                       (pVertex0->normal[1] * pVertex0->tangent[0]);
+                pVertex0->bitangent[0] = bitangent[0];
+                pVertex0->bitangent[1] = bitangent[1];
+                pVertex0->bitangent[2] = bitangent[2];
+            }
+        });
+
+    std::vector<float>().swap(m_faceTangents);
+    m_hasTangents = true;
+}
 
-        bDotB = bitangent[0] * pVertex0->bitangent[0] + 
-                bitangent[1] * pVertex0->bitangent[1] + 
-                bitangent[2] * pVertex0->bitangent[2];
+const float *Model::getFacePosition(int triangle, int corner) const
+{
+    if (!m_faceSources.empty())
+        return &m_vertexCoords[m_faceSources[triangle * 6 + corner] * 3];
 
-        pVertex0->tangent[3] = (bDotB < 0.0f) ? 1.0f : -1.0f;
+    return m_vertexBuffer[m_indexBuffer[triangle * 3 + corner]].position;
+}
 
-        pVertex0->bitangent[0] = bitangent[0];
-        pVertex0->bitangent[1] = bitangent[1];
-        pVertex0->bitangent[2] = bitangent[2];
+const float *Model::getFaceTexCoord(int triangle, int corner) const
+{
+    if (!m_faceSources.empty())
+    {
+        int vt = m_faceSources[triangle * 6 + 3 + corner];
+        return (vt < 0) ? ZERO_TEX_COORD : &m_textureCoords[vt * 2];
     }
 
-    m_hasTangents = true;
+    return m_vertexBuffer[m_indexBuffer[triangle * 3 + corner]].texCoord;
+}
+
+bool Model::hasImportFilter() const
+{
+    return !m_importFilter.groupPatterns.empty() || !m_importFilter.materialNames.empty()
+        || m_importFilter.hasRegion;
 }
 
-void Model::importGeometryFirstPass(FILE *pFile)
+bool Model::importGeometryFirstPass(FILE *pFile)
 {
+    TRACE_ZONE("Model::importGeometryFirstPass");
+
     m_hasTextureCoords = false;
     m_hasNormals = false;
 
@@ -703,53 +2181,139 @@ void Model::importGeometryFirstPass(FILE *pFile)
     int v = 0;
     int vt = 0;
     int vn = 0;
+    int tokens = 0;
     char buffer[256] = {0};
+    float position[3] = {0.0f};
     std::string name;
+    std::vector<int> corners;
+    bool filtering = hasImportFilter();
+    bool groupSelected = true;
+    bool materialSelected = true;
+    bool materialUsed = false;
+
+    // With an import filter the face corners are collected, so that the
+    // vertex attributes referenced by the selected faces can be marked.
+    auto addCorner = [&]()
+    {
+        if (filtering)
+        {
+            corners.push_back(ResolveIndex(v, m_numberOfVertexCoords));
+            corners.push_back(ResolveIndex(vt, m_numberOfTextureCoords));
+            corners.push_back(ResolveIndex(vn, m_numberOfNormals));
+        }
+    };
+
+    // Faces are selected by the material the second pass gives them, which
+    // is the first material for faces before any usemtl and for a usemtl
+    // naming a material that none of the libraries define.
+    auto selectsMaterial = [&](const char *pszName)
+    {
+        if (!pszName || m_materialCache.find(pszName) == m_materialCache.end())
+            pszName = m_materials.empty() ? "default" : m_materials[0].name.c_str();
+
+        return SelectsMaterial(m_importFilter, pszName);
+    };
+
+    m_selectedVertexCoords = IndexSet();
+    m_selectedTextureCoords = IndexSet();
+    m_selectedNormals = IndexSet();
+    m_verticesInRegion = IndexSet();
+    m_selectedFaces.clear();
+
+    if (filtering)
+    {
+        groupSelected = SelectsGroup(m_importFilter, "default");
+        materialSelected = selectsMaterial(0);
+    }
 
     while (fscanf(pFile, "%s", buffer) != EOF)
     {
+        if (++tokens % PROGRESS_INTERVAL == 0 &&
+            !reportProgress(IMPORT_PHASE_FIRST_PASS, ftell(pFile)))
+        {
+            return false;
+        }
+
         switch (buffer[0])
         {
         case 'f':
+            v = vt = vn = 0;
+            corners.clear();
             fscanf(pFile, "%s", buffer);
 
             if (strstr(buffer, "//")) 
             {
                 sscanf(buffer, "%d//%d", &v, &vn);
+                addCorner();
                 fscanf(pFile, "%d//%d", &v, &vn);
+                addCorner();
                 fscanf(pFile, "%d//%d", &v, &vn);
+                addCorner();
                 ++m_numberOfTriangles;
 
                 while (fscanf(pFile, "%d//%d", &v, &vn) > 0)
+                {
+                    addCorner();
                     ++m_numberOfTriangles;
+                }
             }
             else if (sscanf(buffer, "%d/%d/%d", &v, &vt, &vn) == 3)
             {
+                addCorner();
                 fscanf(pFile, "%d/%d/%d", &v, &vt, &vn);
+                addCorner();
                 fscanf(pFile, "%d/%d/%d", &v, &vt, &vn);
+                addCorner();
                 ++m_numberOfTriangles;
 
                 while (fscanf(pFile, "%d/%d/%d", &v, &vt, &vn) > 0)
+                {
+                    addCorner();
                     ++m_numberOfTriangles;
+                }
             }
             else if (sscanf(buffer, "%d/%d", &v, &vt) == 2) 
             {
+                addCorner();
                 fscanf(pFile, "%d/%d", &v, &vt);
+                addCorner();
                 fscanf(pFile, "%d/%d", &v, &vt);
+                addCorner();
                 ++m_numberOfTriangles;
 
                 while (fscanf(pFile, "%d/%d", &v, &vt) > 0)
+                {
+                    addCorner();
                     ++m_numberOfTriangles;
+                }
             }
             else 
             {
+                sscanf(buffer, "%d", &v);
+                addCorner();
                 fscanf(pFile, "%d", &v);
+                addCorner();
                 fscanf(pFile, "%d", &v);
+                addCorner();
                 ++m_numberOfTriangles;
 
                 while (fscanf(pFile, "%d", &v) > 0)
+                {
+                    addCorner();
                     ++m_numberOfTriangles;
+                }
             }
+
+            if (filtering && !selectFace(corners, groupSelected && materialSelected))
+                m_numberOfTriangles -= static_cast<int>(corners.size()) / 3 - 2;
+            break;
+
+        case 'g':
+        case 'o':
+            fgets(buffer, sizeof(buffer), pFile);
+
+            if (filtering)
+                groupSelected = SelectsGroup(m_importFilter, GroupName(buffer));
             break;
 
         case 'm':  
@@ -757,7 +2321,28 @@ void Model::importGeometryFirstPass(FILE *pFile)
             sscanf(buffer, "%s %s", buffer, buffer);
             name = m_directoryPath;
             name += buffer;
-            importMaterials(name.c_str());
+
+            if (importMaterials(name.c_str()))
+            {
+                m_materialLibraries.push_back(name);
+
+                if (filtering && !materialUsed)
+                    materialSelected = selectsMaterial(0);
+
+                if (!reportProgress(IMPORT_PHASE_MATERIALS, ftell(pFile)))
+                    return false;
+            }
+            break;
+
+        case 'u':
+            fgets(buffer, sizeof(buffer), pFile);
+
+            if (filtering)
+            {
+                sscanf(buffer, "%s", buffer);
+                materialSelected = selectsMaterial(buffer);
+                materialUsed = true;
+            }
             break;
 
         case 'v':  
@@ -765,6 +2350,14 @@ void Model::importGeometryFirstPass(FILE *pFile)
             {
             case '\0':
                 fgets(buffer, sizeof(buffer), pFile);
+
+                if (m_importFilter.hasRegion &&
+                    sscanf(buffer, "%f %f %f", &position[0], &position[1], &position[2]) == 3 &&
+                    InsideExtents(position, m_importFilter.minPosition, m_importFilter.maxPosition))
+                {
+                    m_verticesInRegion.insert(m_numberOfVertexCoords);
+                }
+
                 ++m_numberOfVertexCoords;
                 break;
 
@@ -788,6 +2381,16 @@ void Model::importGeometryFirstPass(FILE *pFile)
         }
     }
 
+    // Only the attributes referenced by the selected faces are stored, at
+    // their rank among the referenced ones.
+    if (filtering)
+    {
+        m_numberOfVertexCoords = m_selectedVertexCoords.rank();
+        m_numberOfTextureCoords = m_selectedTextureCoords.rank();
+        m_numberOfNormals = m_selectedNormals.rank();
+        m_verticesInRegion = IndexSet();
+    }
+
     m_hasPositions = m_numberOfVertexCoords > 0;
     m_hasNormals = m_numberOfNormals > 0;
     m_hasTextureCoords = m_numberOfTextureCoords > 0;
@@ -815,10 +2418,14 @@ void Model::importGeometryFirstPass(FILE *pFile)
         m_materials.push_back(defaultMaterial);
         m_materialCache[defaultMaterial.name] = 0;
     }
+
+    return true;
 }
 
-void Model::importGeometrySecondPass(FILE *pFile)
+bool Model::importGeometrySecondPass(FILE *pFile)
 {
+    TRACE_ZONE("Model::importGeometrySecondPass");
+
     int v[3] = {0};
     int vt[3] = {0};
     int vn[3] = {0};
@@ -826,16 +2433,77 @@ void Model::importGeometrySecondPass(FILE *pFile)
     int numTexCoords = 0;
     int numNormals = 0;
     int numTriangles = 0;
+    int numFaces = 0;
+    int index = 0;
     int activeMaterial = 0;
+    int meshStart = 0;
+    int tokens = 0;
     char buffer[256] = {0};
     std::string name;
     std::map<std::string, int>::const_iterator iter;
+    bool normals = !m_faceNormals.empty();
+    bool tangents = !m_faceTangents.empty();
+    bool filtering = hasImportFilter();
+    JobSystem &jobSystem = JobSystem::instance();
+    JobSystem::Counter faces;
+
+    // Face indices count every attribute in the file, but with an import
+    // filter only the referenced ones are stored.
+    auto vertexIndex = [&](int index)
+    {
+        index = ResolveIndex(index, numVertices);
+        return filtering ? m_selectedVertexCoords.find(index) : index;
+    };
+
+    auto texCoordIndex = [&](int index)
+    {
+        index = ResolveIndex(index, numTexCoords);
+        return (filtering && index >= 0) ? m_selectedTextureCoords.find(index) : index;
+    };
+
+    auto normalIndex = [&](int index)
+    {
+        index = ResolveIndex(index, numNormals);
+        return (filtering && index >= 0) ? m_selectedNormals.find(index) : index;
+    };
+
+    // Queues the face normal/tangent jobs for the triangles parsed since the
+    // last material change, i.e. for each mesh as soon as it is complete.
+    auto submitFaces = [&]()
+    {
+        for (int first = meshStart; (normals || tangents) && first < numTriangles; first += TRIANGLES_PER_JOB)
+        {
+            int last = std::min(numTriangles, first + TRIANGLES_PER_JOB);
+
+            jobSystem.run([this, first, last, normals, tangents]()
+                { computeFaces(first, last, normals, tangents); }, &faces);
+        }
+
+        meshStart = numTriangles;
+    };
+
+    ResetExtents(m_minPosition, m_maxPosition);
+    m_groups.clear();
+    addGroup("default", 0);
 
     while (fscanf(pFile, "%s", buffer) != EOF)
     {
+        if (++tokens % PROGRESS_INTERVAL == 0 &&
+            !reportProgress(IMPORT_PHASE_SECOND_PASS, ftell(pFile)))
+        {
+            jobSystem.wait(faces);
+            return false;
+        }
+
         switch (buffer[0])
         {
         case 'f':
+            if (filtering && !m_selectedFaces[numFaces++])
+            {
+                fgets(buffer, sizeof(buffer), pFile);
+                break;
+            }
+
             v[0]  = v[1]  = v[2]  = 0;
             vt[0] = vt[1] = vt[2] = 0;
             vn[0] = vn[1] = vn[2] = 0;
@@ -848,13 +2516,13 @@ void Model::importGeometrySecondPass(FILE *pFile)
                 fscanf(pFile, "%d//%d", &v[1], &vn[1]);
                 fscanf(pFile, "%d//%d", &v[2], &vn[2]);
 
-                v[0] = (v[0] < 0) ? v[0] + numVertices - 1 : v[0] - 1;
-                v[1] = (v[1] < 0) ? v[1] + numVertices - 1 : v[1] - 1;
-                v[2] = (v[2] < 0) ? v[2] + numVertices - 1 : v[2] - 1;
+                v[0] = vertexIndex(v[0]);
+                v[1] = vertexIndex(v[1]);
+                v[2] = vertexIndex(v[2]);
 
-                vn[0] = (vn[0] < 0) ? vn[0] + numNormals - 1 : vn[0] - 1;
-                vn[1] = (vn[1] < 0) ? vn[1] + numNormals - 1 : vn[1] - 1;
-                vn[2] = (vn[2] < 0) ? vn[2] + numNormals - 1 : vn[2] - 1;
+                vn[0] = normalIndex(vn[0]);
+                vn[1] = normalIndex(vn[1]);
+                vn[2] = normalIndex(vn[2]);
 
                 addTrianglePosNormal(numTriangles++, activeMaterial,
                     v[0], v[1], v[2], vn[0], vn[1], vn[2]);
@@ -864,8 +2532,8 @@ void Model::importGeometrySecondPass(FILE *pFile)
 
                 while (fscanf(pFile, "%d//%d", &v[2], &vn[2]) > 0)
                 {
-                    v[2] = (v[2] < 0) ? v[2] + numVertices - 1 : v[2] - 1;
-                    vn[2] = (vn[2] < 0) ? vn[2] + numNormals - 1 : vn[2] - 1;
+                    v[2] = vertexIndex(v[2]);
+                    vn[2] = normalIndex(vn[2]);
 
                     addTrianglePosNormal(numTriangles++, activeMaterial,
                         v[0], v[1], v[2], vn[0], vn[1], vn[2]);
@@ -879,17 +2547,17 @@ void Model::importGeometrySecondPass(FILE *pFile)
                 fscanf(pFile, "%d/%d/%d", &v[1], &vt[1], &vn[1]);
                 fscanf(pFile, "%d/%d/%d", &v[2], &vt[2], &vn[2]);
 
-                v[0] = (v[0] < 0) ? v[0] + numVertices - 1 : v[0] - 1;
-                v[1] = (v[1] < 0) ? v[1] + numVertices - 1 : v[1] - 1;
-                v[2] = (v[2] < 0) ? v[2] + numVertices - 1 : v[2] - 1;
+                v[0] = vertexIndex(v[0]);
+                v[1] = vertexIndex(v[1]);
+                v[2] = vertexIndex(v[2]);
 
-                vt[0] = (vt[0] < 0) ? vt[0] + numTexCoords - 1 : vt[0] - 1;
-                vt[1] = (vt[1] < 0) ? vt[1] + numTexCoords - 1 : vt[1] - 1;
-                vt[2] = (vt[2] < 0) ? vt[2] + numTexCoords - 1 : vt[2] - 1;
+                vt[0] = texCoordIndex(vt[0]);
+                vt[1] = texCoordIndex(vt[1]);
+                vt[2] = texCoordIndex(vt[2]);
 
-                vn[0] = (vn[0] < 0) ? vn[0] + numNormals - 1 : vn[0] - 1;
-                vn[1] = (vn[1] < 0) ? vn[1] + numNormals - 1 : vn[1] - 1;
-                vn[2] = (vn[2] < 0) ? vn[2] + numNormals - 1 : vn[2] - 1;
+                vn[0] = normalIndex(vn[0]);
+                vn[1] = normalIndex(vn[1]);
+                vn[2] = normalIndex(vn[2]);
 
                 addTrianglePosTexCoordNormal(numTriangles++, activeMaterial,
                     v[0], v[1], v[2], vt[0], vt[1], vt[2], vn[0], vn[1], vn[2]);
@@ -900,9 +2568,9 @@ void Model::importGeometrySecondPass(FILE *pFile)
 
                 while (fscanf(pFile, "%d/%d/%d", &v[2], &vt[2], &vn[2]) > 0)
                 {
-                    v[2] = (v[2] < 0) ? v[2] + numVertices - 1 : v[2] - 1;
-                    vt[2] = (vt[2] < 0) ? vt[2] + numTexCoords - 1 : vt[2] - 1;
-                    vn[2] = (vn[2] < 0) ? vn[2] + numNormals - 1 : vn[2] - 1;
+                    v[2] = vertexIndex(v[2]);
+                    vt[2] = texCoordIndex(vt[2]);
+                    vn[2] = normalIndex(vn[2]);
 
                     addTrianglePosTexCoordNormal(numTriangles++, activeMaterial,
                         v[0], v[1], v[2], vt[0], vt[1], vt[2], vn[0], vn[1], vn[2]);
@@ -917,13 +2585,13 @@ void Model::importGeometrySecondPass(FILE *pFile)
                 fscanf(pFile, "%d/%d", &v[1], &vt[1]);
                 fscanf(pFile, "%d/%d", &v[2], &vt[2]);
 
-                v[0] = (v[0] < 0) ? v[0] + numVertices - 1 : v[0] - 1;
-                v[1] = (v[1] < 0) ? v[1] + numVertices - 1 : v[1] - 1;
-                v[2] = (v[2] < 0) ? v[2] + numVertices - 1 : v[2] - 1;
+                v[0] = vertexIndex(v[0]);
+                v[1] = vertexIndex(v[1]);
+                v[2] = vertexIndex(v[2]);
 
-                vt[0] = (vt[0] < 0) ? vt[0] + numTexCoords - 1 : vt[0] - 1;
-                vt[1] = (vt[1] < 0) ? vt[1] + numTexCoords - 1 : vt[1] - 1;
-                vt[2] = (vt[2] < 0) ? vt[2] + numTexCoords - 1 : vt[2] - 1;
+                vt[0] = texCoordIndex(vt[0]);
+                vt[1] = texCoordIndex(vt[1]);
+                vt[2] = texCoordIndex(vt[2]);
 
                 addTrianglePosTexCoord(numTriangles++, activeMaterial,
                     v[0], v[1], v[2], vt[0], vt[1], vt[2]);
@@ -933,8 +2601,8 @@ void Model::importGeometrySecondPass(FILE *pFile)
 
                 while (fscanf(pFile, "%d/%d", &v[2], &vt[2]) > 0)
                 {
-                    v[2] = (v[2] < 0) ? v[2] + numVertices - 1 : v[2] - 1;
-                    vt[2] = (vt[2] < 0) ? vt[2] + numTexCoords - 1 : vt[2] - 1;
+                    v[2] = vertexIndex(v[2]);
+                    vt[2] = texCoordIndex(vt[2]);
 
                     addTrianglePosTexCoord(numTriangles++, activeMaterial,
                         v[0], v[1], v[2], vt[0], vt[1], vt[2]);
@@ -949,9 +2617,9 @@ void Model::importGeometrySecondPass(FILE *pFile)
                 fscanf(pFile, "%d", &v[1]);
                 fscanf(pFile, "%d", &v[2]);
 
-                v[0] = (v[0] < 0) ? v[0] + numVertices - 1 : v[0] - 1;
-                v[1] = (v[1] < 0) ? v[1] + numVertices - 1 : v[1] - 1;
-                v[2] = (v[2] < 0) ? v[2] + numVertices - 1 : v[2] - 1;
+                v[0] = vertexIndex(v[0]);
+                v[1] = vertexIndex(v[1]);
+                v[2] = vertexIndex(v[2]);
 
                 addTrianglePos(numTriangles++, activeMaterial, v[0], v[1], v[2]);
 
@@ -959,7 +2627,7 @@ void Model::importGeometrySecondPass(FILE *pFile)
 
                 while (fscanf(pFile, "%d", &v[2]) > 0)
                 {
-                    v[2] = (v[2] < 0) ? v[2] + numVertices - 1 : v[2] - 1;
+                    v[2] = vertexIndex(v[2]);
 
                     addTrianglePos(numTriangles++, activeMaterial, v[0], v[1], v[2]);
 
@@ -968,37 +2636,71 @@ void Model::importGeometrySecondPass(FILE *pFile)
             }
             break;
 
+        case 'g':
+        case 'o':
+            fgets(buffer, sizeof(buffer), pFile);
+            addGroup(buffer, numTriangles);
+            break;
+
         case 'u':
             fgets(buffer, sizeof(buffer), pFile);
             sscanf(buffer, "%s %s", buffer, buffer);
             name = buffer;
             iter = m_materialCache.find(buffer);
             activeMaterial = (iter == m_materialCache.end()) ? 0 : iter->second;
+            submitFaces();
             break;
 
         case 'v':
             switch (buffer[1])
             {
             case '\0': 
-                fscanf(pFile, "%f %f %f",
-                    &m_vertexCoords[3 * numVertices],
-                    &m_vertexCoords[3 * numVertices + 1],
-                    &m_vertexCoords[3 * numVertices + 2]);
+                if (filtering && !m_selectedVertexCoords.contains(numVertices))
+                {
+                    fgets(buffer, sizeof(buffer), pFile);
+                }
+                else
+                {
+                    index = filtering ? m_selectedVertexCoords.find(numVertices) : numVertices;
+                    fscanf(pFile, "%f %f %f",
+                        &m_vertexCoords[3 * index],
+                        &m_vertexCoords[3 * index + 1],
+                        &m_vertexCoords[3 * index + 2]);
+                }
+
                 ++numVertices;
                 break;
 
             case 'n': 
-                fscanf(pFile, "%f %f %f",
-                    &m_normals[3 * numNormals],
-                    &m_normals[3 * numNormals + 1],
-                    &m_normals[3 * numNormals + 2]);
+                if (filtering && !m_selectedNormals.contains(numNormals))
+                {
+                    fgets(buffer, sizeof(buffer), pFile);
+                }
+                else
+                {
+                    index = filtering ? m_selectedNormals.find(numNormals) : numNormals;
+                    fscanf(pFile, "%f %f %f",
+                        &m_normals[3 * index],
+                        &m_normals[3 * index + 1],
+                        &m_normals[3 * index + 2]);
+                }
+
                 ++numNormals;
                 break;
 
             case 't':
-                fscanf(pFile, "%f %f",
-                    &m_textureCoords[2 * numTexCoords],
-                    &m_textureCoords[2 * numTexCoords + 1]);
+                if (filtering && !m_selectedTextureCoords.contains(numTexCoords))
+                {
+                    fgets(buffer, sizeof(buffer), pFile);
+                }
+                else
+                {
+                    index = filtering ? m_selectedTextureCoords.find(numTexCoords) : numTexCoords;
+                    fscanf(pFile, "%f %f",
+                        &m_textureCoords[2 * index],
+                        &m_textureCoords[2 * index + 1]);
+                }
+
                 ++numTexCoords;
                 break;
 
@@ -1012,10 +2714,26 @@ void Model::importGeometrySecondPass(FILE *pFile)
             break;
         }
     }
+
+    submitFaces();
+    jobSystem.wait(faces);
+
+    for (size_t i = 0; i < m_groups.size(); ++i)
+    {
+        int endIndex = (i + 1 < m_groups.size()) ? m_groups[i + 1].startIndex : numTriangles * 3;
+        m_groups[i].triangleCount = (endIndex - m_groups[i].startIndex) / 3;
+    }
+
+    if (m_groups.back().triangleCount == 0)
+        m_groups.pop_back();
+
+    return true;
 }
 
 bool Model::importMaterials(const char *pszFilename)
 {
+    TRACE_ZONE("Model::importMaterials");
+
     FILE *pFile = fopen(pszFilename, "r");
 
     if (!pFile)
@@ -1174,4 +2892,93 @@ bool Model::importMaterials(const char *pszFilename)
 
     fclose(pFile);
     return true;
+}
+
+void Model::removeUnusedMaterials()
+{
+    // Drops the materials that no selected face uses, so that their textures
+    // aren't loaded either.
+
+    if (m_attributeBuffer.empty() || m_numberOfMaterials == 0)
+        return;
+
+    std::vector<int> materialIds(m_materials.size(), -1);
+    int numMaterials = 0;
+
+    for (size_t i = 0; i < m_attributeBuffer.size(); ++i)
+        materialIds[m_attributeBuffer[i]] = 0;
+
+    for (size_t i = 0; i < m_materials.size(); ++i)
+    {
+        if (materialIds[i] < 0)
+            continue;
+
+        materialIds[i] = numMaterials;
+
+        if (static_cast<int>(i) != numMaterials)
+            m_materials[numMaterials] = m_materials[i];
+
+        ++numMaterials;
+    }
+
+    for (size_t i = 0; i < m_attributeBuffer.size(); ++i)
+        m_attributeBuffer[i] = materialIds[m_attributeBuffer[i]];
+
+    m_materials.resize(numMaterials);
+    m_numberOfMaterials = numMaterials;
+    m_materialCache.clear();
+
+    for (int i = 0; i < numMaterials; ++i)
+        m_materialCache[m_materials[i].name] = i;
+}
+
+bool Model::reportProgress(ImportPhase phase, long bytesParsed)
+{
+    if (!m_pImportCallback)
+        return true;
+
+    return m_pImportCallback(m_pImportContext, phase, bytesParsed, m_importFileSize);
+}
+
+bool Model::selectFace(const std::vector<int> &corners, bool selected)
+{
+    // corners holds the resolved position, texture coordinate and normal
+    // index of each corner, or -1 for absent attributes.
+
+    if (selected && m_importFilter.hasRegion)
+    {
+        selected = false;
+
+        for (size_t i = 0; !selected && i < corners.size(); i += 3)
+            selected = m_verticesInRegion.contains(corners[i]);
+    }
+
+    m_selectedFaces.push_back(selected);
+
+    if (selected)
+    {
+        for (size_t i = 0; i < corners.size(); i += 3)
+        {
+            m_selectedVertexCoords.insert(corners[i]);
+            m_selectedTextureCoords.insert(corners[i + 1]);
+            m_selectedNormals.insert(corners[i + 2]);
+        }
+    }
+
+    return selected;
+}
+
+void Model::setFaceSources(int index, int v0, int v1, int v2, int vt0, int vt1, int vt2)
+{
+    if (m_faceSources.empty())
+        return;
+
+    int *pSources = &m_faceSources[index * 6];
+
+    pSources[0] = v0;
+    pSources[1] = v1;
+    pSources[2] = v2;
+    pSources[3] = vt0;
+    pSources[4] = vt1;
+    pSources[5] = vt2;
 }
\ No newline at end of file
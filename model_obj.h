@@ -8,6 +8,8 @@
 
 class Model
 {
+    friend class ModelBenchmark;
+
 public:
     struct Material
     {
@@ -36,15 +38,85 @@ public:
         int startIndex;
         int triangleCount;
         const Material *pMaterial;
+        int group;
+        int prototype;
+    };
+
+    struct Group
+    {
+        std::string name;
+        int startIndex;
+        int triangleCount;
+        int prototype;
+        int instance;
+        float minPosition[3];
+        float maxPosition[3];
+        bool hidden;
+    };
+
+    // Faces are imported when their group name matches one of the group
+    // patterns ('*' and '?' wildcards), their material is one of the material
+    // names and one of their corners is inside the region. Empty lists and
+    // no region accept everything.
+    struct ImportFilter
+    {
+        ImportFilter();
+
+        std::vector<std::string> groupPatterns;
+        std::vector<std::string> materialNames;
+        bool hasRegion;
+        float minPosition[3];
+        float maxPosition[3];
     };
 
+    // What probe() finds out about a file without importing it. The texture
+    // filenames are those of the color and bump maps, as written in the
+    // material libraries.
+    struct ProbeResult
+    {
+        ProbeResult();
+
+        int numberOfVertexCoords;
+        int numberOfTextureCoords;
+        int numberOfNormals;
+        int numberOfTriangles;
+        int numberOfGroups;
+        int numberOfMaterials;
+        float minPosition[3];
+        float maxPosition[3];
+        std::vector<std::string> materialLibraries;
+        std::vector<std::string> textureFilenames;
+    };
+
+    enum ImportPhase
+    {
+        IMPORT_PHASE_FIRST_PASS,
+        IMPORT_PHASE_MATERIALS,
+        IMPORT_PHASE_SECOND_PASS,
+        IMPORT_PHASE_POST_PROCESS
+    };
+
+    typedef bool (*ImportCallback)(void *pContext, ImportPhase phase,
+        long bytesParsed, long bytesTotal);
+
     Model();
+    Model(const Model &other);
     ~Model();
 
+    Model &operator=(const Model &other);
+
+    static bool probe(const char *pszFilename, ProbeResult &result, bool computeBounds = true);
+
     void destroy();
     bool import(const char *pszFilename, bool rebuildNormals = false);
     void normalize(float scaleTo = 1.0f, bool center = true);
+    bool reloadMaterials();
     void reverseWinding();
+    void setGroupHidden(int i, bool hidden);
+    void setImportCallback(ImportCallback pCallback, void *pContext);
+    void setImportFilter(const ImportFilter &filter);
+    void setPositionsAndNormals(const float *pVertices);
+    void swap(Model &other);
 
     void getCenter(float &x, float &y, float &z) const;
     float getWidth() const;
@@ -53,14 +125,26 @@ public:
     float getRadius() const;
 
     const int *getIndexBuffer() const;
+    const int *getIndexBuffer(int detailLevel) const;
     int getIndexSize() const;
 
+    const Group &getGroup(int i) const;
+    int getInstanceGroup(int prototype, int instance) const;
+    const float *getInstanceTransform(int prototype, int instance) const;
+
     const Material &getMaterial(int i) const;
+    const std::vector<std::string> &getMaterialLibraries() const;
     const Mesh &getMesh(int i) const;
+    const Mesh &getMesh(int i, int detailLevel) const;
 
+    int getNumberOfDetailLevels() const;
+    int getNumberOfGroups() const;
     int getNumberOfIndices() const;
+    int getNumberOfIndices(int detailLevel) const;
+    int getNumberOfInstances(int prototype) const;
     int getNumberOfMaterials() const;
     int getNumberOfMeshes() const;
+    int getNumberOfPrototypes() const;
     int getNumberOfTriangles() const;
     int getNumberOfVertices() const;
 
@@ -70,12 +154,31 @@ public:
     const Vertex *getVertexBuffer() const;
     int getVertexSize() const;
 
+    bool hasImportFilter() const;
     bool hasNormals() const;
     bool hasPositions() const;
     bool hasTangents() const;
     bool hasTextureCoords() const;
 
 private:
+    struct DetailLevel
+    {
+        std::vector<int> indexBuffer;
+        std::vector<Mesh> meshes;
+    };
+
+    struct IndexSet
+    {
+        std::vector<unsigned int> bits;
+        std::vector<int> ranks;
+
+        bool contains(int i) const;
+        int find(int i) const;
+        void insert(int i);
+        int rank();
+    };
+
+    void addGroup(const char *pszName, int triangle);
     void addTrianglePos(int index, int material,
         int v0, int v1, int v2);
     void addTrianglePosNormal(int index, int material,
@@ -91,13 +194,25 @@ private:
     int addVertex(int hash, const Vertex *pVertex);
     void bounds(float center[3], float &width, float &height,
         float &length, float &radius) const;
+    void buildDetailLevel(int gridSize, DetailLevel &level) const;
+    void buildDetailLevels();
+    void buildInstances();
     void buildMeshes();
+    void computeFaces(int firstTriangle, int lastTriangle, bool normals, bool tangents);
+    bool findInstanceTransform(const std::vector<int> &prototype,
+        const std::vector<int> &instance, float transform[16]) const;
     void generateNormals();
     void generateTangents();
-    void importGeometryFirstPass(FILE *pFile);
-    void importGeometrySecondPass(FILE *pFile);
+    const float *getFacePosition(int triangle, int corner) const;
+    const float *getFaceTexCoord(int triangle, int corner) const;
+    bool importGeometryFirstPass(FILE *pFile);
+    bool importGeometrySecondPass(FILE *pFile);
     bool importMaterials(const char *pszFilename);
+    void removeUnusedMaterials();
+    bool reportProgress(ImportPhase phase, long bytesParsed);
     void scale(float scaleFactor, float offset[3]);
+    bool selectFace(const std::vector<int> &corners, bool selected);
+    void setFaceSources(int index, int v0, int v1, int v2, int vt0, int vt1, int vt2);
 
     bool m_hasPositions;
     bool m_hasTextureCoords;
@@ -116,8 +231,22 @@ private:
     float m_height;
     float m_length;
     float m_radius;
+    float m_minPosition[3];
+    float m_maxPosition[3];
 
     std::string m_directoryPath;
+    std::vector<std::string> m_materialLibraries;
+
+    ImportCallback m_pImportCallback;
+    void *m_pImportContext;
+    long m_importFileSize;
+
+    ImportFilter m_importFilter;
+    IndexSet m_selectedVertexCoords;
+    IndexSet m_selectedTextureCoords;
+    IndexSet m_selectedNormals;
+    IndexSet m_verticesInRegion;
+    std::vector<bool> m_selectedFaces;
 
     std::vector<Mesh> m_meshes;
     std::vector<Material> m_materials;
@@ -128,6 +257,17 @@ private:
     std::vector<float> m_textureCoords;
     std::vector<float> m_normals;
 
+    std::vector<int> m_faceSources;
+    std::vector<float> m_faceNormals;
+    std::vector<float> m_faceTangents;
+
+    std::vector<DetailLevel> m_detailLevels;
+
+    std::vector<Group> m_groups;
+    std::vector<int> m_instanceOffsets;
+    std::vector<float> m_instanceTransforms;
+    std::vector<int> m_instanceGroups;
+
     std::map<std::string, int> m_materialCache;
     std::map<int, std::vector<int> > m_vertexCache;
 };
@@ -150,24 +290,57 @@ inline float Model::getRadius() const
 inline const int *Model::getIndexBuffer() const
 { return &m_indexBuffer[0]; }
 
+inline const int *Model::getIndexBuffer(int detailLevel) const
+{ return (detailLevel == 0) ? &m_indexBuffer[0] : &m_detailLevels[detailLevel - 1].indexBuffer[0]; }
+
 inline int Model::getIndexSize() const
 { return static_cast<int>(sizeof(int)); }
 
+inline const Model::Group &Model::getGroup(int i) const
+{ return m_groups[i]; }
+
+inline int Model::getInstanceGroup(int prototype, int instance) const
+{ return m_instanceGroups[m_instanceOffsets[prototype] + instance]; }
+
+inline const float *Model::getInstanceTransform(int prototype, int instance) const
+{ return &m_instanceTransforms[(m_instanceOffsets[prototype] + instance) * 16]; }
+
 inline const Model::Material &Model::getMaterial(int i) const
 { return m_materials[i]; }
 
+inline const std::vector<std::string> &Model::getMaterialLibraries() const
+{ return m_materialLibraries; }
+
 inline const Model::Mesh &Model::getMesh(int i) const
 { return m_meshes[i]; }
 
+inline const Model::Mesh &Model::getMesh(int i, int detailLevel) const
+{ return (detailLevel == 0) ? m_meshes[i] : m_detailLevels[detailLevel - 1].meshes[i]; }
+
+inline int Model::getNumberOfDetailLevels() const
+{ return static_cast<int>(m_detailLevels.size()) + 1; }
+
+inline int Model::getNumberOfGroups() const
+{ return static_cast<int>(m_groups.size()); }
+
 inline int Model::getNumberOfIndices() const
 { return m_numberOfTriangles * 3; }
 
+inline int Model::getNumberOfIndices(int detailLevel) const
+{ return (detailLevel == 0) ? m_numberOfTriangles * 3 : static_cast<int>(m_detailLevels[detailLevel - 1].indexBuffer.size()); }
+
+inline int Model::getNumberOfInstances(int prototype) const
+{ return m_instanceOffsets[prototype + 1] - m_instanceOffsets[prototype]; }
+
 inline int Model::getNumberOfMaterials() const
 { return m_numberOfMaterials; }
 
 inline int Model::getNumberOfMeshes() const
 { return m_numberOfMeshes; }
 
+inline int Model::getNumberOfPrototypes() const
+{ return m_instanceOffsets.empty() ? 0 : static_cast<int>(m_instanceOffsets.size()) - 1; }
+
 inline int Model::getNumberOfTriangles() const
 { return m_numberOfTriangles; }
 
@@ -0,0 +1,889 @@
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <queue>
+#include "model_obj.h"
+#include "progressive_mesh.h"
+#include "trace.h"
+
+namespace
+{
+    const char PROGRESSIVE_MAGIC[4] = {'P', 'M', 'S', '1'};
+    const int BASE_TRIANGLES = 2048;
+    const int CALLBACK_INTERVAL = 4096;
+    const size_t READ_BUFFER_SIZE = 1 << 20;
+    const double BOUNDARY_WEIGHT = 10.0;
+    const double MIN_NORMAL_COSINE = 0.2;
+
+    struct ProgressiveHeader
+    {
+        char magic[4];
+        unsigned int numberOfSplits;
+        long long sourceSize;
+        long long sourceModified;
+        unsigned int numberOfVertices;
+        unsigned int numberOfTriangles;
+        unsigned int numberOfBaseVertices;
+        unsigned int numberOfBaseTriangles;
+    };
+
+    struct SplitHeader
+    {
+        float vertex[ProgressiveMesh::FLOATS_PER_VERTEX];
+        unsigned int numberOfTriangles;
+        unsigned int numberOfCorners;
+    };
+
+    struct Collapse
+    {
+        double cost;
+        int vertex;
+        int target;
+        unsigned int version;
+
+        // Orders std::priority_queue cheapest first.
+        bool operator<(const Collapse &other) const
+        { return cost > other.cost; }
+    };
+
+    bool GetFileStamp(const char *pszFilename, long long &size, long long &modified)
+    {
+#if defined(_WIN32)
+        struct __stat64 info;
+
+        if (_stat64(pszFilename, &info) != 0)
+            return false;
+#else
+        struct stat info;
+
+        if (stat(pszFilename, &info) != 0)
+            return false;
+#endif
+
+        size = static_cast<long long>(info.st_size);
+        modified = static_cast<long long>(info.st_mtime);
+        return true;
+    }
+
+    void Cross(const double a[3], const double b[3], double result[3])
+    {
+        result[0] = a[1] * b[2] - a[2] * b[1];
+        result[1] = a[2] * b[0] - a[0] * b[2];
+        result[2] = a[0] * b[1] - a[1] * b[0];
+    }
+
+    double Dot(const double a[3], const double b[3])
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    unsigned long long GetEdgeKey(int a, int b)
+    {
+        return (static_cast<unsigned long long>(std::min(a, b)) << 32) | static_cast<unsigned int>(std::max(a, b));
+    }
+
+    void FaceNormal(const float *p0, const float *p1, const float *p2, double normal[3])
+    {
+        double edges[2][3];
+
+        for (int i = 0; i < 3; ++i)
+        {
+            edges[0][i] = static_cast<double>(p1[i]) - p0[i];
+            edges[1][i] = static_cast<double>(p2[i]) - p0[i];
+        }
+
+        Cross(edges[0], edges[1], normal);
+    }
+
+    // Half-edge collapse simplification with quadric error metrics. A
+    // collapse removes a vertex by moving its corners onto a neighbor, so no
+    // new positions are created and the collapses can be undone one vertex at
+    // a time. Stale heap entries are skipped by comparing versions.
+    class Simplifier
+    {
+    public:
+        Simplifier(const std::vector<float> &positions, std::vector<int> &triangles);
+
+        bool run(int targetTriangles, ProgressiveMesh::BuildCallback pCallback, void *pContext);
+
+        std::vector<int> collapsedVertices;
+        std::vector<int> removedOffsets;
+        std::vector<int> removedTriangles;
+        std::vector<int> movedOffsets;
+        std::vector<int> movedCorners;
+        std::vector<unsigned char> vertexRemoved;
+        std::vector<unsigned char> triangleRemoved;
+
+    private:
+        void addPlane(int vertex, const double normal[3], double d, double weight);
+        void collapse(int vertex, int target);
+        void computeBestCollapse(int vertex);
+        bool contains(int triangle, int vertex) const;
+        double evaluate(int vertex, int target) const;
+        void getNeighbors(int vertex, std::vector<int> &neighbors) const;
+        bool isValid(int vertex, int target);
+
+        const std::vector<float> &m_positions;
+        std::vector<int> &m_triangles;
+        std::vector<double> m_quadrics;
+        std::vector<std::vector<int> > m_vertexTriangles;
+        std::vector<unsigned int> m_versions;
+        std::priority_queue<Collapse> m_heap;
+        std::vector<int> m_neighbors;
+        std::vector<int> m_targetNeighbors;
+        int m_numberOfTriangles;
+    };
+
+    Simplifier::Simplifier(const std::vector<float> &positions, std::vector<int> &triangles)
+        : m_positions(positions), m_triangles(triangles)
+    {
+        int numberOfVertices = static_cast<int>(positions.size() / 3);
+        std::vector<unsigned long long> edges;
+
+        m_numberOfTriangles = static_cast<int>(triangles.size() / 3);
+        m_quadrics.assign(numberOfVertices * 10, 0.0);
+        m_vertexTriangles.resize(numberOfVertices);
+        m_versions.assign(numberOfVertices, 0);
+        vertexRemoved.assign(numberOfVertices, 0);
+        triangleRemoved.assign(m_numberOfTriangles, 0);
+        removedOffsets.push_back(0);
+        movedOffsets.push_back(0);
+        edges.reserve(triangles.size());
+
+        for (int i = 0; i < m_numberOfTriangles; ++i)
+        {
+            const int *pTriangle = &triangles[i * 3];
+            double normal[3];
+
+            FaceNormal(&positions[pTriangle[0] * 3], &positions[pTriangle[1] * 3], &positions[pTriangle[2] * 3], normal);
+
+            double length = std::sqrt(Dot(normal, normal));
+            double position[3];
+
+            for (int j = 0; j < 3; ++j)
+            {
+                int a = pTriangle[j];
+                int b = pTriangle[(j + 1) % 3];
+
+                m_vertexTriangles[a].push_back(i);
+                edges.push_back(GetEdgeKey(a, b));
+                position[j] = positions[pTriangle[0] * 3 + j];
+            }
+
+            if (length <= 0.0)
+                continue;
+
+            for (int j = 0; j < 3; ++j)
+                normal[j] /= length;
+
+            // Planes are weighted by the triangle's area.
+            for (int j = 0; j < 3; ++j)
+                addPlane(pTriangle[j], normal, -Dot(normal, position), length * 0.5);
+        }
+
+        // Edges with only one triangle are held in place by a plane through
+        // the edge at right angles to the triangle.
+        std::sort(edges.begin(), edges.end());
+
+        for (int i = 0; i < m_numberOfTriangles; ++i)
+        {
+            const int *pTriangle = &triangles[i * 3];
+            double normal[3];
+
+            FaceNormal(&positions[pTriangle[0] * 3], &positions[pTriangle[1] * 3], &positions[pTriangle[2] * 3], normal);
+
+            for (int j = 0; j < 3; ++j)
+            {
+                int a = pTriangle[j];
+                int b = pTriangle[(j + 1) % 3];
+                std::pair<std::vector<unsigned long long>::iterator, std::vector<unsigned long long>::iterator> range =
+                    std::equal_range(edges.begin(), edges.end(), GetEdgeKey(a, b));
+
+                if (range.second - range.first != 1)
+                    continue;
+
+                double edge[3];
+                double plane[3];
+                double position[3];
+
+                for (int k = 0; k < 3; ++k)
+                {
+                    edge[k] = static_cast<double>(positions[b * 3 + k]) - positions[a * 3 + k];
+                    position[k] = positions[a * 3 + k];
+                }
+
+                Cross(edge, normal, plane);
+
+                double length = std::sqrt(Dot(plane, plane));
+
+                if (length <= 0.0)
+                    continue;
+
+                for (int k = 0; k < 3; ++k)
+                    plane[k] /= length;
+
+                addPlane(a, plane, -Dot(plane, position), Dot(edge, edge) * BOUNDARY_WEIGHT);
+                addPlane(b, plane, -Dot(plane, position), Dot(edge, edge) * BOUNDARY_WEIGHT);
+            }
+        }
+    }
+
+    bool Simplifier::run(int targetTriangles, ProgressiveMesh::BuildCallback pCallback, void *pContext)
+    {
+        for (int i = 0; i < static_cast<int>(m_vertexTriangles.size()); ++i)
+            computeBestCollapse(i);
+
+        while (m_numberOfTriangles > targetTriangles && !m_heap.empty())
+        {
+            Collapse best = m_heap.top();
+
+            m_heap.pop();
+
+            if (vertexRemoved[best.vertex] || vertexRemoved[best.target] || best.version != m_versions[best.vertex])
+                continue;
+
+            // Neighbors of the target may have changed since the entry was
+            // made without the vertex noticing.
+            if (!isValid(best.vertex, best.target))
+            {
+                computeBestCollapse(best.vertex);
+                continue;
+            }
+
+            collapse(best.vertex, best.target);
+
+            if (pCallback && collapsedVertices.size() % CALLBACK_INTERVAL == 0 && !pCallback(pContext))
+                return false;
+        }
+
+        return true;
+    }
+
+    void Simplifier::addPlane(int vertex, const double normal[3], double d, double weight)
+    {
+        double *q = &m_quadrics[vertex * 10];
+        double a = normal[0];
+        double b = normal[1];
+        double c = normal[2];
+
+        q[0] += weight * a * a;
+        q[1] += weight * a * b;
+        q[2] += weight * a * c;
+        q[3] += weight * a * d;
+        q[4] += weight * b * b;
+        q[5] += weight * b * c;
+        q[6] += weight * b * d;
+        q[7] += weight * c * c;
+        q[8] += weight * c * d;
+        q[9] += weight * d * d;
+    }
+
+    void Simplifier::collapse(int vertex, int target)
+    {
+        std::vector<int> &triangles = m_vertexTriangles[vertex];
+        std::vector<int> &targetTriangles = m_vertexTriangles[target];
+
+        collapsedVertices.push_back(vertex);
+
+        for (size_t i = 0; i < triangles.size(); ++i)
+        {
+            int triangle = triangles[i];
+
+            if (triangleRemoved[triangle])
+                continue;
+
+            if (contains(triangle, target))
+            {
+                triangleRemoved[triangle] = 1;
+                removedTriangles.push_back(triangle);
+                --m_numberOfTriangles;
+                continue;
+            }
+
+            for (int j = 0; j < 3; ++j)
+            {
+                if (m_triangles[triangle * 3 + j] == vertex)
+                {
+                    m_triangles[triangle * 3 + j] = target;
+                    movedCorners.push_back(triangle * 3 + j);
+                }
+            }
+
+            targetTriangles.push_back(triangle);
+        }
+
+        removedOffsets.push_back(static_cast<int>(removedTriangles.size()));
+        movedOffsets.push_back(static_cast<int>(movedCorners.size()));
+
+        for (int i = 0; i < 10; ++i)
+            m_quadrics[target * 10 + i] += m_quadrics[vertex * 10 + i];
+
+        vertexRemoved[vertex] = 1;
+        std::vector<int>().swap(triangles);
+
+        targetTriangles.erase(std::remove_if(targetTriangles.begin(), targetTriangles.end(),
+            [this](int triangle) { return triangleRemoved[triangle] != 0; }), targetTriangles.end());
+
+        std::vector<int> neighbors;
+
+        getNeighbors(target, neighbors);
+        computeBestCollapse(target);
+
+        for (size_t i = 0; i < neighbors.size(); ++i)
+            computeBestCollapse(neighbors[i]);
+    }
+
+    void Simplifier::computeBestCollapse(int vertex)
+    {
+        Collapse best = {0.0, vertex, -1, ++m_versions[vertex]};
+        std::vector<int> neighbors;
+
+        getNeighbors(vertex, neighbors);
+
+        for (size_t i = 0; i < neighbors.size(); ++i)
+        {
+            double cost = evaluate(vertex, neighbors[i]);
+
+            if ((best.target < 0 || cost < best.cost) && isValid(vertex, neighbors[i]))
+            {
+                best.cost = cost;
+                best.target = neighbors[i];
+            }
+        }
+
+        if (best.target >= 0)
+            m_heap.push(best);
+    }
+
+    bool Simplifier::contains(int triangle, int vertex) const
+    {
+        const int *pTriangle = &m_triangles[triangle * 3];
+        return pTriangle[0] == vertex || pTriangle[1] == vertex || pTriangle[2] == vertex;
+    }
+
+    double Simplifier::evaluate(int vertex, int target) const
+    {
+        // The error of both quadrics at the target's position.
+        const double *q = &m_quadrics[vertex * 10];
+        const double *r = &m_quadrics[target * 10];
+        double x = m_positions[target * 3];
+        double y = m_positions[target * 3 + 1];
+        double z = m_positions[target * 3 + 2];
+        double s[10];
+
+        for (int i = 0; i < 10; ++i)
+            s[i] = q[i] + r[i];
+
+        return s[0] * x * x + 2.0 * s[1] * x * y + 2.0 * s[2] * x * z + 2.0 * s[3] * x +
+            s[4] * y * y + 2.0 * s[5] * y * z + 2.0 * s[6] * y + s[7] * z * z + 2.0 * s[8] * z + s[9];
+    }
+
+    void Simplifier::getNeighbors(int vertex, std::vector<int> &neighbors) const
+    {
+        const std::vector<int> &triangles = m_vertexTriangles[vertex];
+
+        neighbors.clear();
+
+        for (size_t i = 0; i < triangles.size(); ++i)
+        {
+            if (triangleRemoved[triangles[i]])
+                continue;
+
+            for (int j = 0; j < 3; ++j)
+            {
+                int neighbor = m_triangles[triangles[i] * 3 + j];
+
+                if (neighbor != vertex && std::find(neighbors.begin(), neighbors.end(), neighbor) == neighbors.end())
+                    neighbors.push_back(neighbor);
+            }
+        }
+    }
+
+    bool Simplifier::isValid(int vertex, int target)
+    {
+        // Triangles around the vertex must not fold over when it moves to the
+        // target, and the two may share no neighbors other than the ones of
+        // the triangles on their edge, or the surface would pinch.
+        const std::vector<int> &triangles = m_vertexTriangles[vertex];
+        const float *pTarget = &m_positions[target * 3];
+        int shared = 0;
+        int common = 0;
+
+        for (size_t i = 0; i < triangles.size(); ++i)
+        {
+            int triangle = triangles[i];
+
+            if (triangleRemoved[triangle])
+                continue;
+
+            if (contains(triangle, target))
+            {
+                ++shared;
+                continue;
+            }
+
+            const float *pCorners[3];
+            const float *pMoved[3];
+            double before[3];
+            double after[3];
+
+            for (int j = 0; j < 3; ++j)
+            {
+                int corner = m_triangles[triangle * 3 + j];
+
+                pCorners[j] = &m_positions[corner * 3];
+                pMoved[j] = (corner == vertex) ? pTarget : pCorners[j];
+            }
+
+            FaceNormal(pCorners[0], pCorners[1], pCorners[2], before);
+            FaceNormal(pMoved[0], pMoved[1], pMoved[2], after);
+
+            double lengths = std::sqrt(Dot(before, before) * Dot(after, after));
+
+            if (lengths <= 0.0 || Dot(before, after) < MIN_NORMAL_COSINE * lengths)
+                return false;
+        }
+
+        if (shared == 0)
+            return false;
+
+        getNeighbors(vertex, m_neighbors);
+        getNeighbors(target, m_targetNeighbors);
+
+        for (size_t i = 0; i < m_neighbors.size(); ++i)
+        {
+            if (std::find(m_targetNeighbors.begin(), m_targetNeighbors.end(), m_neighbors[i]) != m_targetNeighbors.end())
+                ++common;
+        }
+
+        return common <= shared;
+    }
+}
+
+ProgressiveMesh::ProgressiveMesh()
+    : m_pFile(0), m_isOpen(false), m_numberOfSplits(0), m_splitsApplied(0)
+{
+}
+
+ProgressiveMesh::~ProgressiveMesh()
+{
+    close();
+}
+
+bool ProgressiveMesh::build(const Source &source, const char *pszModelFilename,
+                            BuildCallback pCallback, void *pContext)
+{
+    TRACE_ZONE("ProgressiveMesh::build");
+
+    // The triangles of every mesh, with each instance of a repeated part
+    // transformed into place.
+    std::vector<float> corners;
+
+    corners.reserve(source.indices.size() * 3);
+
+    for (size_t i = 0; i < source.meshes.size(); ++i)
+    {
+        const Source::Mesh &mesh = source.meshes[i];
+        int numberOfInstances = std::max(mesh.numberOfTransforms, 1);
+
+        for (int j = 0; j < numberOfInstances; ++j)
+        {
+            const float *m = mesh.numberOfTransforms ? &source.transforms[(mesh.firstTransform + j) * 16] : 0;
+
+            for (int k = 0; k < mesh.triangleCount * 3; ++k)
+            {
+                const float *p = &source.positions[source.indices[mesh.startIndex + k] * 3];
+
+                if (!m)
+                {
+                    corners.insert(corners.end(), p, p + 3);
+                    continue;
+                }
+
+                for (int l = 0; l < 3; ++l)
+                    corners.push_back(m[l] * p[0] + m[4 + l] * p[1] + m[8 + l] * p[2] + m[12 + l]);
+            }
+        }
+    }
+
+    // Corners at the same position become one vertex.
+    int numberOfCorners = static_cast<int>(corners.size() / 3);
+    std::vector<int> order(numberOfCorners);
+    std::vector<int> triangles(numberOfCorners);
+    std::vector<float> positions;
+    const float *pCorners = corners.empty() ? 0 : &corners[0];
+
+    for (int i = 0; i < numberOfCorners; ++i)
+        order[i] = i;
+
+    std::sort(order.begin(), order.end(), [pCorners](int a, int b)
+        { return std::lexicographical_compare(pCorners + a * 3, pCorners + a * 3 + 3, pCorners + b * 3, pCorners + b * 3 + 3); });
+
+    for (int i = 0; i < numberOfCorners; ++i)
+    {
+        const float *pCorner = pCorners + order[i] * 3;
+
+        if (i == 0 || !std::equal(pCorner, pCorner + 3, pCorners + order[i - 1] * 3))
+            positions.insert(positions.end(), pCorner, pCorner + 3);
+
+        triangles[order[i]] = static_cast<int>(positions.size() / 3 - 1);
+    }
+
+    std::vector<int>().swap(order);
+    std::vector<float>().swap(corners);
+
+    int numberOfTriangles = 0;
+
+    for (int i = 0; i < numberOfCorners; i += 3)
+    {
+        const int *pTriangle = &triangles[i];
+
+        if (pTriangle[0] == pTriangle[1] || pTriangle[1] == pTriangle[2] || pTriangle[0] == pTriangle[2])
+            continue;
+
+        std::copy(pTriangle, pTriangle + 3, &triangles[numberOfTriangles++ * 3]);
+    }
+
+    triangles.resize(numberOfTriangles * 3);
+
+    if (numberOfTriangles == 0)
+        return false;
+
+    // Area weighted normals of the full resolution mesh are used at every
+    // level.
+    int numberOfVertices = static_cast<int>(positions.size() / 3);
+    std::vector<double> normals(numberOfVertices * 3, 0.0);
+
+    for (int i = 0; i < numberOfTriangles; ++i)
+    {
+        double normal[3];
+
+        FaceNormal(&positions[triangles[i * 3] * 3], &positions[triangles[i * 3 + 1] * 3],
+            &positions[triangles[i * 3 + 2] * 3], normal);
+
+        for (int j = 0; j < 3; ++j)
+        {
+            for (int k = 0; k < 3; ++k)
+                normals[triangles[i * 3 + j] * 3 + k] += normal[k];
+        }
+    }
+
+    Simplifier simplifier(positions, triangles);
+
+    if (!simplifier.run(BASE_TRIANGLES, pCallback, pContext))
+        return false;
+
+    // Vertices that survive the simplification come first, then one per
+    // collapse in reverse order. The triangles are ordered the same way, so
+    // every split only refers to vertices and triangles before it.
+    int numberOfCollapses = static_cast<int>(simplifier.collapsedVertices.size());
+    std::vector<unsigned int> vertexOrder(numberOfVertices);
+    std::vector<unsigned int> triangleOrder(numberOfTriangles);
+    unsigned int numberOfBaseVertices = 0;
+    unsigned int numberOfBaseTriangles = 0;
+
+    for (int i = 0; i < numberOfVertices; ++i)
+    {
+        if (!simplifier.vertexRemoved[i])
+            vertexOrder[i] = numberOfBaseVertices++;
+    }
+
+    for (int i = 0; i < numberOfTriangles; ++i)
+    {
+        if (!simplifier.triangleRemoved[i])
+            triangleOrder[i] = numberOfBaseTriangles++;
+    }
+
+    unsigned int nextVertex = numberOfBaseVertices;
+    unsigned int nextTriangle = numberOfBaseTriangles;
+
+    for (int i = numberOfCollapses - 1; i >= 0; --i)
+    {
+        vertexOrder[simplifier.collapsedVertices[i]] = nextVertex++;
+
+        for (int j = simplifier.removedOffsets[i]; j < simplifier.removedOffsets[i + 1]; ++j)
+            triangleOrder[simplifier.removedTriangles[j]] = nextTriangle++;
+    }
+
+    std::string filename = getFilename(pszModelFilename);
+    FILE *pFile = fopen(filename.c_str(), "wb");
+
+    if (!pFile)
+        return false;
+
+    ProgressiveHeader header;
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+
+    memset(&header, 0, sizeof(header));
+    header.numberOfSplits = static_cast<unsigned int>(numberOfCollapses);
+    header.numberOfVertices = static_cast<unsigned int>(numberOfVertices);
+    header.numberOfTriangles = static_cast<unsigned int>(numberOfTriangles);
+    header.numberOfBaseVertices = numberOfBaseVertices;
+    header.numberOfBaseTriangles = numberOfBaseTriangles;
+
+    auto appendVertex = [&positions, &normals](int vertex, float *pVertex)
+    {
+        const double *pNormal = &normals[vertex * 3];
+        double length = std::sqrt(Dot(pNormal, pNormal));
+
+        for (int i = 0; i < 3; ++i)
+        {
+            pVertex[i] = positions[vertex * 3 + i];
+            pVertex[3 + i] = (length > 0.0) ? static_cast<float>(pNormal[i] / length) : ((i == 2) ? 1.0f : 0.0f);
+        }
+    };
+
+    vertices.resize(numberOfBaseVertices * FLOATS_PER_VERTEX);
+    indices.resize(numberOfBaseTriangles * 3);
+
+    for (int i = 0; i < numberOfVertices; ++i)
+    {
+        if (!simplifier.vertexRemoved[i])
+            appendVertex(i, &vertices[vertexOrder[i] * FLOATS_PER_VERTEX]);
+    }
+
+    for (int i = 0; i < numberOfTriangles; ++i)
+    {
+        if (simplifier.triangleRemoved[i])
+            continue;
+
+        for (int j = 0; j < 3; ++j)
+            indices[triangleOrder[i] * 3 + j] = vertexOrder[triangles[i * 3 + j]];
+    }
+
+    // The header is written again once everything else is, so a file that
+    // was cut short is never taken for a complete one.
+    bool ok = fwrite(&header, sizeof(header), 1, pFile) == 1 &&
+        fwrite(&vertices[0], sizeof(float), vertices.size(), pFile) == vertices.size() &&
+        fwrite(&indices[0], sizeof(unsigned int), indices.size(), pFile) == indices.size();
+
+    for (int i = numberOfCollapses - 1; ok && i >= 0; --i)
+    {
+        SplitHeader split;
+        int firstRemoved = simplifier.removedOffsets[i];
+        int firstMoved = simplifier.movedOffsets[i];
+
+        appendVertex(simplifier.collapsedVertices[i], split.vertex);
+        split.numberOfTriangles = static_cast<unsigned int>(simplifier.removedOffsets[i + 1] - firstRemoved);
+        split.numberOfCorners = static_cast<unsigned int>(simplifier.movedOffsets[i + 1] - firstMoved);
+        indices.clear();
+
+        // Removed triangles kept the corners they had when they were removed.
+        for (unsigned int j = 0; j < split.numberOfTriangles; ++j)
+        {
+            int triangle = simplifier.removedTriangles[firstRemoved + j];
+
+            for (int k = 0; k < 3; ++k)
+                indices.push_back(vertexOrder[triangles[triangle * 3 + k]]);
+        }
+
+        for (unsigned int j = 0; j < split.numberOfCorners; ++j)
+        {
+            int corner = simplifier.movedCorners[firstMoved + j];
+            indices.push_back(triangleOrder[corner / 3] * 3 + corner % 3);
+        }
+
+        ok = fwrite(&split, sizeof(split), 1, pFile) == 1 &&
+            (indices.empty() || fwrite(&indices[0], sizeof(unsigned int), indices.size(), pFile) == indices.size());
+    }
+
+    memcpy(header.magic, PROGRESSIVE_MAGIC, sizeof(PROGRESSIVE_MAGIC));
+
+    ok = ok && GetFileStamp(pszModelFilename, header.sourceSize, header.sourceModified) &&
+        fseek(pFile, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, pFile) == 1;
+
+    if (fclose(pFile) != 0)
+        ok = false;
+
+    if (!ok)
+        remove(filename.c_str());
+
+    return ok;
+}
+
+std::string ProgressiveMesh::getFilename(const char *pszModelFilename)
+{
+    return std::string(pszModelFilename) + ".pm";
+}
+
+void ProgressiveMesh::getSource(const Model &model, Source &source)
+{
+    std::vector<int> firstTransforms(model.getNumberOfPrototypes());
+
+    source.positions.resize(model.getNumberOfVertices() * 3);
+    source.indices.clear();
+    source.meshes.resize(model.getNumberOfMeshes());
+    source.transforms.clear();
+
+    if (model.getNumberOfIndices() > 0)
+        source.indices.assign(model.getIndexBuffer(), model.getIndexBuffer() + model.getNumberOfIndices());
+
+    for (int i = 0; i < model.getNumberOfVertices(); ++i)
+        memcpy(&source.positions[i * 3], model.getVertex(i).position, 3 * sizeof(float));
+
+    for (int i = 0; i < model.getNumberOfPrototypes(); ++i)
+    {
+        firstTransforms[i] = static_cast<int>(source.transforms.size() / 16);
+
+        for (int j = 0; j < model.getNumberOfInstances(i); ++j)
+        {
+            const float *m = model.getInstanceTransform(i, j);
+            source.transforms.insert(source.transforms.end(), m, m + 16);
+        }
+    }
+
+    for (int i = 0; i < model.getNumberOfMeshes(); ++i)
+    {
+        const Model::Mesh &mesh = model.getMesh(i);
+        Source::Mesh &sourceMesh = source.meshes[i];
+
+        sourceMesh.startIndex = mesh.startIndex;
+        sourceMesh.triangleCount = mesh.triangleCount;
+        sourceMesh.firstTransform = (mesh.prototype >= 0) ? firstTransforms[mesh.prototype] : 0;
+        sourceMesh.numberOfTransforms = (mesh.prototype >= 0) ? model.getNumberOfInstances(mesh.prototype) : 0;
+    }
+}
+
+bool ProgressiveMesh::isCurrent(const char *pszModelFilename)
+{
+    FILE *pFile = fopen(getFilename(pszModelFilename).c_str(), "rb");
+
+    if (!pFile)
+        return false;
+
+    ProgressiveHeader header;
+    long long size = 0;
+    long long modified = 0;
+    bool current = fread(&header, sizeof(header), 1, pFile) == 1 &&
+        memcmp(header.magic, PROGRESSIVE_MAGIC, sizeof(PROGRESSIVE_MAGIC)) == 0 &&
+        GetFileStamp(pszModelFilename, size, modified) &&
+        header.sourceSize == size && header.sourceModified == modified;
+
+    fclose(pFile);
+    return current;
+}
+
+void ProgressiveMesh::close()
+{
+    if (m_pFile)
+    {
+        fclose(m_pFile);
+        m_pFile = 0;
+    }
+
+    m_isOpen = false;
+    m_numberOfSplits = 0;
+    m_splitsApplied = 0;
+    std::vector<float>().swap(m_vertices);
+    std::vector<unsigned int>().swap(m_indices);
+    std::vector<unsigned int>().swap(m_corners);
+}
+
+bool ProgressiveMesh::open(const char *pszModelFilename)
+{
+    TRACE_ZONE("ProgressiveMesh::open");
+
+    // Only reads the base mesh; refine() reads the split records.
+    close();
+
+    if (!isCurrent(pszModelFilename) || !(m_pFile = fopen(getFilename(pszModelFilename).c_str(), "rb")))
+        return false;
+
+    setvbuf(m_pFile, 0, _IOFBF, READ_BUFFER_SIZE);
+
+    ProgressiveHeader header;
+    bool ok = fread(&header, sizeof(header), 1, m_pFile) == 1 &&
+        header.numberOfBaseVertices <= header.numberOfVertices &&
+        header.numberOfBaseTriangles <= header.numberOfTriangles &&
+        header.numberOfSplits == header.numberOfVertices - header.numberOfBaseVertices;
+
+    if (ok)
+    {
+        m_vertices.reserve(static_cast<size_t>(header.numberOfVertices) * FLOATS_PER_VERTEX);
+        m_indices.reserve(static_cast<size_t>(header.numberOfTriangles) * 3);
+        m_vertices.resize(static_cast<size_t>(header.numberOfBaseVertices) * FLOATS_PER_VERTEX);
+        m_indices.resize(static_cast<size_t>(header.numberOfBaseTriangles) * 3);
+
+        ok = (m_vertices.empty() || fread(&m_vertices[0], sizeof(float), m_vertices.size(), m_pFile) == m_vertices.size()) &&
+            (m_indices.empty() || fread(&m_indices[0], sizeof(unsigned int), m_indices.size(), m_pFile) == m_indices.size());
+    }
+
+    for (size_t i = 0; ok && i < m_indices.size(); ++i)
+        ok = m_indices[i] < header.numberOfBaseVertices;
+
+    if (!ok)
+    {
+        close();
+        return false;
+    }
+
+    m_isOpen = true;
+    m_numberOfSplits = static_cast<int>(header.numberOfSplits);
+
+    if (isComplete())
+    {
+        fclose(m_pFile);
+        m_pFile = 0;
+    }
+
+    return true;
+}
+
+int ProgressiveMesh::refine(int maxSplits)
+{
+    // Applies up to maxSplits more split records and returns how many were
+    // applied. A record that can't be read or doesn't fit the mesh ends the
+    // refinement where it is.
+    int applied = 0;
+
+    while (applied < maxSplits && m_splitsApplied < m_numberOfSplits)
+    {
+        SplitHeader split;
+        size_t firstIndex = m_indices.size();
+        unsigned int vertex = static_cast<unsigned int>(getNumberOfVertices());
+        bool ok = fread(&split, sizeof(split), 1, m_pFile) == 1;
+
+        if (ok)
+        {
+            m_indices.resize(firstIndex + split.numberOfTriangles * 3);
+            m_corners.resize(split.numberOfCorners);
+
+            ok = (split.numberOfTriangles == 0 ||
+                fread(&m_indices[firstIndex], sizeof(unsigned int), split.numberOfTriangles * 3, m_pFile) == split.numberOfTriangles * 3) &&
+                (split.numberOfCorners == 0 ||
+                fread(&m_corners[0], sizeof(unsigned int), split.numberOfCorners, m_pFile) == split.numberOfCorners);
+        }
+
+        for (size_t i = firstIndex; ok && i < m_indices.size(); ++i)
+            ok = m_indices[i] <= vertex;
+
+        for (size_t i = 0; ok && i < m_corners.size(); ++i)
+            ok = m_corners[i] < firstIndex;
+
+        if (!ok)
+        {
+            m_indices.resize(firstIndex);
+            m_numberOfSplits = m_splitsApplied;
+            break;
+        }
+
+        m_vertices.insert(m_vertices.end(), split.vertex, split.vertex + FLOATS_PER_VERTEX);
+
+        for (size_t i = 0; i < m_corners.size(); ++i)
+            m_indices[m_corners[i]] = vertex;
+
+        ++m_splitsApplied;
+        ++applied;
+    }
+
+    if (isComplete() && m_pFile)
+    {
+        fclose(m_pFile);
+        m_pFile = 0;
+    }
+
+    return applied;
+}
@@ -0,0 +1,109 @@
+#if !defined(PROGRESSIVE_MESH_H)
+#define PROGRESSIVE_MESH_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class Model;
+
+// A model's triangles as a coarse base mesh followed by vertex split records,
+// written next to the OBJ file as "<model>.pm" so the next load can show a
+// preview straight away. build() simplifies the model by half-edge collapses
+// in quadric error order and writes the collapses in reverse. Each split
+// record adds one vertex, moves the corners that the collapse had moved back
+// onto it and adds the triangles that the collapse had removed, so after n
+// records the mesh is exactly the one the simplification passed through with
+// n more vertices. Only positions and normals are kept, for the whole model
+// including every instance of its repeated parts. The file records the size
+// and modification time of the OBJ file and is ignored once they change.
+
+class ProgressiveMesh
+{
+public:
+    typedef bool (*BuildCallback)(void *pContext);
+
+    enum
+    {
+        FLOATS_PER_VERTEX = 6
+    };
+
+    // The parts of a model that build() reads, small enough to be kept
+    // around after the model itself has been handed over. A mesh with
+    // transforms is placed once for each of them.
+    struct Source
+    {
+        struct Mesh
+        {
+            int startIndex;
+            int triangleCount;
+            int firstTransform;
+            int numberOfTransforms;
+        };
+
+        std::vector<float> positions;
+        std::vector<int> indices;
+        std::vector<Mesh> meshes;
+        std::vector<float> transforms;
+    };
+
+    ProgressiveMesh();
+    ~ProgressiveMesh();
+
+    static bool build(const Source &source, const char *pszModelFilename,
+        BuildCallback pCallback = 0, void *pContext = 0);
+    static std::string getFilename(const char *pszModelFilename);
+    static void getSource(const Model &model, Source &source);
+    static bool isCurrent(const char *pszModelFilename);
+
+    void close();
+    bool open(const char *pszModelFilename);
+    int refine(int maxSplits);
+
+    const std::vector<unsigned int> &getIndices() const;
+    int getNumberOfSplits() const;
+    int getNumberOfSplitsApplied() const;
+    int getNumberOfTriangles() const;
+    int getNumberOfVertices() const;
+    const std::vector<float> &getVertices() const;
+    bool isComplete() const;
+    bool isOpen() const;
+
+private:
+    ProgressiveMesh(const ProgressiveMesh &);
+    ProgressiveMesh &operator=(const ProgressiveMesh &);
+
+    FILE *m_pFile;
+    bool m_isOpen;
+    int m_numberOfSplits;
+    int m_splitsApplied;
+    std::vector<float> m_vertices;
+    std::vector<unsigned int> m_indices;
+    std::vector<unsigned int> m_corners;
+};
+
+inline const std::vector<unsigned int> &ProgressiveMesh::getIndices() const
+{ return m_indices; }
+
+inline int ProgressiveMesh::getNumberOfSplits() const
+{ return m_numberOfSplits; }
+
+inline int ProgressiveMesh::getNumberOfSplitsApplied() const
+{ return m_splitsApplied; }
+
+inline int ProgressiveMesh::getNumberOfTriangles() const
+{ return static_cast<int>(m_indices.size() / 3); }
+
+inline int ProgressiveMesh::getNumberOfVertices() const
+{ return static_cast<int>(m_vertices.size() / FLOATS_PER_VERTEX); }
+
+inline const std::vector<float> &ProgressiveMesh::getVertices() const
+{ return m_vertices; }
+
+inline bool ProgressiveMesh::isComplete() const
+{ return m_splitsApplied == m_numberOfSplits; }
+
+inline bool ProgressiveMesh::isOpen() const
+{ return m_isOpen; }
+
+#endif
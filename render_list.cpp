@@ -0,0 +1,73 @@
+#include <algorithm>
+#include "render_list.h"
+
+namespace
+{
+    // Key layout from the most significant bit: 4 bits pass, 4 bits shader,
+    // 24 bits texture and 32 bits material state.
+    const int PASS_SHIFT = 60;
+    const int SHADER_SHIFT = 56;
+    const int TEXTURE_SHIFT = 32;
+
+    bool CommandKeyLess(const RenderList::Command &lhs, const RenderList::Command &rhs)
+    {
+        return lhs.key < rhs.key;
+    }
+}
+
+RenderList::Key RenderList::makeKey(Pass pass, int shader, unsigned int texture, unsigned int state)
+{
+    return (static_cast<Key>(pass & 0xf) << PASS_SHIFT)
+        | (static_cast<Key>(shader & 0xf) << SHADER_SHIFT)
+        | (static_cast<Key>(texture & 0xffffff) << TEXTURE_SHIFT)
+        | static_cast<Key>(state);
+}
+
+RenderList::RenderList() : m_numberOfDetailLevels(0)
+{
+}
+
+void RenderList::add(const Command &command)
+{
+    m_commands.push_back(command);
+}
+
+void RenderList::clear()
+{
+    m_numberOfDetailLevels = 0;
+    m_commands.clear();
+    m_batches.clear();
+    m_counts.clear();
+    m_indices.clear();
+}
+
+void RenderList::setNumberOfDetailLevels(int numberOfDetailLevels)
+{
+    m_numberOfDetailLevels = numberOfDetailLevels;
+    m_counts.assign(numberOfDetailLevels * m_commands.size(), 0);
+    m_indices.assign(numberOfDetailLevels * m_commands.size(), static_cast<const void *>(0));
+}
+
+void RenderList::setRange(int detailLevel, int command, int count, const void *pIndices)
+{
+    m_counts[detailLevel * m_commands.size() + command] = count;
+    m_indices[detailLevel * m_commands.size() + command] = pIndices;
+}
+
+void RenderList::sort()
+{
+    std::stable_sort(m_commands.begin(), m_commands.end(), CommandKeyLess);
+
+    m_batches.clear();
+
+    for (size_t i = 0; i < m_commands.size(); ++i)
+    {
+        if (m_batches.empty() || m_commands[i].key != m_commands[i - 1].key)
+        {
+            Batch batch = {static_cast<int>(i), 0};
+            m_batches.push_back(batch);
+        }
+
+        ++m_batches.back().numberOfCommands;
+    }
+}
@@ -0,0 +1,96 @@
+#if !defined(RENDER_LIST_H)
+#define RENDER_LIST_H
+
+#include <vector>
+
+// Draw commands for the meshes of the loaded models. Everything a mesh needs
+// at draw time is resolved when the list is built: the shader program, the
+// texture names and the uniform locations. The commands are sorted by a 64-bit
+// key made of the pass, shader, texture and a material state id, which the
+// caller assigns so that commands with equal ids draw identically. Within a
+// key the commands keep the order in which they were added. Runs of commands
+// with equal keys form batches that can be drawn with one
+// glMultiDrawElements() call: for every detail level the list holds the index
+// count and index offset of each command in sorted order, so a batch's ranges
+// are contiguous.
+
+class RenderList
+{
+public:
+    typedef unsigned long long Key;
+
+    enum Pass
+    {
+        PASS_OPAQUE,
+        PASS_TRANSLUCENT
+    };
+
+    struct Batch
+    {
+        int firstCommand;
+        int numberOfCommands;
+    };
+
+    struct Command
+    {
+        Key key;
+        int model;
+        int vertexSource;
+        int mesh;
+        int material;
+        int group;
+        int prototype;
+        unsigned int program;
+        unsigned int colorMap;
+        unsigned int normalMap;
+        int alphaLocation;
+    };
+
+    RenderList();
+
+    static Key makeKey(Pass pass, int shader, unsigned int texture, unsigned int state);
+
+    void add(const Command &command);
+    void clear();
+    void setNumberOfDetailLevels(int numberOfDetailLevels);
+    void setRange(int detailLevel, int command, int count, const void *pIndices);
+    void sort();
+
+    const Batch &getBatch(int i) const;
+    const Command &getCommand(int i) const;
+    const int *getCounts(int detailLevel, const Batch &batch) const;
+    const void *const *getIndices(int detailLevel, const Batch &batch) const;
+    int getNumberOfBatches() const;
+    int getNumberOfCommands() const;
+    int getNumberOfDetailLevels() const;
+
+private:
+    int m_numberOfDetailLevels;
+    std::vector<Command> m_commands;
+    std::vector<Batch> m_batches;
+    std::vector<int> m_counts;
+    std::vector<const void *> m_indices;
+};
+
+inline const RenderList::Batch &RenderList::getBatch(int i) const
+{ return m_batches[i]; }
+
+inline const RenderList::Command &RenderList::getCommand(int i) const
+{ return m_commands[i]; }
+
+inline const int *RenderList::getCounts(int detailLevel, const Batch &batch) const
+{ return &m_counts[detailLevel * m_commands.size() + batch.firstCommand]; }
+
+inline const void *const *RenderList::getIndices(int detailLevel, const Batch &batch) const
+{ return &m_indices[detailLevel * m_commands.size() + batch.firstCommand]; }
+
+inline int RenderList::getNumberOfBatches() const
+{ return static_cast<int>(m_batches.size()); }
+
+inline int RenderList::getNumberOfCommands() const
+{ return static_cast<int>(m_commands.size()); }
+
+inline int RenderList::getNumberOfDetailLevels() const
+{ return m_numberOfDetailLevels; }
+
+#endif
@@ -0,0 +1,204 @@
+#include <cstring>
+#include "texture_cache.h"
+
+bool TextureCache::Key::operator<(const Key &other) const
+{
+    if (contentHash != other.contentHash)
+        return contentHash < other.contentHash;
+
+    if (linear != other.linear)
+        return linear < other.linear;
+
+    return path < other.path;
+}
+
+TextureCache::TextureCache(DeleteFunc deleteFunc, size_t memoryBudget)
+    : m_deleteFunc(deleteFunc), m_memoryBudget(memoryBudget)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+TextureCache::~TextureCache()
+{
+}
+
+TextureCache::Hash TextureCache::hash(const void *pData, size_t size)
+{
+    // 64-bit FNV-1a over the raw file bytes. The length is folded in so that
+    // truncated copies of the same file never compare equal.
+
+    const unsigned char *pBytes = static_cast<const unsigned char *>(pData);
+    Hash h = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        h ^= pBytes[i];
+        h *= 1099511628211ULL;
+    }
+
+    h ^= static_cast<Hash>(size);
+    h *= 1099511628211ULL;
+
+    return h;
+}
+
+unsigned int TextureCache::acquire(const std::string &path, Hash contentHash, bool linear)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    Key key = {path, contentHash, linear};
+    std::map<Key, unsigned int>::iterator iterKey = m_keys.find(key);
+    unsigned int id = 0;
+
+    if (iterKey != m_keys.end())
+    {
+        id = iterKey->second;
+        ++m_stats.hits;
+    }
+    else
+    {
+        std::map<ContentKey, unsigned int>::iterator iterContent =
+            m_contents.find(ContentKey(contentHash, linear));
+
+        if (iterContent == m_contents.end())
+        {
+            ++m_stats.misses;
+            return 0;
+        }
+
+        id = iterContent->second;
+        m_keys[key] = id;
+        m_entries[id].keys.push_back(key);
+        ++m_stats.contentHits;
+    }
+
+    Entry &entry = m_entries[id];
+
+    if (entry.refCount++ == 0)
+    {
+        m_unused.erase(entry.lruPosition);
+        entry.lruPosition = m_unused.end();
+        m_stats.unusedBytes -= entry.sizeInBytes;
+    }
+
+    return id;
+}
+
+void TextureCache::insert(const std::string &path, Hash contentHash, bool linear,
+                          unsigned int id, size_t sizeInBytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    Key key = {path, contentHash, linear};
+    Entry &entry = m_entries[id];
+
+    entry.sizeInBytes = sizeInBytes;
+    entry.refCount = 1;
+    entry.contentKey = ContentKey(contentHash, linear);
+    entry.keys.push_back(key);
+    entry.lruPosition = m_unused.end();
+
+    m_keys[key] = id;
+    m_contents[entry.contentKey] = id;
+    m_stats.residentBytes += sizeInBytes;
+    ++m_stats.numberOfTextures;
+
+    evict(m_memoryBudget);
+}
+
+void TextureCache::release(unsigned int id)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::map<unsigned int, Entry>::iterator iter = m_entries.find(id);
+
+    if (iter == m_entries.end() || iter->second.refCount == 0)
+        return;
+
+    Entry &entry = iter->second;
+
+    if (--entry.refCount == 0)
+    {
+        entry.lruPosition = m_unused.insert(m_unused.end(), id);
+        m_stats.unusedBytes += entry.sizeInBytes;
+        evict(m_memoryBudget);
+    }
+}
+
+void TextureCache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::map<unsigned int, Entry>::iterator iter = m_entries.begin();
+
+    while (iter != m_entries.end())
+    {
+        if (m_deleteFunc)
+            m_deleteFunc(iter->first);
+
+        ++iter;
+    }
+
+    m_keys.clear();
+    m_contents.clear();
+    m_entries.clear();
+    m_unused.clear();
+
+    m_stats.numberOfTextures = 0;
+    m_stats.residentBytes = 0;
+    m_stats.unusedBytes = 0;
+}
+
+size_t TextureCache::getMemoryBudget() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_memoryBudget;
+}
+
+TextureCache::Statistics TextureCache::getStatistics() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+void TextureCache::setMemoryBudget(size_t memoryBudget)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_memoryBudget = memoryBudget;
+    evict(m_memoryBudget);
+}
+
+void TextureCache::evict(size_t memoryBudget)
+{
+    // Only textures no longer referenced by any loaded model are candidates.
+    // A budget of zero means unlimited: unused textures stay resident so that
+    // reopening a model is free.
+
+    if (memoryBudget == 0)
+        return;
+
+    while (m_stats.residentBytes > memoryBudget && !m_unused.empty())
+    {
+        unsigned int id = m_unused.front();
+        Entry &entry = m_entries[id];
+
+        for (size_t i = 0; i < entry.keys.size(); ++i)
+            m_keys.erase(entry.keys[i]);
+
+        std::map<ContentKey, unsigned int>::iterator iterContent =
+            m_contents.find(entry.contentKey);
+
+        if (iterContent != m_contents.end() && iterContent->second == id)
+            m_contents.erase(iterContent);
+
+        m_stats.residentBytes -= entry.sizeInBytes;
+        m_stats.unusedBytes -= entry.sizeInBytes;
+        --m_stats.numberOfTextures;
+        ++m_stats.evictions;
+
+        m_unused.pop_front();
+        m_entries.erase(id);
+
+        if (m_deleteFunc)
+            m_deleteFunc(id);
+    }
+}
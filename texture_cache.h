@@ -0,0 +1,80 @@
+#if !defined(TEXTURE_CACHE_H)
+#define TEXTURE_CACHE_H
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+class TextureCache
+{
+public:
+    typedef void (*DeleteFunc)(unsigned int id);
+    typedef unsigned long long Hash;
+
+    struct Statistics
+    {
+        int hits;
+        int contentHits;
+        int misses;
+        int evictions;
+        int numberOfTextures;
+        size_t residentBytes;
+        size_t unusedBytes;
+    };
+
+    explicit TextureCache(DeleteFunc deleteFunc, size_t memoryBudget = 0);
+    ~TextureCache();
+
+    static Hash hash(const void *pData, size_t size);
+
+    unsigned int acquire(const std::string &path, Hash contentHash, bool linear);
+    void insert(const std::string &path, Hash contentHash, bool linear,
+        unsigned int id, size_t sizeInBytes);
+    void release(unsigned int id);
+    void clear();
+
+    size_t getMemoryBudget() const;
+    Statistics getStatistics() const;
+    void setMemoryBudget(size_t memoryBudget);
+
+private:
+    struct Key
+    {
+        std::string path;
+        Hash contentHash;
+        bool linear;
+
+        bool operator<(const Key &other) const;
+    };
+
+    typedef std::pair<Hash, bool> ContentKey;
+
+    struct Entry
+    {
+        size_t sizeInBytes;
+        int refCount;
+        ContentKey contentKey;
+        std::vector<Key> keys;
+        std::list<unsigned int>::iterator lruPosition;
+    };
+
+    TextureCache(const TextureCache &);
+    TextureCache &operator=(const TextureCache &);
+
+    void evict(size_t memoryBudget);
+
+    DeleteFunc m_deleteFunc;
+    size_t m_memoryBudget;
+    Statistics m_stats;
+    mutable std::mutex m_mutex;
+    std::map<Key, unsigned int> m_keys;
+    std::map<ContentKey, unsigned int> m_contents;
+    std::map<unsigned int, Entry> m_entries;
+    std::list<unsigned int> m_unused;
+};
+
+#endif
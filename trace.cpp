@@ -0,0 +1,200 @@
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "trace.h"
+
+namespace
+{
+    const int EVENTS_PER_THREAD = 1 << 18;
+
+    struct Event
+    {
+        const char *pszName;
+        long long timestamp;
+        char phase;
+    };
+
+    struct ThreadBuffer
+    {
+        int id;
+        std::string name;
+        std::vector<Event> events;
+        std::atomic<int> numberOfEvents;
+        std::atomic<int> dropped;
+        std::atomic<int> generation;
+    };
+
+    std::mutex g_buffersMutex;
+    std::vector<ThreadBuffer *> g_buffers;
+    std::atomic<long long> g_sessionStart(0);
+    std::atomic<int> g_generation(0);
+
+    thread_local ThreadBuffer *t_pBuffer = 0;
+    thread_local std::string t_threadName;
+
+    long long GetTimestamp()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    ThreadBuffer *GetThreadBuffer()
+    {
+        if (!t_pBuffer)
+        {
+            ThreadBuffer *pBuffer = new ThreadBuffer;
+
+            pBuffer->events.resize(EVENTS_PER_THREAD);
+            pBuffer->numberOfEvents = 0;
+            pBuffer->dropped = 0;
+            pBuffer->generation = g_generation.load();
+
+            std::lock_guard<std::mutex> lock(g_buffersMutex);
+
+            pBuffer->id = static_cast<int>(g_buffers.size()) + 1;
+            pBuffer->name = t_threadName.empty() ? "thread" : t_threadName;
+            g_buffers.push_back(pBuffer);
+            t_pBuffer = pBuffer;
+        }
+
+        return t_pBuffer;
+    }
+
+    void Record(const char *pszName, char phase)
+    {
+        ThreadBuffer *pBuffer = GetThreadBuffer();
+        int generation = g_generation.load(std::memory_order_acquire);
+
+        // Only the owner rewinds its buffer, on its first event of a new
+        // session. The fence orders the new generation before the events
+        // that overwrite the old ones, so write() can tell when it has read
+        // a buffer that was rewound under it.
+        if (pBuffer->generation.load(std::memory_order_relaxed) != generation)
+        {
+            pBuffer->numberOfEvents.store(0, std::memory_order_relaxed);
+            pBuffer->dropped.store(0, std::memory_order_relaxed);
+            pBuffer->generation.store(generation, std::memory_order_release);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        int index = pBuffer->numberOfEvents.load(std::memory_order_relaxed);
+
+        if (index == EVENTS_PER_THREAD)
+        {
+            pBuffer->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        Event &event = pBuffer->events[index];
+
+        event.pszName = pszName;
+        event.timestamp = GetTimestamp();
+        event.phase = phase;
+
+        // Publishes the event to write(), which may run on another thread.
+        pBuffer->numberOfEvents.store(index + 1, std::memory_order_release);
+    }
+}
+
+std::atomic<bool> Trace::s_enabled(false);
+
+void Trace::begin(const char *pszName)
+{
+    Record(pszName, 'B');
+}
+
+void Trace::end(const char *pszName)
+{
+    Record(pszName, 'E');
+}
+
+void Trace::setThreadName(const char *pszName)
+{
+    t_threadName = pszName;
+}
+
+void Trace::start()
+{
+    g_sessionStart = GetTimestamp();
+    g_generation.fetch_add(1, std::memory_order_release);
+    s_enabled = true;
+}
+
+void Trace::stop()
+{
+    s_enabled = false;
+}
+
+bool Trace::write(const char *pszFilename)
+{
+    FILE *pFile = fopen(pszFilename, "w");
+
+    if (!pFile)
+        return false;
+
+    std::vector<ThreadBuffer *> buffers;
+
+    {
+        std::lock_guard<std::mutex> lock(g_buffersMutex);
+        buffers = g_buffers;
+    }
+
+    // Only the events of the most recent session are written. A buffer whose
+    // owner hasn't recorded anything since start() still holds an older
+    // session and is skipped, and one that was rewound while it was being
+    // copied is left out as well.
+    int generation = g_generation.load(std::memory_order_acquire);
+    long long sessionStart = g_sessionStart.load();
+    const char *pszSeparator = "";
+    std::vector<Event> events;
+
+    fprintf(pFile, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+    for (size_t i = 0; i < buffers.size(); ++i)
+    {
+        const ThreadBuffer *pBuffer = buffers[i];
+        int dropped = 0;
+
+        events.clear();
+
+        if (pBuffer->generation.load(std::memory_order_acquire) == generation)
+        {
+            int numberOfEvents = pBuffer->numberOfEvents.load(std::memory_order_acquire);
+
+            events.assign(pBuffer->events.begin(), pBuffer->events.begin() + numberOfEvents);
+            dropped = pBuffer->dropped.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (pBuffer->generation.load(std::memory_order_relaxed) != generation)
+            {
+                events.clear();
+                dropped = 0;
+            }
+        }
+
+        fprintf(pFile, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+            "\"args\": {\"name\": \"%s\"}}", pszSeparator, pBuffer->id, pBuffer->name.c_str());
+        pszSeparator = ",\n";
+
+        for (size_t j = 0; j < events.size(); ++j)
+        {
+            const Event &event = events[j];
+
+            fprintf(pFile, ",\n{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": 1, \"tid\": %d}",
+                event.pszName, event.phase, (event.timestamp - sessionStart) / 1000.0, pBuffer->id);
+        }
+
+        if (dropped > 0 && !events.empty())
+        {
+            fprintf(pFile, ",\n{\"name\": \"buffer full, %d events dropped\", \"ph\": \"i\", \"s\": \"t\", "
+                "\"ts\": %.3f, \"pid\": 1, \"tid\": %d}", dropped,
+                (events.back().timestamp - sessionStart) / 1000.0, pBuffer->id);
+        }
+    }
+
+    fprintf(pFile, "\n]}\n");
+
+    return fclose(pFile) == 0;
+}
@@ -0,0 +1,68 @@
+#if !defined(TRACE_H)
+#define TRACE_H
+
+#include <atomic>
+
+// Scoped trace zones written as Chrome trace events (chrome://tracing,
+// ui.perfetto.dev). Every thread appends begin/end events to its own
+// fixed-size buffer without locking; write() can run while other threads are
+// still recording. Each start() begins a new session, and a thread rewinds its
+// buffer when it records its first zone of that session, so the buffer size
+// limits a single session rather than the whole run. Zone names must be
+// string literals, and a thread's name has to be set before it records its
+// first zone. While tracing is stopped a zone costs one relaxed atomic load,
+// and defining DISABLE_TRACING compiles the zones out entirely.
+
+class Trace
+{
+public:
+    static void begin(const char *pszName);
+    static void end(const char *pszName);
+    static bool isEnabled();
+    static void setThreadName(const char *pszName);
+    static void start();
+    static void stop();
+    static bool write(const char *pszFilename);
+
+private:
+    static std::atomic<bool> s_enabled;
+};
+
+class TraceZone
+{
+public:
+    explicit TraceZone(const char *pszName) : m_pszName(0)
+    {
+        if (Trace::isEnabled())
+        {
+            m_pszName = pszName;
+            Trace::begin(pszName);
+        }
+    }
+
+    ~TraceZone()
+    {
+        if (m_pszName)
+            Trace::end(m_pszName);
+    }
+
+private:
+    TraceZone(const TraceZone &);
+    TraceZone &operator=(const TraceZone &);
+
+    const char *m_pszName;
+};
+
+inline bool Trace::isEnabled()
+{ return s_enabled.load(std::memory_order_relaxed); }
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#if defined(DISABLE_TRACING)
+#define TRACE_ZONE(name)
+#else
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+#endif
+
+#endif